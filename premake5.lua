@@ -21,24 +21,16 @@ IncludeDir["threadpool"] = "rec_rays/vendor/threadpool"
 include "rec_rays/vendor/freeimage"
 include "rec_rays/vendor/sdl"
 
-project "rec_rays"
+-- Settings shared by the render library and the command line client
+function RecRaysProjectSettings()
 	location "rec_rays"
-	kind "ConsoleApp"
 	language "C++"
 	staticruntime "on"
 	cppdialect "C++17"
 
-
 	targetdir ("bin/" .. outputdir .. "/%{prj.name}")
 	objdir ("bin-int/" .. outputdir .. "/%{prj.name}")
 
-	files	
-	{
-		"%{prj.name}/src/**.h",
-		"%{prj.name}/src/**.cpp",
-		"%{IncludeDir.threadpool}/**.cpp" -- Threadpool dependency
-	}
-
 	defines 
 	{
 		"_CRT_SECURE_NO_WARNINGS"
@@ -49,12 +41,94 @@ project "rec_rays"
 		"rec_rays/src", --should not work
 		"%{IncludeDir.glm}",
 		"%{IncludeDir.freeimage}",
+		"%{IncludeDir.freeimage}/ZLib", -- zlib bundled with FreeImage, for PNG encoding
 		"%{IncludeDir.sdl}",
 		"%{IncludeDir.threadpool}"
 	}
 
+	filter	"system:windows" -- ran only when compiling on windows
+		systemversion "latest"
+
+		defines {			-- define this symbols when building
+			"RRAYS_PLATFORM_WINDOWS",
+		}
+
+	filter "configurations:Debug"
+		defines {"RRAYS_DEBUG", "RRAYS_ENABLE_ASSERTS", "RRAYS_TRACK_ALLOCATIONS"}
+		runtime "Debug"
+		symbols "on"
+
+	filter "configurations:Release"
+		defines "RRAYS_RELEASE"
+		runtime "Release"
+		optimize "on"
+
+	filter "configurations:Dist"
+		defines "RRAYS_DIST"
+		runtime "Release"
+		optimize "on"
+
+	filter {}
+end
+
+-- Build step writing the mesh assets as C++ arrays into src/EmbeddedMeshes.h, so they load without any I/O
+project "mesh_embedder"
+	kind "ConsoleApp"
+	RecRaysProjectSettings()
+
+	files
+	{
+		"rec_rays/tools/MeshEmbedder.cpp",
+		"rec_rays/src/Geometry.cpp",
+		"rec_rays/src/Trace.cpp",
+		"rec_rays/src/Memory.cpp",
+		"%{IncludeDir.threadpool}/**.cpp"
+	}
+
+	defines
+	{
+		"RRAYS_NO_EMBEDDED_MESHES"	-- the embedder loads assets from their files
+	}
+
+-- Everything but the command line client, to render from other programs through Renderer.h
+project "rec_rays_lib"
+	kind "StaticLib"
+	RecRaysProjectSettings()
+	dependson { "mesh_embedder" }
+
+	-- Runs from rec_rays, where asset paths are relative to
+	prebuildcommands
+	{
+		"%{wks.location}/bin/" .. outputdir .. "/mesh_embedder/mesh_embedder src/EmbeddedMeshes.h"
+	}
+
+	files	
+	{
+		"rec_rays/src/**.h",
+		"rec_rays/src/**.cpp",
+		"%{IncludeDir.threadpool}/**.cpp" -- Threadpool dependency
+	}
+
+	removefiles
+	{
+		"rec_rays/src/main.cpp",
+		"rec_rays/src/RecRays.cpp"
+	}
+
+project "rec_rays"
+	kind "ConsoleApp"
+	RecRaysProjectSettings()
+
+	files	
+	{
+		"rec_rays/src/main.cpp",
+		"rec_rays/src/RecRays.cpp"
+	}
+
 	links 
 	{
+		"rec_rays_lib",
+
 		"SDL",
 		"SDLmain",
 
@@ -73,29 +147,16 @@ project "rec_rays"
 		"LibJXR"
 	}
 
-	filter	"system:windows" -- ran only when compiling on windows
-		systemversion "latest"
-
-		defines {			-- define this symbols when building
-			"RRAYS_PLATFORM_WINDOWS",
+	filter	"system:linux"
+		links {
+			"rt"			-- shm_open for the shared frame buffer, part of libc since glibc 2.34
 		}
 
-	filter "configurations:Debug"
-		defines {"RRAYS_DEBUG", "RRAYS_ENABLE_ASSERTS"}
-		runtime "Debug"
-		symbols "on"
-
-	filter "configurations:Release"
-		defines "RRAYS_RELEASE"
-		runtime "Release"
-		optimize "on"
-
-	filter "configurations:Dist"
-		defines "RRAYS_DIST"
-		runtime "Release"
-		optimize "on"
+	filter	"system:windows"
+		links {
+			"ws2_32"		-- sockets for distributed rendering
+		}
 
-	filter "system:windows"
 		postbuildcommands {
 			"{COPYFILE} vendor/freeimage/Dist/x64/FreeImaged.dll ../bin/Debug-windows-x86_64/rec_rays" ,
 			"{COPYFILE} ../x64/Debug/SDL2.dll ../bin/Debug-windows-x86_64/rec_rays"
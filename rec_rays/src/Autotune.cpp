@@ -0,0 +1,262 @@
+// Local includes
+#include "Autotune.h"
+#include "Renderer.h"
+#include "Status.h"
+
+// STL includes
+#include <vector>
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <functional>
+#include <filesystem>
+#include <thread>
+
+namespace RecRays
+{
+	constexpr uint32_t RENDER_PROFILE_VERSION = 1;
+	// Renders per candidate, the fastest one counts
+	constexpr int AUTOTUNE_REPETITIONS = 3;
+	// A candidate has to be this much faster than the best so far to replace it, smaller gains are noise
+	constexpr double AUTOTUNE_MIN_GAIN = 0.03;
+
+	// Values tried for each parameter. Tile sizes are multiples of every preview scale, leaves fit in 8 bits
+	constexpr size_t AUTOTUNE_TILE_SIZES[] = { 8, 16, 32, 64 };
+	constexpr uint32_t AUTOTUNE_LEAF_TRIANGLES[] = { 2, 4, 8, 16 };
+	constexpr float AUTOTUNE_CELLS_PER_SPHERE[] = { 0.5f, 1.f, 2.f, 4.f, 8.f };
+
+	/**
+	 * \brief Hardware threads of this machine, profiles tuned on a different count are not used
+	 */
+	static size_t GetHardwareThreads()
+	{
+		return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+	}
+
+	/**
+	 * \brief If a profile could be used for rendering
+	 */
+	static bool IsValidProfile(const RenderProfile& profile)
+	{
+		return profile.nThreads > 0 && profile.nThreads <= 16 * GetHardwareThreads() &&
+			profile.tileSize > 0 && profile.tileSize % 4 == 0 && profile.tileSize <= 1024 &&
+			profile.bvhMaxLeafTriangles > 0 && profile.bvhMaxLeafTriangles <= UINT8_MAX &&
+			profile.sphereGridCellsPerSphere > 0 && profile.sphereGridCellsPerSphere <= 64;
+	}
+
+	int LoadRenderProfile(const std::string& filepath, RenderProfile& outProfile)
+	{
+		std::ifstream file(filepath);
+		if (!file)
+			return FAIL;
+
+		RenderProfile profile;
+		uint32_t version = 0;
+		size_t hardwareThreads = 0;
+		std::string line;
+		while (std::getline(file, line))
+		{
+			// Lines are "key value", # starts a comment
+			std::stringstream ss(line);
+			std::string key;
+			if (!(ss >> key) || key[0] == '#')
+				continue;
+
+			bool ok = true;
+			if (key == "version")
+				ok = static_cast<bool>(ss >> version);
+			else if (key == "hardwareThreads")
+				ok = static_cast<bool>(ss >> hardwareThreads);
+			else if (key == "threads")
+				ok = static_cast<bool>(ss >> profile.nThreads);
+			else if (key == "tileSize")
+				ok = static_cast<bool>(ss >> profile.tileSize);
+			else if (key == "bvhMaxLeafTriangles")
+				ok = static_cast<bool>(ss >> profile.bvhMaxLeafTriangles);
+			else if (key == "sphereGridCellsPerSphere")
+				ok = static_cast<bool>(ss >> profile.sphereGridCellsPerSphere);
+			else
+				std::cerr << "Ignoring unknown setting '" << key << "' in render profile " << filepath << std::endl;
+
+			if (!ok)
+			{
+				std::cerr << "Invalid value for '" << key << "' in render profile " << filepath << std::endl;
+				return FAIL;
+			}
+		}
+
+		if (version != RENDER_PROFILE_VERSION || !IsValidProfile(profile))
+		{
+			std::cerr << "Invalid or unsupported render profile " << filepath << std::endl;
+			return FAIL;
+		}
+
+		// Copied from another machine, or the machine changed since
+		if (hardwareThreads != GetHardwareThreads())
+		{
+			std::cerr << "Render profile " << filepath << " was tuned for " << hardwareThreads << " hardware threads, this machine has "
+				<< GetHardwareThreads() << ". Run --autotune again" << std::endl;
+			return FAIL;
+		}
+
+		outProfile = profile;
+		return SUCCESS;
+	}
+
+	int SaveRenderProfile(const std::string& filepath, const RenderProfile& profile)
+	{
+		std::string const temporaryPath = filepath + ".tmp";
+		{
+			std::ofstream file(temporaryPath);
+			if (!file)
+				return FAIL;
+
+			file << "# Render profile written by rec_rays --autotune" << std::endl;
+			file << "version " << RENDER_PROFILE_VERSION << std::endl;
+			file << "hardwareThreads " << GetHardwareThreads() << std::endl;
+			file << "threads " << profile.nThreads << std::endl;
+			file << "tileSize " << profile.tileSize << std::endl;
+			file << "bvhMaxLeafTriangles " << profile.bvhMaxLeafTriangles << std::endl;
+			file << "sphereGridCellsPerSphere " << profile.sphereGridCellsPerSphere << std::endl;
+			if (!file)
+				return FAIL;
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, filepath, error);
+		if (error)
+		{
+			std::filesystem::remove(temporaryPath, error);
+			return FAIL;
+		}
+
+		return SUCCESS;
+	}
+
+	/**
+	 * \brief Best render time in milliseconds of a scene with a profile, or a negative time if it could not be rendered
+	 * \param outPixels Image rendered, as 8 bit RGB
+	 */
+	static double TimeProfile(const SceneDescription& scene, const RenderProfile& profile, std::vector<uint8_t>& outPixels)
+	{
+		Renderer renderer(profile.nThreads);
+		renderer.SetProfile(profile);
+
+		outPixels.assign(scene.imgResX * scene.imgResY * 3, 0);
+		FrameBuffer target;
+		target.pixels = outPixels.data();
+		target.width = scene.imgResX;
+		target.height = scene.imgResY;
+
+		double best = -1;
+		for (int i = 0; i < AUTOTUNE_REPETITIONS; i++)
+		{
+			auto const start = std::chrono::steady_clock::now();
+			if (renderer.Render(scene, target) != SUCCESS)
+				return -1;
+
+			double const milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			best = best < 0 ? milliseconds : std::min(best, milliseconds);
+		}
+
+		return best;
+	}
+
+	/**
+	 * \brief A parameter to tune: its name, how many values to try and how to set each one in a profile
+	 */
+	struct TunedParameter
+	{
+		const char* name;
+		size_t nValues;
+		std::function<void(RenderProfile&, size_t)> setValue;
+		std::function<std::string(const RenderProfile&)> getValue;
+	};
+
+	int RunAutotune(const SceneDescription& scene, RenderProfile& outProfile, std::ostream& os)
+	{
+		size_t const hardwareThreads = GetHardwareThreads();
+		std::vector<size_t> threadCounts = { std::max<size_t>(hardwareThreads / 2, 1), hardwareThreads, 2 * hardwareThreads, DEFAULT_RENDER_THREADS };
+		std::sort(threadCounts.begin(), threadCounts.end());
+		threadCounts.erase(std::unique(threadCounts.begin(), threadCounts.end()), threadCounts.end());
+
+		// Threads go first, every other parameter depends on how many tiles run at once
+		std::vector<TunedParameter> const parameters = {
+			{ "threads", threadCounts.size(),
+				[&threadCounts](RenderProfile& profile, size_t i) { profile.nThreads = threadCounts[i]; },
+				[](const RenderProfile& profile) { return std::to_string(profile.nThreads); } },
+			{ "tileSize", std::size(AUTOTUNE_TILE_SIZES),
+				[](RenderProfile& profile, size_t i) { profile.tileSize = AUTOTUNE_TILE_SIZES[i]; },
+				[](const RenderProfile& profile) { return std::to_string(profile.tileSize); } },
+			{ "bvhMaxLeafTriangles", std::size(AUTOTUNE_LEAF_TRIANGLES),
+				[](RenderProfile& profile, size_t i) { profile.bvhMaxLeafTriangles = AUTOTUNE_LEAF_TRIANGLES[i]; },
+				[](const RenderProfile& profile) { return std::to_string(profile.bvhMaxLeafTriangles); } },
+			{ "sphereGridCellsPerSphere", std::size(AUTOTUNE_CELLS_PER_SPHERE),
+				[](RenderProfile& profile, size_t i) { profile.sphereGridCellsPerSphere = AUTOTUNE_CELLS_PER_SPHERE[i]; },
+				[](const RenderProfile& profile) { std::stringstream ss; ss << profile.sphereGridCellsPerSphere; return ss.str(); } },
+		};
+
+		// Defaults give the reference image every candidate has to match
+		RenderProfile best;
+		std::vector<uint8_t> reference, pixels;
+		double const defaultTime = TimeProfile(scene, best, reference);
+		if (defaultTime < 0)
+		{
+			std::cerr << "[ERROR] Could not render autotune scene" << std::endl;
+			return FAIL;
+		}
+
+		double bestTime = defaultTime;
+		os << "-- Autotune -------------------------------------" << std::endl;
+		os << std::fixed << std::setprecision(2);
+		os << std::setw(26) << "Parameter" << std::setw(10) << "Value" << std::setw(14) << "Time (ms)" << std::endl;
+		os << std::setw(26) << "defaults" << std::setw(10) << "" << std::setw(14) << defaultTime << std::endl;
+
+		for (auto const& parameter : parameters)
+		{
+			std::string const current = parameter.getValue(best);
+			RenderProfile bestForParameter = best;
+			for (size_t i = 0; i < parameter.nValues; i++)
+			{
+				RenderProfile candidate = best;
+				parameter.setValue(candidate, i);
+				auto const value = parameter.getValue(candidate);
+				if (value == current)
+					continue;
+
+				double const time = TimeProfile(scene, candidate, pixels);
+				os << std::setw(26) << parameter.name << std::setw(10) << value;
+				if (time < 0)
+				{
+					os << std::setw(14) << "failed" << std::endl;
+					continue;
+				}
+
+				if (pixels != reference)
+				{
+					os << std::setw(14) << time << "  changes the image, rejected" << std::endl;
+					continue;
+				}
+
+				os << std::setw(14) << time << std::endl;
+				if (time < bestTime * (1 - AUTOTUNE_MIN_GAIN))
+				{
+					bestTime = time;
+					bestForParameter = candidate;
+				}
+			}
+
+			best = bestForParameter;
+		}
+
+		os << "Best: threads " << best.nThreads << ", tileSize " << best.tileSize << ", bvhMaxLeafTriangles " << best.bvhMaxLeafTriangles
+			<< ", sphereGridCellsPerSphere " << best.sphereGridCellsPerSphere << std::endl;
+		os << "Renders in " << bestTime << " ms, " << defaultTime / bestTime << "x faster than defaults" << std::endl;
+		os << "------------------------------------------------" << std::endl;
+
+		outProfile = best;
+		return SUCCESS;
+	}
+}
@@ -0,0 +1,40 @@
+// Per machine search of the fastest render profile, and the file where it's kept between runs
+#pragma once
+
+// STL includes
+#include <string>
+#include <iostream>
+
+// Local includes
+#include "RecursiveRayTracer.h"
+
+namespace RecRays
+{
+	// Profile loaded by every render and written by --autotune, relative to the working directory
+	constexpr const char* RENDER_PROFILE_FILE = "rec_rays.profile";
+
+	/**
+	 * \brief Read a profile written by SaveRenderProfile
+	 * \param outProfile Profile in the file, only set if it's valid
+	 * \return Success status. Fails for missing or invalid files, and for profiles tuned on a machine with another
+	 * number of hardware threads
+	 */
+	int LoadRenderProfile(const std::string& filepath, RenderProfile& outProfile);
+
+	/**
+	 * \brief Write a profile as a text file, replacing the previous one at once
+	 * \return Success status
+	 */
+	int SaveRenderProfile(const std::string& filepath, const RenderProfile& profile);
+
+	/**
+	 * \brief Find the fastest profile for this machine by timing short renders of a scene. Parameters are tuned one
+	 * at a time, each one keeping the best values found so far for the rest. Values that change any pixel of the
+	 * image are rejected
+	 * \param scene Representative scene, rendered many times so it should render in about a second
+	 * \param outProfile Fastest profile found
+	 * \param os Where to print timings
+	 * \return Success status
+	 */
+	int RunAutotune(const SceneDescription& scene, RenderProfile& outProfile, std::ostream& os);
+}
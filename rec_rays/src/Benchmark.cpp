@@ -0,0 +1,123 @@
+// Local includes
+#include "Benchmark.h"
+#include "Renderer.h"
+#include "Status.h"
+
+// STL includes
+#include <vector>
+#include <random>
+#include <chrono>
+#include <iomanip>
+#include <algorithm>
+
+// Third party includes
+#include <glm/gtc/matrix_transform.hpp>
+
+namespace RecRays
+{
+	// Sphere counts go from the first one to the last one, doubling each time
+	constexpr size_t SPHERE_BENCHMARK_MIN_COUNT = 2;
+	constexpr size_t SPHERE_BENCHMARK_MAX_COUNT = 8192;
+	// Width and height in pixels of benchmark images
+	constexpr size_t SPHERE_BENCHMARK_RESOLUTION = 64;
+	// Small scenes render in a few milliseconds, so they are timed a few times keeping the best one
+	constexpr size_t SPHERE_BENCHMARK_MAX_REPEATED_COUNT = 512;
+	constexpr int SPHERE_BENCHMARK_REPETITIONS = 3;
+
+	/**
+	 * \brief Spheres at random inside a cube from -1 to 1, sized so they cover about the same part of the view
+	 * no matter how many there are
+	 */
+	static SceneDescription CreateSphereScene(size_t nSpheres, SphereAccelerator accelerator)
+	{
+		SceneDescription scene;
+		scene.camera = CameraDescription{ glm::vec3(0, 0, 4), glm::vec3(0), glm::vec3(0, 1, 0), 30.f };
+		scene.imgWidth = scene.imgHeight = 10;
+		scene.imgResX = scene.imgResY = SPHERE_BENCHMARK_RESOLUTION;
+		scene.imgDistanceToViewplane = 10;
+		scene.sphereAccelerator = accelerator;
+		scene.AddLight(Light{ glm::vec4(2, 2, 4, 1), glm::vec4(1) });
+
+		// Same seed for every accelerator, so they render the same scene
+		std::mt19937 random(static_cast<uint32_t>(nSpheres));
+		std::uniform_real_distribution<float> position(-1.f, 1.f);
+		float const radius = 0.3f * std::cbrt(8.f / static_cast<float>(nSpheres));
+		for (size_t i = 0; i < nSpheres; i++)
+		{
+			Object sphere;
+			sphere.ambient = glm::vec4(0.1f, 0.1f, 0.1f, 1);
+			sphere.diffuse = glm::vec4(0.6f, 0.4f, 0.3f, 1);
+			sphere.specular = glm::vec4(0.3f, 0.3f, 0.3f, 1);
+			sphere.shininess = 20;
+			sphere.shape = Shape::Sphere;
+			sphere.size = radius;
+			sphere.transform = glm::translate(glm::mat4(1), glm::vec3(position(random), position(random), position(random)));
+			if (scene.AddObject(sphere) != SUCCESS)
+				break;
+		}
+
+		return scene;
+	}
+
+	/**
+	 * \brief Best render time in milliseconds of a scene, or a negative time if it could not be rendered
+	 */
+	static double TimeRender(Renderer& renderer, const SceneDescription& scene, int repetitions)
+	{
+		std::vector<uint8_t> pixels(scene.imgResX * scene.imgResY * 3);
+		FrameBuffer target;
+		target.pixels = pixels.data();
+		target.width = scene.imgResX;
+		target.height = scene.imgResY;
+
+		double best = -1;
+		for (int i = 0; i < repetitions; i++)
+		{
+			auto const start = std::chrono::steady_clock::now();
+			if (renderer.Render(scene, target) != SUCCESS)
+				return -1;
+
+			double const milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+			best = best < 0 ? milliseconds : std::min(best, milliseconds);
+		}
+
+		return best;
+	}
+
+	int RunSphereBenchmark(std::ostream& os)
+	{
+		Renderer renderer;
+		os << "-- Sphere accelerators -------------------------" << std::endl;
+		os << std::setw(10) << "Spheres" << std::setw(14) << "None (ms)" << std::setw(14) << "Grid (ms)" << std::setw(10) << "Speedup" << std::endl;
+
+		// Grid pays off from the smallest count after which it's never slower
+		size_t crossover = 0;
+		for (size_t nSpheres = SPHERE_BENCHMARK_MIN_COUNT; nSpheres <= SPHERE_BENCHMARK_MAX_COUNT; nSpheres *= 2)
+		{
+			int const repetitions = nSpheres <= SPHERE_BENCHMARK_MAX_REPEATED_COUNT ? SPHERE_BENCHMARK_REPETITIONS : 1;
+			double const none = TimeRender(renderer, CreateSphereScene(nSpheres, SphereAccelerator::None), repetitions);
+			double const grid = TimeRender(renderer, CreateSphereScene(nSpheres, SphereAccelerator::Grid), repetitions);
+			if (none < 0 || grid < 0)
+			{
+				std::cerr << "[ERROR] Could not render benchmark scene with " << nSpheres << " spheres" << std::endl;
+				return FAIL;
+			}
+
+			os << std::fixed << std::setprecision(2)
+				<< std::setw(10) << nSpheres << std::setw(14) << none << std::setw(14) << grid << std::setw(9) << none / grid << "x" << std::endl;
+
+			if (grid >= none)
+				crossover = 0;
+			else if (crossover == 0)
+				crossover = nSpheres;
+		}
+
+		if (crossover != 0)
+			os << "Grid is faster from " << crossover << " spheres on (auto picks it from " << SPHERE_GRID_MIN_SPHERES << ")" << std::endl;
+		else
+			os << "Grid was never faster than testing every sphere" << std::endl;
+		os << "------------------------------------------------" << std::endl;
+
+		return SUCCESS;
+	}
+}
@@ -0,0 +1,16 @@
+// Benchmarks of acceleration structures on generated scenes, to find out where each one pays off
+#pragma once
+
+// STL includes
+#include <iostream>
+
+namespace RecRays
+{
+	/**
+	 * \brief Render scenes of randomly placed spheres of similar size, from a few to thousands of them, both testing
+	 * every sphere and walking a uniform grid. Prints render time of each and how many spheres the grid needs to be faster
+	 * \param os Where to print results
+	 * \return Success status
+	 */
+	int RunSphereBenchmark(std::ostream& os);
+}
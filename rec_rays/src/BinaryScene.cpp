@@ -0,0 +1,430 @@
+// Local includes
+#include "BinaryScene.h"
+#include "SceneSerializer.h"
+#include "Trace.h"
+#include "Status.h"
+
+// STL includes
+#include <map>
+#include <fstream>
+#include <iostream>
+#include <filesystem>
+#include <cstring>
+
+#ifdef RRAYS_PLATFORM_WINDOWS
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace RecRays
+{
+	constexpr uint32_t BINARY_SCENE_MAGIC = 0x4E535252; // "RRSN"
+	constexpr uint32_t BINARY_SCENE_VERSION = 1;
+
+	// Sections start at multiples of this many bytes
+	constexpr size_t BINARY_SCENE_ALIGNMENT = 16;
+
+	// -- < File layout > ---------------------------------
+	// Every field is explicit, padding included, so files hold no uninitialized bytes
+
+	/**
+	 * \brief Start of the file. Offsets are bytes from the start of the file
+	 */
+	struct FileHeader
+	{
+		uint32_t magic, version;
+		uint8_t enableLight, compactMeshes, meshLods, rasterPrimary;
+		uint8_t sphereAccelerator;
+		uint8_t padding[3];
+		uint32_t usedMeshes;		// Bit per MeshAsset some object uses
+		uint32_t nLights;
+		uint32_t nViews;			// Main camera first
+		uint32_t nMaterials;
+		uint64_t nObjects;
+		float imgWidth, imgHeight, imgDistanceToViewplane;
+		uint32_t padding2;
+		uint64_t imgResX, imgResY;
+		uint64_t lightsOffset, viewsOffset, materialsOffset, objectsOffset;
+		uint64_t stringsOffset, stringsSize;
+	};
+
+	struct FileView
+	{
+		CameraDescription camera;
+		uint32_t outputOffset, outputSize; // Output file name in the strings section, empty for the default one
+	};
+
+	/**
+	 * \brief Shading properties shared by objects. Scenes usually have few materials and lots of objects
+	 */
+	struct FileMaterial
+	{
+		glm::vec4 ambient, diffuse, specular, emission, mirror;
+		float shininess;
+		float padding[3];
+	};
+
+	struct FileObject
+	{
+		glm::mat4 transform;	// Final transform, the transform stack is already applied
+		uint32_t material;		// Index in the materials section
+		uint32_t shape;
+		float size;
+		uint32_t padding;
+	};
+
+	static_assert(std::is_trivially_copyable_v<FileHeader> && std::is_trivially_copyable_v<FileView> &&
+		std::is_trivially_copyable_v<FileMaterial> && std::is_trivially_copyable_v<FileObject>, "File records are copied as bytes");
+
+	// -- < Mapped file > ---------------------------------
+
+	/**
+	 * \brief Read only view of a whole file, unmapped on destruction
+	 */
+	class MappedFile
+	{
+	public:
+		MappedFile() = default;
+		~MappedFile();
+
+		MappedFile(const MappedFile&) = delete;
+		MappedFile& operator=(const MappedFile&) = delete;
+
+		/**
+		 * \return Success status, fails for missing or empty files
+		 */
+		int Open(const std::string& filepath);
+
+		const uint8_t* GetData() const { return m_Data; }
+		size_t GetSize() const { return m_Size; }
+
+	private:
+		const uint8_t* m_Data = nullptr;
+		size_t m_Size = 0;
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		HANDLE m_File = INVALID_HANDLE_VALUE;
+		HANDLE m_Mapping = nullptr;
+	#endif
+	};
+
+	MappedFile::~MappedFile()
+	{
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		if (m_Data)
+			UnmapViewOfFile(m_Data);
+		if (m_Mapping)
+			CloseHandle(m_Mapping);
+		if (m_File != INVALID_HANDLE_VALUE)
+			CloseHandle(m_File);
+	#else
+		if (m_Data)
+			munmap(const_cast<uint8_t*>(m_Data), m_Size);
+	#endif
+	}
+
+	int MappedFile::Open(const std::string& filepath)
+	{
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		m_File = CreateFileA(filepath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+		LARGE_INTEGER size;
+		if (m_File == INVALID_HANDLE_VALUE || !GetFileSizeEx(m_File, &size) || size.QuadPart == 0)
+			return FAIL;
+
+		m_Mapping = CreateFileMappingA(m_File, nullptr, PAGE_READONLY, 0, 0, nullptr);
+		if (m_Mapping == nullptr)
+			return FAIL;
+
+		m_Data = static_cast<const uint8_t*>(MapViewOfFile(m_Mapping, FILE_MAP_READ, 0, 0, 0));
+		m_Size = m_Data ? static_cast<size_t>(size.QuadPart) : 0;
+	#else
+		int const descriptor = open(filepath.c_str(), O_RDONLY);
+		if (descriptor < 0)
+			return FAIL;
+
+		struct stat status;
+		void* memory = MAP_FAILED;
+		if (fstat(descriptor, &status) == 0 && status.st_size > 0)
+			memory = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+		// The mapping keeps the file alive
+		close(descriptor);
+		if (memory == MAP_FAILED)
+			return FAIL;
+
+		// Objects are read front to back once
+		madvise(memory, static_cast<size_t>(status.st_size), MADV_SEQUENTIAL);
+		m_Data = static_cast<const uint8_t*>(memory);
+		m_Size = static_cast<size_t>(status.st_size);
+	#endif
+		return m_Data ? SUCCESS : FAIL;
+	}
+
+	// -- < Binary Scene > ---------------------------------
+
+	/**
+	 * \brief Meshes an object needs loaded, as a bit per MeshAsset
+	 */
+	static uint32_t GetUsedMeshes(Shape shape)
+	{
+		if (shape == Shape::Cube)
+			return 1u << static_cast<uint32_t>(MeshAsset::Cube);
+		if (shape == Shape::Teapot)
+			return 1u << static_cast<uint32_t>(MeshAsset::Teapot);
+
+		return 0;
+	}
+
+	/**
+	 * \brief Pad buffer with zeros up to the next section start
+	 * \return Offset of next section
+	 */
+	static uint64_t AlignSection(std::vector<uint8_t>& data)
+	{
+		data.resize((data.size() + BINARY_SCENE_ALIGNMENT - 1) / BINARY_SCENE_ALIGNMENT * BINARY_SCENE_ALIGNMENT, 0);
+		return data.size();
+	}
+
+	int BinaryScene::Load(const std::string& filepath, SceneDescription& outDescription)
+	{
+		MappedFile file;
+		if (file.Open(filepath) != SUCCESS)
+		{
+			std::cerr << "Could not open binary scene file " << filepath << std::endl;
+			return FAIL;
+		}
+
+		const uint8_t* const data = file.GetData();
+		size_t const size = file.GetSize();
+
+		FileHeader header{};
+		if (size >= sizeof(FileHeader))
+			std::memcpy(&header, data, sizeof(FileHeader));
+
+		// If count elements starting at offset are inside the file
+		auto const fits = [size](uint64_t offset, uint64_t count, size_t elementSize)
+		{
+			return offset <= size && count <= (size - offset) / elementSize;
+		};
+
+		bool const valid = header.magic == BINARY_SCENE_MAGIC &&
+			header.version == BINARY_SCENE_VERSION &&
+			header.sphereAccelerator <= static_cast<uint8_t>(SphereAccelerator::Grid) &&
+			header.nLights <= MAX_LIGHTS &&
+			header.nViews > 0 &&
+			header.imgResX >= 1 && header.imgResX <= MAX_IMAGE_RESOLUTION &&
+			header.imgResY >= 1 && header.imgResY <= MAX_IMAGE_RESOLUTION &&
+			header.nObjects <= static_cast<uint64_t>(MAX_OBJECTS) + MAX_SPHERES &&
+			fits(header.lightsOffset, header.nLights, sizeof(Light)) &&
+			fits(header.viewsOffset, header.nViews, sizeof(FileView)) &&
+			fits(header.materialsOffset, header.nMaterials, sizeof(FileMaterial)) &&
+			fits(header.objectsOffset, header.nObjects, sizeof(FileObject)) &&
+			fits(header.stringsOffset, header.stringsSize, 1);
+
+		if (!valid)
+		{
+			std::cerr << "Invalid or unsupported binary scene file " << filepath << std::endl;
+			return FAIL;
+		}
+
+		// Meshes load in the background while objects are copied
+		for (size_t asset = 0; asset < static_cast<size_t>(MeshAsset::Count); asset++)
+			if (header.usedMeshes & (1u << asset))
+				GeometryLoader::Request(static_cast<MeshAsset>(asset));
+
+		SceneDescription description;
+		description.enableLight = header.enableLight != 0;
+		description.compactMeshes = header.compactMeshes != 0;
+		description.meshLods = header.meshLods != 0;
+		description.rasterPrimary = header.rasterPrimary != 0;
+		description.sphereAccelerator = static_cast<SphereAccelerator>(header.sphereAccelerator);
+		description.imgWidth = header.imgWidth;
+		description.imgHeight = header.imgHeight;
+		description.imgDistanceToViewplane = header.imgDistanceToViewplane;
+		description.imgResX = static_cast<size_t>(header.imgResX);
+		description.imgResY = static_cast<size_t>(header.imgResY);
+
+		// Lights
+		for (uint32_t i = 0; i < header.nLights; i++)
+		{
+			Light light;
+			std::memcpy(&light, data + header.lightsOffset + i * sizeof(Light), sizeof(Light));
+			description.AddLight(light);
+		}
+
+		// Cameras
+		const char* const strings = reinterpret_cast<const char*>(data + header.stringsOffset);
+		for (uint32_t i = 0; i < header.nViews; i++)
+		{
+			FileView view;
+			std::memcpy(&view, data + header.viewsOffset + i * sizeof(FileView), sizeof(FileView));
+			if (view.outputOffset > header.stringsSize || view.outputSize > header.stringsSize - view.outputOffset)
+			{
+				std::cerr << "Invalid camera output in binary scene file " << filepath << std::endl;
+				return FAIL;
+			}
+
+			std::string output(strings + view.outputOffset, view.outputSize);
+			if (i == 0)
+			{
+				description.camera = view.camera;
+				description.output = std::move(output);
+			}
+			else
+				description.extraViews.push_back(ViewDescription{ view.camera, std::move(output) });
+		}
+
+		// Materials
+		std::vector<FileMaterial> materials(header.nMaterials);
+		if (!materials.empty())
+			std::memcpy(materials.data(), data + header.materialsOffset, materials.size() * sizeof(FileMaterial));
+
+		// Objects
+		description.GetObjects().reserve(static_cast<size_t>(header.nObjects));
+		const uint8_t* record = data + header.objectsOffset;
+		for (uint64_t i = 0; i < header.nObjects; i++, record += sizeof(FileObject))
+		{
+			FileObject fileObject;
+			std::memcpy(&fileObject, record, sizeof(FileObject));
+			if (fileObject.material >= materials.size() || fileObject.shape > static_cast<uint32_t>(Shape::Teapot))
+			{
+				std::cerr << "Invalid object " << i << " in binary scene file " << filepath << std::endl;
+				return FAIL;
+			}
+
+			auto const& material = materials[fileObject.material];
+			Object object;
+			object.ambient = material.ambient;
+			object.diffuse = material.diffuse;
+			object.specular = material.specular;
+			object.emission = material.emission;
+			object.mirror = material.mirror;
+			object.shininess = material.shininess;
+			object.shape = static_cast<Shape>(fileObject.shape);
+			object.size = fileObject.size;
+			object.transform = fileObject.transform;
+			if (description.AddObject(object) != SUCCESS)
+			{
+				std::cerr << "Too many objects in binary scene file " << filepath << std::endl;
+				return FAIL;
+			}
+		}
+
+		outDescription = std::move(description);
+		return SUCCESS;
+	}
+
+	int BinaryScene::Save(const SceneDescription& description, const std::string& filepath)
+	{
+		RRAYS_TRACE_SCOPE("BinaryScene::Save");
+		FileHeader header{};
+		header.magic = BINARY_SCENE_MAGIC;
+		header.version = BINARY_SCENE_VERSION;
+		header.enableLight = description.enableLight;
+		header.compactMeshes = description.compactMeshes;
+		header.meshLods = description.meshLods;
+		header.rasterPrimary = description.rasterPrimary;
+		header.sphereAccelerator = static_cast<uint8_t>(description.sphereAccelerator);
+		header.imgWidth = description.imgWidth;
+		header.imgHeight = description.imgHeight;
+		header.imgDistanceToViewplane = description.imgDistanceToViewplane;
+		header.imgResX = description.imgResX;
+		header.imgResY = description.imgResY;
+
+		// Objects with the same shading share one material
+		auto const& objects = description.GetObjectsConst();
+		std::vector<FileMaterial> materials;
+		std::map<std::string, uint32_t> materialIds;
+		std::vector<FileObject> fileObjects;
+		fileObjects.reserve(objects.size());
+		for (auto const& object : objects)
+		{
+			FileMaterial material{};
+			material.ambient = object.ambient;
+			material.diffuse = object.diffuse;
+			material.specular = object.specular;
+			material.emission = object.emission;
+			material.mirror = object.mirror;
+			material.shininess = object.shininess;
+
+			std::string const key(reinterpret_cast<const char*>(&material), sizeof(FileMaterial));
+			auto const [id, isNew] = materialIds.emplace(key, static_cast<uint32_t>(materials.size()));
+			if (isNew)
+				materials.push_back(material);
+
+			FileObject fileObject{};
+			fileObject.transform = object.transform;
+			fileObject.material = id->second;
+			fileObject.shape = static_cast<uint32_t>(object.shape);
+			fileObject.size = object.size;
+			fileObjects.push_back(fileObject);
+
+			header.usedMeshes |= GetUsedMeshes(object.shape);
+		}
+
+		// Cameras, with their output names stored back to back
+		std::vector<FileView> views;
+		std::string strings;
+		for (size_t i = 0; i < description.GetNumViews(); i++)
+		{
+			auto const view = description.GetView(i);
+			views.push_back(FileView{ view.camera, static_cast<uint32_t>(strings.size()), static_cast<uint32_t>(view.output.size()) });
+			strings += view.output;
+		}
+
+		auto const& lights = description.GetLights();
+		header.nLights = static_cast<uint32_t>(lights.size());
+		header.nViews = static_cast<uint32_t>(views.size());
+		header.nMaterials = static_cast<uint32_t>(materials.size());
+		header.nObjects = fileObjects.size();
+
+		// Header goes in last, once section offsets are known
+		std::vector<uint8_t> data(sizeof(FileHeader), 0);
+		BinaryWriter writer(data);
+		header.lightsOffset = AlignSection(data);
+		writer.WriteBytes(lights.data(), lights.size() * sizeof(Light));
+		header.viewsOffset = AlignSection(data);
+		writer.WriteBytes(views.data(), views.size() * sizeof(FileView));
+		header.materialsOffset = AlignSection(data);
+		writer.WriteBytes(materials.data(), materials.size() * sizeof(FileMaterial));
+		header.objectsOffset = AlignSection(data);
+		writer.WriteBytes(fileObjects.data(), fileObjects.size() * sizeof(FileObject));
+		header.stringsOffset = AlignSection(data);
+		header.stringsSize = strings.size();
+		writer.WriteBytes(strings.data(), strings.size());
+		std::memcpy(data.data(), &header, sizeof(FileHeader));
+
+		// Written under a temporary name and renamed, so a failed export never leaves half a scene
+		std::string const temporaryPath = filepath + ".tmp";
+		{
+			std::ofstream file(temporaryPath, std::ios::binary);
+			if (!file)
+				return FAIL;
+
+			file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+			if (!file)
+				return FAIL;
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, filepath, error);
+		if (error)
+		{
+			std::filesystem::remove(temporaryPath, error);
+			return FAIL;
+		}
+
+		return SUCCESS;
+	}
+
+	bool BinaryScene::IsBinarySceneFile(const std::string& filepath)
+	{
+		return std::filesystem::path(filepath).extension() == BINARY_SCENE_EXTENSION;
+	}
+}
@@ -0,0 +1,46 @@
+// Binary scene files: scenes flattened ahead of time, so huge generated scenes load without parsing text
+#pragma once
+
+// STL includes
+#include <string>
+
+// Local includes
+#include "RecursiveRayTracer.h"
+
+namespace RecRays
+{
+	// Extension of binary scene files, scene files with any other extension are parsed as text
+	constexpr const char* BINARY_SCENE_EXTENSION = ".rrscene";
+
+	/**
+	 * \brief Read and write .rrscene files. A file holds the global settings, lights, cameras with their outputs,
+	 * a table of unique materials and every object with its final transform, so loading replays no transform stack
+	 * and converts no text. Files are mapped in memory and objects are copied out of the mapping, each one in the
+	 * same constant time. Values are stored with the native byte order
+	 */
+	class BinaryScene
+	{
+		// Default constructor private, use static members only
+		BinaryScene();
+
+	public:
+		/**
+		 * \brief Load a scene from a binary scene file. Starts loading the meshes it uses right away
+		 * \param filepath File written by Save
+		 * \param outDescription Loaded scene if everything went ok
+		 * \return Success status, 0 for success, 1 for failure
+		 */
+		static int Load(const std::string& filepath, SceneDescription& outDescription);
+
+		/**
+		 * \brief Write a scene to a binary scene file, replacing it at once
+		 * \return Success status, 0 for success, 1 for failure
+		 */
+		static int Save(const SceneDescription& description, const std::string& filepath);
+
+		/**
+		 * \brief If a scene file should be loaded with Load instead of parsed as text, going by its extension
+		 */
+		static bool IsBinarySceneFile(const std::string& filepath);
+	};
+}
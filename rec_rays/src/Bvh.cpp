@@ -0,0 +1,660 @@
+// Local includes
+#include "Bvh.h"
+#include "Trace.h"
+
+// STL includes
+#include <algorithm>
+#include <array>
+#include <future>
+
+namespace RecRays
+{
+	namespace
+	{
+		// Relative cost of visiting a node against intersecting a triangle, used by the surface area heuristic
+		constexpr float TRAVERSAL_COST = 1.f;
+		constexpr float TRIANGLE_COST = 1.f;
+
+		/**
+		 * \brief Triangle as seen by the builder
+		 */
+		struct BuildTriangle
+		{
+			Bounds bounds;
+			glm::vec3 centroid;
+			uint32_t triangle;
+		};
+
+		/**
+		 * \brief Node of the intermediate binary tree, later collapsed into wide nodes
+		 */
+		struct BinaryNode
+		{
+			Bounds bounds;
+			uint32_t left = 0, right = 0;	// Children, for inner nodes
+			uint32_t first = 0, count = 0;	// Range of triangles, for leaves
+
+			bool IsLeaf() const { return count > 0; }
+		};
+
+		struct Bin
+		{
+			Bounds bounds;
+			uint32_t count = 0;
+		};
+
+		// Bins of every axis
+		using SplitBins = std::array<std::array<Bin, BVH_BINS>, 3>;
+
+		/**
+		 * \brief Best split plane found in the bins of a node
+		 */
+		struct SplitPlane
+		{
+			int axis = -1;			// -1 if no plane leaves triangles at both sides
+			uint32_t bin = 0;		// Plane goes after this bin
+			float cost = INFINITY;	// Sum of count times area of both sides
+		};
+
+		uint32_t BinIndex(float value, float min, float binScale)
+		{
+			auto const bin = static_cast<int64_t>((value - min) * binScale);
+			return static_cast<uint32_t>(std::clamp<int64_t>(bin, 0, BVH_BINS - 1));
+		}
+
+		/**
+		 * \brief Add triangles in [begin, end) to the bins of every axis with some extent
+		 */
+		void FillBins(const std::vector<BuildTriangle>& triangles, uint32_t begin, uint32_t end, const Bounds& centroidBounds, SplitBins& outBins)
+		{
+			auto const extent = centroidBounds.max - centroidBounds.min;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (extent[axis] <= 0)
+					continue;
+
+				float const binScale = BVH_BINS / extent[axis];
+				for (uint32_t i = begin; i < end; i++)
+				{
+					auto const bin = BinIndex(triangles[i].centroid[axis], centroidBounds.min[axis], binScale);
+					outBins[axis][bin].bounds.Extend(triangles[i].bounds);
+					outBins[axis][bin].count++;
+				}
+			}
+		}
+
+		/**
+		 * \brief Find the split plane between bins with the lowest surface area heuristic cost
+		 * \param count Triangles in the bins
+		 */
+		SplitPlane FindSplitPlane(const SplitBins& bins, const Bounds& centroidBounds, uint32_t count)
+		{
+			SplitPlane best;
+			auto const extent = centroidBounds.max - centroidBounds.min;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				if (extent[axis] <= 0)
+					continue;
+
+				// Sweep from the right to know area and count at the right of every plane
+				std::array<float, BVH_BINS> rightCost;
+				Bounds rightBounds;
+				uint32_t rightCount = 0;
+				for (uint32_t bin = BVH_BINS - 1; bin > 0; bin--)
+				{
+					rightBounds.Extend(bins[axis][bin].bounds);
+					rightCount += bins[axis][bin].count;
+					rightCost[bin] = rightCount * rightBounds.SurfaceArea();
+				}
+
+				// Then from the left, plane after bin i
+				Bounds leftBounds;
+				uint32_t leftCount = 0;
+				for (uint32_t bin = 0; bin < BVH_BINS - 1; bin++)
+				{
+					leftBounds.Extend(bins[axis][bin].bounds);
+					leftCount += bins[axis][bin].count;
+					float const cost = leftCount * leftBounds.SurfaceArea() + rightCost[bin + 1];
+					if (leftCount > 0 && leftCount < count && cost < best.cost)
+						best = { axis, bin, cost };
+				}
+			}
+
+			return best;
+		}
+
+		/**
+		 * \brief Axis along which centroids spread the most, to split in half when no plane is any good
+		 */
+		int LongestAxis(const Bounds& centroidBounds)
+		{
+			auto const extent = centroidBounds.max - centroidBounds.min;
+			int axis = 0;
+			if (extent[1] > extent[axis]) axis = 1;
+			if (extent[2] > extent[axis]) axis = 2;
+			return axis;
+		}
+
+		class BinaryBuilder
+		{
+		public:
+			BinaryBuilder(std::vector<BuildTriangle>& triangles, uint32_t maxLeafTriangles)
+				: m_Triangles(triangles)
+				, m_MaxLeafTriangles(maxLeafTriangles)
+			{ }
+
+			/**
+			 * \brief Build node for triangles in [begin, end) and its subtree
+			 * \return Index of node
+			 */
+			uint32_t Build(uint32_t begin, uint32_t end)
+			{
+				auto const nodeIndex = static_cast<uint32_t>(m_Nodes.size());
+				m_Nodes.emplace_back();
+
+				Bounds bounds, centroidBounds;
+				for (uint32_t i = begin; i < end; i++)
+				{
+					bounds.Extend(m_Triangles[i].bounds);
+					centroidBounds.Extend(m_Triangles[i].centroid);
+				}
+				m_Nodes[nodeIndex].bounds = bounds;
+
+				uint32_t const count = end - begin;
+				uint32_t const middle = Split(begin, end, bounds, centroidBounds);
+				if (middle == begin || middle == end)
+				{
+					m_Nodes[nodeIndex].first = begin;
+					m_Nodes[nodeIndex].count = count;
+					return nodeIndex;
+				}
+
+				// Careful, building children may reallocate nodes
+				auto const left = Build(begin, middle);
+				auto const right = Build(middle, end);
+				m_Nodes[nodeIndex].left = left;
+				m_Nodes[nodeIndex].right = right;
+				return nodeIndex;
+			}
+
+			std::vector<BinaryNode>& GetNodes() { return m_Nodes; }
+
+		private:
+			/**
+			 * \brief Partition triangles in [begin, end) in two groups
+			 * \return First triangle of the second group, begin or end if it's better to keep them in a leaf
+			 */
+			uint32_t Split(uint32_t begin, uint32_t end, const Bounds& bounds, const Bounds& centroidBounds)
+			{
+				uint32_t const count = end - begin;
+				if (count <= 1)
+					return begin;
+
+				// Find best split plane between bins in every axis
+				SplitBins bins;
+				FillBins(m_Triangles, begin, end, centroidBounds, bins);
+				auto const plane = FindSplitPlane(bins, centroidBounds, count);
+
+				// Compare against keeping every triangle in a leaf
+				float const area = bounds.SurfaceArea();
+				float const splitCost = TRAVERSAL_COST * area + TRIANGLE_COST * plane.cost;
+				float const leafCost = TRIANGLE_COST * count * area;
+				if (count <= m_MaxLeafTriangles && (plane.axis < 0 || leafCost <= splitCost))
+					return begin;
+
+				auto* const first = m_Triangles.data() + begin;
+				auto* const last = m_Triangles.data() + end;
+
+				// Too many triangles and no good plane, like when all centroids are the same. Split them in half
+				if (plane.axis < 0)
+				{
+					int const axis = LongestAxis(centroidBounds);
+					auto* const middle = first + count / 2;
+					std::nth_element(first, middle, last, [axis](const BuildTriangle& a, const BuildTriangle& b) { return a.centroid[axis] < b.centroid[axis]; });
+					return begin + count / 2;
+				}
+
+				float const binScale = BVH_BINS / (centroidBounds.max[plane.axis] - centroidBounds.min[plane.axis]);
+				float const minCentroid = centroidBounds.min[plane.axis];
+				auto* const middle = std::partition(first, last, [&](const BuildTriangle& triangle)
+				{
+					return BinIndex(triangle.centroid[plane.axis], minCentroid, binScale) <= plane.bin;
+				});
+
+				return begin + static_cast<uint32_t>(middle - first);
+			}
+
+		private:
+			std::vector<BuildTriangle>& m_Triangles;
+			uint32_t m_MaxLeafTriangles;
+			std::vector<BinaryNode> m_Nodes;
+		};
+
+		/**
+		 * \brief Run function(chunk, chunkBegin, chunkEnd) over [begin, end) split in chunks of BVH_PARALLEL_CHUNK
+		 * on every thread, and wait for all of them
+		 */
+		template<typename Function>
+		void ParallelFor(thread_pool& threads, uint32_t begin, uint32_t end, Function&& function)
+		{
+			std::vector<std::future<void>> futures;
+			uint32_t chunk = 0;
+			for (uint32_t chunkBegin = begin; chunkBegin < end; chunkBegin += BVH_PARALLEL_CHUNK, chunk++)
+			{
+				uint32_t const chunkEnd = std::min(end, chunkBegin + BVH_PARALLEL_CHUNK);
+				futures.push_back(threads.execute([&function, chunk, chunkBegin, chunkEnd]() { function(chunk, chunkBegin, chunkEnd); }));
+			}
+
+			for (auto& future : futures)
+				future.get();
+		}
+
+		uint32_t CountChunks(uint32_t begin, uint32_t end)
+		{
+			return (end - begin + BVH_PARALLEL_CHUNK - 1) / BVH_PARALLEL_CHUNK;
+		}
+
+		/**
+		 * \brief Builds the top of the tree with every thread working on each node: bounds, bins and partitions are
+		 * computed over chunks of triangles in parallel. Once nodes are small enough, their subtrees are built as
+		 * independent tasks by BinaryBuilder and stitched below the top of the tree. Only the calling thread ever
+		 * waits, so it shouldn't be a thread of the pool
+		 */
+		class ParallelBuilder
+		{
+		public:
+			ParallelBuilder(std::vector<BuildTriangle>& triangles, thread_pool& threads, uint32_t maxLeafTriangles)
+				: m_Triangles(triangles)
+				, m_Threads(threads)
+				, m_MaxLeafTriangles(maxLeafTriangles)
+			{ }
+
+			/**
+			 * \brief Build the tree for every triangle
+			 * \return Index of root node
+			 */
+			uint32_t Build()
+			{
+				uint32_t root;
+				{
+					RRAYS_TRACE_SCOPE("BVH top levels");
+					root = BuildTop(0, static_cast<uint32_t>(m_Triangles.size()));
+				}
+
+				RRAYS_TRACE_SCOPE("BVH subtrees");
+
+				// Biggest subtrees first, so the last tasks to start are short
+				std::sort(m_Subtrees.begin(), m_Subtrees.end(), [](const Subtree& a, const Subtree& b) { return a.end - a.begin > b.end - b.begin; });
+
+				std::vector<std::future<std::vector<BinaryNode>>> futures;
+				futures.reserve(m_Subtrees.size());
+				for (auto const& subtree : m_Subtrees)
+				{
+					futures.push_back(m_Threads.execute([this, subtree]()
+					{
+						BinaryBuilder builder(m_Triangles, m_MaxLeafTriangles);
+						builder.Build(subtree.begin, subtree.end);
+						return std::move(builder.GetNodes());
+					}));
+				}
+
+				// Subtree root replaces its placeholder, the rest of nodes go at the end with their children remapped
+				for (size_t i = 0; i < m_Subtrees.size(); i++)
+				{
+					auto nodes = futures[i].get();
+					auto const placeholder = m_Subtrees[i].node;
+					auto const offset = static_cast<uint32_t>(m_Nodes.size()) - 1;
+					auto const remap = [placeholder, offset](uint32_t index) { return index == 0 ? placeholder : offset + index; };
+					for (auto& node : nodes)
+					{
+						if (node.IsLeaf())
+							continue;
+						node.left = remap(node.left);
+						node.right = remap(node.right);
+					}
+
+					m_Nodes[placeholder] = nodes[0];
+					m_Nodes.insert(m_Nodes.end(), nodes.begin() + 1, nodes.end());
+				}
+
+				return root;
+			}
+
+			std::vector<BinaryNode>& GetNodes() { return m_Nodes; }
+
+		private:
+			/**
+			 * \brief Range of triangles whose subtree is built by a single task
+			 */
+			struct Subtree
+			{
+				uint32_t node;	// Placeholder node for the root of the subtree
+				uint32_t begin, end;
+			};
+
+			/**
+			 * \brief Build node for triangles in [begin, end), splitting it in parallel if it's big enough or leaving
+			 * its subtree to a task otherwise
+			 * \return Index of node
+			 */
+			uint32_t BuildTop(uint32_t begin, uint32_t end)
+			{
+				auto const nodeIndex = static_cast<uint32_t>(m_Nodes.size());
+				m_Nodes.emplace_back();
+
+				uint32_t const count = end - begin;
+				if (count <= BVH_PARALLEL_SPLIT_TRIANGLES)
+				{
+					m_Subtrees.push_back({ nodeIndex, begin, end });
+					return nodeIndex;
+				}
+
+				Bounds bounds, centroidBounds;
+				ComputeBounds(begin, end, bounds, centroidBounds);
+				m_Nodes[nodeIndex].bounds = bounds;
+
+				// Every chunk fills its own bins, then they are merged
+				std::vector<SplitBins> chunkBins(CountChunks(begin, end));
+				ParallelFor(m_Threads, begin, end, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd)
+				{
+					FillBins(m_Triangles, chunkBegin, chunkEnd, centroidBounds, chunkBins[chunk]);
+				});
+
+				SplitBins bins;
+				for (auto const& chunk : chunkBins)
+				{
+					for (int axis = 0; axis < 3; axis++)
+					{
+						for (uint32_t bin = 0; bin < BVH_BINS; bin++)
+						{
+							bins[axis][bin].bounds.Extend(chunk[axis][bin].bounds);
+							bins[axis][bin].count += chunk[axis][bin].count;
+						}
+					}
+				}
+
+				// Nodes this big are never leaves
+				uint32_t middle;
+				auto const plane = FindSplitPlane(bins, centroidBounds, count);
+				if (plane.axis < 0)
+				{
+					int const axis = LongestAxis(centroidBounds);
+					middle = begin + count / 2;
+					std::nth_element(m_Triangles.begin() + begin, m_Triangles.begin() + middle, m_Triangles.begin() + end,
+						[axis](const BuildTriangle& a, const BuildTriangle& b) { return a.centroid[axis] < b.centroid[axis]; });
+				}
+				else
+					middle = Partition(begin, end, plane, centroidBounds);
+
+				// Careful, building children may reallocate nodes
+				auto const left = BuildTop(begin, middle);
+				auto const right = BuildTop(middle, end);
+				m_Nodes[nodeIndex].left = left;
+				m_Nodes[nodeIndex].right = right;
+				return nodeIndex;
+			}
+
+			void ComputeBounds(uint32_t begin, uint32_t end, Bounds& outBounds, Bounds& outCentroidBounds)
+			{
+				std::vector<Bounds> chunkBounds(CountChunks(begin, end)), chunkCentroidBounds(chunkBounds.size());
+				ParallelFor(m_Threads, begin, end, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd)
+				{
+					for (uint32_t i = chunkBegin; i < chunkEnd; i++)
+					{
+						chunkBounds[chunk].Extend(m_Triangles[i].bounds);
+						chunkCentroidBounds[chunk].Extend(m_Triangles[i].centroid);
+					}
+				});
+
+				for (size_t chunk = 0; chunk < chunkBounds.size(); chunk++)
+				{
+					outBounds.Extend(chunkBounds[chunk]);
+					outCentroidBounds.Extend(chunkCentroidBounds[chunk]);
+				}
+			}
+
+			/**
+			 * \brief Stable partition of triangles in [begin, end) by the side of a plane they fall on. Chunks count
+			 * their triangles at each side, then scatter them to their final place in a scratch buffer and copy back
+			 * \return First triangle at the right of the plane
+			 */
+			uint32_t Partition(uint32_t begin, uint32_t end, const SplitPlane& plane, const Bounds& centroidBounds)
+			{
+				float const binScale = BVH_BINS / (centroidBounds.max[plane.axis] - centroidBounds.min[plane.axis]);
+				float const minCentroid = centroidBounds.min[plane.axis];
+				auto const isLeft = [&](const BuildTriangle& triangle)
+				{
+					return BinIndex(triangle.centroid[plane.axis], minCentroid, binScale) <= plane.bin;
+				};
+
+				std::vector<uint32_t> leftCounts(CountChunks(begin, end));
+				ParallelFor(m_Threads, begin, end, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd)
+				{
+					leftCounts[chunk] = static_cast<uint32_t>(std::count_if(m_Triangles.begin() + chunkBegin, m_Triangles.begin() + chunkEnd, isLeft));
+				});
+
+				uint32_t totalLeft = 0;
+				for (auto const leftCount : leftCounts)
+					totalLeft += leftCount;
+
+				// Where each chunk starts writing at each side
+				std::vector<uint32_t> leftOffsets(leftCounts.size()), rightOffsets(leftCounts.size());
+				uint32_t leftOffset = begin, rightOffset = begin + totalLeft;
+				for (uint32_t chunk = 0; chunk < leftCounts.size(); chunk++)
+				{
+					leftOffsets[chunk] = leftOffset;
+					rightOffsets[chunk] = rightOffset;
+					leftOffset += leftCounts[chunk];
+					rightOffset += std::min(end, begin + (chunk + 1) * BVH_PARALLEL_CHUNK) - (begin + chunk * BVH_PARALLEL_CHUNK) - leftCounts[chunk];
+				}
+
+				m_Scratch.resize(m_Triangles.size());
+				ParallelFor(m_Threads, begin, end, [&](uint32_t chunk, uint32_t chunkBegin, uint32_t chunkEnd)
+				{
+					uint32_t left = leftOffsets[chunk], right = rightOffsets[chunk];
+					for (uint32_t i = chunkBegin; i < chunkEnd; i++)
+						m_Scratch[isLeft(m_Triangles[i]) ? left++ : right++] = m_Triangles[i];
+				});
+
+				ParallelFor(m_Threads, begin, end, [&](uint32_t, uint32_t chunkBegin, uint32_t chunkEnd)
+				{
+					std::copy(m_Scratch.begin() + chunkBegin, m_Scratch.begin() + chunkEnd, m_Triangles.begin() + chunkBegin);
+				});
+
+				return begin + totalLeft;
+			}
+
+		private:
+			std::vector<BuildTriangle>& m_Triangles;
+			std::vector<BuildTriangle> m_Scratch;
+			thread_pool& m_Threads;
+			uint32_t m_MaxLeafTriangles;
+			std::vector<BinaryNode> m_Nodes;
+			std::vector<Subtree> m_Subtrees;
+		};
+		/**
+		 * \brief Smallest exponent such that 255 steps cover extent
+		 */
+		int8_t QuantizationExponent(float extent)
+		{
+			if (!(extent > 0))
+				return -126;
+
+			int exponent = static_cast<int>(std::ceil(std::log2(extent / 255.f)));
+			while (exponent < 127 && 255.f * QuantizationStep(static_cast<int8_t>(std::clamp(exponent, -126, 127))) < extent)
+				exponent++;
+
+			return static_cast<int8_t>(std::clamp(exponent, -126, 127));
+		}
+
+		/**
+		 * \brief Turns a binary tree into a tree of wide nodes, pulling grandchildren into each node until it's full
+		 */
+		class WideCollapser
+		{
+		public:
+			WideCollapser(const std::vector<BinaryNode>& binaryNodes, uint32_t firstTriangle, std::vector<WideBvhNode>& outNodes)
+				: m_BinaryNodes(binaryNodes)
+				, m_FirstTriangle(firstTriangle)
+				, m_Nodes(outNodes)
+			{ }
+
+			/**
+			 * \brief Create a wide node for a binary node and everything below it
+			 * \return Index of new node
+			 */
+			uint32_t Collapse(uint32_t binaryIndex)
+			{
+				auto const nodeIndex = static_cast<uint32_t>(m_Nodes.size());
+				m_Nodes.emplace_back();
+
+				// Open the biggest inner child until there's no more room
+				std::array<uint32_t, BVH_WIDTH> children;
+				uint32_t nChildren = 0;
+				auto const& binaryNode = m_BinaryNodes[binaryIndex];
+				if (binaryNode.IsLeaf())
+					children[nChildren++] = binaryIndex;
+				else
+				{
+					children[nChildren++] = binaryNode.left;
+					children[nChildren++] = binaryNode.right;
+				}
+
+				while (nChildren < BVH_WIDTH)
+				{
+					int biggest = -1;
+					float biggestArea = -1;
+					for (uint32_t i = 0; i < nChildren; i++)
+					{
+						auto const& child = m_BinaryNodes[children[i]];
+						if (!child.IsLeaf() && child.bounds.SurfaceArea() > biggestArea)
+						{
+							biggest = static_cast<int>(i);
+							biggestArea = child.bounds.SurfaceArea();
+						}
+					}
+
+					if (biggest < 0)
+						break;
+
+					auto const& opened = m_BinaryNodes[children[biggest]];
+					children[biggest] = opened.left;
+					children[nChildren++] = opened.right;
+				}
+
+				// Quantize child bounds relative to this node bounds
+				WideBvhNode node = {};
+				auto const& bounds = binaryNode.bounds;
+				node.origin = bounds.min;
+				float step[3];
+				for (int axis = 0; axis < 3; axis++)
+				{
+					node.exponent[axis] = QuantizationExponent(bounds.max[axis] - bounds.min[axis]);
+					step[axis] = QuantizationStep(node.exponent[axis]);
+				}
+
+				for (uint32_t i = 0; i < nChildren; i++)
+				{
+					auto const& child = m_BinaryNodes[children[i]];
+					for (int axis = 0; axis < 3; axis++)
+					{
+						node.childMin[axis][i] = QuantizeDown(child.bounds.min[axis], node.origin[axis], step[axis]);
+						node.childMax[axis][i] = QuantizeUp(child.bounds.max[axis], node.origin[axis], step[axis]);
+					}
+
+					node.childMask |= 1u << i;
+					if (child.IsLeaf())
+					{
+						node.child[i] = m_FirstTriangle + child.first;
+						node.childTriangles[i] = static_cast<uint8_t>(child.count);
+					}
+					else
+						node.child[i] = Collapse(children[i]);
+				}
+
+				m_Nodes[nodeIndex] = node;
+				return nodeIndex;
+			}
+
+		private:
+			static uint8_t QuantizeDown(float value, float origin, float step)
+			{
+				// Rounding might leave us a bit inside the box, step back in that case
+				int q = std::clamp(static_cast<int>(std::floor((value - origin) / step)), 0, 255);
+				while (q > 0 && origin + q * step > value)
+					q--;
+				return static_cast<uint8_t>(q);
+			}
+
+			static uint8_t QuantizeUp(float value, float origin, float step)
+			{
+				int q = std::clamp(static_cast<int>(std::ceil((value - origin) / step)), 0, 255);
+				while (q < 255 && origin + q * step < value)
+					q++;
+				return static_cast<uint8_t>(q);
+			}
+
+		private:
+			const std::vector<BinaryNode>& m_BinaryNodes;
+			uint32_t m_FirstTriangle;
+			std::vector<WideBvhNode>& m_Nodes;
+		};
+	}
+
+	uint32_t BuildWideBvh(const glm::vec3* vertices, glm::uvec3* triangles, uint32_t nTriangles, uint32_t firstTriangle, std::vector<WideBvhNode>& outNodes, thread_pool* threads, uint32_t maxLeafTriangles)
+	{
+		assert(nTriangles > 0 && "Can't build a BVH without triangles");
+		assert(maxLeafTriangles > 0 && maxLeafTriangles <= UINT8_MAX && "Leaf triangle counts are stored in 8 bits");
+
+		// Without threads, every parallel loop runs as a single chunk in this thread
+		auto const parallelFor = [threads, nTriangles](auto&& function)
+		{
+			if (threads)
+				ParallelFor(*threads, 0, nTriangles, function);
+			else
+				function(0u, 0u, nTriangles);
+		};
+
+		std::vector<BuildTriangle> buildTriangles(nTriangles);
+		parallelFor([&](uint32_t, uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; i++)
+			{
+				auto const& indices = triangles[i];
+				auto& buildTriangle = buildTriangles[i];
+				buildTriangle.bounds.Extend(vertices[indices.x]);
+				buildTriangle.bounds.Extend(vertices[indices.y]);
+				buildTriangle.bounds.Extend(vertices[indices.z]);
+				buildTriangle.centroid = buildTriangle.bounds.Center();
+				buildTriangle.triangle = i;
+			}
+		});
+
+		std::vector<BinaryNode> binaryNodes;
+		uint32_t binaryRoot;
+		if (threads)
+		{
+			ParallelBuilder builder(buildTriangles, *threads, maxLeafTriangles);
+			binaryRoot = builder.Build();
+			binaryNodes = std::move(builder.GetNodes());
+		}
+		else
+		{
+			BinaryBuilder builder(buildTriangles, maxLeafTriangles);
+			binaryRoot = builder.Build(0, nTriangles);
+			binaryNodes = std::move(builder.GetNodes());
+		}
+
+		// Store triangles in leaf order
+		std::vector<glm::uvec3> reordered(nTriangles);
+		parallelFor([&](uint32_t, uint32_t begin, uint32_t end)
+		{
+			for (uint32_t i = begin; i < end; i++)
+				reordered[i] = triangles[buildTriangles[i].triangle];
+		});
+		std::copy(reordered.begin(), reordered.end(), triangles);
+
+		WideCollapser collapser(binaryNodes, firstTriangle, outNodes);
+		return collapser.Collapse(binaryRoot);
+	}
+}
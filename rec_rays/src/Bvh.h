@@ -0,0 +1,250 @@
+// Bounding volume hierarchy for triangle meshes, stored as compressed 4-wide nodes
+#pragma once
+
+// STL includes
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <assert.h>
+
+// Third party includes
+#include <glm/glm.hpp>
+#include <threadpool.h>
+
+// Local includes
+#include "Geometry.h"
+#include "Memory.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#define RRAYS_BVH_SSE
+	#include <emmintrin.h>
+#endif
+
+namespace RecRays
+{
+	// Children per node
+	constexpr uint32_t BVH_WIDTH = 4;
+	// Leaves never hold more triangles than this, unless a render profile says otherwise
+	constexpr uint32_t BVH_MAX_LEAF_TRIANGLES = 8;
+	// Bins used to evaluate splits per axis
+	constexpr uint32_t BVH_BINS = 16;
+	// Meshes with less triangles than this are just intersected triangle by triangle
+	constexpr uint32_t BVH_MIN_TRIANGLES = 32;
+	// Nodes with more triangles than this are split by every thread together, smaller ones are built by a single task
+	constexpr uint32_t BVH_PARALLEL_SPLIT_TRIANGLES = 1u << 16;
+	// Triangles per job when threads share work over a range of triangles
+	constexpr uint32_t BVH_PARALLEL_CHUNK = 1u << 14;
+	// Max nodes pending during traversal. Each level adds at most BVH_WIDTH - 1 of them, so only trees deeper than
+	// 85 levels need more. Those are traversed with a nested stack when it's full
+	constexpr size_t BVH_STACK_SIZE = 256;
+
+	/**
+	 * \brief BVH node with up to four children, exactly one cache line. Child bounds are quantized to 8 bits
+	 * per axis relative to the node bounds: child box is origin + [min, max] * 2^exponent, rounded outwards
+	 * so it always contains the actual child. Roughly a quarter the size of four float boxes
+	 */
+	struct alignas(CACHE_LINE_SIZE) WideBvhNode
+	{
+		glm::vec3 origin;					// Min corner of node bounds
+		int8_t exponent[3];					// Quantization step per axis is 2^exponent
+		uint8_t childMask;					// Bit i is set if child i is used
+		uint8_t childMin[3][BVH_WIDTH];		// [axis][child]
+		uint8_t childMax[3][BVH_WIDTH];		// [axis][child]
+		uint32_t child[BVH_WIDTH];			// Index of child node, or first triangle of leaf
+		uint8_t childTriangles[BVH_WIDTH];	// Triangles in leaf child, 0 for inner nodes
+		uint8_t padding[4];
+	};
+
+	static_assert(sizeof(WideBvhNode) == CACHE_LINE_SIZE, "Nodes should fit a single cache line");
+
+	/**
+	 * \brief Ray prepared for traversal
+	 */
+	struct BvhRay
+	{
+		BvhRay(const glm::vec3& _origin, const glm::vec3& direction)
+			: origin(_origin)
+		{
+			// Avoid infinities, they turn into NaN when multiplied by 0
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float const d = direction[axis];
+				inverseDirection[axis] = 1.f / (std::abs(d) > 1e-20f ? d : std::copysign(1e-20f, d));
+			}
+		}
+
+		glm::vec3 origin;
+		glm::vec3 inverseDirection;
+	};
+
+	/**
+	 * \brief Build a BVH over a range of triangles and append its nodes to outNodes. Splits are chosen with the
+	 * surface area heuristic evaluated at BVH_BINS bins per axis. Triangles in the range are reordered so every
+	 * leaf covers a contiguous run of them
+	 * \param vertices Vertices referenced by triangles
+	 * \param triangles First of the triangles to build the BVH for, reordered in place
+	 * \param nTriangles How many triangles to build the BVH for
+	 * \param firstTriangle Index leaves should use for the first triangle, triangles[i] is referenced as firstTriangle + i
+	 * \param outNodes Where to append nodes. Child indices are absolute indices in this vector
+	 * \param threads Where to run build jobs, or nullptr to build in the calling thread. Waits for its jobs, so it
+	 * shouldn't be called from one of these threads
+	 * \param maxLeafTriangles Most triangles a leaf can hold, up to 255
+	 * \return Index of root node in outNodes
+	 */
+	uint32_t BuildWideBvh(const glm::vec3* vertices, glm::uvec3* triangles, uint32_t nTriangles, uint32_t firstTriangle, std::vector<WideBvhNode>& outNodes,
+		thread_pool* threads = nullptr, uint32_t maxLeafTriangles = BVH_MAX_LEAF_TRIANGLES);
+
+	/**
+	 * \brief Step between quantized values for an exponent, built from float bits to keep it cheap
+	 */
+	inline float QuantizationStep(int8_t exponent)
+	{
+		uint32_t const bits = static_cast<uint32_t>(exponent + 127) << 23;
+		float step;
+		std::memcpy(&step, &bits, sizeof(float));
+		return step;
+	}
+
+	/**
+	 * \brief Test ray against every child box of a node
+	 * \param outEnter Where the ray enters each child box
+	 * \return Bit mask of children crossed by the ray in [minT, maxT]
+	 */
+	inline uint32_t IntersectChildren(const WideBvhNode& node, const BvhRay& ray, float minT, float maxT, float outEnter[BVH_WIDTH])
+	{
+#ifdef RRAYS_BVH_SSE
+		__m128 enter = _mm_set1_ps(minT);
+		__m128 exit = _mm_set1_ps(maxT);
+		__m128i const zero = _mm_setzero_si128();
+
+		// Widen 4 bytes into 4 floats
+		auto const decode = [&zero](const uint8_t* bytes)
+		{
+			int32_t packed;
+			std::memcpy(&packed, bytes, sizeof(packed));
+			__m128i const words = _mm_unpacklo_epi8(_mm_cvtsi32_si128(packed), zero);
+			return _mm_cvtepi32_ps(_mm_unpacklo_epi16(words, zero));
+		};
+
+		for (int axis = 0; axis < 3; axis++)
+		{
+			// t = (origin + q * step - rayOrigin) / direction = q * scale + offset
+			float const inverse = ray.inverseDirection[axis];
+			__m128 const scale = _mm_set1_ps(QuantizationStep(node.exponent[axis]) * inverse);
+			__m128 const offset = _mm_set1_ps((node.origin[axis] - ray.origin[axis]) * inverse);
+
+			__m128 const t0 = _mm_add_ps(_mm_mul_ps(decode(node.childMin[axis]), scale), offset);
+			__m128 const t1 = _mm_add_ps(_mm_mul_ps(decode(node.childMax[axis]), scale), offset);
+			enter = _mm_max_ps(enter, _mm_min_ps(t0, t1));
+			exit = _mm_min_ps(exit, _mm_max_ps(t0, t1));
+		}
+
+		_mm_storeu_ps(outEnter, enter);
+		return static_cast<uint32_t>(_mm_movemask_ps(_mm_cmple_ps(enter, exit))) & node.childMask;
+#else
+		float scale[3], offset[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float const inverse = ray.inverseDirection[axis];
+			scale[axis] = QuantizationStep(node.exponent[axis]) * inverse;
+			offset[axis] = (node.origin[axis] - ray.origin[axis]) * inverse;
+		}
+
+		uint32_t mask = 0;
+		for (uint32_t child = 0; child < BVH_WIDTH; child++)
+		{
+			float enter = minT, exit = maxT;
+			for (int axis = 0; axis < 3; axis++)
+			{
+				float const t0 = node.childMin[axis][child] * scale[axis] + offset[axis];
+				float const t1 = node.childMax[axis][child] * scale[axis] + offset[axis];
+				enter = std::max(enter, std::min(t0, t1));
+				exit = std::min(exit, std::max(t0, t1));
+			}
+
+			outEnter[child] = enter;
+			mask |= (enter <= exit ? 1u : 0u) << child;
+		}
+
+		return mask & node.childMask;
+#endif
+	}
+
+	/**
+	 * \brief Visit every leaf of a BVH that might hold a hit nearer than maxT, nearest children first
+	 * \param nodes Node array the BVH was built into
+	 * \param root Index of root node
+	 * \param minT Minimum value of T to consider
+	 * \param maxT Nearest hit so far. Read again after each leaf, so leaves should update it when they find a hit
+	 * \param outVisitedNodes Incremented for every node visited
+	 * \param intersectLeaf Called as intersectLeaf(firstTriangle, nTriangles)
+	 */
+	template<typename IntersectLeaf>
+	void TraverseWideBvh(const WideBvhNode* nodes, uint32_t root, const BvhRay& ray, float minT, const float& maxT, uint64_t& outVisitedNodes, IntersectLeaf&& intersectLeaf)
+	{
+		struct StackEntry
+		{
+			uint32_t node;
+			float enter;
+		};
+
+		StackEntry stack[BVH_STACK_SIZE];
+		size_t stackSize = 0;
+		stack[stackSize++] = { root, minT };
+
+		while (stackSize > 0)
+		{
+			auto const entry = stack[--stackSize];
+
+			// Something nearer was found since this node was pushed
+			if (entry.enter > maxT)
+				continue;
+
+			auto const& node = nodes[entry.node];
+			outVisitedNodes++;
+
+			float enter[BVH_WIDTH];
+			uint32_t mask = IntersectChildren(node, ray, minT, maxT, enter);
+
+			// Leaves are intersected right away, inner nodes are sorted farthest first so the nearest is popped first
+			StackEntry inner[BVH_WIDTH];
+			size_t nInner = 0;
+			for (uint32_t child = 0; child < BVH_WIDTH; child++)
+			{
+				if ((mask & (1u << child)) == 0)
+					continue;
+
+				if (node.childTriangles[child] > 0)
+				{
+					intersectLeaf(node.child[child], static_cast<uint32_t>(node.childTriangles[child]));
+					continue;
+				}
+
+				size_t position = nInner++;
+				while (position > 0 && inner[position - 1].enter < enter[child])
+				{
+					inner[position] = inner[position - 1];
+					position--;
+				}
+				inner[position] = { node.child[child], enter[child] };
+			}
+
+			// Stack is full, degenerate meshes can make trees that deep. Children are traversed right away instead,
+			// nearest first as if they had been popped, each with a stack of its own
+			if (stackSize + nInner > BVH_STACK_SIZE)
+			{
+				for (size_t i = nInner; i-- > 0;)
+				{
+					if (inner[i].enter <= maxT)
+						TraverseWideBvh(nodes, inner[i].node, ray, minT, maxT, outVisitedNodes, intersectLeaf);
+				}
+				continue;
+			}
+
+			for (size_t i = 0; i < nInner; i++)
+				stack[stackSize++] = inner[i];
+		}
+	}
+}
@@ -0,0 +1,182 @@
+// Local includes
+#include "Checkpoint.h"
+#include "SceneSerializer.h"
+#include "Trace.h"
+#include "Status.h"
+
+// STL includes
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <filesystem>
+
+namespace RecRays
+{
+	constexpr uint32_t CHECKPOINT_MAGIC = 0x50435252; // "RRCP"
+	constexpr uint32_t CHECKPOINT_VERSION = 2;
+
+	RenderCheckpoint::RenderCheckpoint(const std::string& filepath, uint64_t sceneKey, size_t nTiles, double intervalSeconds)
+		: m_Filepath(filepath)
+		, m_SceneKey(sceneKey)
+		, m_Interval(intervalSeconds)
+		, m_LastWrite(std::chrono::steady_clock::now())
+		, m_Tiles(nTiles)
+	{ }
+
+	RenderCheckpoint::~RenderCheckpoint()
+	{
+		if (m_Write.valid())
+			m_Write.wait();
+	}
+
+	int RenderCheckpoint::Load()
+	{
+		std::ifstream file(m_Filepath, std::ios::binary);
+		if (!file)
+			return FAIL;
+
+		std::vector<uint8_t> const data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		BinaryReader reader(data.data(), data.size());
+
+		uint32_t magic, version;
+		uint64_t key, nTiles;
+		bool const ok = reader.Read(magic) && magic == CHECKPOINT_MAGIC &&
+			reader.Read(version) && version == CHECKPOINT_VERSION &&
+			reader.Read(key) && key == m_SceneKey &&
+			reader.Read(nTiles) && nTiles == m_Tiles.size();
+
+		if (!ok)
+			return FAIL;
+
+		// Nothing is taken unless the whole file reads fine, but for a partial tile at the end from a killed write.
+		// Tiles written twice keep their last colors
+		std::vector<std::vector<glm::vec3>> tiles(m_Tiles.size());
+		uint64_t fileSize = reader.GetPosition();
+		while (reader.GetPosition() < reader.GetSize())
+		{
+			uint32_t tile, nColors;
+			if (!reader.Read(tile) || !reader.Read(nColors) || nColors > (reader.GetSize() - reader.GetPosition()) / sizeof(glm::vec3))
+				break;
+
+			if (tile >= tiles.size() || nColors == 0)
+				return FAIL;
+
+			tiles[tile].resize(nColors);
+			reader.ReadBytes(tiles[tile].data(), nColors * sizeof(glm::vec3));
+			fileSize = reader.GetPosition();
+		}
+
+		m_Tiles = std::move(tiles);
+		m_FileSize = fileSize;
+		return SUCCESS;
+	}
+
+	size_t RenderCheckpoint::GetNumFinishedTiles() const
+	{
+		size_t finished = 0;
+		for (auto const& tile : m_Tiles)
+			finished += tile.empty() ? 0 : 1;
+
+		return finished;
+	}
+
+	void RenderCheckpoint::GetTile(size_t tile, std::vector<glm::vec4>& outColors) const
+	{
+		auto const& colors = m_Tiles[tile];
+		outColors.resize(colors.size());
+		for (size_t i = 0; i < colors.size(); i++)
+			outColors[i] = glm::vec4(colors[i], 1);
+	}
+
+	void RenderCheckpoint::AddTile(size_t tile, const std::vector<glm::vec4>& colors)
+	{
+		BinaryWriter writer(m_PendingTiles);
+		writer.Write(static_cast<uint32_t>(tile));
+		writer.Write(static_cast<uint32_t>(colors.size()));
+		for (auto const& color : colors)
+			writer.Write(glm::vec3(color));
+	}
+
+	void RenderCheckpoint::Update()
+	{
+		auto const now = std::chrono::steady_clock::now();
+		if (m_PendingTiles.empty() || now - m_LastWrite < m_Interval)
+			return;
+
+		// Never wait for the disk, a slow write just makes the next one later
+		if (m_Write.valid() && m_Write.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+			return;
+
+		// Tiles of a failed write are missing from the file, a resumed render draws them again
+		if (m_Write.valid() && m_Write.get() != SUCCESS)
+			std::cerr << "Could not write checkpoint to " << m_Filepath << std::endl;
+
+		m_Write = std::async(std::launch::async, &RenderCheckpoint::Write, this, std::move(m_PendingTiles));
+		m_PendingTiles.clear();
+		m_LastWrite = now;
+	}
+
+	void RenderCheckpoint::Remove()
+	{
+		if (m_Write.valid())
+			m_Write.wait();
+
+		std::error_code error;
+		std::filesystem::remove(m_Filepath, error);
+	}
+
+	int RenderCheckpoint::Write(std::vector<uint8_t> tiles)
+	{
+		RRAYS_TRACE_SCOPE("Write checkpoint");
+		std::error_code error;
+
+		// The first write starts a new file under a temporary name and renames it, so a previous checkpoint stays
+		// intact until this render has some tiles of its own
+		if (m_FileSize == 0)
+		{
+			std::vector<uint8_t> data;
+			BinaryWriter writer(data);
+			writer.Write(CHECKPOINT_MAGIC);
+			writer.Write(CHECKPOINT_VERSION);
+			writer.Write(m_SceneKey);
+			writer.Write(static_cast<uint64_t>(m_Tiles.size()));
+			writer.WriteBytes(tiles.data(), tiles.size());
+
+			std::string const temporaryPath = m_Filepath + ".tmp";
+			{
+				std::ofstream file(temporaryPath, std::ios::binary);
+				if (!file)
+					return FAIL;
+
+				file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+				if (!file)
+					return FAIL;
+			}
+
+			std::filesystem::rename(temporaryPath, m_Filepath, error);
+			if (error)
+				return FAIL;
+
+			m_FileSize = data.size();
+			return SUCCESS;
+		}
+
+		// Later tiles go right after the last whole one, over anything a failed or killed write left behind
+		{
+			std::fstream file(m_Filepath, std::ios::binary | std::ios::in | std::ios::out);
+			if (!file)
+				return FAIL;
+
+			file.seekp(static_cast<std::streamoff>(m_FileSize));
+			file.write(reinterpret_cast<const char*>(tiles.data()), static_cast<std::streamsize>(tiles.size()));
+			if (!file)
+				return FAIL;
+		}
+
+		m_FileSize += tiles.size();
+		if (std::filesystem::file_size(m_Filepath, error) != m_FileSize && !error)
+			std::filesystem::resize_file(m_Filepath, m_FileSize, error);
+
+		return error ? FAIL : SUCCESS;
+	}
+}
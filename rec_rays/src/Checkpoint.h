@@ -0,0 +1,94 @@
+// Partial renders saved to disk while drawing, so an interrupted render can pick up where it left off
+#pragma once
+
+// STL includes
+#include <vector>
+#include <string>
+#include <future>
+#include <chrono>
+#include <cstdint>
+
+// Third party includes
+#include <glm/glm.hpp>
+
+namespace RecRays
+{
+	// Seconds between checkpoint writes
+	constexpr double CHECKPOINT_INTERVAL_SECONDS = 30;
+
+	/**
+	 * \brief Colors of every tile finished so far in a render, appended to a file every now and then. Tiles are
+	 * encoded as they finish, and each write appends the tiles finished since the previous one in the background, so
+	 * drawing goes on meanwhile; if the previous write is still going when the next one is due, it's skipped and
+	 * its tiles go into the following one. Only RGB is kept, alpha isn't part of the image. A render killed while
+	 * writing leaves a partial tile at the end of the file, which loading ignores
+	 */
+	class RenderCheckpoint
+	{
+	public:
+		/**
+		 * \param filepath Where to write checkpoints
+		 * \param sceneKey Key of scene being rendered, from TileCache::HashScene. Checkpoints of other scenes are not loaded
+		 * \param nTiles Tiles in render
+		 * \param intervalSeconds Seconds between writes
+		 */
+		RenderCheckpoint(const std::string& filepath, uint64_t sceneKey, size_t nTiles, double intervalSeconds = CHECKPOINT_INTERVAL_SECONDS);
+
+		/**
+		 * \brief Waits for the write in flight, if any
+		 */
+		~RenderCheckpoint();
+
+		/**
+		 * \brief Take finished tiles from the checkpoint file. Tiles added afterwards are appended to it
+		 * \return Success status, fails if there is no file or it belongs to another render
+		 */
+		int Load();
+
+		bool HasTile(size_t tile) const { return !m_Tiles[tile].empty(); }
+		size_t GetNumFinishedTiles() const;
+
+		/**
+		 * \brief Colors of a loaded tile
+		 * \param outColors Colors in the order they were added, alpha set to 1
+		 */
+		void GetTile(size_t tile, std::vector<glm::vec4>& outColors) const;
+
+		/**
+		 * \brief Record a finished tile, it goes into the next write
+		 */
+		void AddTile(size_t tile, const std::vector<glm::vec4>& colors);
+
+		/**
+		 * \brief Start writing in the background if it's time to. Returns immediately
+		 */
+		void Update();
+
+		/**
+		 * \brief Wait for the write in flight and delete the checkpoint file, once the render is saved for good
+		 */
+		void Remove();
+
+	private:
+		/**
+		 * \brief Append encoded tiles to the checkpoint file, starting it first if this render didn't yet. Runs in
+		 * the background
+		 * \return Success status
+		 */
+		int Write(std::vector<uint8_t> tiles);
+
+	private:
+		std::string m_Filepath;
+		uint64_t m_SceneKey;
+		std::chrono::duration<double> m_Interval;
+		std::chrono::steady_clock::time_point m_LastWrite;
+		// Colors of each tile loaded from the file, empty for tiles it didn't have
+		std::vector<std::vector<glm::vec3>> m_Tiles;
+		// Tiles added since the last write started, encoded like in the file
+		std::vector<uint8_t> m_PendingTiles;
+		// Bytes of the file up to its last whole tile, 0 until this render started the file or loaded it. Only
+		// touched by Load and the write in flight
+		uint64_t m_FileSize = 0;
+		std::future<int> m_Write;
+	};
+}
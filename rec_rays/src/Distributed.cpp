@@ -0,0 +1,412 @@
+// Local includes
+#include "Distributed.h"
+#include "SceneSerializer.h"
+#include "Status.h"
+#include "Trace.h"
+
+// STL includes
+#include <thread>
+#include <iostream>
+
+// Vendor includes
+#include <threadpool.h>
+
+namespace RecRays
+{
+	// A worker should say hello right after connecting
+	constexpr int HELLO_TIMEOUT_MS = 10000;
+	// A worker with tiles in flight that sends nothing for this long is considered dead
+	constexpr int WORKER_TIMEOUT_MS = 60000;
+	// Max workers rendering the same tile at once
+	constexpr uint32_t MAX_TILE_COPIES = 2;
+	// A tile is late if it takes this many times the average tile time
+	constexpr double LATE_TILE_FACTOR = 2.0;
+
+	// -- < Tile Scheduler > ----------------------------------------------------
+	TileScheduler::TileScheduler(size_t nTiles)
+		: m_Done(nTiles, false)
+		, m_Assignees(nTiles, 0)
+		, m_DispatchTime(nTiles)
+	{
+		for (size_t i = 0; i < nTiles; i++)
+			m_Pending.push_back(i);
+	}
+
+	bool TileScheduler::Acquire(const std::set<size_t>& workerTiles, size_t& outTile)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		auto const now = Clock::now();
+
+		// Hand out tiles nobody is working on first
+		while (!m_Pending.empty())
+		{
+			size_t const tile = m_Pending.front();
+			m_Pending.pop_front();
+			if (m_Done[tile])
+				continue;
+
+			m_Assignees[tile]++;
+			m_DispatchTime[tile] = now;
+			outTile = tile;
+			return true;
+		}
+
+		// Nothing left in queue: help with the oldest late tile, in case its worker is slow
+		if (m_AverageSeconds <= 0)
+			return false;
+
+		bool found = false;
+		for (size_t tile = 0; tile < m_Done.size(); tile++)
+		{
+			if (m_Done[tile] || m_Assignees[tile] >= MAX_TILE_COPIES || workerTiles.count(tile))
+				continue;
+
+			auto const elapsed = std::chrono::duration<double>(now - m_DispatchTime[tile]).count();
+			if (elapsed < LATE_TILE_FACTOR * m_AverageSeconds)
+				continue;
+
+			if (!found || m_DispatchTime[tile] < m_DispatchTime[outTile])
+			{
+				outTile = tile;
+				found = true;
+			}
+		}
+
+		if (found)
+			m_Assignees[outTile]++;
+
+		return found;
+	}
+
+	bool TileScheduler::Complete(size_t tile)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Assignees[tile] > 0)
+			m_Assignees[tile]--;
+
+		if (m_Done[tile])
+			return false;
+
+		// Update running average of tile times
+		auto const elapsed = std::chrono::duration<double>(Clock::now() - m_DispatchTime[tile]).count();
+		m_AverageSeconds = m_Completed == 0 ? elapsed : m_AverageSeconds + (elapsed - m_AverageSeconds) / static_cast<double>(m_Completed + 1);
+
+		m_Done[tile] = true;
+		m_Completed++;
+		return true;
+	}
+
+	void TileScheduler::Release(size_t tile)
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (m_Assignees[tile] > 0)
+			m_Assignees[tile]--;
+
+		// Someone else might still deliver it
+		if (!m_Done[tile] && m_Assignees[tile] == 0)
+			m_Pending.push_front(tile);
+	}
+
+	// -- < Render Coordinator > ------------------------------------------------
+	RenderCoordinator::RenderCoordinator(const SceneDescription& description, uint16_t port, int timeoutSeconds)
+		: m_Port(port)
+		, m_TimeoutSeconds(timeoutSeconds)
+		, m_RayTracer(description)
+		, m_ColorBuffer(description.imgResX, description.imgResY)
+		, m_Scheduler(m_RayTracer.GetNumTiles())
+	{
+		SceneSerializer::Serialize(description, m_SerializedScene);
+	}
+
+	int RenderCoordinator::Draw(FIBITMAP*& outImage)
+	{
+		auto const& scene = m_RayTracer.GetSceneDescription();
+		auto image = FreeImage_Allocate(scene.imgResX, scene.imgResY, 8 * 3);
+		if (!image)
+			return FAIL;
+
+		Socket listener = Socket::Listen(m_Port);
+		if (!listener.IsValid())
+		{
+			std::cerr << "[ERROR] Could not listen for workers on port " << m_Port << std::endl;
+			FreeImage_Unload(image);
+			return FAIL;
+		}
+
+		std::cout << "Waiting for workers on port " << m_Port << "..." << std::endl;
+
+		// Accept workers for as long as there's work to do, each one is served by its own thread
+		std::vector<std::thread> workerThreads;
+		ProgressBar progressBar(m_RayTracer.GetNumTiles());
+		size_t lastCompleted = 0;
+		auto lastProgress = std::chrono::steady_clock::now();
+		{
+			RRAYS_TRACE_SCOPE("Distributed render");
+			while (!m_Scheduler.AllDone())
+			{
+				Socket socket = listener.Accept(100);
+				if (socket.IsValid())
+				{
+					std::cout << "Worker " << workerThreads.size() << " connected" << std::endl;
+					workerThreads.emplace_back(&RenderCoordinator::ServeWorker, this, std::move(socket), workerThreads.size());
+					lastProgress = std::chrono::steady_clock::now();
+				}
+
+				size_t const completed = m_Scheduler.GetCompleted();
+				if (completed != lastCompleted)
+				{
+					progressBar.SetSteps(completed);
+					progressBar.Draw();
+					lastCompleted = completed;
+					lastProgress = std::chrono::steady_clock::now();
+				}
+
+				// Nobody is left to finish the image, or nobody ever came
+				if (m_TimeoutSeconds > 0 && std::chrono::steady_clock::now() - lastProgress > std::chrono::seconds(m_TimeoutSeconds))
+				{
+					m_Aborted = true;
+					break;
+				}
+			}
+		}
+		std::cout << std::endl;
+
+		for (auto& thread : workerThreads)
+			thread.join();
+
+		if (m_Aborted)
+		{
+			std::cerr << "[ERROR] No progress from workers in " << m_TimeoutSeconds << " seconds, " << lastCompleted << " of "
+				<< m_RayTracer.GetNumTiles() << " tiles done. Giving up on distributed render" << std::endl;
+			FreeImage_Unload(image);
+			return FAIL;
+		}
+
+		RecursiveRayTracer::ConvertToImage(m_ColorBuffer, image);
+		outImage = image;
+		return SUCCESS;
+	}
+
+	void RenderCoordinator::ServeWorker(Socket socket, size_t workerId)
+	{
+		uint32_t type;
+		std::vector<uint8_t> payload;
+
+		// Handshake: learn how many tiles the worker can render at once and send it the scene
+		uint32_t workerThreads = 1;
+		if (!ReceivePacket(socket, type, payload, HELLO_TIMEOUT_MS) ||
+			type != static_cast<uint32_t>(PacketType::Hello) ||
+			payload.size() != sizeof(workerThreads))
+		{
+			std::cerr << "[ERROR] Worker " << workerId << " sent an invalid handshake" << std::endl;
+			return;
+		}
+		std::memcpy(&workerThreads, payload.data(), sizeof(workerThreads));
+
+		if (!SendPacket(socket, static_cast<uint32_t>(PacketType::Scene), m_SerializedScene.data(), static_cast<uint32_t>(m_SerializedScene.size())))
+			return;
+
+		// Keep a couple of tiles queued per worker thread so workers never starve
+		size_t const window = 2 * std::max<uint32_t>(workerThreads, 1);
+		std::set<size_t> inFlight;
+		auto lastActivity = std::chrono::steady_clock::now();
+		bool lost = false;
+
+		while (!lost)
+		{
+			if (m_Scheduler.AllDone() || m_Aborted)
+			{
+				SendPacket(socket, static_cast<uint32_t>(PacketType::Done), nullptr, 0);
+				break;
+			}
+
+			// Fill this worker's queue
+			size_t tile;
+			while (inFlight.size() < window && m_Scheduler.Acquire(inFlight, tile))
+			{
+				inFlight.insert(tile);
+				uint32_t const tileIndex = static_cast<uint32_t>(tile);
+				if (!SendPacket(socket, static_cast<uint32_t>(PacketType::Tile), &tileIndex, sizeof(tileIndex)))
+				{
+					lost = true;
+					break;
+				}
+			}
+
+			if (lost)
+				break;
+
+			if (!socket.WaitReadable(50))
+			{
+				// Nothing arrived, check if worker is hanging
+				auto const idle = std::chrono::steady_clock::now() - lastActivity;
+				if (!inFlight.empty() && idle > std::chrono::milliseconds(WORKER_TIMEOUT_MS))
+					lost = true;
+
+				continue;
+			}
+
+			if (!ReceivePacket(socket, type, payload, WORKER_TIMEOUT_MS) || type != static_cast<uint32_t>(PacketType::TileResult))
+			{
+				lost = true;
+				break;
+			}
+
+			// Unpack tile, first its index then its colors
+			uint32_t tileIndex;
+			if (payload.size() < sizeof(tileIndex))
+			{
+				lost = true;
+				break;
+			}
+			std::memcpy(&tileIndex, payload.data(), sizeof(tileIndex));
+
+			size_t startI, endI, startJ, endJ;
+			if (!inFlight.count(tileIndex))
+			{
+				lost = true; // Never asked for this one
+				break;
+			}
+			m_RayTracer.GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+
+			size_t const nPixels = (endI - startI) * (endJ - startJ);
+			if (payload.size() != sizeof(tileIndex) + nPixels * sizeof(glm::vec4))
+			{
+				lost = true;
+				break;
+			}
+
+			inFlight.erase(tileIndex);
+			lastActivity = std::chrono::steady_clock::now();
+
+			// Only the first copy of a tile is written, so no two threads write the same pixels
+			if (!m_Scheduler.Complete(tileIndex))
+				continue;
+
+			auto pixel = payload.data() + sizeof(tileIndex);
+			for (size_t i = startI; i < endI; i++)
+			{
+				for (size_t j = startJ; j < endJ; j++)
+				{
+					glm::vec4 color;
+					std::memcpy(&color, pixel, sizeof(color));
+					m_ColorBuffer.Set(i, j, color);
+					pixel += sizeof(color);
+				}
+			}
+		}
+
+		if (lost)
+		{
+			std::cerr << "Lost worker " << workerId << ", re-dispatching " << inFlight.size() << " tiles" << std::endl;
+			for (auto const lostTile : inFlight)
+				m_Scheduler.Release(lostTile);
+		}
+	}
+
+	// -- < Render Worker > -----------------------------------------------------
+	RenderWorker::RenderWorker(const std::string& host, uint16_t port, size_t nThreads)
+		: m_Host(host)
+		, m_Port(port)
+		, m_NThreads(std::max<size_t>(nThreads, 1))
+	{ }
+
+	int RenderWorker::Run()
+	{
+		std::cout << "Connecting to coordinator at " << m_Host << ":" << m_Port << "..." << std::endl;
+		Socket socket = Socket::Connect(m_Host, m_Port);
+		if (!socket.IsValid())
+		{
+			std::cerr << "[ERROR] Could not connect to coordinator" << std::endl;
+			return FAIL;
+		}
+
+		uint32_t const nThreads = static_cast<uint32_t>(m_NThreads);
+		if (!SendPacket(socket, static_cast<uint32_t>(PacketType::Hello), &nThreads, sizeof(nThreads)))
+			return FAIL;
+
+		// Receive scene and set it up once
+		uint32_t type;
+		std::vector<uint8_t> payload;
+		SceneDescription scene;
+		if (!ReceivePacket(socket, type, payload, WORKER_TIMEOUT_MS) ||
+			type != static_cast<uint32_t>(PacketType::Scene) ||
+			SceneSerializer::Deserialize(payload.data(), payload.size(), scene) != SUCCESS)
+		{
+			std::cerr << "[ERROR] Could not receive scene from coordinator" << std::endl;
+			return FAIL;
+		}
+
+		// Render requested tiles in parallel and send them back as soon as they're ready
+		thread_pool threads(m_NThreads);
+		RecursiveRayTracer rayTracer(scene);
+		rayTracer.PrepareScene(&threads);
+		TwoDimensionVector<glm::vec4> colorBuffer(scene.imgResX, scene.imgResY);
+
+		std::vector<std::future<void>> futures;
+		std::mutex sendMutex;
+		std::atomic<bool> stop = false;
+		size_t renderedTiles = 0;
+
+		auto renderTile = [&](size_t tileIndex)
+		{
+			if (stop)
+				return;
+
+			rayTracer.DrawTile(colorBuffer, tileIndex);
+
+			size_t startI, endI, startJ, endJ;
+			rayTracer.GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+
+			std::vector<uint8_t> result;
+			BinaryWriter writer(result);
+			writer.Write(static_cast<uint32_t>(tileIndex));
+			for (size_t i = startI; i < endI; i++)
+				for (size_t j = startJ; j < endJ; j++)
+					writer.Write(colorBuffer.Get(i, j));
+
+			std::lock_guard<std::mutex> lock(sendMutex);
+			if (!SendPacket(socket, static_cast<uint32_t>(PacketType::TileResult), result.data(), static_cast<uint32_t>(result.size())))
+				stop = true;
+		};
+
+		int status = SUCCESS;
+		while (!stop)
+		{
+			// Coordinator might be waiting for other workers for a long time, so wait with no timeout
+			if (!socket.WaitReadable(1000))
+				continue;
+
+			if (!ReceivePacket(socket, type, payload, WORKER_TIMEOUT_MS))
+			{
+				std::cerr << "[ERROR] Lost connection to coordinator" << std::endl;
+				status = FAIL;
+				break;
+			}
+
+			if (type == static_cast<uint32_t>(PacketType::Done))
+				break;
+
+			uint32_t tileIndex;
+			if (type != static_cast<uint32_t>(PacketType::Tile) ||
+				payload.size() != sizeof(tileIndex) ||
+				(std::memcpy(&tileIndex, payload.data(), sizeof(tileIndex)), tileIndex >= rayTracer.GetNumTiles()))
+			{
+				std::cerr << "[ERROR] Invalid request from coordinator" << std::endl;
+				status = FAIL;
+				break;
+			}
+
+			futures.push_back(threads.execute(renderTile, static_cast<size_t>(tileIndex)));
+			renderedTiles++;
+		}
+
+		// Anything still queued is not needed anymore
+		stop = true;
+		for (auto& future : futures)
+			future.get();
+
+		std::cout << "Worker finished after rendering " << renderedTiles << " tiles" << std::endl;
+		return status;
+	}
+}
@@ -0,0 +1,146 @@
+// Render a single image with many processes: a coordinator hands out tiles to workers over TCP
+#pragma once
+
+// STL includes
+#include <vector>
+#include <deque>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Local includes
+#include "RecursiveRayTracer.h"
+#include "Network.h"
+
+namespace RecRays
+{
+	// Distributed renders fail when no worker connects and no tile arrives for this long
+	constexpr int DEFAULT_COORDINATOR_TIMEOUT_SECONDS = 300;
+
+	/**
+	 * \brief Kind of packets exchanged between coordinator and workers
+	 */
+	enum class PacketType : uint32_t
+	{
+		Hello,		// worker -> coordinator: number of render threads in worker
+		Scene,		// coordinator -> worker: serialized scene description
+		Tile,		// coordinator -> worker: index of tile to render
+		TileResult,	// worker -> coordinator: tile index followed by its colors
+		Done		// coordinator -> worker: image is complete, disconnect
+	};
+
+	/**
+	 * \brief Hands out tiles to workers. Tiles lost with a dead worker go back to the queue, and once the
+	 * queue is empty, tiles taking too long are handed to idle workers too. The first copy to arrive wins.
+	 * Thread safe.
+	 */
+	class TileScheduler
+	{
+	public:
+		TileScheduler(size_t nTiles);
+
+		/**
+		 * \brief Get next tile a worker should render
+		 * \param workerTiles Tiles the worker is already rendering, so it doesn't get the same tile twice
+		 * \param outTile Tile to render
+		 * \return If there's something to render right now
+		 */
+		bool Acquire(const std::set<size_t>& workerTiles, size_t& outTile);
+
+		/**
+		 * \brief Mark a tile as rendered
+		 * \return If this is the first copy of the tile, false if someone else rendered it already
+		 */
+		bool Complete(size_t tile);
+
+		/**
+		 * \brief Give up on a tile, for example because its worker died. It's queued again if nobody else has it
+		 */
+		void Release(size_t tile);
+
+		bool AllDone() const { return m_Completed == m_Done.size(); }
+		size_t GetCompleted() const { return m_Completed; }
+
+	private:
+		using Clock = std::chrono::steady_clock;
+
+		std::mutex m_Mutex;
+		std::deque<size_t> m_Pending;
+		std::vector<bool> m_Done;
+		std::vector<uint32_t> m_Assignees; // How many workers are rendering each tile
+		std::vector<Clock::time_point> m_DispatchTime;
+		std::atomic<size_t> m_Completed = 0;
+
+		// Average time from dispatch to completion, to tell when a tile is late
+		double m_AverageSeconds = 0;
+	};
+
+	/**
+	 * \brief Renders nothing by itself: ships the scene to every worker that connects, schedules tiles
+	 * between them and assembles the returned tiles into the final image
+	 */
+	class RenderCoordinator
+	{
+	public:
+		/**
+		 * \param description Scene to render
+		 * \param port Port where workers should connect to
+		 * \param timeoutSeconds How long to wait without a worker connecting or a tile arriving before giving up on
+		 * the render, 0 to wait forever
+		 */
+		RenderCoordinator(const SceneDescription& description, uint16_t port, int timeoutSeconds = DEFAULT_COORDINATOR_TIMEOUT_SECONDS);
+
+		/**
+		 * \brief Wait for workers and render the full image with them
+		 * \param outImage Resulting image
+		 * \return Success status, 0 for success, 1 for failure. Fails if the render makes no progress for longer
+		 * than the timeout, for example because no worker ever connects
+		 */
+		int Draw(FIBITMAP*& outImage);
+
+	private:
+		/**
+		 * \brief Talk to a single worker until the image is complete or the worker is lost
+		 */
+		void ServeWorker(Socket socket, size_t workerId);
+
+	private:
+		uint16_t m_Port;
+		int m_TimeoutSeconds;
+		// Set when the render is given up, so workers are sent home
+		std::atomic<bool> m_Aborted = false;
+		// Used to share tile layout with workers
+		RecursiveRayTracer m_RayTracer;
+		std::vector<uint8_t> m_SerializedScene;
+
+		TwoDimensionVector<glm::vec4> m_ColorBuffer;
+		TileScheduler m_Scheduler;
+	};
+
+	/**
+	 * \brief Connects to a coordinator and renders every tile it asks for
+	 */
+	class RenderWorker
+	{
+	public:
+		/**
+		 * \param host Name or address of coordinator
+		 * \param port Port where coordinator is listening
+		 * \param nThreads How many tiles to render in parallel
+		 */
+		RenderWorker(const std::string& host, uint16_t port, size_t nThreads);
+
+		/**
+		 * \brief Serve the coordinator until the image is done
+		 * \return Success status, 0 for success, 1 for failure
+		 */
+		int Run();
+
+	private:
+		std::string m_Host;
+		uint16_t m_Port;
+		size_t m_NThreads;
+	};
+}
@@ -1,33 +1,177 @@
 #include "Geometry.h"
+#include "Status.h"
+#include "Trace.h"
 #include <iostream>
+#include <assert.h>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+
+// Assets converted at build time by mesh_embedder, missing until it runs. The embedder itself loads them from files
+#if !defined(RRAYS_NO_EMBEDDED_MESHES) && __has_include("EmbeddedMeshes.h")
+	#include "EmbeddedMeshes.h"
+	#define RRAYS_HAS_EMBEDDED_MESHES
+#endif
 
 namespace RecRays
 {
 	void GeometryLoader::Init()
 	{
-		LoadCubeGeometry();
-		LoadTeapotGeometry();
-		s_Initialized = true;
+		s_Threads = std::make_unique<thread_pool>(ASSET_LOADER_THREADS);
 	}
 
 	void GeometryLoader::Shutdown()
 	{
-		s_CubeGeometry = Geometry();
-		s_TeapotGeometry = Geometry();
-		s_Initialized = false;
+		for (size_t asset = 0; asset < s_NumAssets; asset++)
+		{
+			if (s_Loads[asset].valid())
+				s_Loads[asset].wait();
+			s_Loads[asset] = std::shared_future<void>();
+			s_Assets[asset] = LoadedAsset();
+		}
+
+		s_Threads.reset();
 	}
 
-	Geometry GeometryLoader::GetCubeGeometry()
+	void GeometryLoader::Request(MeshAsset asset)
 	{
-		return s_CubeGeometry;
+		auto const index = static_cast<size_t>(asset);
+		std::lock_guard<std::mutex> lock(s_LoadsMutex);
+		if (s_Loads[index].valid())
+			return;
+
+		if (s_Threads)
+			s_Loads[index] = s_Threads->execute(&GeometryLoader::Load, asset).share();
+		else
+			s_Loads[index] = std::async(std::launch::deferred, &GeometryLoader::Load, asset).share();
 	}
 
-	Geometry GeometryLoader::GetTeapotGeometry()
+	void GeometryLoader::Wait(MeshAsset asset)
 	{
-		return s_TeapotGeometry;
+		Request(asset);
+
+		std::shared_future<void> load;
+		{
+			std::lock_guard<std::mutex> lock(s_LoadsMutex);
+			load = s_Loads[static_cast<size_t>(asset)];
+		}
+		load.wait();
+	}
+
+	const Geometry& GeometryLoader::GetGeometry(MeshAsset asset)
+	{
+		Wait(asset);
+		return s_Assets[static_cast<size_t>(asset)].geometry;
+	}
+
+	const std::vector<GeometryLod>& GeometryLoader::GetLods(MeshAsset asset)
+	{
+		Wait(asset);
+		auto& loaded = s_Assets[static_cast<size_t>(asset)];
+
+		std::lock_guard<std::mutex> lock(s_LodsMutex);
+		if (!loaded.hasLods && !loaded.failed)
+		{
+			RRAYS_TRACE_SCOPE("GeometryLoader::GetLods", "asset", static_cast<int64_t>(asset));
+			if (!LoadEmbeddedLods(asset, loaded.lods))
+				loaded.lods = BuildGeometryLods(loaded.geometry);
+			loaded.hasLods = true;
+		}
+
+		return loaded.lods;
 	}
 
-	void GeometryLoader::LoadTeapotGeometry()
+	bool GeometryLoader::HasFailed(MeshAsset asset)
+	{
+		Wait(asset);
+		return s_Assets[static_cast<size_t>(asset)].failed;
+	}
+
+	void GeometryLoader::Load(MeshAsset asset)
+	{
+		RRAYS_TRACE_SCOPE("GeometryLoader::Load", "asset", static_cast<int64_t>(asset));
+		auto& loaded = s_Assets[static_cast<size_t>(asset)];
+		auto& geometry = loaded.geometry;
+		if (LoadEmbedded(asset, geometry))
+			return;
+
+		switch (asset)
+		{
+		case MeshAsset::Cube:
+			LoadCubeGeometry(geometry);
+			break;
+		case MeshAsset::Teapot:
+			if (LoadTeapotGeometry(geometry) != SUCCESS)
+			{
+				std::cerr << "[ERROR] Could not load teapot mesh, teapots are left out of scenes" << std::endl;
+				geometry = Geometry();
+				loaded.failed = true;
+			}
+			break;
+		default:
+			assert(false && "Invalid asset");
+		}
+	}
+
+#ifdef RRAYS_HAS_EMBEDDED_MESHES
+	/**
+	 * \brief Copy embedded arrays into geometry, they already have its layout
+	 */
+	static Geometry ToGeometry(const EmbeddedGeometry& embedded)
+	{
+		static_assert(sizeof(glm::vec3) == 3 * sizeof(float) && sizeof(glm::uvec3) == 3 * sizeof(uint32_t), "Embedded arrays are copied as is");
+
+		Geometry geometry;
+		geometry.vertices.resize(embedded.nVertices);
+		geometry.normals.resize(embedded.nNormals);
+		geometry.indices.resize(embedded.nTriangles);
+		if (embedded.nVertices > 0)
+			std::memcpy(static_cast<void*>(geometry.vertices.data()), embedded.vertices, embedded.nVertices * sizeof(glm::vec3));
+		if (embedded.nNormals > 0)
+			std::memcpy(static_cast<void*>(geometry.normals.data()), embedded.normals, embedded.nNormals * sizeof(glm::vec3));
+		if (embedded.nTriangles > 0)
+			std::memcpy(static_cast<void*>(geometry.indices.data()), embedded.indices, embedded.nTriangles * sizeof(glm::uvec3));
+
+		return geometry;
+	}
+#endif
+
+	bool GeometryLoader::LoadEmbedded(MeshAsset asset, Geometry& outGeometry)
+	{
+	#ifdef RRAYS_HAS_EMBEDDED_MESHES
+		auto const& mesh = EmbeddedMeshes::s_Meshes[static_cast<size_t>(asset)];
+		if (mesh.nLevels == 0)
+			return false;
+
+		outGeometry = ToGeometry(mesh.levels[0]);
+		return true;
+	#else
+		(void)asset;
+		(void)outGeometry;
+		return false;
+	#endif
+	}
+
+	bool GeometryLoader::LoadEmbeddedLods(MeshAsset asset, std::vector<GeometryLod>& outLods)
+	{
+	#ifdef RRAYS_HAS_EMBEDDED_MESHES
+		auto const& mesh = EmbeddedMeshes::s_Meshes[static_cast<size_t>(asset)];
+		if (mesh.nLevels == 0)
+			return false;
+
+		outLods.clear();
+		for (size_t level = 1; level < mesh.nLevels; level++)
+			outLods.push_back(GeometryLod{ ToGeometry(mesh.levels[level]), mesh.levels[level].error });
+
+		return true;
+	#else
+		(void)asset;
+		(void)outLods;
+		return false;
+	#endif
+	}
+
+	int GeometryLoader::LoadTeapotGeometry(Geometry& outGeometry)
 	{
 		std::vector<glm::vec3> teapotVertices;
 		std::vector<glm::vec3> teapotNormals;
@@ -44,7 +188,7 @@ namespace RecRays
 
 		if (fp == nullptr) {
 			std::cerr << "Error loading file: " << s_PathToTeapotObj<< std::endl;
-			exit(-1);
+			return FAIL;
 		}
 
 		while (!feof(fp)) {
@@ -78,6 +222,16 @@ namespace RecRays
 
 		fclose(fp); // Finished parsing
 
+		// An empty or truncated file would leave nothing to draw, or triangles pointing past the vertices
+		auto const nVertices = teapotVertices.size();
+		bool valid = !teapotIndices.empty();
+		for (auto const& triIndices : teapotIndices)
+			valid = valid && triIndices.x < nVertices && triIndices.y < nVertices && triIndices.z < nVertices;
+		if (!valid) {
+			std::cerr << "Invalid mesh file: " << s_PathToTeapotObj << std::endl;
+			return FAIL;
+		}
+
 		// Recenter the teapot
 		float avgY = (minY + maxY) / 2.0f - 0.02f;
 		float avgZ = (minZ + maxZ) / 2.0f;
@@ -86,10 +240,11 @@ namespace RecRays
 			teapotVertices[i] = shiftedVertex;
 		}
 
-		s_TeapotGeometry = Geometry{ teapotVertices, teapotNormals, teapotIndices };
+		outGeometry = Geometry{ teapotVertices, teapotNormals, teapotIndices };
+		return SUCCESS;
 	}
 
-	void GeometryLoader::LoadCubeGeometry()
+	void GeometryLoader::LoadCubeGeometry(Geometry& outGeometry)
 	{
 		std::vector<glm::vec3> cubePoints = {
 			// Front face
@@ -130,6 +285,298 @@ namespace RecRays
 			{20, 21, 22}, {20, 22, 23} // Bottom face
 		};
 
-		s_CubeGeometry = Geometry{ cubePoints, cubeNormals, cubeIndices };
+		outGeometry = Geometry{ cubePoints, cubeNormals, cubeIndices };
+	}
+
+	// -- < Bounds > ---------------------------------
+	Bounds Bounds::Transform(const glm::mat4& transform) const
+	{
+		// Transform every corner and bound them again
+		Bounds result;
+		for (int corner = 0; corner < 8; corner++)
+		{
+			glm::vec3 const point(
+				(corner & 1) ? max.x : min.x,
+				(corner & 2) ? max.y : min.y,
+				(corner & 4) ? max.z : min.z
+			);
+			result.Extend(glm::vec3(transform * glm::vec4(point, 1.f)));
+		}
+
+		return result;
+	}
+
+	// -- < Simplification > ---------------------------------
+	namespace
+	{
+		/**
+		 * \brief Mesh being simplified. Vertices are never removed, collapsed ones are just no longer referenced
+		 */
+		struct SimplificationState
+		{
+			std::vector<glm::vec3> positions;
+			std::vector<glm::vec3> normals;
+			std::vector<glm::uvec3> triangles;
+			std::vector<uint32_t> owner; // Vertex each original vertex was merged into
+		};
+
+		glm::vec3 TriangleNormal(const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3)
+		{
+			return glm::cross(v2 - v1, v3 - v1);
+		}
+
+		/**
+		 * \brief Distance from a point to the nearest point of a triangle
+		 */
+		float DistanceToTriangle(const glm::vec3& p, const glm::vec3& a, const glm::vec3& b, const glm::vec3& c)
+		{
+			// Find which feature of the triangle is nearest, using barycentric coordinates of the projected point
+			auto const ab = b - a, ac = c - a, ap = p - a;
+			float const d1 = glm::dot(ab, ap), d2 = glm::dot(ac, ap);
+			if (d1 <= 0.f && d2 <= 0.f)
+				return glm::length(p - a);
+
+			auto const bp = p - b;
+			float const d3 = glm::dot(ab, bp), d4 = glm::dot(ac, bp);
+			if (d3 >= 0.f && d4 <= d3)
+				return glm::length(p - b);
+
+			float const vc = d1 * d4 - d3 * d2;
+			if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+				return glm::length(p - (a + ab * (d1 / (d1 - d3))));
+
+			auto const cp = p - c;
+			float const d5 = glm::dot(ab, cp), d6 = glm::dot(ac, cp);
+			if (d6 >= 0.f && d5 <= d6)
+				return glm::length(p - c);
+
+			float const vb = d5 * d2 - d1 * d6;
+			if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+				return glm::length(p - (a + ac * (d2 / (d2 - d6))));
+
+			float const va = d3 * d6 - d5 * d4;
+			if (va <= 0.f && d4 - d3 >= 0.f && d5 - d6 >= 0.f)
+				return glm::length(p - (b + (c - b) * ((d4 - d3) / ((d4 - d3) + (d5 - d6)))));
+
+			// Inside the face
+			float const denominator = 1.f / (va + vb + vc);
+			return glm::length(p - (a + ab * (vb * denominator) + ac * (vc * denominator)));
+		}
+
+		/**
+		 * \brief Collapse shortest edges into their midpoint, at most one collapse per neighborhood so every
+		 * collapse sees the triangles around it unchanged. Collapses flipping a triangle are skipped
+		 * \param maxRemoved Stop once this many triangles would be removed
+		 * \return How many triangles were removed
+		 */
+		size_t CollapseEdges(SimplificationState& state, size_t maxRemoved)
+		{
+			auto const nVertices = state.positions.size();
+			auto const nTriangles = state.triangles.size();
+
+			// Triangles around each vertex, packed: triangles of v are in [firstTriangle[v], firstTriangle[v + 1])
+			std::vector<uint32_t> firstTriangle(nVertices + 1, 0);
+			for (auto const& triangle : state.triangles)
+				for (int k = 0; k < 3; k++)
+					firstTriangle[triangle[k] + 1]++;
+			std::partial_sum(firstTriangle.begin(), firstTriangle.end(), firstTriangle.begin());
+
+			std::vector<uint32_t> vertexTriangles(firstTriangle.back());
+			std::vector<uint32_t> fill(firstTriangle.begin(), firstTriangle.end() - 1);
+			for (uint32_t t = 0; t < nTriangles; t++)
+				for (int k = 0; k < 3; k++)
+					vertexTriangles[fill[state.triangles[t][k]]++] = t;
+
+			// Every edge once, shortest first
+			struct Edge
+			{
+				float length;
+				uint32_t a, b;
+			};
+
+			std::vector<Edge> edges;
+			edges.reserve(3 * nTriangles);
+			for (auto const& triangle : state.triangles)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					auto const a = std::min(triangle[k], triangle[(k + 1) % 3]);
+					auto const b = std::max(triangle[k], triangle[(k + 1) % 3]);
+					edges.push_back({ glm::length(state.positions[a] - state.positions[b]), a, b });
+				}
+			}
+
+			std::sort(edges.begin(), edges.end(), [](const Edge& x, const Edge& y)
+			{
+				return x.length < y.length || (x.length == y.length && (x.a < y.a || (x.a == y.a && x.b < y.b)));
+			});
+			edges.erase(std::unique(edges.begin(), edges.end(), [](const Edge& x, const Edge& y) { return x.a == y.a && x.b == y.b; }), edges.end());
+
+			std::vector<bool> locked(nVertices, false);
+			std::vector<uint32_t> remap(nVertices);
+			std::iota(remap.begin(), remap.end(), 0u);
+
+			size_t removed = 0;
+			for (auto const& edge : edges)
+			{
+				if (removed >= maxRemoved)
+					break;
+
+				auto const a = edge.a, b = edge.b;
+				if (locked[a] || locked[b])
+					continue;
+
+				// Check triangles that would survive the collapse keep facing the same way
+				auto const midpoint = 0.5f * (state.positions[a] + state.positions[b]);
+				bool flips = false;
+				size_t shared = 0;
+				for (auto const vertex : { a, b })
+				{
+					for (auto i = firstTriangle[vertex]; i < firstTriangle[vertex + 1] && !flips; i++)
+					{
+						auto const& triangle = state.triangles[vertexTriangles[i]];
+						bool const hasA = triangle.x == a || triangle.y == a || triangle.z == a;
+						bool const hasB = triangle.x == b || triangle.y == b || triangle.z == b;
+						if (hasA && hasB)
+						{
+							// Visited from both ends
+							shared += vertex == a ? 1 : 0;
+							continue;
+						}
+
+						glm::vec3 before[3], after[3];
+						for (int k = 0; k < 3; k++)
+						{
+							before[k] = state.positions[triangle[k]];
+							after[k] = triangle[k] == vertex ? midpoint : before[k];
+						}
+
+						flips = glm::dot(TriangleNormal(before[0], before[1], before[2]), TriangleNormal(after[0], after[1], after[2])) <= 0.f;
+					}
+				}
+
+				if (flips)
+					continue;
+
+				// Merge b into a
+				auto const normal = state.normals[a] + state.normals[b];
+				state.positions[a] = midpoint;
+				state.normals[a] = glm::length(normal) > 0.f ? glm::normalize(normal) : state.normals[a];
+				remap[b] = a;
+				removed += shared;
+
+				// Nothing else around here can change until next round
+				for (auto const vertex : { a, b })
+					for (auto i = firstTriangle[vertex]; i < firstTriangle[vertex + 1]; i++)
+						for (int k = 0; k < 3; k++)
+							locked[state.triangles[vertexTriangles[i]][k]] = true;
+			}
+
+			// Rewrite triangles, dropping the ones that collapsed into a line
+			std::vector<glm::uvec3> triangles;
+			triangles.reserve(nTriangles);
+			for (auto const& triangle : state.triangles)
+			{
+				glm::uvec3 const remapped(remap[triangle.x], remap[triangle.y], remap[triangle.z]);
+				if (remapped.x != remapped.y && remapped.y != remapped.z && remapped.z != remapped.x)
+					triangles.push_back(remapped);
+			}
+
+			for (auto& vertex : state.owner)
+				vertex = remap[vertex];
+
+			removed = nTriangles - triangles.size();
+			state.triangles = std::move(triangles);
+			return removed;
+		}
+
+		/**
+		 * \brief Copy current state of simplification as standalone geometry, keeping only referenced vertices
+		 * \param original Positions of vertices of the original geometry, to measure error
+		 */
+		GeometryLod ExtractLod(const SimplificationState& state, const std::vector<glm::vec3>& original)
+		{
+			GeometryLod lod;
+			lod.error = 0;
+
+			// Error is how far original vertices are from the simplified surface around the vertex they were merged into
+			std::vector<float> distance(state.positions.size(), INFINITY);
+			std::vector<std::vector<uint32_t>> merged(state.positions.size());
+			for (uint32_t vertex = 0; vertex < original.size(); vertex++)
+				merged[state.owner[vertex]].push_back(vertex);
+
+			for (auto const& triangle : state.triangles)
+			{
+				auto const& a = state.positions[triangle.x];
+				auto const& b = state.positions[triangle.y];
+				auto const& c = state.positions[triangle.z];
+				for (int k = 0; k < 3; k++)
+					for (auto const vertex : merged[triangle[k]])
+						distance[vertex] = std::min(distance[vertex], DistanceToTriangle(original[vertex], a, b, c));
+			}
+
+			std::vector<uint32_t> newIndex(state.positions.size(), UINT32_MAX);
+			for (auto const& triangle : state.triangles)
+			{
+				glm::uvec3 indices;
+				for (int k = 0; k < 3; k++)
+				{
+					auto const vertex = triangle[k];
+					if (newIndex[vertex] == UINT32_MAX)
+					{
+						newIndex[vertex] = static_cast<uint32_t>(lod.geometry.vertices.size());
+						lod.geometry.vertices.push_back(state.positions[vertex]);
+						lod.geometry.normals.push_back(state.normals[vertex]);
+					}
+					indices[k] = newIndex[vertex];
+				}
+				lod.geometry.indices.push_back(indices);
+			}
+
+			// Vertices merged into one with no triangles left were part of something that collapsed completely,
+			// use how far they moved instead
+			for (uint32_t vertex = 0; vertex < original.size(); vertex++)
+			{
+				if (distance[vertex] == INFINITY)
+					distance[vertex] = glm::length(original[vertex] - state.positions[state.owner[vertex]]);
+				lod.error = std::max(lod.error, distance[vertex]);
+			}
+
+			return lod;
+		}
+	}
+
+	std::vector<GeometryLod> BuildGeometryLods(const Geometry& geometry)
+	{
+		std::vector<GeometryLod> lods;
+
+		// Normals are stored per vertex, meshes without them can't be simplified this way
+		if (geometry.normals.size() != geometry.vertices.size())
+			return lods;
+
+		SimplificationState state;
+		state.positions = geometry.vertices;
+		state.normals = geometry.normals;
+		state.triangles = geometry.indices;
+		state.owner.resize(geometry.vertices.size());
+		std::iota(state.owner.begin(), state.owner.end(), 0u);
+
+		while (lods.size() < LOD_MAX_LEVELS && state.triangles.size() / 2 >= LOD_MIN_TRIANGLES)
+		{
+			// Keep collapsing until this level has half the triangles of the previous one
+			auto const target = state.triangles.size() / 2;
+			while (state.triangles.size() > target)
+			{
+				if (CollapseEdges(state, state.triangles.size() - target) == 0)
+					break;
+			}
+
+			if (state.triangles.size() > target)
+				break; // Stuck, every remaining collapse would flip something
+
+			lods.push_back(ExtractLod(state, geometry.vertices));
+		}
+
+		return lods;
 	}
 }
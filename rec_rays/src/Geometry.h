@@ -3,9 +3,15 @@
 
 // STL includes
 #include <vector>
+#include <array>
+#include <future>
+#include <mutex>
+#include <memory>
+#include <cmath>
 
 // Third party includes
 #include <glm/glm.hpp>
+#include <threadpool.h>
 
 namespace RecRays
 {
@@ -16,32 +22,214 @@ namespace RecRays
 		std::vector<glm::uvec3> indices;
 	};
 
+	// Simplification stops once a level of detail has less triangles than this
+	constexpr size_t LOD_MIN_TRIANGLES = 32;
+	// Max levels of detail generated for a single mesh
+	constexpr size_t LOD_MAX_LEVELS = 8;
+
+	/**
+	 * \brief Simplified version of some geometry
+	 */
+	struct GeometryLod
+	{
+		Geometry geometry;
+		float error; // Max distance from a vertex of the original geometry to the simplified surface, as measured by ExtractLod
+	};
+
+	/**
+	 * \brief Build coarser versions of some geometry by collapsing its shortest edges, each one with about half
+	 * the triangles of the previous one
+	 * \param geometry Geometry to simplify
+	 * \return Levels of detail from finest to coarsest, not including the original geometry. Might be empty
+	 * if geometry is already too small or can't be simplified
+	 */
+	std::vector<GeometryLod> BuildGeometryLods(const Geometry& geometry);
+
+	/**
+	 * \brief Axis aligned bounding box
+	 */
+	struct Bounds
+	{
+		glm::vec3 min = glm::vec3(INFINITY);
+		glm::vec3 max = glm::vec3(-INFINITY);
+
+		void Extend(const glm::vec3& point)
+		{
+			min = glm::min(min, point);
+			max = glm::max(max, point);
+		}
+
+		void Extend(const Bounds& other)
+		{
+			min = glm::min(min, other.min);
+			max = glm::max(max, other.max);
+		}
+
+		bool IsEmpty() const { return min.x > max.x || min.y > max.y || min.z > max.z; }
+
+		glm::vec3 Center() const { return 0.5f * (min + max); }
+
+		/**
+		 * \brief Surface area of box, 0 if empty
+		 */
+		float SurfaceArea() const
+		{
+			if (IsEmpty())
+				return 0;
+
+			auto const extent = max - min;
+			return 2.f * (extent.x * extent.y + extent.y * extent.z + extent.z * extent.x);
+		}
+
+		/**
+		 * \brief If both boxes share some point, touching faces included
+		 */
+		bool Overlaps(const Bounds& other) const
+		{
+			return min.x <= other.max.x && min.y <= other.max.y && min.z <= other.max.z &&
+				other.min.x <= max.x && other.min.y <= max.y && other.min.z <= max.z;
+		}
+
+		/**
+		 * \brief If other box is completely inside this one
+		 */
+		bool Contains(const Bounds& other) const
+		{
+			return min.x <= other.min.x && min.y <= other.min.y && min.z <= other.min.z &&
+				other.max.x <= max.x && other.max.y <= max.y && other.max.z <= max.z;
+		}
+
+		/**
+		 * \brief Bounds of this box after being transformed
+		 */
+		Bounds Transform(const glm::mat4& transform) const;
+	};
+
+	// Threads loading assets in the background
+	constexpr size_t ASSET_LOADER_THREADS = 2;
+
+	/**
+	 * \brief Meshes the loader knows about
+	 */
+	enum class MeshAsset
+	{
+		Cube,
+		Teapot,
+		Count
+	};
+
+	/**
+	 * \brief Geometry written into the binary as plain arrays by mesh_embedder, laid out exactly like Geometry
+	 */
+	struct EmbeddedGeometry
+	{
+		const float* vertices;		// x, y, z of each vertex
+		size_t nVertices;
+		const float* normals;		// x, y, z of each normal
+		size_t nNormals;
+		const uint32_t* indices;	// Three vertices per triangle
+		size_t nTriangles;
+		float error;				// Simplification error of a level of detail, 0 for the original geometry
+	};
+
+	/**
+	 * \brief Embedded asset: its original geometry followed by its levels of detail, finest first. No levels if
+	 * the asset was not embedded
+	 */
+	struct EmbeddedMesh
+	{
+		const EmbeddedGeometry* levels;
+		size_t nLevels;
+	};
+
 	/**
-	 * \brief Load geometry from the start for common shapes and query it whenever it's necessary
+	 * \brief Load geometry of common shapes on demand. Assets are loaded in the background once first requested,
+	 * so the scene can keep being parsed meanwhile and different assets load in parallel.
+	 * Builds that ran mesh_embedder have assets and their levels of detail compiled in, those are copied without
+	 * touching the disk. Assets are read from files otherwise
 	 */
 	class GeometryLoader
 	{
 	public:
 		/**
-		 * \brief Initialize static class. Load geometry for available objects and store it in static mem
+		 * \brief Initialize static class. Starts loader threads, nothing is loaded until it's requested
 		 */
 		static void Init();
 
 		/**
-		 * \brief Destroys stored geometry
+		 * \brief Waits for pending loads and destroys stored geometry
 		 */
 		static void Shutdown();
 
-		static Geometry GetCubeGeometry();
-		static Geometry GetTeapotGeometry();
+		/**
+		 * \brief Start loading an asset in the background, unless it's loaded or loading already. Returns immediately.
+		 * Without loader threads the asset is loaded once it's first queried instead
+		 */
+		static void Request(MeshAsset asset);
+
+		/**
+		 * \brief Geometry of an asset, requesting it and waiting for it if necessary
+		 * \return Geometry of the asset, empty if it could not be loaded
+		 */
+		static const Geometry& GetGeometry(MeshAsset asset);
+
+		/**
+		 * \brief Simplified versions of an asset, from finest to coarsest. Built, or copied from the binary, the
+		 * first time they are asked for, so scenes not using levels of detail never pay for them
+		 */
+		static const std::vector<GeometryLod>& GetLods(MeshAsset asset);
+
+		/**
+		 * \brief If an asset could not be loaded, requesting it and waiting for it if necessary. Its geometry is
+		 * empty then, and objects using it should be left out of scenes
+		 */
+		static bool HasFailed(MeshAsset asset);
+
+		static const Geometry& GetCubeGeometry() { return GetGeometry(MeshAsset::Cube); }
+		static const Geometry& GetTeapotGeometry() { return GetGeometry(MeshAsset::Teapot); }
+		static const std::vector<GeometryLod>& GetCubeLods() { return GetLods(MeshAsset::Cube); }
+		static const std::vector<GeometryLod>& GetTeapotLods() { return GetLods(MeshAsset::Teapot); }
 
 	private:
-		static void LoadTeapotGeometry();
-		static void LoadCubeGeometry();
+		struct LoadedAsset
+		{
+			Geometry geometry;
+			std::vector<GeometryLod> lods;
+			bool hasLods; // If lods were already set up by GetLods. False in value initialized assets
+			bool failed; // If the asset could not be loaded. False in value initialized assets
+		};
+
+		/**
+		 * \brief Load an asset. Runs in a loader thread
+		 */
+		static void Load(MeshAsset asset);
+
+		/**
+		 * \brief Copy an asset from the binary
+		 * \return If asset was embedded at build time
+		 */
+		static bool LoadEmbedded(MeshAsset asset, Geometry& outGeometry);
+
+		/**
+		 * \brief Copy levels of detail of an asset from the binary
+		 * \return If asset was embedded at build time
+		 */
+		static bool LoadEmbeddedLods(MeshAsset asset, std::vector<GeometryLod>& outLods);
+
+		/**
+		 * \brief Wait until an asset is loaded, requesting it first if necessary
+		 */
+		static void Wait(MeshAsset asset);
+
+		static int LoadTeapotGeometry(Geometry& outGeometry);
+		static void LoadCubeGeometry(Geometry& outGeometry);
 	private:
-		inline static Geometry s_CubeGeometry;
-		inline static Geometry s_TeapotGeometry;
-		inline static bool s_Initialized = false;
+		static constexpr size_t s_NumAssets = static_cast<size_t>(MeshAsset::Count);
+		inline static std::array<LoadedAsset, s_NumAssets> s_Assets;
+		inline static std::array<std::shared_future<void>, s_NumAssets> s_Loads;
+		inline static std::mutex s_LoadsMutex;
+		inline static std::mutex s_LodsMutex;
+		inline static std::unique_ptr<thread_pool> s_Threads;
 		static constexpr char* s_PathToTeapotObj = "models/teapot.obj";
 		static constexpr char* s_PathToCubeObj = "models/cube.obj";
 	};
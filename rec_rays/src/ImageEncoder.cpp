@@ -0,0 +1,296 @@
+// Local includes
+#include "ImageEncoder.h"
+#include "Status.h"
+#include "Trace.h"
+
+// STL includes
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <assert.h>
+
+// Third party includes
+#include <zlib.h>
+
+namespace RecRays
+{
+	constexpr size_t PNG_BYTES_PER_PIXEL = 3;
+
+	// Filter types of PNG rows
+	enum PngFilter : uint8_t
+	{
+		PNG_FILTER_NONE = 0,
+		PNG_FILTER_SUB,
+		PNG_FILTER_UP,
+		PNG_FILTER_AVERAGE,
+		PNG_FILTER_PAETH,
+		PNG_FILTER_COUNT
+	};
+
+	static uint8_t PaethPredictor(int left, int up, int upLeft)
+	{
+		int const estimate = left + up - upLeft;
+		int const toLeft = std::abs(estimate - left);
+		int const toUp = std::abs(estimate - up);
+		int const toUpLeft = std::abs(estimate - upLeft);
+		if (toLeft <= toUp && toLeft <= toUpLeft)
+			return static_cast<uint8_t>(left);
+
+		return static_cast<uint8_t>(toUp <= toUpLeft ? up : upLeft);
+	}
+
+	/**
+	 * \brief Filter a row of pixels
+	 * \param row Pixels of row
+	 * \param previous Pixels of row above, nullptr if it shouldn't be used
+	 * \param outFiltered Where to write filtered bytes, same size as the row
+	 */
+	static void FilterRow(PngFilter filter, const uint8_t* row, const uint8_t* previous, size_t size, uint8_t* outFiltered)
+	{
+		for (size_t i = 0; i < size; i++)
+		{
+			int const left = i >= PNG_BYTES_PER_PIXEL ? row[i - PNG_BYTES_PER_PIXEL] : 0;
+			int const up = previous ? previous[i] : 0;
+			int const upLeft = previous && i >= PNG_BYTES_PER_PIXEL ? previous[i - PNG_BYTES_PER_PIXEL] : 0;
+
+			int prediction = 0;
+			switch (filter)
+			{
+			case PNG_FILTER_SUB: prediction = left; break;
+			case PNG_FILTER_UP: prediction = up; break;
+			case PNG_FILTER_AVERAGE: prediction = (left + up) / 2; break;
+			case PNG_FILTER_PAETH: prediction = PaethPredictor(left, up, upLeft); break;
+			default: break;
+			}
+
+			outFiltered[i] = static_cast<uint8_t>(row[i] - prediction);
+		}
+	}
+
+	static void WriteBigEndian(std::vector<uint8_t>& outData, uint32_t value)
+	{
+		for (int shift = 24; shift >= 0; shift -= 8)
+			outData.push_back(static_cast<uint8_t>(value >> shift));
+	}
+
+	static void WriteChunk(std::ofstream& file, const char* type, const uint8_t* data, size_t size)
+	{
+		std::vector<uint8_t> header;
+		WriteBigEndian(header, static_cast<uint32_t>(size));
+		header.insert(header.end(), type, type + 4);
+
+		// crc32 with no data restarts the checksum instead
+		uLong crc = crc32(0, header.data() + 4, 4);
+		if (size > 0)
+			crc = crc32(crc, data, static_cast<uInt>(size));
+		std::vector<uint8_t> footer;
+		WriteBigEndian(footer, static_cast<uint32_t>(crc));
+
+		file.write(reinterpret_cast<const char*>(header.data()), header.size());
+		file.write(reinterpret_cast<const char*>(data), static_cast<std::streamsize>(size));
+		file.write(reinterpret_cast<const char*>(footer.data()), footer.size());
+	}
+
+	PngEncoder::PngEncoder(size_t nThreads)
+		: m_Threads(nThreads)
+	{ }
+
+	PngEncoder::~PngEncoder()
+	{
+		// Pieces reference the image and this encoder, nothing can go away while they are in flight
+		for (auto& piece : m_Pieces)
+			piece.wait();
+
+		if (m_Result.valid())
+			m_Result.wait();
+	}
+
+	void PngEncoder::Start(FIBITMAP* image)
+	{
+		assert(FreeImage_GetBPP(image) == 8 * PNG_BYTES_PER_PIXEL && "Only 24 bit images can be encoded");
+		assert(m_Pieces.empty() && !m_Result.valid() && "Previous image is not done");
+
+		m_Image = image;
+		m_Width = FreeImage_GetWidth(image);
+		m_Height = FreeImage_GetHeight(image);
+		m_Scheduled.assign(m_Height, false);
+	}
+
+	void PngEncoder::EncodeScanLines(size_t firstScanLine, size_t endScanLine)
+	{
+		// Scanlines go from the bottom up, PNG rows from the top down
+		endScanLine = std::min(endScanLine, m_Height);
+		if (firstScanLine < endScanLine)
+			Schedule(m_Height - endScanLine, m_Height - firstScanLine);
+	}
+
+	void PngEncoder::Finish(const std::string& filepath)
+	{
+		Schedule(0, m_Height);
+		m_Result = std::async(std::launch::async, &PngEncoder::Write, this, filepath);
+	}
+
+	int PngEncoder::Wait()
+	{
+		if (!m_Result.valid())
+			return FAIL;
+
+		int const status = m_Result.get();
+		m_Pieces.clear();
+		m_Image = nullptr;
+		return status;
+	}
+
+	void PngEncoder::Schedule(size_t firstRow, size_t endRow)
+	{
+		size_t row = firstRow;
+		while (row < endRow)
+		{
+			if (m_Scheduled[row])
+			{
+				row++;
+				continue;
+			}
+
+			// Longest run of rows not scheduled so far, up to the size of a piece
+			size_t pieceEnd = row;
+			while (pieceEnd < endRow && pieceEnd - row < PNG_PIECE_ROWS && !m_Scheduled[pieceEnd])
+				m_Scheduled[pieceEnd++] = true;
+
+			m_Pieces.push_back(m_Threads.execute(&PngEncoder::Compress, this, row, pieceEnd));
+			row = pieceEnd;
+		}
+	}
+
+	PngEncoder::Piece PngEncoder::Compress(size_t firstRow, size_t endRow) const
+	{
+		RRAYS_TRACE_SCOPE("Compress PNG rows", "row", static_cast<int64_t>(firstRow));
+		size_t const rowSize = m_Width * PNG_BYTES_PER_PIXEL;
+
+		// Every row is stored as its filter type followed by filtered bytes
+		std::vector<uint8_t> filtered((endRow - firstRow) * (rowSize + 1));
+		std::vector<uint8_t> row(rowSize), previous(rowSize), candidate(rowSize);
+		for (size_t r = firstRow; r < endRow; r++)
+		{
+			// FreeImage stores pixels in BGR order on little endian machines
+			const BYTE* scanLine = FreeImage_GetScanLine(m_Image, static_cast<int>(RowToScanLine(r, m_Height)));
+			for (size_t x = 0; x < m_Width; x++)
+			{
+				row[x * 3 + 0] = scanLine[x * 3 + FI_RGBA_RED];
+				row[x * 3 + 1] = scanLine[x * 3 + FI_RGBA_GREEN];
+				row[x * 3 + 2] = scanLine[x * 3 + FI_RGBA_BLUE];
+			}
+
+			// Rows above this piece might not be done yet, so the first row can't be predicted from them.
+			// Otherwise keep the filter with the smallest sum of signed residuals, as libpng does
+			bool const hasPrevious = r > firstRow;
+			uint8_t* const out = &filtered[(r - firstRow) * (rowSize + 1)];
+			uint64_t bestCost = UINT64_MAX;
+			for (uint8_t filter = PNG_FILTER_NONE; filter < (hasPrevious ? PNG_FILTER_COUNT : PNG_FILTER_UP); filter++)
+			{
+				FilterRow(static_cast<PngFilter>(filter), row.data(), hasPrevious ? previous.data() : nullptr, rowSize, candidate.data());
+
+				uint64_t cost = 0;
+				for (auto const value : candidate)
+					cost += static_cast<uint64_t>(std::abs(static_cast<int8_t>(value)));
+
+				if (cost < bestCost)
+				{
+					bestCost = cost;
+					out[0] = filter;
+					std::copy(candidate.begin(), candidate.end(), out + 1);
+				}
+			}
+
+			std::swap(row, previous);
+		}
+
+		Piece piece;
+		piece.firstRow = firstRow;
+		piece.endRow = endRow;
+		piece.filteredSize = filtered.size();
+		piece.adler = static_cast<uint32_t>(adler32(adler32(0, nullptr, 0), filtered.data(), static_cast<uInt>(filtered.size())));
+
+		// Raw deflate, the zlib header and checksum of the whole stream are added around the pieces. Pieces other
+		// than the last one are flushed to a byte boundary without marking their last block as final
+		z_stream stream = {};
+		if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+		{
+			piece.status = FAIL;
+			return piece;
+		}
+
+		bool const isLast = endRow == m_Height;
+
+		if (firstRow == 0)
+			piece.data = { 0x78, 0x9C };
+
+		size_t const headerSize = piece.data.size();
+		piece.data.resize(headerSize + deflateBound(&stream, static_cast<uLong>(filtered.size())) + 16);
+		stream.next_in = filtered.data();
+		stream.avail_in = static_cast<uInt>(filtered.size());
+		stream.next_out = piece.data.data() + headerSize;
+		stream.avail_out = static_cast<uInt>(piece.data.size() - headerSize);
+		// Output has room for the whole piece, so a single call consumes every row
+		int const result = deflate(&stream, isLast ? Z_FINISH : Z_SYNC_FLUSH);
+		if (result != (isLast ? Z_STREAM_END : Z_OK) || stream.avail_in != 0)
+			piece.status = FAIL;
+
+		piece.data.resize(headerSize + stream.total_out);
+		deflateEnd(&stream);
+
+		return piece;
+	}
+
+	int PngEncoder::Write(const std::string& filepath)
+	{
+		RRAYS_TRACE_SCOPE("Write PNG");
+		std::vector<Piece> pieces;
+		pieces.reserve(m_Pieces.size());
+		for (auto& piece : m_Pieces)
+			pieces.push_back(piece.get());
+
+		std::sort(pieces.begin(), pieces.end(), [](const Piece& a, const Piece& b) { return a.firstRow < b.firstRow; });
+
+		for (auto const& piece : pieces)
+		{
+			if (piece.status != SUCCESS)
+			{
+				std::cerr << "Could not compress rows " << piece.firstRow << " to " << piece.endRow << " of " << filepath << std::endl;
+				return FAIL;
+			}
+		}
+
+		// Checksum of the whole stream goes after the last piece
+		uLong adler = adler32(0, nullptr, 0);
+		for (auto const& piece : pieces)
+			adler = adler32_combine(adler, piece.adler, static_cast<z_off_t>(piece.filteredSize));
+
+		if (!pieces.empty())
+			WriteBigEndian(pieces.back().data, static_cast<uint32_t>(adler));
+
+		std::ofstream file(filepath, std::ios::binary);
+		if (!file)
+		{
+			std::cerr << "Could not open " << filepath << " for writing" << std::endl;
+			return FAIL;
+		}
+
+		static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+		file.write(reinterpret_cast<const char*>(signature), sizeof(signature));
+
+		// 8 bits per channel, RGB, no interlacing
+		std::vector<uint8_t> header;
+		WriteBigEndian(header, static_cast<uint32_t>(m_Width));
+		WriteBigEndian(header, static_cast<uint32_t>(m_Height));
+		header.insert(header.end(), { 8, 2, 0, 0, 0 });
+		WriteChunk(file, "IHDR", header.data(), header.size());
+
+		for (auto const& piece : pieces)
+			WriteChunk(file, "IDAT", piece.data.data(), piece.data.size());
+
+		WriteChunk(file, "IEND", nullptr, 0);
+		return file ? SUCCESS : FAIL;
+	}
+}
@@ -0,0 +1,110 @@
+// Output images: PNG encoding in the background, compressing parts of the image in parallel as they are finished
+#pragma once
+
+// STL includes
+#include <vector>
+#include <string>
+#include <future>
+#include <cstdint>
+
+// Third party includes
+#include <FreeImage.h>
+#include <threadpool.h>
+
+// Local includes
+#include "Status.h"
+
+namespace RecRays
+{
+	// Max rows of the image compressed as a single piece
+	constexpr size_t PNG_PIECE_ROWS = 32;
+	// Threads compressing pieces of the image, they run alongside render threads
+	constexpr size_t PNG_ENCODER_THREADS = 4;
+
+	/**
+	 * \brief FreeImage scanline holding a row of pixels of an image, and the other way around. Rows go from the top
+	 * down, like pixels of the color buffer and rows of PNG files, while FreeImage stores scanlines from the bottom up
+	 * \param row Row of pixels, 0 is the top one
+	 * \param height Rows in the image
+	 */
+	inline size_t RowToScanLine(size_t row, size_t height) { return height - 1 - row; }
+
+	/**
+	 * \brief Writes an 8 bit RGB image as PNG without blocking the caller. Rows are handed over as soon as they are
+	 * final, and compressed in parallel while the rest of the image is still being rendered. Each piece of rows is
+	 * filtered and deflated independently, so pieces can be done in any order: filters never look at rows of
+	 * another piece, and compressed pieces end at byte boundaries so they can be concatenated into a single stream.
+	 * The stream checksum is combined from the checksums of every piece
+	 */
+	class PngEncoder
+	{
+	public:
+		PngEncoder(size_t nThreads = PNG_ENCODER_THREADS);
+		~PngEncoder();
+
+		/**
+		 * \brief Start encoding a new image. Previous image should be done already
+		 * \param image 24 bit image to encode, should stay alive until Wait returns
+		 */
+		void Start(FIBITMAP* image);
+
+		/**
+		 * \brief Compress some rows of the image in the background. They shouldn't change from now on.
+		 * Rows already handed over are skipped
+		 * \param firstScanLine First FreeImage scanline, scanlines are counted from the bottom of the image
+		 * \param endScanLine One past last scanline
+		 */
+		void EncodeScanLines(size_t firstScanLine, size_t endScanLine);
+
+		/**
+		 * \brief Compress the rows not handed over so far and write the file in the background. Returns immediately
+		 * \param filepath Where to write the PNG
+		 */
+		void Finish(const std::string& filepath);
+
+		/**
+		 * \brief Wait until the file is written
+		 * \return Success status
+		 */
+		int Wait();
+
+	private:
+		/**
+		 * \brief Rows of the image filtered and deflated on their own
+		 */
+		struct Piece
+		{
+			size_t firstRow, endRow;	// Rows of the PNG, counted from the top
+			std::vector<uint8_t> data;	// Deflated rows, with the stream header if it's the first piece
+			uint32_t adler;				// Checksum of filtered rows
+			size_t filteredSize;		// Size of filtered rows
+			int status = SUCCESS;		// FAIL if zlib couldn't deflate the rows, data is unusable then
+		};
+
+		/**
+		 * \brief Schedule compression of rows in [firstRow, endRow) not yet scheduled, in pieces of at most PNG_PIECE_ROWS
+		 */
+		void Schedule(size_t firstRow, size_t endRow);
+
+		/**
+		 * \brief Filter and deflate a piece of the image
+		 */
+		Piece Compress(size_t firstRow, size_t endRow) const;
+
+		/**
+		 * \brief Wait for every piece and write them to a file
+		 * \return Success status
+		 */
+		int Write(const std::string& filepath);
+
+	private:
+		FIBITMAP* m_Image = nullptr;
+		size_t m_Width = 0, m_Height = 0;
+		// Which rows are already scheduled
+		std::vector<bool> m_Scheduled;
+		std::vector<std::future<Piece>> m_Pieces;
+		// Status of writing the file, valid after Finish
+		std::future<int> m_Result;
+		thread_pool m_Threads;
+	};
+}
@@ -0,0 +1,282 @@
+// Local includes
+#include "Incremental.h"
+#include "RecursiveRayTracer.h"
+#include "SceneSerializer.h"
+#include "Status.h"
+
+// STL includes
+#include <fstream>
+#include <iterator>
+#include <algorithm>
+
+#ifdef RRAYS_PLATFORM_WINDOWS
+	#include <intrin.h>
+#endif
+
+namespace RecRays
+{
+	static_assert(MAX_LIGHTS <= 64, "Light dependencies are stored as a 64 bit mask");
+
+	// -- < Tile dependencies > ---------------------------------
+	void TileDependencies::Reset()
+	{
+		objects.clear();
+		lights = 0;
+		shadowedLights = 0;
+		rayBounds = Bounds();
+		raysEscape = false;
+	}
+
+	bool TileDependencies::HasObject(uint32_t object) const
+	{
+		return std::binary_search(objects.begin(), objects.end(), object);
+	}
+
+	// -- < Tile object recorder > ---------------------------------
+	/**
+	 * \brief Index of the lowest set bit, bits should not be 0
+	 */
+	static size_t CountTrailingZeros(uint64_t bits)
+	{
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		unsigned long index;
+		_BitScanForward64(&index, bits);
+		return index;
+	#else
+		return static_cast<size_t>(__builtin_ctzll(bits));
+	#endif
+	}
+
+	void TileObjectRecorder::Begin(size_t nObjects)
+	{
+		// Bits are always cleared by End, so only a new size needs new memory
+		size_t const nWords = (nObjects + 63) / 64;
+		if (m_Bits.size() != nWords)
+		{
+			m_Bits.assign(nWords, 0);
+			m_UsedWords.assign((nWords + 63) / 64, 0);
+		}
+	}
+
+	void TileObjectRecorder::End(std::vector<uint32_t>& outObjects)
+	{
+		outObjects.clear();
+		for (size_t usedIndex = 0; usedIndex < m_UsedWords.size(); usedIndex++)
+		{
+			for (uint64_t used = m_UsedWords[usedIndex]; used != 0; used &= used - 1)
+			{
+				size_t const wordIndex = usedIndex * 64 + CountTrailingZeros(used);
+				for (uint64_t bits = m_Bits[wordIndex]; bits != 0; bits &= bits - 1)
+					outObjects.push_back(static_cast<uint32_t>(wordIndex * 64 + CountTrailingZeros(bits)));
+
+				m_Bits[wordIndex] = 0;
+			}
+
+			m_UsedWords[usedIndex] = 0;
+		}
+	}
+
+	// -- < Render state files > ---------------------------------
+	constexpr uint32_t RENDER_STATE_MAGIC = 0x54535252; // "RRST"
+	constexpr uint32_t RENDER_STATE_VERSION = 3;
+
+	int SaveRenderState(const std::string& filepath, const RenderState& state)
+	{
+		std::vector<uint8_t> data;
+		BinaryWriter writer(data);
+		writer.Write(RENDER_STATE_MAGIC);
+		writer.Write(RENDER_STATE_VERSION);
+
+		writer.Write(static_cast<uint64_t>(state.scene.size()));
+		writer.WriteBytes(state.scene.data(), state.scene.size());
+		writer.Write(state.sceneBounds);
+		writer.Write(state.tileSize);
+
+		writer.Write(static_cast<uint64_t>(state.tiles.size()));
+		for (auto const& tile : state.tiles)
+		{
+			writer.Write(static_cast<uint32_t>(tile.objects.size()));
+			writer.WriteBytes(tile.objects.data(), tile.objects.size() * sizeof(uint32_t));
+			writer.Write(tile.lights);
+			writer.Write(tile.shadowedLights);
+			writer.Write(tile.rayBounds);
+			writer.Write(static_cast<uint8_t>(tile.raysEscape));
+		}
+
+		writer.Write(static_cast<uint64_t>(state.colors.size()));
+		writer.WriteBytes(state.colors.data(), state.colors.size() * sizeof(glm::vec4));
+
+		std::ofstream file(filepath, std::ios::binary);
+		if (!file)
+			return FAIL;
+
+		file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+		return file ? SUCCESS : FAIL;
+	}
+
+	int LoadRenderState(const std::string& filepath, RenderState& outState)
+	{
+		std::ifstream file(filepath, std::ios::binary);
+		if (!file)
+			return FAIL;
+
+		std::vector<uint8_t> const data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		BinaryReader reader(data.data(), data.size());
+		RenderState state;
+
+		// Sizes are checked against what's left before allocating, so a corrupt file can't ask for huge buffers
+		auto const fits = [&reader](uint64_t count, size_t elementSize)
+		{
+			return count <= (reader.GetSize() - reader.GetPosition()) / elementSize;
+		};
+
+		uint32_t magic, version;
+		uint64_t sceneSize;
+		if (!reader.Read(magic) || magic != RENDER_STATE_MAGIC || !reader.Read(version) || version != RENDER_STATE_VERSION)
+			return FAIL;
+
+		if (!reader.Read(sceneSize) || !fits(sceneSize, 1))
+			return FAIL;
+
+		state.scene.resize(static_cast<size_t>(sceneSize));
+		uint64_t nTiles;
+		if (!reader.ReadBytes(state.scene.data(), state.scene.size()) || !reader.Read(state.sceneBounds) || !reader.Read(state.tileSize) || !reader.Read(nTiles) || !fits(nTiles, sizeof(uint32_t)))
+			return FAIL;
+
+		state.tiles.resize(static_cast<size_t>(nTiles));
+		for (auto& tile : state.tiles)
+		{
+			uint32_t nObjects;
+			uint8_t raysEscape;
+			if (!reader.Read(nObjects) || !fits(nObjects, sizeof(uint32_t)))
+				return FAIL;
+
+			tile.objects.resize(nObjects);
+			bool const ok = reader.ReadBytes(tile.objects.data(), nObjects * sizeof(uint32_t)) &&
+				reader.Read(tile.lights) &&
+				reader.Read(tile.shadowedLights) &&
+				reader.Read(tile.rayBounds) &&
+				reader.Read(raysEscape);
+
+			if (!ok || !std::is_sorted(tile.objects.begin(), tile.objects.end()))
+				return FAIL;
+
+			tile.raysEscape = raysEscape != 0;
+		}
+
+		uint64_t nColors;
+		if (!reader.Read(nColors) || !fits(nColors, sizeof(glm::vec4)))
+			return FAIL;
+
+		state.colors.resize(static_cast<size_t>(nColors));
+		if (!reader.ReadBytes(state.colors.data(), state.colors.size() * sizeof(glm::vec4)))
+			return FAIL;
+
+		outState = std::move(state);
+		return SUCCESS;
+	}
+
+	// -- < Scene diff > ---------------------------------
+	bool FindDirtyTiles(const RenderState& previous, const SceneDescription& scene, size_t tileSize, std::vector<bool>& outDirty)
+	{
+		SceneDescription previousScene;
+		if (SceneSerializer::Deserialize(previous.scene.data(), previous.scene.size(), previousScene) != SUCCESS)
+			return false;
+
+		// Anything that changes every pixel
+		auto const& camera = scene.camera;
+		auto const& previousCamera = previousScene.camera;
+		bool const sameFrame =
+			camera.position == previousCamera.position &&
+			camera.lookAt == previousCamera.lookAt &&
+			camera.up == previousCamera.up &&
+			camera.fovy == previousCamera.fovy &&
+			scene.imgWidth == previousScene.imgWidth &&
+			scene.imgHeight == previousScene.imgHeight &&
+			scene.imgResX == previousScene.imgResX &&
+			scene.imgResY == previousScene.imgResY &&
+			scene.imgDistanceToViewplane == previousScene.imgDistanceToViewplane &&
+			scene.enableLight == previousScene.enableLight &&
+			scene.compactMeshes == previousScene.compactMeshes &&
+			scene.meshLods == previousScene.meshLods &&
+			scene.rasterPrimary == previousScene.rasterPrimary &&
+			scene.GetNumObjects() == previousScene.GetNumObjects() &&
+			scene.GetNumLights() == previousScene.GetNumLights() &&
+			previous.colors.size() == scene.imgResX * scene.imgResY;
+
+		if (!sameFrame)
+			return false;
+
+		// Tiles should be split like the ones of the new render, and only know about objects of the scene
+		size_t const nTiles = ((scene.imgResX + tileSize - 1) / tileSize) * ((scene.imgResY + tileSize - 1) / tileSize);
+		if (previous.tileSize != tileSize || previous.tiles.size() != nTiles)
+			return false;
+
+		for (auto const& tile : previous.tiles)
+			if (!tile.objects.empty() && tile.objects.back() >= scene.GetNumObjects())
+				return false;
+
+		// Any change to a light affects points it lit. Points in its shadow stay dark whatever its color, they only
+		// change if it moves and its shadow with it
+		uint64_t changedLights = 0, movedLights = 0;
+		for (size_t i = 0; i < scene.GetNumLights(); i++)
+		{
+			auto const& light = scene.GetLights()[i];
+			auto const& previousLight = previousScene.GetLights()[i];
+			if (light.position != previousLight.position)
+				movedLights |= uint64_t(1) << i;
+			if (light.position != previousLight.position || light.color != previousLight.color)
+				changedLights |= uint64_t(1) << i;
+		}
+
+		// Material edits only affect tiles that hit the object, geometry edits also the space the object moved through
+		std::vector<uint32_t> changedObjects;
+		std::vector<Bounds> sweptBounds;
+		for (size_t i = 0; i < scene.GetNumObjects(); i++)
+		{
+			auto const& object = scene.GetObjectsConst()[i];
+			auto const& previousObject = previousScene.GetObjectsConst()[i];
+
+			bool const sameMaterial =
+				object.ambient == previousObject.ambient &&
+				object.diffuse == previousObject.diffuse &&
+				object.specular == previousObject.specular &&
+				object.emission == previousObject.emission &&
+				object.mirror == previousObject.mirror &&
+				object.shininess == previousObject.shininess;
+
+			bool const sameGeometry =
+				object.shape == previousObject.shape &&
+				object.size == previousObject.size &&
+				object.transform == previousObject.transform;
+
+			if (!sameMaterial || !sameGeometry)
+				changedObjects.push_back(static_cast<uint32_t>(i));
+
+			if (!sameGeometry)
+			{
+				Bounds swept = previousObject.GetBounds();
+				swept.Extend(object.GetBounds());
+				sweptBounds.push_back(swept);
+			}
+		}
+
+		outDirty.assign(previous.tiles.size(), false);
+		for (size_t tileIndex = 0; tileIndex < previous.tiles.size(); tileIndex++)
+		{
+			auto const& tile = previous.tiles[tileIndex];
+			bool dirty = (tile.lights & changedLights) != 0 || (tile.shadowedLights & movedLights) != 0;
+
+			for (auto const object : changedObjects)
+				dirty = dirty || tile.HasObject(object);
+
+			// Rays that left the scene were clipped at its bounds, anything moving outside them might be in their way
+			for (auto const& swept : sweptBounds)
+				dirty = dirty || tile.rayBounds.Overlaps(swept) || (tile.raysEscape && !previous.sceneBounds.Contains(swept));
+
+			outDirty[tileIndex] = dirty;
+		}
+
+		return true;
+	}
+}
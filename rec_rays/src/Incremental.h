@@ -0,0 +1,110 @@
+// Incremental rendering: remember what each tile depends on, so after a scene edit only affected tiles are rendered again
+#pragma once
+
+// STL includes
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// Third party includes
+#include <glm/glm.hpp>
+
+// Local includes
+#include "Geometry.h"
+
+namespace RecRays
+{
+	struct SceneDescription;
+
+	/**
+	 * \brief Everything a tile touched while it was rendered. Anything not recorded here can change without
+	 * affecting the tile
+	 */
+	struct TileDependencies
+	{
+		std::vector<uint32_t> objects;	// Sorted ids of objects some ray of the tile hit
+		uint64_t lights = 0;			// Bit per light, set if its light was added to some pixel of the tile
+		uint64_t shadowedLights = 0;	// Bit per light, set if some point of the tile was in its shadow
+		Bounds rayBounds;				// Bounds of every ray segment traced for the tile
+		bool raysEscape = false;		// If some ray left the scene towards infinity, those are clipped in rayBounds
+
+		/**
+		 * \brief Forget everything recorded so far
+		 */
+		void Reset();
+
+		void RecordLight(size_t light) { lights |= uint64_t(1) << light; }
+		void RecordShadowedLight(size_t light) { shadowedLights |= uint64_t(1) << light; }
+
+		bool HasObject(uint32_t object) const;
+	};
+
+	/**
+	 * \brief Objects hit while a tile is rendered. Kept as a bitset of every object so recording never allocates,
+	 * and turned into the sorted list of TileDependencies once the tile is done. One per render thread
+	 */
+	class TileObjectRecorder
+	{
+	public:
+		/**
+		 * \brief Get ready to record a tile, allocating the bitset the first time
+		 * \param nObjects Objects in the scene
+		 */
+		void Begin(size_t nObjects);
+
+		void Record(uint32_t object)
+		{
+			m_Bits[object / 64] |= uint64_t(1) << (object % 64);
+			m_UsedWords[object / (64 * 64)] |= uint64_t(1) << (object / 64 % 64);
+		}
+
+		/**
+		 * \brief Stop recording and clear the bitset for the next tile
+		 * \param outObjects Where to write ids of recorded objects, sorted
+		 */
+		void End(std::vector<uint32_t>& outObjects);
+
+	private:
+		std::vector<uint64_t> m_Bits;		// Bit per object id
+		std::vector<uint64_t> m_UsedWords;	// Bit per word of m_Bits, set if any bit of the word is, so End skips empty ones
+	};
+
+	/**
+	 * \brief What's needed to render a scene again after an edit: the scene that was rendered, what each tile
+	 * depended on, and the resulting colors
+	 */
+	struct RenderState
+	{
+		std::vector<uint8_t> scene;				// Scene encoded with SceneSerializer
+		Bounds sceneBounds;						// Bounds of every object in the scene
+		uint64_t tileSize = 0;					// Width and height of tiles
+		std::vector<TileDependencies> tiles;	// Indexed like tiles of RecursiveRayTracer
+		std::vector<glm::vec4> colors;			// Rendered colors, laid out like the color buffer
+	};
+
+	/**
+	 * \brief Write a render state to a file
+	 * \return Success status
+	 */
+	int SaveRenderState(const std::string& filepath, const RenderState& state);
+
+	/**
+	 * \brief Read a render state written with SaveRenderState
+	 * \return Success status, fails if file is missing or was written by another version
+	 */
+	int LoadRenderState(const std::string& filepath, RenderState& outState);
+
+	/**
+	 * \brief Find which tiles of a previous render are out of date after the scene changed. A tile is out of date if
+	 * it hit an edited object, was lit by an edited light, or was in the shadow of a light that moved. Objects that
+	 * moved, changed shape or size also invalidate tiles whose rays crossed the space swept from their old bounds to
+	 * their new ones
+	 * \param previous State of previous render
+	 * \param scene New version of the scene
+	 * \param tileSize Width and height of tiles of the new render
+	 * \param outDirty Which tiles should be rendered again, one entry per tile of previous
+	 * \return If previous render can be reused at all. Changes to camera, image, tile size or settings, or adding and
+	 * removing objects or lights, require rendering everything
+	 */
+	bool FindDirtyTiles(const RenderState& previous, const SceneDescription& scene, size_t tileSize, std::vector<bool>& outDirty);
+}
@@ -0,0 +1,203 @@
+// Local includes
+#include "Memory.h"
+
+// STL includes
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+#include <assert.h>
+
+#ifdef RRAYS_PLATFORM_WINDOWS
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+#endif
+
+namespace RecRays
+{
+	// -- < Large allocations > ---------------------------------
+	// Blocks at least this big try to use huge pages
+	constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+	void* AllocateLarge(size_t size, bool& outHugePages)
+	{
+		outHugePages = false;
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		// Large pages need the "Lock pages in memory" privilege, fall back to regular pages without it
+		size_t const largePage = GetLargePageMinimum();
+		if (largePage > 0 && size >= largePage)
+		{
+			size_t const rounded = (size + largePage - 1) / largePage * largePage;
+			if (void* ptr = VirtualAlloc(nullptr, rounded, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE))
+			{
+				outHugePages = true;
+				return ptr;
+			}
+		}
+
+		return _aligned_malloc(size, CACHE_LINE_SIZE);
+	#else
+		if (size < HUGE_PAGE_SIZE)
+		{
+			size_t const rounded = (size + CACHE_LINE_SIZE - 1) / CACHE_LINE_SIZE * CACHE_LINE_SIZE;
+			return std::aligned_alloc(CACHE_LINE_SIZE, rounded);
+		}
+
+		// Align to huge pages and ask for transparent huge pages. If the kernel says no, it's still regular memory
+		size_t const rounded = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+		void* ptr = std::aligned_alloc(HUGE_PAGE_SIZE, rounded);
+		#ifdef MADV_HUGEPAGE
+		if (ptr != nullptr)
+			outHugePages = madvise(ptr, rounded, MADV_HUGEPAGE) == 0;
+		#endif
+		return ptr;
+	#endif
+	}
+
+	void FreeLarge(void* ptr, bool hugePages)
+	{
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		if (hugePages)
+			VirtualFree(ptr, 0, MEM_RELEASE);
+		else
+			_aligned_free(ptr);
+	#else
+		// Huge pages were only advised on memory from aligned_alloc, it's freed like any other
+		(void)hugePages;
+		std::free(ptr);
+	#endif
+	}
+
+	// -- < Scratch Arena > ---------------------------------
+	ScratchArena::ScratchArena(size_t blockSize)
+	{
+		// Memory is reserved on first use, so threads that never render don't pay for it
+		m_Blocks.push_back({ nullptr, blockSize });
+	}
+
+	ScratchArena& ScratchArena::Local()
+	{
+		thread_local ScratchArena arena;
+		return arena;
+	}
+
+	void* ScratchArena::Allocate(size_t size, size_t alignment)
+	{
+		assert((alignment & (alignment - 1)) == 0 && "Alignment should be a power of two");
+
+		auto* block = &m_Blocks.back();
+		if (block->data == nullptr)
+			block->data = std::make_unique<uint8_t[]>(block->size);
+
+		// Align from the actual address, heap blocks are only aligned to max_align_t
+		auto const base = reinterpret_cast<uintptr_t>(block->data.get());
+		auto start = ((base + m_Offset + alignment - 1) & ~(uintptr_t(alignment) - 1)) - base;
+
+		// Not enough space left, add a block big enough for this allocation
+		if (start + size > block->size)
+		{
+			auto const newSize = std::max(2 * block->size, size + alignment);
+			m_Blocks.push_back({ std::make_unique<uint8_t[]>(newSize), newSize });
+			block = &m_Blocks.back();
+
+			auto const newBase = reinterpret_cast<uintptr_t>(block->data.get());
+			start = ((newBase + alignment - 1) & ~(uintptr_t(alignment) - 1)) - newBase;
+		}
+
+		m_Offset = start + size;
+		m_Used += size;
+		return block->data.get() + start;
+	}
+
+	void ScratchArena::Reset()
+	{
+		// Merge blocks into one, big enough for everything allocated in this round
+		if (m_Blocks.size() > 1)
+		{
+			auto const capacity = GetCapacity();
+			m_Blocks.clear();
+			m_Blocks.push_back({ std::make_unique<uint8_t[]>(capacity), capacity });
+		}
+
+		m_Offset = 0;
+		m_Used = 0;
+	}
+
+	size_t ScratchArena::GetCapacity() const
+	{
+		size_t capacity = 0;
+		for (auto const& block : m_Blocks)
+			capacity += block.data ? block.size : 0;
+
+		return capacity;
+	}
+
+	// -- < Allocation tracking > ---------------------------------
+	uint64_t AllocationCounter::GetThreadAllocations()
+	{
+		return s_ThreadAllocations;
+	}
+
+	NoAllocationScope::~NoAllocationScope()
+	{
+		auto const allocations = AllocationCounter::GetThreadAllocations() - m_StartAllocations;
+		if (allocations == 0)
+			return;
+
+		std::cerr << "Heap allocation inside allocation free scope '" << m_Name << "': " << allocations << " allocations" << std::endl;
+		assert(false && "Heap allocation inside allocation free scope");
+	}
+}
+
+#ifdef RRAYS_TRACK_ALLOCATIONS
+// Replace global allocation functions to count allocations. Every other form of operator new and
+// operator delete is implemented in terms of these ones by the standard library
+namespace
+{
+	void* AlignedMalloc(size_t size, size_t alignment)
+	{
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		return _aligned_malloc(size, alignment);
+	#else
+		// aligned_alloc requires size to be a multiple of alignment
+		return std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+	#endif
+	}
+
+	void AlignedFree(void* ptr)
+	{
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		_aligned_free(ptr);
+	#else
+		std::free(ptr);
+	#endif
+	}
+}
+
+void* operator new(size_t size)
+{
+	RecRays::AllocationCounter::OnAllocation();
+	if (void* ptr = std::malloc(size == 0 ? 1 : size))
+		return ptr;
+
+	throw std::bad_alloc();
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+	RecRays::AllocationCounter::OnAllocation();
+	if (void* ptr = AlignedMalloc(size == 0 ? 1 : size, static_cast<size_t>(alignment)))
+		return ptr;
+
+	throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { std::free(ptr); }
+void operator delete(void* ptr, std::align_val_t) noexcept { AlignedFree(ptr); }
+void operator delete(void* ptr, size_t, std::align_val_t) noexcept { AlignedFree(ptr); }
+#endif
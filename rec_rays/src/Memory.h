@@ -0,0 +1,224 @@
+// Scratch memory for the render loop and a way to make sure it doesn't touch the heap
+#pragma once
+
+// STL includes
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+#include <utility>
+
+#define RRAYS_MEMORY_CONCAT_IMPL(a, b) a##b
+#define RRAYS_MEMORY_CONCAT(a, b) RRAYS_MEMORY_CONCAT_IMPL(a, b)
+
+// Fail if the calling thread allocates from the heap before the enclosing scope ends: RRAYS_NO_ALLOCATION_SCOPE(name).
+// It's a debugging aid, not a guarantee: it only asserts in Debug builds with RRAYS_TRACK_ALLOCATIONS. Release builds
+// with tracking just report allocations, and without tracking nothing is checked at all
+#ifdef RRAYS_TRACK_ALLOCATIONS
+	#define RRAYS_NO_ALLOCATION_SCOPE(name) ::RecRays::NoAllocationScope RRAYS_MEMORY_CONCAT(_noAllocationScope, __LINE__)(name)
+#else
+	#define RRAYS_NO_ALLOCATION_SCOPE(name)
+#endif
+
+namespace RecRays
+{
+	// Alignment of large buffers, a cache line
+	constexpr size_t CACHE_LINE_SIZE = 64;
+
+	/**
+	 * \brief Reserve a big block of memory, aligned to a cache line. Blocks of a few MB or more are backed
+	 * by huge pages when the system allows it, so walking big structures doesn't thrash the TLB
+	 * \param size Size in bytes
+	 * \param outHugePages If huge pages were used, pass it back to FreeLarge
+	 * \return Allocated memory, nullptr if could not allocate
+	 */
+	void* AllocateLarge(size_t size, bool& outHugePages);
+
+	/**
+	 * \brief Release memory reserved with AllocateLarge
+	 */
+	void FreeLarge(void* ptr, bool hugePages);
+
+	/**
+	 * \brief Fixed size array of trivially copyable elements in memory reserved with AllocateLarge. Elements can be
+	 * changed in place, but not added. Move only
+	 */
+	template<typename T>
+	class LargeBuffer
+	{
+		static_assert(std::is_trivially_copyable_v<T>, "Large buffers are filled with memcpy");
+
+	public:
+		LargeBuffer() = default;
+		~LargeBuffer() { Clear(); }
+
+		LargeBuffer(LargeBuffer&& other) noexcept { *this = std::move(other); }
+		LargeBuffer& operator=(LargeBuffer&& other) noexcept
+		{
+			if (this != &other)
+			{
+				Clear();
+				std::swap(m_Data, other.m_Data);
+				std::swap(m_Size, other.m_Size);
+				std::swap(m_HugePages, other.m_HugePages);
+			}
+			return *this;
+		}
+
+		LargeBuffer(const LargeBuffer&) = delete;
+		LargeBuffer& operator=(const LargeBuffer&) = delete;
+
+		/**
+		 * \brief Replace contents with a copy of the given elements
+		 * \return If memory could be reserved
+		 */
+		bool Assign(const T* data, size_t count)
+		{
+			Clear();
+			if (count == 0)
+				return true;
+
+			m_Data = static_cast<T*>(AllocateLarge(count * sizeof(T), m_HugePages));
+			if (m_Data == nullptr)
+				return false;
+
+			std::memcpy(m_Data, data, count * sizeof(T));
+			m_Size = count;
+			return true;
+		}
+
+		void Clear()
+		{
+			if (m_Data != nullptr)
+				FreeLarge(m_Data, m_HugePages);
+
+			m_Data = nullptr;
+			m_Size = 0;
+			m_HugePages = false;
+		}
+
+		T& operator[](size_t i) { return m_Data[i]; }
+		const T& operator[](size_t i) const { return m_Data[i]; }
+		T* Data() { return m_Data; }
+		const T* Data() const { return m_Data; }
+		size_t Size() const { return m_Size; }
+		bool UsesHugePages() const { return m_HugePages; }
+
+	private:
+		T* m_Data = nullptr;
+		size_t m_Size = 0;
+		bool m_HugePages = false;
+	};
+
+	/**
+	 * \brief Bump allocator for short lived scratch memory. Allocating is just moving a pointer forward,
+	 * and everything is released at once with Reset. Memory is kept between resets, so once it has grown
+	 * to fit the biggest tile, rendering doesn't allocate anymore. Not thread safe, use one per thread.
+	 * Only meant for trivially destructible types, destructors are never called
+	 */
+	class ScratchArena
+	{
+	public:
+		/**
+		 * \param blockSize Size in bytes of the first block of memory
+		 */
+		ScratchArena(size_t blockSize = 64 * 1024);
+
+		ScratchArena(const ScratchArena&) = delete;
+		ScratchArena& operator=(const ScratchArena&) = delete;
+
+		/**
+		 * \brief Arena for the calling thread
+		 */
+		static ScratchArena& Local();
+
+		/**
+		 * \brief Get uninitialized memory, valid until next Reset
+		 * \param size Size in bytes
+		 * \param alignment Alignment in bytes, should be a power of two
+		 */
+		void* Allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+		/**
+		 * \brief Get an uninitialized array of count elements of type T, valid until next Reset
+		 */
+		template<typename T>
+		T* Allocate(size_t count)
+		{
+			static_assert(std::is_trivially_destructible_v<T>, "Arena memory is released without calling destructors");
+			return static_cast<T*>(Allocate(count * sizeof(T), alignof(T)));
+		}
+
+		/**
+		 * \brief Release every allocation at once. If memory overflowed into more than one block, they're
+		 * merged into a single block big enough for all of it, so the next round fits without allocating
+		 */
+		void Reset();
+
+		/**
+		 * \brief Bytes handed out since last Reset
+		 */
+		size_t GetUsed() const { return m_Used; }
+
+		/**
+		 * \brief Bytes reserved from the heap
+		 */
+		size_t GetCapacity() const;
+
+	private:
+		struct Block
+		{
+			std::unique_ptr<uint8_t[]> data;
+			size_t size;
+		};
+
+		std::vector<Block> m_Blocks;
+		size_t m_Offset = 0;	// Offset of next free byte in last block
+		size_t m_Used = 0;
+	};
+
+	/**
+	 * \brief Count heap allocations made by each thread. Counting only happens when built with
+	 * RRAYS_TRACK_ALLOCATIONS, which replaces global operator new, otherwise counts are always 0
+	 */
+	class AllocationCounter
+	{
+	public:
+		/**
+		 * \brief Heap allocations made by the calling thread so far
+		 */
+		static uint64_t GetThreadAllocations();
+
+		/**
+		 * \brief Called by operator new on every allocation
+		 */
+		static void OnAllocation() { s_ThreadAllocations++; }
+
+	private:
+		inline static thread_local uint64_t s_ThreadAllocations = 0;
+	};
+
+	/**
+	 * \brief Check that the calling thread doesn't allocate while this object is alive. Reports and asserts
+	 * on destruction otherwise. Use it through RRAYS_NO_ALLOCATION_SCOPE
+	 */
+	class NoAllocationScope
+	{
+	public:
+		NoAllocationScope(const char* name)
+			: m_Name(name)
+			, m_StartAllocations(AllocationCounter::GetThreadAllocations())
+		{ }
+
+		~NoAllocationScope();
+
+		NoAllocationScope(const NoAllocationScope&) = delete;
+		NoAllocationScope& operator=(const NoAllocationScope&) = delete;
+
+	private:
+		const char* m_Name;
+		uint64_t m_StartAllocations;
+	};
+}
@@ -0,0 +1,233 @@
+// Local includes
+#include "Network.h"
+#include "Status.h"
+
+// Platform includes
+#ifdef RRAYS_PLATFORM_WINDOWS
+	#include <ws2tcpip.h>
+#else
+	#include <sys/socket.h>
+	#include <sys/select.h>
+	#include <netinet/in.h>
+	#include <netinet/tcp.h>
+	#include <netdb.h>
+	#include <unistd.h>
+	#include <signal.h>
+#endif
+
+// STL includes
+#include <cstring>
+
+namespace RecRays
+{
+	// -- < Platform helpers > --------------------------------------------------
+	static void CloseSocketHandle(SocketHandle handle)
+	{
+#ifdef RRAYS_PLATFORM_WINDOWS
+		closesocket(handle);
+#else
+		close(handle);
+#endif
+	}
+
+	static bool WaitForRead(SocketHandle handle, int timeoutMs)
+	{
+		fd_set readSet;
+		FD_ZERO(&readSet);
+		FD_SET(handle, &readSet);
+
+		timeval timeout;
+		timeout.tv_sec = timeoutMs / 1000;
+		timeout.tv_usec = (timeoutMs % 1000) * 1000;
+
+		// First argument is ignored on windows
+		return select(static_cast<int>(handle) + 1, &readSet, nullptr, nullptr, &timeout) > 0;
+	}
+
+	// -- < Socket > ------------------------------------------------------------
+	Socket::Socket(Socket&& other) noexcept
+		: m_Handle(other.m_Handle)
+	{
+		other.m_Handle = INVALID_SOCKET_HANDLE;
+	}
+
+	Socket& Socket::operator=(Socket&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Close();
+			m_Handle = other.m_Handle;
+			other.m_Handle = INVALID_SOCKET_HANDLE;
+		}
+
+		return *this;
+	}
+
+	int Socket::InitNetworking()
+	{
+#ifdef RRAYS_PLATFORM_WINDOWS
+		WSADATA wsaData;
+		if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0)
+			return FAIL;
+#else
+		// A dead peer should be a failed send, not a killed process
+		signal(SIGPIPE, SIG_IGN);
+#endif
+		return SUCCESS;
+	}
+
+	void Socket::ShutdownNetworking()
+	{
+#ifdef RRAYS_PLATFORM_WINDOWS
+		WSACleanup();
+#endif
+	}
+
+	Socket Socket::Connect(const std::string& host, uint16_t port)
+	{
+		addrinfo hints;
+		std::memset(&hints, 0, sizeof(hints));
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+
+		addrinfo* addresses = nullptr;
+		if (getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+			return Socket();
+
+		// Try every address until one works
+		Socket result;
+		for (auto address = addresses; address != nullptr; address = address->ai_next)
+		{
+			SocketHandle handle = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+			if (handle == INVALID_SOCKET_HANDLE)
+				continue;
+
+			if (connect(handle, address->ai_addr, static_cast<int>(address->ai_addrlen)) == 0)
+			{
+				result = Socket(handle);
+				break;
+			}
+
+			CloseSocketHandle(handle);
+		}
+
+		freeaddrinfo(addresses);
+
+		// Tiles are small messages, don't wait to batch them
+		if (result.IsValid())
+		{
+			int noDelay = 1;
+			setsockopt(result.m_Handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+		}
+
+		return result;
+	}
+
+	Socket Socket::Listen(uint16_t port)
+	{
+		SocketHandle handle = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+		if (handle == INVALID_SOCKET_HANDLE)
+			return Socket();
+
+		Socket result(handle);
+
+		int reuse = 1;
+		setsockopt(handle, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char*>(&reuse), sizeof(reuse));
+
+		sockaddr_in address;
+		std::memset(&address, 0, sizeof(address));
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_ANY);
+		address.sin_port = htons(port);
+
+		if (bind(handle, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+			return Socket();
+
+		if (listen(handle, SOMAXCONN) != 0)
+			return Socket();
+
+		return result;
+	}
+
+	Socket Socket::Accept(int timeoutMs)
+	{
+		if (!WaitForRead(m_Handle, timeoutMs))
+			return Socket();
+
+		SocketHandle handle = accept(m_Handle, nullptr, nullptr);
+		if (handle == INVALID_SOCKET_HANDLE)
+			return Socket();
+
+		int noDelay = 1;
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&noDelay), sizeof(noDelay));
+
+		return Socket(handle);
+	}
+
+	bool Socket::WaitReadable(int timeoutMs) const
+	{
+		return WaitForRead(m_Handle, timeoutMs);
+	}
+
+	bool Socket::SendAll(const void* data, size_t size)
+	{
+		auto bytes = static_cast<const char*>(data);
+		while (size > 0)
+		{
+			auto const sent = send(m_Handle, bytes, static_cast<int>(size), 0);
+			if (sent <= 0)
+				return false;
+
+			bytes += sent;
+			size -= static_cast<size_t>(sent);
+		}
+
+		return true;
+	}
+
+	bool Socket::ReceiveAll(void* outData, size_t size, int timeoutMs)
+	{
+		auto bytes = static_cast<char*>(outData);
+		while (size > 0)
+		{
+			if (!WaitForRead(m_Handle, timeoutMs))
+				return false;
+
+			auto const received = recv(m_Handle, bytes, static_cast<int>(size), 0);
+			if (received <= 0)
+				return false; // Error or connection closed
+
+			bytes += received;
+			size -= static_cast<size_t>(received);
+		}
+
+		return true;
+	}
+
+	void Socket::Close()
+	{
+		if (m_Handle == INVALID_SOCKET_HANDLE)
+			return;
+
+		CloseSocketHandle(m_Handle);
+		m_Handle = INVALID_SOCKET_HANDLE;
+	}
+
+	// -- < Packets > -----------------------------------------------------------
+	bool SendPacket(Socket& socket, uint32_t type, const void* payload, uint32_t size)
+	{
+		PacketHeader const header{ type, size };
+		return socket.SendAll(&header, sizeof(header)) && (size == 0 || socket.SendAll(payload, size));
+	}
+
+	bool ReceivePacket(Socket& socket, uint32_t& outType, std::vector<uint8_t>& outPayload, int timeoutMs, uint32_t maxSize)
+	{
+		PacketHeader header;
+		if (!socket.ReceiveAll(&header, sizeof(header), timeoutMs) || header.size > maxSize)
+			return false;
+
+		outType = header.type;
+		outPayload.resize(header.size);
+		return header.size == 0 || socket.ReceiveAll(outPayload.data(), header.size, timeoutMs);
+	}
+}
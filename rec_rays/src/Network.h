@@ -0,0 +1,126 @@
+// Minimal blocking TCP sockets, enough to talk between render processes
+#pragma once
+
+// STL includes
+#include <string>
+#include <vector>
+#include <cstdint>
+
+#ifdef RRAYS_PLATFORM_WINDOWS
+	#ifndef NOMINMAX
+		#define NOMINMAX // Keep windows headers from defining min and max macros
+	#endif
+	#include <winsock2.h>
+#endif
+
+namespace RecRays
+{
+#ifdef RRAYS_PLATFORM_WINDOWS
+	using SocketHandle = SOCKET;
+	constexpr SocketHandle INVALID_SOCKET_HANDLE = INVALID_SOCKET;
+#else
+	using SocketHandle = int;
+	constexpr SocketHandle INVALID_SOCKET_HANDLE = -1;
+#endif
+
+	/**
+	 * \brief Owns a TCP socket, closed on destruction. Move only
+	 */
+	class Socket
+	{
+	public:
+		Socket(SocketHandle handle = INVALID_SOCKET_HANDLE)
+			: m_Handle(handle)
+		{ }
+
+		~Socket() { Close(); }
+
+		Socket(Socket&& other) noexcept;
+		Socket& operator=(Socket&& other) noexcept;
+		Socket(const Socket&) = delete;
+		Socket& operator=(const Socket&) = delete;
+
+		/**
+		 * \brief Init platform networking. Call it once before using any socket
+		 * \return Success status, 0 for success, 1 for failure
+		 */
+		static int InitNetworking();
+
+		/**
+		 * \brief Release platform networking resources
+		 */
+		static void ShutdownNetworking();
+
+		/**
+		 * \brief Connect to a listening socket
+		 * \param host Name or address of host to connect to
+		 * \param port Port where the host is listening
+		 * \return Connected socket, or an invalid socket if could not connect
+		 */
+		static Socket Connect(const std::string& host, uint16_t port);
+
+		/**
+		 * \brief Create a socket listening for connections in every interface
+		 * \param port Port to listen to
+		 * \return Listening socket, or an invalid socket if could not listen
+		 */
+		static Socket Listen(uint16_t port);
+
+		/**
+		 * \brief Accept a pending connection on a listening socket
+		 * \param timeoutMs How long to wait for a connection
+		 * \return Connected socket, or an invalid socket if no connection arrived in time
+		 */
+		Socket Accept(int timeoutMs);
+
+		/**
+		 * \brief Wait until there's data to read
+		 * \param timeoutMs How long to wait
+		 * \return If there's data to read (or the connection was closed) before timeout
+		 */
+		bool WaitReadable(int timeoutMs) const;
+
+		/**
+		 * \brief Send all bytes, blocking until done
+		 * \return If everything was sent
+		 */
+		bool SendAll(const void* data, size_t size);
+
+		/**
+		 * \brief Receive exactly the requested amount of bytes
+		 * \param timeoutMs Max time to wait for each chunk of data
+		 * \return If everything was received, false on timeout, error or closed connection
+		 */
+		bool ReceiveAll(void* outData, size_t size, int timeoutMs);
+
+		void Close();
+
+		bool IsValid() const { return m_Handle != INVALID_SOCKET_HANDLE; }
+
+	private:
+		SocketHandle m_Handle;
+	};
+
+	/**
+	 * \brief Header preceding every packet sent between render processes
+	 */
+	struct PacketHeader
+	{
+		uint32_t type;
+		uint32_t size; // payload size in bytes
+	};
+
+	/**
+	 * \brief Send a packet with the given type and payload
+	 * \return If the packet was sent
+	 */
+	bool SendPacket(Socket& socket, uint32_t type, const void* payload, uint32_t size);
+
+	/**
+	 * \brief Receive a full packet
+	 * \param timeoutMs Max time to wait for data to arrive
+	 * \param maxSize Packets bigger than this are considered an error
+	 * \return If a packet was received
+	 */
+	bool ReceivePacket(Socket& socket, uint32_t& outType, std::vector<uint8_t>& outPayload, int timeoutMs, uint32_t maxSize = 1u << 30);
+}
@@ -0,0 +1,88 @@
+// Local includes
+#include "Preview.h"
+
+// STL includes
+#include <algorithm>
+#include <iterator>
+#include <cmath>
+
+namespace RecRays
+{
+	bool IsValidPreviewScale(size_t scale)
+	{
+		return std::find(std::begin(PREVIEW_SCALES), std::end(PREVIEW_SCALES), scale) != std::end(PREVIEW_SCALES);
+	}
+
+	void PreviewUpsampler::Locate(size_t pixel, size_t resolution, size_t& outFirst, size_t& outSecond, float& outWeight) const
+	{
+		// Position of pixel center in sample coordinates, samples are at integer positions
+		float const position = (static_cast<float>(pixel) - static_cast<float>(m_Scale / 2)) / static_cast<float>(m_Scale);
+		float const clamped = std::clamp(position, 0.f, static_cast<float>(resolution - 1));
+
+		outFirst = static_cast<size_t>(std::floor(clamped));
+		outSecond = std::min(outFirst + 1, resolution - 1);
+		outWeight = clamped - static_cast<float>(outFirst);
+	}
+
+	bool PreviewUpsampler::Reconstruct(size_t pixelX, size_t pixelY, glm::vec4& outColor) const
+	{
+		size_t x0, x1, y0, y1;
+		float wx, wy;
+		Locate(pixelX, m_ResX, x0, x1, wx);
+		Locate(pixelY, m_ResY, y0, y1, wy);
+
+		// Pixel was traced as a sample
+		if (wx == 0.f && wy == 0.f)
+		{
+			outColor = GetSample(x0, y0).color;
+			return true;
+		}
+
+		const GBufferSample* samples[4] = { &GetSample(x0, y0), &GetSample(x1, y0), &GetSample(x0, y1), &GetSample(x1, y1) };
+		float const bilinear[4] = { (1 - wx) * (1 - wy), wx * (1 - wy), (1 - wx) * wy, wx * wy };
+
+		// Nearest sample is the reference to compare the others against
+		auto const& reference = *samples[(wx > 0.5f ? 1 : 0) + (wy > 0.5f ? 2 : 0)];
+		outColor = reference.color;
+
+		glm::vec4 color(0);
+		float totalWeight = 0;
+		for (int i = 0; i < 4; i++)
+		{
+			if (bilinear[i] <= 0.f)
+				continue;
+
+			auto const& sample = *samples[i];
+
+			// Silhouettes, or background against an object
+			if (sample.objectId != reference.objectId)
+				return false;
+
+			// Shadow and reflection edges don't show up in the G-buffer
+			auto const colorDifference = glm::abs(sample.color - reference.color);
+			if (std::max({ colorDifference.r, colorDifference.g, colorDifference.b }) > PREVIEW_COLOR_TOLERANCE)
+				return false;
+
+			float weight = bilinear[i];
+			if (reference.objectId != UINT32_MAX)
+			{
+				// Same object, but maybe not the same smooth surface: folds, creases or the object occluding itself
+				float const depthDifference = std::abs(sample.depth - reference.depth) / std::max(reference.depth, 1e-6f);
+				float const cosNormals = glm::dot(sample.normal, reference.normal);
+				if (depthDifference > PREVIEW_DEPTH_TOLERANCE || cosNormals < PREVIEW_NORMAL_TOLERANCE)
+					return false;
+
+				// Still fade samples out as they get less similar
+				float const depthWeight = 1.f - depthDifference / PREVIEW_DEPTH_TOLERANCE;
+				float const normalWeight = (cosNormals - PREVIEW_NORMAL_TOLERANCE) / (1.f - PREVIEW_NORMAL_TOLERANCE);
+				weight *= std::max(depthWeight * normalWeight, 1e-3f);
+			}
+
+			color += weight * sample.color;
+			totalWeight += weight;
+		}
+
+		outColor = color / totalWeight;
+		return true;
+	}
+}
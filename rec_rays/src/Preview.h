@@ -0,0 +1,87 @@
+// Fast previews: trace a G-buffer at a fraction of the resolution and upsample it guided by depth, normals and object ids
+#pragma once
+
+// STL includes
+#include <cstdint>
+#include <cstddef>
+
+// Third party includes
+#include <glm/glm.hpp>
+
+namespace RecRays
+{
+	// Resolution divisors supported by previews. Tiles should be a multiple of them
+	constexpr size_t PREVIEW_SCALES[] = { 2, 4 };
+	// Samples whose depth differs more than this fraction of the nearest one are on another surface
+	constexpr float PREVIEW_DEPTH_TOLERANCE = 0.05f;
+	// Samples whose normals have a smaller cosine than this are across a crease
+	constexpr float PREVIEW_NORMAL_TOLERANCE = 0.9f;
+	// Samples whose colors differ more than this in some channel are across a shadow or reflection edge
+	constexpr float PREVIEW_COLOR_TOLERANCE = 0.1f;
+	// Pixels a tile may trace because they can't be reconstructed, as a fraction of the samples it traced. Past it,
+	// evenly spread ones are traced and the rest keep the color of their nearest sample
+	constexpr float PREVIEW_EXTRA_RAY_BUDGET = 0.5f;
+
+	/**
+	 * \brief What a primary ray found for a single pixel
+	 */
+	struct GBufferSample
+	{
+		glm::vec4 color = glm::vec4(0);
+		glm::vec3 normal = glm::vec3(0);
+		float depth = 0;				// t of primary hit
+		uint32_t objectId = UINT32_MAX;	// Material id of object hit, NO_MATERIAL if nothing was hit
+	};
+
+	/**
+	 * \brief Check if a preview resolution divisor is supported
+	 */
+	bool IsValidPreviewScale(size_t scale);
+
+	/**
+	 * \brief Reconstructs full resolution colors from a G-buffer traced at reduced resolution. Low resolution
+	 * sample (x, y) was traced through the center of full resolution pixel (x * scale + scale / 2, y * scale + scale / 2).
+	 * Each pixel is a joint bilateral blend of the four samples around it: bilinear weights scaled by how similar
+	 * each sample's depth and normal are to the nearest sample. Pixels where samples are not all on the same smooth
+	 * surface, or where their colors change sharply, can't be blended safely, those are left for the caller to trace
+	 */
+	class PreviewUpsampler
+	{
+	public:
+		/**
+		 * \param samples Low resolution G-buffer, row by row
+		 * \param resX Width of G-buffer
+		 * \param resY Height of G-buffer
+		 * \param scale How many full resolution pixels per sample in each axis
+		 */
+		PreviewUpsampler(const GBufferSample* samples, size_t resX, size_t resY, size_t scale)
+			: m_Samples(samples)
+			, m_ResX(resX)
+			, m_ResY(resY)
+			, m_Scale(scale)
+		{ }
+
+		/**
+		 * \brief Reconstruct the color of a full resolution pixel
+		 * \param outColor Reconstructed color, or color of the nearest sample when it can't be reconstructed
+		 * \return If pixel could be reconstructed, false when samples around it are across a discontinuity
+		 */
+		bool Reconstruct(size_t pixelX, size_t pixelY, glm::vec4& outColor) const;
+
+	private:
+		const GBufferSample& GetSample(size_t x, size_t y) const { return m_Samples[y * m_ResX + x]; }
+
+		/**
+		 * \brief Find low resolution coordinates of a full resolution pixel along an axis
+		 * \param outFirst First sample around pixel
+		 * \param outSecond Second sample around pixel, might be the same as the first one at borders
+		 * \param outWeight Weight of second sample
+		 */
+		void Locate(size_t pixel, size_t resolution, size_t& outFirst, size_t& outSecond, float& outWeight) const;
+
+	private:
+		const GBufferSample* m_Samples;
+		size_t m_ResX, m_ResY;
+		size_t m_Scale;
+	};
+}
@@ -0,0 +1,783 @@
+// Local includes
+#include "Primitives.h"
+#include "RenderStats.h"
+
+// STL includes
+#include <algorithm>
+#include <cmath>
+#include <assert.h>
+#include <iostream>
+
+namespace RecRays
+{
+	// -- < Material > ---------------------------------
+	void Material::Classify(bool enableLight)
+	{
+		// Colors with no visible contribution are skipped while shading
+		auto const isBlack = [](const glm::vec4& color) { return color.r <= 0.f && color.g <= 0.f && color.b <= 0.f; };
+
+		materialClass = 0;
+		if (enableLight && !isBlack(diffuse))
+			materialClass |= MATERIAL_DIFFUSE;
+		if (enableLight && !isBlack(specular))
+			materialClass |= MATERIAL_SPECULAR;
+		if (!isBlack(mirror))
+			materialClass |= MATERIAL_REFLECTIVE;
+	}
+
+	// -- < Spheres > ---------------------------------
+	void SphereSet::Clear()
+	{
+		centerX.clear();
+		centerY.clear();
+		centerZ.clear();
+		radius.clear();
+		materialId.clear();
+		gridBounds = Bounds();
+		gridResolution = glm::ivec3(0);
+		gridCellSize = glm::vec3(0);
+		gridCellStart.clear();
+		gridSpheres.clear();
+	}
+
+	void SphereSet::Add(const glm::vec3& center, float sphereRadius, uint32_t material)
+	{
+		centerX.push_back(center.x);
+		centerY.push_back(center.y);
+		centerZ.push_back(center.z);
+		radius.push_back(sphereRadius);
+		materialId.push_back(material);
+	}
+
+	void SphereSet::BuildAccelerationStructures(SphereAccelerator accelerator, size_t otherPrimitives, float cellsPerSphere)
+	{
+		gridCellStart.clear();
+		gridSpheres.clear();
+		if (accelerator == SphereAccelerator::None || Size() == 0)
+			return;
+
+		if (accelerator == SphereAccelerator::Auto)
+		{
+			if (Size() < SPHERE_GRID_MIN_SPHERES || otherPrimitives > Size())
+				return;
+
+			float maxRadius = 0, sumRadius = 0;
+			for (auto const r : radius)
+			{
+				maxRadius = std::max(maxRadius, r);
+				sumRadius += r;
+			}
+
+			if (maxRadius > SPHERE_GRID_MAX_RADIUS_RATIO * sumRadius / Size())
+				return;
+		}
+
+		BuildGrid(cellsPerSphere);
+
+		// Crowded cells mean spheres are clustered, rays going through the clusters would test most of them anyway
+		if (accelerator == SphereAccelerator::Auto)
+		{
+			size_t occupiedCells = 0;
+			for (size_t cell = 0; cell + 1 < gridCellStart.size(); cell++)
+				occupiedCells += gridCellStart[cell + 1] > gridCellStart[cell] ? 1 : 0;
+
+			if (gridSpheres.size() > SPHERE_GRID_MAX_CELL_LOAD * occupiedCells)
+			{
+				gridCellStart.clear();
+				gridSpheres.clear();
+			}
+		}
+	}
+
+	void SphereSet::BuildGrid(float cellsPerSphere)
+	{
+		gridBounds = Bounds();
+		for (size_t i = 0; i < Size(); i++)
+		{
+			auto const c = glm::vec3(centerX[i], centerY[i], centerZ[i]);
+			gridBounds.Extend(c - glm::vec3(radius[i]));
+			gridBounds.Extend(c + glm::vec3(radius[i]));
+		}
+
+		// Roughly cubic cells, cellsPerSphere per sphere. Flat grids get some thickness so cells don't collapse
+		auto extent = gridBounds.max - gridBounds.min;
+		float const maxExtent = std::max({ extent.x, extent.y, extent.z, 1e-6f });
+		extent = glm::max(extent, glm::vec3(1e-3f * maxExtent));
+		gridBounds.max = gridBounds.min + extent;
+
+		float const cellSide = std::cbrt(extent.x * extent.y * extent.z / (cellsPerSphere * static_cast<float>(Size())));
+		for (int axis = 0; axis < 3; axis++)
+			gridResolution[axis] = std::clamp(static_cast<int>(std::ceil(extent[axis] / cellSide)), 1, SPHERE_GRID_MAX_RESOLUTION);
+		gridCellSize = extent / glm::vec3(gridResolution);
+
+		// Call function with the index of every cell overlapping a sphere. Boxes are padded a bit so points on the
+		// surface always land in a cell holding the sphere
+		auto const forEachCell = [this](size_t sphere, auto&& function)
+		{
+			auto const c = glm::vec3(centerX[sphere], centerY[sphere], centerZ[sphere]);
+			auto const r = glm::vec3(radius[sphere]) + 1e-3f * gridCellSize;
+			int first[3], last[3];
+			for (int axis = 0; axis < 3; axis++)
+			{
+				first[axis] = std::clamp(static_cast<int>((c[axis] - r[axis] - gridBounds.min[axis]) / gridCellSize[axis]), 0, gridResolution[axis] - 1);
+				last[axis] = std::clamp(static_cast<int>((c[axis] + r[axis] - gridBounds.min[axis]) / gridCellSize[axis]), 0, gridResolution[axis] - 1);
+			}
+
+			for (int z = first[2]; z <= last[2]; z++)
+				for (int y = first[1]; y <= last[1]; y++)
+					for (int x = first[0]; x <= last[0]; x++)
+						function(static_cast<size_t>(x) + static_cast<size_t>(gridResolution.x) * (static_cast<size_t>(y) + static_cast<size_t>(gridResolution.y) * z));
+		};
+
+		// Count spheres per cell, then turn counts into offsets and fill cells
+		size_t const nCells = static_cast<size_t>(gridResolution.x) * gridResolution.y * gridResolution.z;
+		gridCellStart.assign(nCells + 1, 0);
+		for (size_t sphere = 0; sphere < Size(); sphere++)
+			forEachCell(sphere, [this](size_t cell) { gridCellStart[cell + 1]++; });
+
+		for (size_t cell = 0; cell < nCells; cell++)
+			gridCellStart[cell + 1] += gridCellStart[cell];
+
+		gridSpheres.resize(gridCellStart[nCells]);
+		std::vector<uint32_t> nextSlot(gridCellStart.begin(), gridCellStart.end() - 1);
+		for (size_t sphere = 0; sphere < Size(); sphere++)
+			forEachCell(sphere, [&](size_t cell) { gridSpheres[nextSlot[cell]++] = static_cast<uint32_t>(sphere); });
+	}
+
+	void SphereSet::Intersect(const Ray& ray, float minT, PrimitiveHit& inOutHit) const
+	{
+		auto& counters = RenderStats::Local();
+		if (HasGrid())
+		{
+			IntersectGrid(ray, minT, inOutHit, counters);
+			return;
+		}
+
+		counters.traversalSteps += Size();
+		counters.sphereTests += Size();
+
+		auto const dd = glm::dot(ray.direction, ray.direction);
+		for (size_t i = 0; i < Size(); i++)
+			IntersectSphere(static_cast<uint32_t>(i), ray, dd, minT, inOutHit);
+	}
+
+	void SphereSet::IntersectSphere(uint32_t sphere, const Ray& ray, float dd, float minT, PrimitiveHit& inOutHit) const
+	{
+		// We just have to compute intersection point solving for t in the
+		// equation of a sphere substituting by a point in the ray
+		auto const d = ray.direction;
+		auto const e = ray.position;
+		auto const c = glm::vec3(centerX[sphere], centerY[sphere], centerZ[sphere]);
+		auto const r = radius[sphere];
+
+		// Compute discriminant to check what kind of intersection we have here
+		auto discriminant = glm::dot(d, e - c);
+		discriminant = discriminant * discriminant;
+		discriminant -= (dd * dot(e - c, e - c) - r * r);
+
+		// no intersection at all
+		if (discriminant < -0.0001)
+			return;
+
+		// Pick nearest root in front of the ray. Both roots are the same when discriminant is near 0
+		float const t = -dot(d, e - c);
+		float nearest = INFINITY;
+		if (std::abs(discriminant) > 0.0001)
+		{
+			float const sqrtDiscriminant = glm::sqrt(discriminant);
+			float const farRoot = t + sqrtDiscriminant;
+			float const nearRoot = t - sqrtDiscriminant;
+			if (farRoot > 0)
+				nearest = farRoot;
+			if (nearRoot > 0 && nearRoot < nearest)
+				nearest = nearRoot;
+		}
+		else if (t > 0)
+			nearest = t;
+
+		if (nearest > minT && nearest < inOutHit.t)
+		{
+			inOutHit.t = nearest;
+			inOutHit.kind = KIND;
+			inOutHit.primitive = sphere;
+		}
+	}
+
+	void SphereSet::IntersectGrid(const Ray& ray, float minT, PrimitiveHit& inOutHit, RenderCounters& counters) const
+	{
+		// Part of the ray inside the grid
+		BvhRay const gridRay(ray.position, ray.direction);
+		float enter = minT, exit = inOutHit.t;
+		for (int axis = 0; axis < 3; axis++)
+		{
+			float const t0 = (gridBounds.min[axis] - ray.position[axis]) * gridRay.inverseDirection[axis];
+			float const t1 = (gridBounds.max[axis] - ray.position[axis]) * gridRay.inverseDirection[axis];
+			enter = std::max(enter, std::min(t0, t1));
+			exit = std::min(exit, std::max(t0, t1));
+		}
+
+		if (!(enter <= exit))
+			return;
+
+		// 3D-DDA: step to whichever neighbor cell the ray reaches first
+		glm::vec3 const start = ray.position + enter * ray.direction;
+		int cell[3], step[3], end[3];
+		float next[3], delta[3];
+		for (int axis = 0; axis < 3; axis++)
+		{
+			cell[axis] = std::clamp(static_cast<int>((start[axis] - gridBounds.min[axis]) / gridCellSize[axis]), 0, gridResolution[axis] - 1);
+			float const direction = ray.direction[axis];
+			float const inverse = gridRay.inverseDirection[axis];
+			if (direction > 0)
+			{
+				step[axis] = 1;
+				end[axis] = gridResolution[axis];
+				next[axis] = (gridBounds.min[axis] + (cell[axis] + 1) * gridCellSize[axis] - ray.position[axis]) * inverse;
+				delta[axis] = gridCellSize[axis] * inverse;
+			}
+			else if (direction < 0)
+			{
+				step[axis] = -1;
+				end[axis] = -1;
+				next[axis] = (gridBounds.min[axis] + cell[axis] * gridCellSize[axis] - ray.position[axis]) * inverse;
+				delta[axis] = -gridCellSize[axis] * inverse;
+			}
+			else
+			{
+				step[axis] = 0;
+				end[axis] = -1;
+				next[axis] = INFINITY;
+				delta[axis] = INFINITY;
+			}
+		}
+
+		auto const dd = glm::dot(ray.direction, ray.direction);
+		while (true)
+		{
+			counters.traversalSteps++;
+			size_t const cellIndex = static_cast<size_t>(cell[0]) + static_cast<size_t>(gridResolution.x) * (static_cast<size_t>(cell[1]) + static_cast<size_t>(gridResolution.y) * cell[2]);
+			for (uint32_t i = gridCellStart[cellIndex]; i < gridCellStart[cellIndex + 1]; i++)
+			{
+				counters.sphereTests++;
+				IntersectSphere(gridSpheres[i], ray, dd, minT, inOutHit);
+			}
+
+			int axis = 0;
+			if (next[1] < next[axis]) axis = 1;
+			if (next[2] < next[axis]) axis = 2;
+
+			// Hits before leaving this cell can't be beaten by spheres in cells further away
+			if (inOutHit.t <= next[axis] || next[axis] > exit)
+				return;
+
+			cell[axis] += step[axis];
+			if (cell[axis] == end[axis])
+				return;
+			next[axis] += delta[axis];
+		}
+	}
+
+	RayIntersectionResult SphereSet::GetIntersection(const Ray& ray, const PrimitiveHit& hit) const
+	{
+		// Compute intersection point and normal
+		auto const c = glm::vec3(centerX[hit.primitive], centerY[hit.primitive], centerZ[hit.primitive]);
+		glm::vec3 const intersectionPos = ray.position + hit.t * ray.direction;
+		glm::vec3 const intersectionNormal = glm::normalize(glm::vec3(intersectionPos - c));
+
+		return RayIntersectionResult{
+			materialId[hit.primitive],
+			intersectionNormal,
+			intersectionPos, hit.t, &ray };
+	}
+
+	// -- < Mesh compression > ---------------------------------
+	uint32_t EncodeOctahedral(const glm::vec3& normal)
+	{
+		auto const signNotZero = [](float value) { return value >= 0.f ? 1.f : -1.f; };
+
+		// Degenerate triangles can leave zero normals, which have no direction to project. +Z encodes as 0
+		float const length = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+		if (!(length > 0.f) || !std::isfinite(length))
+			return 0;
+
+		// Project on octahedron |x| + |y| + |z| = 1, then fold lower half over the upper one
+		auto const n = normal / length;
+		float x = n.x, y = n.y;
+		if (n.z < 0.f)
+		{
+			x = (1.f - std::abs(n.y)) * signNotZero(n.x);
+			y = (1.f - std::abs(n.x)) * signNotZero(n.y);
+		}
+
+		auto const toFixed = [](float value)
+		{
+			return static_cast<uint16_t>(static_cast<int16_t>(std::round(std::clamp(value, -1.f, 1.f) * 32767.f)));
+		};
+
+		return static_cast<uint32_t>(toFixed(x)) | (static_cast<uint32_t>(toFixed(y)) << 16);
+	}
+
+	glm::vec3 DecodeOctahedral(uint32_t packed)
+	{
+		float x = static_cast<int16_t>(packed & 0xFFFF) / 32767.f;
+		float y = static_cast<int16_t>(packed >> 16) / 32767.f;
+		float const z = 1.f - std::abs(x) - std::abs(y);
+
+		// Unfold lower half
+		float const t = std::max(-z, 0.f);
+		x += x >= 0.f ? -t : t;
+		y += y >= 0.f ? -t : t;
+
+		return glm::normalize(glm::vec3(x, y, z));
+	}
+
+	// -- < Meshes > ---------------------------------
+	void MeshSet::Clear()
+	{
+		vertices.Clear();
+		normals.clear();
+		indices.Clear();
+		packedPositions.Clear();
+		packedNormals.clear();
+		packedTriangles.Clear();
+		m_Pending = PendingGeometry();
+
+		meshFormat.clear();
+		meshFirstVertex.clear();
+		meshFirstTriangle.clear();
+		meshTriangleCount.clear();
+		meshQuantizationOrigin.clear();
+		meshQuantizationStep.clear();
+		meshBounds.clear();
+		meshCoarserLod.clear();
+		meshLodError.clear();
+		meshBvhRoot.clear();
+		bvhNodes.Clear();
+
+		boundsMin.clear();
+		boundsMax.clear();
+		worldToObject.clear();
+		instanceMesh.clear();
+		windingSign.clear();
+		instanceScale.clear();
+
+		normalToWorld.clear();
+		materialId.clear();
+	}
+
+	uint32_t MeshSet::AddMesh(const Geometry& geometry, bool compact)
+	{
+		Bounds bounds;
+		for (auto const& vertex : geometry.vertices)
+			bounds.Extend(vertex);
+
+		auto const nVertices = static_cast<uint32_t>(geometry.vertices.size());
+		auto const nTriangles = static_cast<uint32_t>(geometry.indices.size());
+
+		if (!compact)
+		{
+			auto const firstVertex = static_cast<uint32_t>(m_Pending.vertices.size());
+			m_Pending.vertices.insert(m_Pending.vertices.end(), geometry.vertices.begin(), geometry.vertices.end());
+			normals.insert(normals.end(), geometry.normals.begin(), geometry.normals.end());
+
+			meshFormat.push_back(MeshFormat::Full);
+			meshFirstVertex.push_back(firstVertex);
+			meshFirstTriangle.push_back(static_cast<uint32_t>(m_Pending.indices.size()));
+			meshQuantizationOrigin.push_back(glm::vec3(0));
+			meshQuantizationStep.push_back(glm::vec3(0));
+			for (auto const& triIndices : geometry.indices)
+				m_Pending.indices.push_back(triIndices + glm::uvec3(firstVertex));
+		}
+		else
+		{
+			// Quantize positions to 16 bits inside mesh bounds
+			auto const firstVertex = static_cast<uint32_t>(m_Pending.packedPositions.size());
+			auto const origin = nVertices > 0 ? bounds.min : glm::vec3(0);
+			auto const step = nVertices > 0 ? (bounds.max - bounds.min) / 65535.f : glm::vec3(0);
+			auto const quantize = [](float value, float origin, float step)
+			{
+				return step > 0.f ? static_cast<uint16_t>(std::clamp(std::round((value - origin) / step), 0.f, 65535.f)) : uint16_t(0);
+			};
+
+			for (auto const& vertex : geometry.vertices)
+			{
+				m_Pending.packedPositions.push_back({
+					quantize(vertex.x, origin.x, step.x),
+					quantize(vertex.y, origin.y, step.y),
+					quantize(vertex.z, origin.z, step.z)
+				});
+			}
+
+			for (auto const& normal : geometry.normals)
+				packedNormals.push_back(EncodeOctahedral(normal));
+
+			// Use 16 bit indices when every vertex can be addressed with them
+			bool const smallIndices = nVertices <= 65536;
+			meshFormat.push_back(smallIndices ? MeshFormat::Compact16 : MeshFormat::Compact);
+			meshFirstVertex.push_back(firstVertex);
+			meshQuantizationOrigin.push_back(origin);
+			meshQuantizationStep.push_back(step);
+			if (smallIndices)
+			{
+				meshFirstTriangle.push_back(static_cast<uint32_t>(m_Pending.packedTriangles.size()));
+				for (auto const& triIndices : geometry.indices)
+				{
+					m_Pending.packedTriangles.push_back({
+						static_cast<uint16_t>(triIndices.x),
+						static_cast<uint16_t>(triIndices.y),
+						static_cast<uint16_t>(triIndices.z)
+					});
+				}
+			}
+			else
+			{
+				meshFirstTriangle.push_back(static_cast<uint32_t>(m_Pending.indices.size()));
+				for (auto const& triIndices : geometry.indices)
+					m_Pending.indices.push_back(triIndices + glm::uvec3(firstVertex));
+			}
+
+			// Bounds of quantized mesh, so instance bounds and BVH contain what's actually intersected
+			bounds = Bounds();
+			for (uint32_t vertex = 0; vertex < nVertices; vertex++)
+			{
+				auto const& packed = m_Pending.packedPositions[firstVertex + vertex];
+				bounds.Extend(origin + glm::vec3(packed.x, packed.y, packed.z) * step);
+			}
+		}
+
+		meshTriangleCount.push_back(nTriangles);
+		meshBounds.push_back(bounds);
+		meshCoarserLod.push_back(NO_LOD);
+		meshLodError.push_back(0.f);
+		meshBvhRoot.push_back(NO_BVH);
+
+		return static_cast<uint32_t>(meshFirstTriangle.size() - 1);
+	}
+
+	uint32_t MeshSet::AddMeshWithLods(const Geometry& geometry, const std::vector<GeometryLod>& lods, bool compact)
+	{
+		auto const mesh = AddMesh(geometry, compact);
+
+		auto previous = mesh;
+		for (auto const& lod : lods)
+		{
+			auto const lodMesh = AddMesh(lod.geometry, compact);
+			meshLodError[lodMesh] = lod.error;
+			meshCoarserLod[previous] = lodMesh;
+			previous = lodMesh;
+		}
+
+		return mesh;
+	}
+
+	void MeshSet::BuildAccelerationStructures(thread_pool* threads, uint32_t maxLeafTriangles)
+	{
+		// Geometry goes to its final place first, BVHs reorder triangles there
+		bool const allocated =
+			vertices.Assign(m_Pending.vertices.data(), m_Pending.vertices.size()) &&
+			indices.Assign(m_Pending.indices.data(), m_Pending.indices.size()) &&
+			packedPositions.Assign(m_Pending.packedPositions.data(), m_Pending.packedPositions.size()) &&
+			packedTriangles.Assign(m_Pending.packedTriangles.data(), m_Pending.packedTriangles.size());
+		m_Pending = PendingGeometry();
+
+		if (!allocated)
+		{
+			// Meshes are left without triangles, instances would point to ones that aren't there
+			std::cerr << "Could not allocate mesh geometry, meshes won't be drawn" << std::endl;
+			vertices.Clear();
+			indices.Clear();
+			packedPositions.Clear();
+			packedTriangles.Clear();
+			std::fill(meshTriangleCount.begin(), meshTriangleCount.end(), 0);
+			std::fill(meshBvhRoot.begin(), meshBvhRoot.end(), NO_BVH);
+			return;
+		}
+
+		std::vector<WideBvhNode> nodes;
+		std::vector<glm::vec3> decodedVertices;
+		std::vector<glm::uvec3> localTriangles;
+		for (uint32_t mesh = 0; mesh < GetNumMeshes(); mesh++)
+		{
+			auto const first = meshFirstTriangle[mesh];
+			auto const count = meshTriangleCount[mesh];
+			if (count < BVH_MIN_TRIANGLES)
+			{
+				meshBvhRoot[mesh] = NO_BVH;
+				continue;
+			}
+
+			if (meshFormat[mesh] == MeshFormat::Full)
+			{
+				meshBvhRoot[mesh] = BuildWideBvh(vertices.Data(), indices.Data() + first, count, first, nodes, threads, maxLeafTriangles);
+				continue;
+			}
+
+			// Compact meshes are built from decoded positions and local indices, then stored back in their format
+			auto const firstVertex = meshFirstVertex[mesh];
+			localTriangles.resize(count);
+			uint32_t maxVertex = 0;
+			for (uint32_t i = 0; i < count; i++)
+			{
+				localTriangles[i] = GetTriangleIndices(mesh, first + i) - glm::uvec3(firstVertex);
+				maxVertex = std::max({ maxVertex, localTriangles[i].x, localTriangles[i].y, localTriangles[i].z });
+			}
+
+			decodedVertices.resize(maxVertex + 1);
+			for (uint32_t vertex = 0; vertex <= maxVertex; vertex++)
+				decodedVertices[vertex] = DecodePosition(mesh, firstVertex + vertex);
+
+			meshBvhRoot[mesh] = BuildWideBvh(decodedVertices.data(), localTriangles.data(), count, first, nodes, threads, maxLeafTriangles);
+
+			for (uint32_t i = 0; i < count; i++)
+			{
+				auto const& local = localTriangles[i];
+				if (meshFormat[mesh] == MeshFormat::Compact16)
+					packedTriangles[first + i] = { static_cast<uint16_t>(local.x), static_cast<uint16_t>(local.y), static_cast<uint16_t>(local.z) };
+				else
+					indices[first + i] = local + glm::uvec3(firstVertex);
+			}
+		}
+
+		if (!bvhNodes.Assign(nodes.data(), nodes.size()))
+		{
+			// Still correct without them, just slower
+			std::cerr << "Could not allocate BVH nodes, meshes will be intersected triangle by triangle" << std::endl;
+			std::fill(meshBvhRoot.begin(), meshBvhRoot.end(), NO_BVH);
+		}
+	}
+
+	void MeshSet::AddInstance(uint32_t mesh, const glm::mat4& objectToWorld, uint32_t material)
+	{
+		assert(mesh < GetNumMeshes() && "Invalid mesh id");
+
+		// Pad bounds a little so rays grazing flat faces are not discarded
+		auto const bounds = meshBounds[mesh].Transform(objectToWorld);
+		auto const padding = 1e-4f * (glm::vec3(1) + glm::abs(bounds.max - bounds.min));
+		boundsMin.push_back(bounds.min - padding);
+		boundsMax.push_back(bounds.max + padding);
+		worldToObject.push_back(glm::inverse(objectToWorld));
+		instanceMesh.push_back(mesh);
+		windingSign.push_back(glm::determinant(glm::mat3(objectToWorld)) < 0 ? -1.f : 1.f);
+		instanceScale.push_back(std::max({
+			glm::length(glm::vec3(objectToWorld[0])),
+			glm::length(glm::vec3(objectToWorld[1])),
+			glm::length(glm::vec3(objectToWorld[2]))
+		}));
+
+		normalToWorld.push_back(glm::transpose(glm::inverse(glm::mat3(objectToWorld))));
+		materialId.push_back(material);
+	}
+
+	void MeshSet::Intersect(const Ray& ray, float minT, PrimitiveHit& inOutHit) const
+	{
+		auto& counters = RenderStats::Local();
+		counters.traversalSteps += Size();
+
+		glm::vec3 const inverseDirection = 1.f / ray.direction;
+		for (size_t i = 0; i < Size(); i++)
+		{
+			float enter;
+			if (!IntersectRayToBounds(ray.position, inverseDirection, boundsMin[i], boundsMax[i], inOutHit.t, enter))
+				continue;
+
+			// Footprint is smallest where the ray enters the instance, so the level picked there is fine for all of it
+			auto const maxError = LOD_MAX_FOOTPRINT_ERROR * ray.GetFootprint(enter) / instanceScale[i];
+			auto const mesh = SelectLod(instanceMesh[i], maxError);
+
+			// Move ray to object coordinates. Direction is not normalized, so t is the same in both spaces
+			auto const& transform = worldToObject[i];
+			Ray const objectRay{
+				glm::vec3(transform * glm::vec4(ray.position, 1.f)),
+				glm::vec3(transform * glm::vec4(ray.direction, 0.f))
+			};
+
+			// Pick the loop specialized for how this mesh is stored
+			switch (meshFormat[mesh])
+			{
+			case MeshFormat::Full: IntersectInstance<MeshFormat::Full>(i, mesh, objectRay, minT, inOutHit, counters); break;
+			case MeshFormat::Compact: IntersectInstance<MeshFormat::Compact>(i, mesh, objectRay, minT, inOutHit, counters); break;
+			case MeshFormat::Compact16: IntersectInstance<MeshFormat::Compact16>(i, mesh, objectRay, minT, inOutHit, counters); break;
+			}
+		}
+	}
+
+	template<MeshFormat Format>
+	void MeshSet::IntersectInstance(size_t instance, uint32_t mesh, const Ray& objectRay, float minT, PrimitiveHit& inOutHit, RenderCounters& counters) const
+	{
+		auto const intersectTriangles = [&](uint32_t first, uint32_t count)
+		{
+			counters.triangleTests += count;
+			for (uint32_t triangle = first; triangle < first + count; triangle++)
+			{
+				glm::vec3 v1, v2, v3;
+				GetTriangle<Format>(mesh, triangle, v1, v2, v3);
+
+				float t, u, v;
+				bool const wasIntersection = IntersectRayToTriangle(
+					objectRay,
+					v1, v2, v3,
+					windingSign[instance],
+					t, u, v);
+
+				if (wasIntersection && t >= minT && t < inOutHit.t)
+				{
+					inOutHit.t = t;
+					inOutHit.kind = KIND;
+					inOutHit.primitive = static_cast<uint32_t>(instance);
+					inOutHit.mesh = mesh;
+					inOutHit.triangle = triangle;
+					inOutHit.u = u;
+					inOutHit.v = v;
+				}
+			}
+		};
+
+		if (meshBvhRoot[mesh] == NO_BVH)
+			intersectTriangles(meshFirstTriangle[mesh], meshTriangleCount[mesh]);
+		else
+			TraverseWideBvh(bvhNodes.Data(), meshBvhRoot[mesh], BvhRay(objectRay.position, objectRay.direction), minT, inOutHit.t, counters.traversalSteps, intersectTriangles);
+	}
+
+	template<MeshFormat Format>
+	void MeshSet::GetTriangle(uint32_t mesh, uint32_t triangle, glm::vec3& outV1, glm::vec3& outV2, glm::vec3& outV3) const
+	{
+		if constexpr (Format == MeshFormat::Full)
+		{
+			auto const& triIndices = indices[triangle];
+			outV1 = vertices[triIndices.x];
+			outV2 = vertices[triIndices.y];
+			outV3 = vertices[triIndices.z];
+		}
+		else if constexpr (Format == MeshFormat::Compact)
+		{
+			auto const& triIndices = indices[triangle];
+			outV1 = DecodePosition(mesh, triIndices.x);
+			outV2 = DecodePosition(mesh, triIndices.y);
+			outV3 = DecodePosition(mesh, triIndices.z);
+		}
+		else
+		{
+			auto const& packed = packedTriangles[triangle];
+			auto const firstVertex = meshFirstVertex[mesh];
+			outV1 = DecodePosition(mesh, firstVertex + packed.a);
+			outV2 = DecodePosition(mesh, firstVertex + packed.b);
+			outV3 = DecodePosition(mesh, firstVertex + packed.c);
+		}
+	}
+
+	void MeshSet::GetTriangleVertices(uint32_t mesh, uint32_t triangle, glm::vec3& outV1, glm::vec3& outV2, glm::vec3& outV3) const
+	{
+		switch (meshFormat[mesh])
+		{
+		case MeshFormat::Full: GetTriangle<MeshFormat::Full>(mesh, triangle, outV1, outV2, outV3); break;
+		case MeshFormat::Compact: GetTriangle<MeshFormat::Compact>(mesh, triangle, outV1, outV2, outV3); break;
+		case MeshFormat::Compact16: GetTriangle<MeshFormat::Compact16>(mesh, triangle, outV1, outV2, outV3); break;
+		}
+	}
+
+	glm::uvec3 MeshSet::GetTriangleIndices(uint32_t mesh, uint32_t triangle) const
+	{
+		if (meshFormat[mesh] != MeshFormat::Compact16)
+			return indices[triangle];
+
+		auto const& packed = packedTriangles[triangle];
+		return glm::uvec3(packed.a, packed.b, packed.c) + glm::uvec3(meshFirstVertex[mesh]);
+	}
+
+	RayIntersectionResult MeshSet::GetIntersection(const Ray& ray, const PrimitiveHit& hit) const
+	{
+		// Interpolate normal from barycentric coordinates, then move it to world coordinates
+		auto const mesh = hit.mesh;
+		auto const triIndices = GetTriangleIndices(mesh, hit.triangle);
+		glm::vec3 n1, n2, n3;
+		if (meshFormat[mesh] == MeshFormat::Full)
+		{
+			n1 = normals[triIndices.x];
+			n2 = normals[triIndices.y];
+			n3 = normals[triIndices.z];
+		}
+		else
+		{
+			n1 = DecodeOctahedral(packedNormals[triIndices.x]);
+			n2 = DecodeOctahedral(packedNormals[triIndices.y]);
+			n3 = DecodeOctahedral(packedNormals[triIndices.z]);
+		}
+
+		auto const objectNormal = (1.f - hit.u - hit.v) * n1 + hit.u * n2 + hit.v * n3;
+
+		return RayIntersectionResult{
+			materialId[hit.primitive],
+			normalToWorld[hit.primitive] * objectNormal,
+			ray.position + ray.direction * hit.t,
+			hit.t,
+			&ray
+		};
+	}
+
+	size_t MeshSet::GetMeshMemory() const
+	{
+		return vertices.Size() * sizeof(glm::vec3) +
+			normals.size() * sizeof(glm::vec3) +
+			indices.Size() * sizeof(glm::uvec3) +
+			packedPositions.Size() * sizeof(PackedPosition) +
+			packedNormals.size() * sizeof(uint32_t) +
+			packedTriangles.Size() * sizeof(PackedTriangle) +
+			bvhNodes.Size() * sizeof(WideBvhNode);
+	}
+
+	// -- < Intersection tests > ---------------------------------
+	bool IntersectRayToBounds(const glm::vec3& origin, const glm::vec3& inverseDirection, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float maxT, float& outEnter)
+	{
+		// Slab test: ray crosses the box if it's inside every slab at the same time
+		auto const t1 = (boundsMin - origin) * inverseDirection;
+		auto const t2 = (boundsMax - origin) * inverseDirection;
+		auto const tNear = glm::min(t1, t2);
+		auto const tFar = glm::max(t1, t2);
+
+		float const enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+		float const exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+		outEnter = enter;
+		return enter <= exit;
+	}
+
+	bool IntersectRayToTriangle(const Ray& ray, const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3, float cullSign, float& outT, float& outU, float& outV)
+	{
+		auto const edge1 = v2 - v1;
+		auto const edge2 = v3 - v1;
+
+		// Before everything, perform backface culling. If direction and triangle normal
+		// have an angle > 90, then it can't intersect by any mean. Winding order is clock wise
+		auto const triangleNormal = glm::cross(edge1, edge2);
+		if (cullSign * glm::dot(ray.direction, triangleNormal) >= 0)
+			return false;
+
+		constexpr float EPSILON = 0.0000001f;
+
+		auto const h = glm::cross(ray.direction, edge2);
+		auto const k = glm::dot(edge1, h);
+
+		// No intersection, ray is parallel to triangle
+		if (k > -EPSILON && k < EPSILON)
+			return false;
+
+		auto const f = 1.f / k;
+		auto const s = ray.position - v1;
+		auto const u = f * glm::dot(s, h);
+		if (u < 0.0f || u > 1.0)
+			return false;
+
+		auto const q = glm::cross(s, edge1);
+		auto const v = f * glm::dot(ray.direction, q);
+		if (v < 0.0 || u + v > 1.0)
+			return false;
+
+		auto const t = f * glm::dot(edge2, q);
+		if (t <= EPSILON)
+			return false; // Line intersection, but not ray
+
+		outT = t;
+		outU = u;
+		outV = v;
+		return true;
+	}
+}
@@ -0,0 +1,411 @@
+// Scene data laid out for intersection: compact arrays with only what the intersection loops read
+#pragma once
+
+// STL includes
+#include <vector>
+#include <cstdint>
+#include <cmath>
+
+// Third party includes
+#include <glm/glm.hpp>
+
+// Local includes
+#include "Geometry.h"
+#include "Bvh.h"
+#include "RenderStats.h"
+
+namespace RecRays
+{
+	// Material id of intersection results that didn't hit anything
+	constexpr uint32_t NO_MATERIAL = UINT32_MAX;
+	// Max error of a level of detail, relative to the ray footprint. Below one pixel, so switching is not visible
+	constexpr float LOD_MAX_FOOTPRINT_ERROR = 0.5f;
+
+	// Spheres needed before Auto builds a grid. --benchmark-spheres shows it winning from 4-8 on, this leaves some margin
+	constexpr size_t SPHERE_GRID_MIN_SPHERES = 16;
+	// Grid cells created per sphere
+	constexpr float SPHERE_GRID_CELLS_PER_SPHERE = 2.f;
+	// Max cells along each axis of the grid
+	constexpr int SPHERE_GRID_MAX_RESOLUTION = 256;
+	// Spheres are uniform enough for a grid when the biggest radius is at most this times the mean one...
+	constexpr float SPHERE_GRID_MAX_RADIUS_RATIO = 4.f;
+	// ...and cells with some sphere hold at most this many on average
+	constexpr float SPHERE_GRID_MAX_CELL_LOAD = 8.f;
+
+	/**
+	 * \brief How rays find the spheres they hit
+	 */
+	enum class SphereAccelerator : uint8_t
+	{
+		Auto,	// Grid if the scene is mostly spheres and they are uniform in size and placement
+		None,	// Test every sphere
+		Grid	// Always walk a uniform grid
+	};
+
+	struct Ray
+	{
+		glm::vec3 position;
+		glm::vec3 direction;
+
+		// Footprint of the ray, a cone approximating its differentials: how wide the area covered by the ray
+		// is at its origin, and how much wider it gets per unit of t. Rays with no footprint are infinitely thin
+		float width = 0;
+		float spread = 0;
+
+		/**
+		 * \brief Width of the area covered by the ray at some point of it, in world units
+		 */
+		float GetFootprint(float t) const { return width + spread * t; }
+	};
+
+	struct RayIntersectionResult
+	{
+		RayIntersectionResult(uint32_t _materialId = NO_MATERIAL, glm::vec3 _normal = glm::vec3(0), glm::vec3 _position = glm::vec3(0), float _t = 0, const Ray* _ray = nullptr)
+			: materialId(_materialId)
+			, normal(_normal)
+			, position(_position)
+			, t(_t)
+			, ray(_ray)
+		{
+
+		}
+		uint32_t materialId; // Index of material of the object that was hit
+		glm::vec3 normal;
+		glm::vec3 position; // world coordinates
+		float t; // Intersection point in ray. How far from origin
+		const Ray* ray; // Ray casted, owned by whoever casted it
+
+		bool WasIntersection() const { return materialId != NO_MATERIAL; }
+	};
+
+	/**
+	 * \brief Flags describing which terms of the shading model a material actually uses. Every combination is
+	 * a material class with its own specialized shading kernel, a material with none of them only emits
+	 * its ambient and emission colors
+	 */
+	enum MaterialFlags : uint32_t
+	{
+		MATERIAL_DIFFUSE = 1 << 0,
+		MATERIAL_SPECULAR = 1 << 1,
+		MATERIAL_REFLECTIVE = 1 << 2,
+	};
+
+	constexpr uint32_t MATERIAL_CLASS_COUNT = 8;
+
+	/**
+	 * \brief Shading properties of an object. Kept apart from intersection data, only read for the final hit
+	 */
+	struct Material
+	{
+		glm::vec4 ambient, diffuse, specular, emission, mirror;
+		float shininess;
+		uint32_t materialClass; // Combination of MaterialFlags, set up by Classify
+
+		/**
+		 * \brief Find out which terms of the shading model are used by this material
+		 * \param enableLight If lighting is enabled in the scene. When disabled, diffuse and specular are skipped
+		 */
+		void Classify(bool enableLight);
+	};
+
+	/**
+	 * \brief Nearest hit found so far by intersection loops. Just enough to tell which primitive was hit,
+	 * everything else about the intersection is computed once the nearest hit is known
+	 */
+	struct PrimitiveHit
+	{
+		float t;
+		uint32_t kind = UINT32_MAX;	// KIND of the set holding the hit primitive, UINT32_MAX if no hit
+		uint32_t primitive;			// Index of primitive inside its set
+		uint32_t mesh;				// Mesh holding the hit triangle, might be a level of detail of the instanced mesh
+		uint32_t triangle;			// Index of hit triangle, for meshes
+		float u, v;					// Barycentric coordinates of hit inside triangle, for meshes
+
+		bool WasHit() const { return kind != UINT32_MAX; }
+	};
+
+	/**
+	 * \brief Spheres in world coordinates, one array per field
+	 */
+	struct SphereSet
+	{
+		static constexpr uint32_t KIND = 0;
+
+		// Hot: read by intersection loop
+		std::vector<float> centerX, centerY, centerZ, radius;
+
+		// Cold: read for final hit only
+		std::vector<uint32_t> materialId;
+
+		// Uniform grid, empty if every sphere is tested. Spheres overlapping cell (x, y, z) are
+		// gridSpheres[gridCellStart[c], gridCellStart[c + 1]) with c = x + resolution.x * (y + resolution.y * z)
+		Bounds gridBounds;
+		glm::ivec3 gridResolution = glm::ivec3(0);
+		glm::vec3 gridCellSize = glm::vec3(0);
+		std::vector<uint32_t> gridCellStart;
+		std::vector<uint32_t> gridSpheres;
+
+		size_t Size() const { return radius.size(); }
+		bool HasGrid() const { return !gridCellStart.empty(); }
+
+		void Clear();
+
+		void Add(const glm::vec3& center, float sphereRadius, uint32_t material);
+
+		/**
+		 * \brief Build a grid over spheres if asked to. Call it after adding every sphere
+		 * \param accelerator What to build. Auto only builds a grid if there are enough spheres and they are
+		 * uniform: similar radii and no cell much more crowded than the rest
+		 * \param otherPrimitives Primitives in the scene that are not spheres. Auto skips the grid if they outnumber spheres
+		 * \param cellsPerSphere Grid cells per sphere, more cells mean less spheres per cell but more cells per ray
+		 */
+		void BuildAccelerationStructures(SphereAccelerator accelerator, size_t otherPrimitives, float cellsPerSphere = SPHERE_GRID_CELLS_PER_SPHERE);
+
+		/**
+		 * \brief Intersect ray with spheres, updating hit if a nearer one is found
+		 */
+		void Intersect(const Ray& ray, float minT, PrimitiveHit& inOutHit) const;
+
+		/**
+		 * \brief Compute full intersection description from a hit in this set
+		 */
+		RayIntersectionResult GetIntersection(const Ray& ray, const PrimitiveHit& hit) const;
+
+	private:
+		void BuildGrid(float cellsPerSphere);
+
+		/**
+		 * \brief Intersect ray with a single sphere, updating hit if it's nearer
+		 * \param dd Squared length of ray direction
+		 */
+		void IntersectSphere(uint32_t sphere, const Ray& ray, float dd, float minT, PrimitiveHit& inOutHit) const;
+
+		/**
+		 * \brief Intersect ray with spheres in the cells it crosses, front to back, until no nearer hit is possible
+		 */
+		void IntersectGrid(const Ray& ray, float minT, PrimitiveHit& inOutHit, RenderCounters& counters) const;
+	};
+
+	/**
+	 * \brief How a mesh is stored
+	 */
+	enum class MeshFormat : uint8_t
+	{
+		Full,		// float positions and normals, 32 bit indices
+		Compact,	// 16 bit quantized positions, octahedral normals, 32 bit indices
+		Compact16	// Like Compact, but 16 bit indices relative to the first vertex of the mesh
+	};
+
+	/**
+	 * \brief Position quantized to 16 bits per axis inside the bounds of its mesh
+	 */
+	struct PackedPosition
+	{
+		uint16_t x, y, z;
+	};
+
+	/**
+	 * \brief Triangle with 16 bit indices, relative to the first vertex of its mesh
+	 */
+	struct PackedTriangle
+	{
+		uint16_t a, b, c;
+	};
+
+	/**
+	 * \brief Encode a unit vector in 32 bits: projected onto an octahedron, which is unfolded onto a square
+	 * and stored as two 16 bit fixed point coordinates. Zero or invalid vectors are encoded as +Z
+	 */
+	uint32_t EncodeOctahedral(const glm::vec3& normal);
+
+	/**
+	 * \brief Decode a unit vector encoded with EncodeOctahedral
+	 */
+	glm::vec3 DecodeOctahedral(uint32_t packed);
+
+	/**
+	 * \brief Triangle meshes. Meshes are stored once in object coordinates and shared by every instance of them,
+	 * instances are intersected by moving rays into object coordinates
+	 */
+	struct MeshSet
+	{
+		static constexpr uint32_t KIND = 1;
+
+		// Shared meshes, in object coordinates. Triangles of mesh m are the range
+		// [meshFirstTriangle[m], meshFirstTriangle[m] + meshTriangleCount[m]) in the triangle list of its format:
+		// packedTriangles for Compact16, indices otherwise. Positions and triangles are read by every intersection
+		// test, so like BVH nodes they're in large buffers, filled by BuildAccelerationStructures. Normals are only
+		// read for the nearest hit
+
+		// Full meshes
+		LargeBuffer<glm::vec3> vertices;
+		std::vector<glm::vec3> normals;
+		LargeBuffer<glm::uvec3> indices; // Already offset to point into vertices, or packedPositions for Compact meshes
+
+		// Compact meshes, decoded on the fly. Position is origin + packed position * step
+		LargeBuffer<PackedPosition> packedPositions;
+		std::vector<uint32_t> packedNormals;
+		LargeBuffer<PackedTriangle> packedTriangles;
+
+		// Per mesh
+		std::vector<MeshFormat> meshFormat;
+		std::vector<uint32_t> meshFirstVertex, meshFirstTriangle, meshTriangleCount;
+		std::vector<glm::vec3> meshQuantizationOrigin, meshQuantizationStep;
+		std::vector<Bounds> meshBounds;
+
+		// Levels of detail: each mesh might point to a coarser version of itself, NO_LOD for the coarsest.
+		// Error is the max distance in object coordinates from the original mesh, 0 for originals
+		static constexpr uint32_t NO_LOD = UINT32_MAX;
+		std::vector<uint32_t> meshCoarserLod;
+		std::vector<float> meshLodError;
+
+		// BVH of each mesh, NO_BVH for meshes small enough to test every triangle. Nodes of every mesh
+		// share the same buffer
+		static constexpr uint32_t NO_BVH = UINT32_MAX;
+		std::vector<uint32_t> meshBvhRoot;
+		LargeBuffer<WideBvhNode> bvhNodes;
+
+		// Instances, hot: read by intersection loop
+		std::vector<glm::vec3> boundsMin, boundsMax; // world coordinates
+		std::vector<glm::mat4> worldToObject;
+		std::vector<uint32_t> instanceMesh;
+		std::vector<float> windingSign; // -1 for mirroring transforms, which flip triangle winding
+		std::vector<float> instanceScale; // Max scale of transform, to move errors to world units
+
+		// Instances, cold: read for final hit only
+		std::vector<glm::mat3> normalToWorld;
+		std::vector<uint32_t> materialId;
+
+		size_t Size() const { return instanceMesh.size(); }
+		size_t GetNumMeshes() const { return meshFirstTriangle.size(); }
+
+		void Clear();
+
+		/**
+		 * \brief Store a mesh so it can be instanced
+		 * \param compact Use less memory per triangle in exchange of some precision and decoding cost
+		 * \return Id of new mesh
+		 */
+		uint32_t AddMesh(const Geometry& geometry, bool compact = false);
+
+		/**
+		 * \brief Store a mesh along with its levels of detail. Instances of it are intersected with the coarsest
+		 * level whose error is below the footprint of the ray
+		 * \param lods Levels of detail from finest to coarsest
+		 * \param compact Use less memory per triangle in exchange of some precision and decoding cost
+		 * \return Id of finest mesh, the one to instance
+		 */
+		uint32_t AddMeshWithLods(const Geometry& geometry, const std::vector<GeometryLod>& lods, bool compact = false);
+
+		/**
+		 * \brief Move positions and triangles of every mesh to their large buffers, and build a BVH for every mesh
+		 * big enough to need one. Call it once after adding every mesh, before intersecting them. Reorders
+		 * triangles of meshes with a BVH
+		 * \param threads Where to run build jobs, or nullptr to build in the calling thread
+		 * \param maxLeafTriangles Most triangles in a BVH leaf
+		 */
+		void BuildAccelerationStructures(thread_pool* threads = nullptr, uint32_t maxLeafTriangles = BVH_MAX_LEAF_TRIANGLES);
+
+		/**
+		 * \brief Place a mesh in the world
+		 * \param mesh Id of mesh to place
+		 * \param objectToWorld Transform from object coordinates of mesh to world coordinates
+		 * \param material Material of this instance
+		 */
+		void AddInstance(uint32_t mesh, const glm::mat4& objectToWorld, uint32_t material);
+
+		/**
+		 * \brief Intersect ray with every instance, updating hit if a nearer one is found
+		 */
+		void Intersect(const Ray& ray, float minT, PrimitiveHit& inOutHit) const;
+
+		/**
+		 * \brief Compute full intersection description from a hit in this set
+		 */
+		RayIntersectionResult GetIntersection(const Ray& ray, const PrimitiveHit& hit) const;
+
+		/**
+		 * \brief Bytes used by mesh geometry and BVH nodes
+		 */
+		size_t GetMeshMemory() const;
+
+		/**
+		 * \brief Get object space vertices of a triangle, whatever the format of its mesh
+		 */
+		void GetTriangleVertices(uint32_t mesh, uint32_t triangle, glm::vec3& outV1, glm::vec3& outV2, glm::vec3& outV3) const;
+
+	private:
+		/**
+		 * \brief Intersect ray, already in object coordinates, with a single instance of a mesh stored in the given format
+		 */
+		template<MeshFormat Format>
+		void IntersectInstance(size_t instance, uint32_t mesh, const Ray& objectRay, float minT, PrimitiveHit& inOutHit, RenderCounters& counters) const;
+
+		/**
+		 * \brief Pick coarsest level of detail of a mesh with an error below the given one
+		 * \param maxError Max error allowed, in object coordinates
+		 */
+		uint32_t SelectLod(uint32_t mesh, float maxError) const
+		{
+			while (meshCoarserLod[mesh] != NO_LOD && meshLodError[meshCoarserLod[mesh]] <= maxError)
+				mesh = meshCoarserLod[mesh];
+			return mesh;
+		}
+
+		/**
+		 * \brief Get object space vertices of a triangle from a mesh stored in the given format
+		 */
+		template<MeshFormat Format>
+		void GetTriangle(uint32_t mesh, uint32_t triangle, glm::vec3& outV1, glm::vec3& outV2, glm::vec3& outV3) const;
+
+		/**
+		 * \brief Get vertex indices of a triangle, pointing into vertices for Full meshes and packedPositions otherwise
+		 */
+		glm::uvec3 GetTriangleIndices(uint32_t mesh, uint32_t triangle) const;
+
+		glm::vec3 DecodePosition(uint32_t mesh, uint32_t vertex) const
+		{
+			auto const& packed = packedPositions[vertex];
+			return meshQuantizationOrigin[mesh] + glm::vec3(packed.x, packed.y, packed.z) * meshQuantizationStep[mesh];
+		}
+
+	private:
+		/**
+		 * \brief Positions and triangles of meshes added since last build, waiting to be moved to their large buffers
+		 */
+		struct PendingGeometry
+		{
+			std::vector<glm::vec3> vertices;
+			std::vector<glm::uvec3> indices;
+			std::vector<PackedPosition> packedPositions;
+			std::vector<PackedTriangle> packedTriangles;
+		};
+
+		PendingGeometry m_Pending;
+	};
+
+	/**
+	 * \brief Check if ray crosses an axis aligned box before maxT
+	 * \param inverseDirection 1 / ray direction, per component
+	 * \param outEnter Where the ray enters the box, 0 if it starts inside
+	 */
+	bool IntersectRayToBounds(const glm::vec3& origin, const glm::vec3& inverseDirection, const glm::vec3& boundsMin, const glm::vec3& boundsMax, float maxT, float& outEnter);
+
+	/**
+	 * \brief Intersect a ray to the triangle specified by the given vertices.
+	 * \param ray Ray to intersect
+	 * \param v1 First vertex of triangle
+	 * \param v2 Second vertex of triangle
+	 * \param v3 Third vertex of triangle
+	 * \param cullSign Triangles facing away are culled, winding order is reversed if this is negative
+	 * \param outT where in the ray the intersection happened
+	 * \param outU barycentric coordinate of intersection for v2
+	 * \param outV barycentric coordinate of intersection for v3
+	 * \return If there was an intersection
+	 */
+	bool IntersectRayToTriangle(
+		const Ray& ray,
+		const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3,
+		float cullSign,
+		float& outT, float& outU, float& outV);
+}
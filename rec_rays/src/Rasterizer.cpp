@@ -0,0 +1,366 @@
+// Local includes
+#include "Rasterizer.h"
+#include "Trace.h"
+
+// STL includes
+#include <algorithm>
+#include <future>
+#include <cmath>
+
+namespace RecRays
+{
+	/**
+	 * \brief Vertex of a triangle being clipped
+	 */
+	struct ClipVertex
+	{
+		glm::vec3 position;		// Homogeneous screen coordinates
+		glm::vec2 barycentric;	// Barycentric coordinates in original triangle
+	};
+
+	/**
+	 * \brief Cut away the part of a triangle too close to the eye or behind it
+	 * \param outVertices Polygon left, up to 4 vertices
+	 * \return How many vertices are left, 0 if whole triangle was cut away
+	 */
+	static size_t ClipNear(const ClipVertex (&vertices)[3], ClipVertex (&outVertices)[4])
+	{
+		size_t count = 0;
+		for (size_t i = 0; i < 3; i++)
+		{
+			auto const& current = vertices[i];
+			auto const& next = vertices[(i + 1) % 3];
+			bool const currentInside = current.position.z >= RASTER_NEAR_DEPTH;
+			bool const nextInside = next.position.z >= RASTER_NEAR_DEPTH;
+
+			if (currentInside)
+				outVertices[count++] = current;
+
+			// Homogeneous coordinates are linear in world space, so is everything interpolated along the edge
+			if (currentInside != nextInside)
+			{
+				float const s = (RASTER_NEAR_DEPTH - current.position.z) / (next.position.z - current.position.z);
+				outVertices[count++] = {
+					current.position + s * (next.position - current.position),
+					current.barycentric + s * (next.barycentric - current.barycentric)
+				};
+			}
+		}
+
+		return count;
+	}
+
+	void VisibilityRasterizer::Rasterize(const ViewPlane& viewPlane, size_t resX, size_t resY, const SphereSet& spheres, const MeshSet& meshes, thread_pool& threads)
+	{
+		RRAYS_TRACE_SCOPE("Rasterize visibility");
+		m_ViewPlane = viewPlane;
+		m_WorldToScreen = glm::inverse(glm::mat3(viewPlane.right, viewPlane.down, viewPlane.topLeft - viewPlane.eye));
+		m_ResX = resX;
+		m_ResY = resY;
+		m_BinsX = (resX + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+		m_BinsY = (resY + RASTER_BIN_SIZE - 1) / RASTER_BIN_SIZE;
+
+		PrimitiveHit noHit;
+		noHit.t = INFINITY;
+		m_Hits.assign(resX * resY, noHit);
+
+		// Number triangles of every instance one after another, so setup work can be split evenly
+		m_ObjectToWorld.clear();
+		m_FirstTriangle.assign(1, 0);
+		for (size_t i = 0; i < meshes.Size(); i++)
+		{
+			m_ObjectToWorld.push_back(glm::inverse(meshes.worldToObject[i]));
+			m_FirstTriangle.push_back(m_FirstTriangle.back() + meshes.meshTriangleCount[meshes.instanceMesh[i]]);
+		}
+
+		size_t const nBatches = (m_FirstTriangle.back() + RASTER_SETUP_BATCH - 1) / RASTER_SETUP_BATCH;
+		m_Batches.resize(nBatches);
+		std::vector<std::future<void>> futures;
+		for (size_t batch = 0; batch < nBatches; batch++)
+			futures.push_back(threads.execute(&VisibilityRasterizer::SetupTriangles, this, batch, std::cref(meshes)));
+
+		// Spheres are few, bin them here while triangles are set up
+		m_SphereBins.assign(m_BinsX * m_BinsY, {});
+		m_SphereRects.resize(spheres.Size());
+		for (size_t i = 0; i < spheres.Size(); i++)
+		{
+			auto const center = glm::vec3(spheres.centerX[i], spheres.centerY[i], spheres.centerZ[i]);
+			// Intersection tests let rays grazing the sphere within a tolerance hit it, the box should cover those too
+			auto const radius = std::sqrt(spheres.radius[i] * spheres.radius[i] + 0.0001f);
+
+			// Screen rectangle around the corners of the box around the sphere. Whole screen if some corner is behind the eye
+			float minX = 0, minY = 0, maxX = static_cast<float>(resX - 1), maxY = static_cast<float>(resY - 1);
+			bool inFront = true;
+			glm::vec2 screenMin(INFINITY), screenMax(-INFINITY);
+			for (int corner = 0; corner < 8; corner++)
+			{
+				auto const offset = glm::vec3(corner & 1 ? radius : -radius, corner & 2 ? radius : -radius, corner & 4 ? radius : -radius);
+				auto const position = ToScreen(center + offset);
+				inFront = inFront && position.z >= RASTER_NEAR_DEPTH;
+				auto const pixel = glm::vec2(position.x / position.z - 0.5f, position.y / position.z - 0.5f);
+				screenMin = glm::min(screenMin, pixel);
+				screenMax = glm::max(screenMax, pixel);
+			}
+
+			if (inFront)
+			{
+				minX = std::max(minX, std::ceil(screenMin.x));
+				minY = std::max(minY, std::ceil(screenMin.y));
+				maxX = std::min(maxX, std::floor(screenMax.x));
+				maxY = std::min(maxY, std::floor(screenMax.y));
+				if (minX > maxX || minY > maxY)
+					continue;
+			}
+
+			m_SphereRects[i] = { static_cast<size_t>(minX), static_cast<size_t>(minY), static_cast<size_t>(maxX) + 1, static_cast<size_t>(maxY) + 1 };
+			for (size_t binY = static_cast<size_t>(minY) / RASTER_BIN_SIZE; binY <= static_cast<size_t>(maxY) / RASTER_BIN_SIZE; binY++)
+				for (size_t binX = static_cast<size_t>(minX) / RASTER_BIN_SIZE; binX <= static_cast<size_t>(maxX) / RASTER_BIN_SIZE; binX++)
+					m_SphereBins[binY * m_BinsX + binX].push_back(static_cast<uint32_t>(i));
+		}
+
+		for (auto& future : futures)
+			future.get();
+		futures.clear();
+
+		// Bins cover disjoint pixels, so they can be drawn at the same time
+		for (size_t bin = 0; bin < m_BinsX * m_BinsY; bin++)
+			futures.push_back(threads.execute(&VisibilityRasterizer::DrawBin, this, bin, std::cref(spheres)));
+
+		for (auto& future : futures)
+			future.get();
+	}
+
+	void VisibilityRasterizer::Clear()
+	{
+		m_Hits.clear();
+		m_Batches.clear();
+		m_SphereBins.clear();
+		m_SphereRects.clear();
+	}
+
+	void VisibilityRasterizer::SetupTriangles(size_t batchIndex, const MeshSet& meshes)
+	{
+		RRAYS_TRACE_SCOPE("Set up triangles", "batch", static_cast<int64_t>(batchIndex));
+		auto& batch = m_Batches[batchIndex];
+		batch.triangles.clear();
+		batch.bins.assign(m_BinsX * m_BinsY, {});
+
+		size_t const first = batchIndex * RASTER_SETUP_BATCH;
+		size_t const end = std::min(first + RASTER_SETUP_BATCH, m_FirstTriangle.back());
+		size_t instance = std::upper_bound(m_FirstTriangle.begin(), m_FirstTriangle.end(), first) - m_FirstTriangle.begin() - 1;
+
+		for (size_t index = first; index < end; index++)
+		{
+			while (index >= m_FirstTriangle[instance + 1])
+				instance++;
+
+			auto const mesh = meshes.instanceMesh[instance];
+			auto const triangle = static_cast<uint32_t>(meshes.meshFirstTriangle[mesh] + (index - m_FirstTriangle[instance]));
+
+			glm::vec3 vertices[3];
+			meshes.GetTriangleVertices(mesh, triangle, vertices[0], vertices[1], vertices[2]);
+			for (auto& vertex : vertices)
+				vertex = glm::vec3(m_ObjectToWorld[instance] * glm::vec4(vertex, 1.f));
+
+			// Back faces are culled like ray tracing does. Mirroring transforms flip the winding of triangles
+			// and their normals at the same time, so in world space facing is just the side the eye is on
+			auto const normal = glm::cross(vertices[1] - vertices[0], vertices[2] - vertices[0]);
+			if (glm::dot(vertices[0] - m_ViewPlane.eye, normal) >= 0.f)
+				continue;
+
+			ClipVertex const clipVertices[3] = {
+				{ ToScreen(vertices[0]), glm::vec2(0, 0) },
+				{ ToScreen(vertices[1]), glm::vec2(1, 0) },
+				{ ToScreen(vertices[2]), glm::vec2(0, 1) }
+			};
+
+			ClipVertex polygon[4];
+			size_t const nVertices = ClipNear(clipVertices, polygon);
+
+			// Clipping leaves a triangle or a quad, split in a fan
+			for (size_t i = 1; i + 1 < nVertices; i++)
+			{
+				ScreenTriangle screenTriangle;
+				size_t const corners[3] = { 0, i, i + 1 };
+				for (size_t k = 0; k < 3; k++)
+				{
+					auto const& vertex = polygon[corners[k]];
+					float const inverseDepth = 1.f / vertex.position.z;
+					screenTriangle.positions[k] = glm::vec2(vertex.position.x * inverseDepth - 0.5f, vertex.position.y * inverseDepth - 0.5f);
+					screenTriangle.inverseDepths[k] = inverseDepth;
+					screenTriangle.barycentrics[k] = vertex.barycentric * inverseDepth;
+				}
+				screenTriangle.instance = static_cast<uint32_t>(instance);
+				screenTriangle.mesh = mesh;
+				screenTriangle.triangle = triangle;
+
+				BinTriangle(screenTriangle, static_cast<uint32_t>(batch.triangles.size()), batch);
+			}
+		}
+	}
+
+	void VisibilityRasterizer::BinTriangle(const ScreenTriangle& triangle, uint32_t index, SetupBatch& outBatch) const
+	{
+		auto const& p = triangle.positions;
+		auto const screenMin = glm::min(p[0], glm::min(p[1], p[2]));
+		auto const screenMax = glm::max(p[0], glm::max(p[1], p[2]));
+
+		// Pixel centers inside the box around the triangle
+		float const minX = std::max(0.f, std::ceil(screenMin.x));
+		float const minY = std::max(0.f, std::ceil(screenMin.y));
+		float const maxX = std::min(static_cast<float>(m_ResX - 1), std::floor(screenMax.x));
+		float const maxY = std::min(static_cast<float>(m_ResY - 1), std::floor(screenMax.y));
+		if (!(minX <= maxX && minY <= maxY))
+			return;
+
+		outBatch.triangles.push_back(triangle);
+		for (size_t binY = static_cast<size_t>(minY) / RASTER_BIN_SIZE; binY <= static_cast<size_t>(maxY) / RASTER_BIN_SIZE; binY++)
+			for (size_t binX = static_cast<size_t>(minX) / RASTER_BIN_SIZE; binX <= static_cast<size_t>(maxX) / RASTER_BIN_SIZE; binX++)
+				outBatch.bins[binY * m_BinsX + binX].push_back(index);
+	}
+
+	void VisibilityRasterizer::DrawBin(size_t bin, const SphereSet& spheres)
+	{
+		RRAYS_TRACE_SCOPE("Draw bin", "bin", static_cast<int64_t>(bin));
+		size_t const startX = (bin % m_BinsX) * RASTER_BIN_SIZE;
+		size_t const startY = (bin / m_BinsX) * RASTER_BIN_SIZE;
+		size_t const endX = std::min(startX + RASTER_BIN_SIZE, m_ResX);
+		size_t const endY = std::min(startY + RASTER_BIN_SIZE, m_ResY);
+
+		// Depth is measured along the plane normal, hits keep t along the ray of their pixel instead
+		float rayLengths[RASTER_BIN_SIZE * RASTER_BIN_SIZE];
+		for (size_t y = startY; y < endY; y++)
+			for (size_t x = startX; x < endX; x++)
+				rayLengths[(y - startY) * RASTER_BIN_SIZE + (x - startX)] = glm::length(GetPixelDirection(x, y));
+
+		// Batches and triangles inside them are drawn in order, so ties are always resolved the same way
+		for (auto const& batch : m_Batches)
+		{
+			for (auto const index : batch.bins[bin])
+			{
+				auto const& triangle = batch.triangles[index];
+				auto const& p = triangle.positions;
+
+				// Edge functions, in double so triangles right in front of the eye stay watertight.
+				// Edge k is the one in front of vertex k, and is positive on the inner side
+				double a[3], b[3], c[3];
+				for (int k = 0; k < 3; k++)
+				{
+					auto const& from = p[(k + 1) % 3];
+					auto const& to = p[(k + 2) % 3];
+					a[k] = -(static_cast<double>(to.y) - from.y);
+					b[k] = static_cast<double>(to.x) - from.x;
+					c[k] = -(a[k] * from.x + b[k] * from.y);
+				}
+
+				double area = a[0] * p[0].x + b[0] * p[0].y + c[0];
+				if (area == 0.0)
+					continue;
+
+				// Winding on screen depends on the transform of the instance, make inner side positive anyway
+				if (area < 0.0)
+				{
+					for (int k = 0; k < 3; k++)
+					{
+						a[k] = -a[k];
+						b[k] = -b[k];
+						c[k] = -c[k];
+					}
+					area = -area;
+				}
+
+				auto const screenMin = glm::min(p[0], glm::min(p[1], p[2]));
+				auto const screenMax = glm::max(p[0], glm::max(p[1], p[2]));
+				size_t const minX = std::max(startX, static_cast<size_t>(std::max(0.f, std::ceil(screenMin.x))));
+				size_t const minY = std::max(startY, static_cast<size_t>(std::max(0.f, std::ceil(screenMin.y))));
+				size_t const maxX = std::min(endX, static_cast<size_t>(std::max(0.f, std::floor(screenMax.x) + 1.f)));
+				size_t const maxY = std::min(endY, static_cast<size_t>(std::max(0.f, std::floor(screenMax.y) + 1.f)));
+
+				for (size_t y = minY; y < maxY; y++)
+				{
+					for (size_t x = minX; x < maxX; x++)
+					{
+						double weights[3];
+						bool inside = true;
+						for (int k = 0; k < 3; k++)
+						{
+							weights[k] = a[k] * static_cast<double>(x) + b[k] * static_cast<double>(y) + c[k];
+							inside = inside && weights[k] >= 0.0;
+						}
+
+						if (!inside)
+							continue;
+
+						// Screen space weights, then corrected for perspective
+						float const w0 = static_cast<float>(weights[0] / area);
+						float const w1 = static_cast<float>(weights[1] / area);
+						float const w2 = static_cast<float>(weights[2] / area);
+						float const inverseDepth = w0 * triangle.inverseDepths[0] + w1 * triangle.inverseDepths[1] + w2 * triangle.inverseDepths[2];
+						float const t = rayLengths[(y - startY) * RASTER_BIN_SIZE + (x - startX)] / inverseDepth;
+
+						auto& hit = m_Hits[y * m_ResX + x];
+						if (!(t > 0.f && t < hit.t))
+							continue;
+
+						auto const barycentric = (w0 * triangle.barycentrics[0] + w1 * triangle.barycentrics[1] + w2 * triangle.barycentrics[2]) / inverseDepth;
+						hit.t = t;
+						hit.kind = MeshSet::KIND;
+						hit.primitive = triangle.instance;
+						hit.mesh = triangle.mesh;
+						hit.triangle = triangle.triangle;
+						hit.u = barycentric.x;
+						hit.v = barycentric.y;
+					}
+				}
+			}
+		}
+
+		// Spheres are intersected with the ray of every pixel inside their rectangle, same test as ray tracing
+		for (auto const sphere : m_SphereBins[bin])
+		{
+			auto const center = glm::vec3(spheres.centerX[sphere], spheres.centerY[sphere], spheres.centerZ[sphere]);
+			auto const radius = spheres.radius[sphere];
+			auto const toCenter = m_ViewPlane.eye - center;
+
+			// Only the part of the rectangle inside this bin
+			auto const& rect = m_SphereRects[sphere];
+			size_t const minX = std::max(startX, rect.minX);
+			size_t const minY = std::max(startY, rect.minY);
+			size_t const maxX = std::min(endX, rect.endX);
+			size_t const maxY = std::min(endY, rect.endY);
+
+			for (size_t y = minY; y < maxY; y++)
+			{
+				for (size_t x = minX; x < maxX; x++)
+				{
+					auto const d = GetPixelDirection(x, y) / rayLengths[(y - startY) * RASTER_BIN_SIZE + (x - startX)];
+					float discriminant = glm::dot(d, toCenter);
+					discriminant = discriminant * discriminant - (glm::dot(d, d) * glm::dot(toCenter, toCenter) - radius * radius);
+					if (discriminant < -0.0001f)
+						continue;
+
+					float const middle = -glm::dot(d, toCenter);
+					float nearest = INFINITY;
+					if (std::abs(discriminant) > 0.0001f)
+					{
+						float const sqrtDiscriminant = std::sqrt(discriminant);
+						if (middle + sqrtDiscriminant > 0.f)
+							nearest = middle + sqrtDiscriminant;
+						if (middle - sqrtDiscriminant > 0.f && middle - sqrtDiscriminant < nearest)
+							nearest = middle - sqrtDiscriminant;
+					}
+					else if (middle > 0.f)
+						nearest = middle;
+
+					auto& hit = m_Hits[y * m_ResX + x];
+					if (nearest < hit.t)
+					{
+						hit.t = nearest;
+						hit.kind = SphereSet::KIND;
+						hit.primitive = sphere;
+					}
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,144 @@
+// Primary visibility by rasterization: draw scene primitives from the camera into a buffer with the nearest hit of each pixel
+#pragma once
+
+// STL includes
+#include <vector>
+#include <cstdint>
+
+// Third party includes
+#include <glm/glm.hpp>
+#include <threadpool.h>
+
+// Local includes
+#include "Primitives.h"
+
+namespace RecRays
+{
+	// Width and height in pixels of the screen bins triangles are sorted into before drawing
+	constexpr size_t RASTER_BIN_SIZE = 32;
+	// Triangles transformed, clipped and binned by a single job
+	constexpr size_t RASTER_SETUP_BATCH = 4096;
+	// Geometry closer to the eye than this fraction of the distance to the view plane is not drawn
+	constexpr float RASTER_NEAR_DEPTH = 1e-3f;
+
+	/**
+	 * \brief Where primary rays start and the grid of pixels they go through. The ray of pixel (x, y) goes from
+	 * the eye through topLeft + (x + 0.5) * right + (y + 0.5) * down
+	 */
+	struct ViewPlane
+	{
+		glm::vec3 eye;
+		glm::vec3 topLeft;	// Top left corner of the first pixel
+		glm::vec3 right;	// From a pixel to the next one to the right
+		glm::vec3 down;		// From a pixel to the next one below
+	};
+
+	/**
+	 * \brief Finds what the primary ray of every pixel hits without tracing them. Triangles are projected and
+	 * clipped in parallel batches, each batch sorting them into screen bins; then bins are drawn in parallel, each
+	 * one testing every triangle sorted into it. Spheres are drawn as the screen rectangle around them, intersecting
+	 * the ray of each pixel inside analytically. Meshes are always drawn at full detail, and back faces are culled
+	 * like ray tracing does
+	 */
+	class VisibilityRasterizer
+	{
+	public:
+		/**
+		 * \brief Draw every primitive into a new visibility buffer
+		 * \param viewPlane Camera primary rays are generated with
+		 * \param resX Width of image in pixels
+		 * \param resY Height of image in pixels
+		 * \param threads Where to run setup and drawing jobs. Waits for them before returning
+		 */
+		void Rasterize(const ViewPlane& viewPlane, size_t resX, size_t resY, const SphereSet& spheres, const MeshSet& meshes, thread_pool& threads);
+
+		/**
+		 * \brief Forget last visibility buffer
+		 */
+		void Clear();
+
+		bool IsEmpty() const { return m_Hits.empty(); }
+
+		/**
+		 * \brief Nearest hit of the primary ray of a pixel, t is measured along that ray. No hit if it misses everything
+		 */
+		const PrimitiveHit& GetHit(size_t x, size_t y) const { return m_Hits[y * m_ResX + x]; }
+
+	private:
+		/**
+		 * \brief Triangle after projection and clipping
+		 */
+		struct ScreenTriangle
+		{
+			glm::vec2 positions[3];		// Pixel coordinates, pixel centers are at integer coordinates
+			float inverseDepths[3];		// 1 / depth, interpolates linearly on screen
+			glm::vec2 barycentrics[3];	// Barycentric coordinates in original triangle, divided by depth
+			uint32_t instance, mesh, triangle;
+		};
+
+		/**
+		 * \brief Pixels a sphere might cover, [minX, endX) x [minY, endY)
+		 */
+		struct SphereRect
+		{
+			size_t minX, minY, endX, endY;
+		};
+
+		/**
+		 * \brief Triangles set up by a single job, and which of them touch each bin
+		 */
+		struct SetupBatch
+		{
+			std::vector<ScreenTriangle> triangles;
+			std::vector<std::vector<uint32_t>> bins;
+		};
+
+		/**
+		 * \brief Project, clip and bin a range of triangles. Triangles of all instances are numbered one after another
+		 * \param batchIndex Batch to set up, covers triangles [batchIndex * RASTER_SETUP_BATCH, (batchIndex + 1) * RASTER_SETUP_BATCH)
+		 */
+		void SetupTriangles(size_t batchIndex, const MeshSet& meshes);
+
+		/**
+		 * \brief Find nearest hit of every pixel in a bin
+		 */
+		void DrawBin(size_t bin, const SphereSet& spheres);
+
+		/**
+		 * \brief Add a triangle to the bins it might cover
+		 */
+		void BinTriangle(const ScreenTriangle& triangle, uint32_t index, SetupBatch& outBatch) const;
+
+		/**
+		 * \brief Move a world position to homogeneous screen coordinates: pixel coordinates times depth, and depth.
+		 * Depth is 1 on the view plane, 0 on the eye and negative behind it
+		 */
+		glm::vec3 ToScreen(const glm::vec3& position) const { return m_WorldToScreen * (position - m_ViewPlane.eye); }
+
+		/**
+		 * \brief Point on the view plane at the center of a pixel, relative to the eye
+		 */
+		glm::vec3 GetPixelDirection(size_t x, size_t y) const
+		{
+			return m_ViewPlane.topLeft - m_ViewPlane.eye + (static_cast<float>(x) + 0.5f) * m_ViewPlane.right + (static_cast<float>(y) + 0.5f) * m_ViewPlane.down;
+		}
+
+	private:
+		ViewPlane m_ViewPlane;
+		glm::mat3 m_WorldToScreen;
+		size_t m_ResX = 0, m_ResY = 0;
+		size_t m_BinsX = 0, m_BinsY = 0;
+
+		// Instances of meshes: transform and where their triangles start when all of them are numbered together
+		std::vector<glm::mat4> m_ObjectToWorld;
+		std::vector<size_t> m_FirstTriangle;
+
+		std::vector<SetupBatch> m_Batches;
+		// Spheres whose screen rectangle covers each bin
+		std::vector<std::vector<uint32_t>> m_SphereBins;
+		// Screen rectangle of each sphere, only valid for spheres in some bin
+		std::vector<SphereRect> m_SphereRects;
+
+		std::vector<PrimitiveHit> m_Hits;
+	};
+}
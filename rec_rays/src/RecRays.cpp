@@ -8,20 +8,293 @@
 #include <RecRays.h>
 #include <FreeImage.h>
 #include "SceneParser.h"
+#include "BinaryScene.h"
+#include "Autotune.h"
 #include "RecursiveRayTracer.h"
+#include "Trace.h"
+#include "Distributed.h"
+#include "Network.h"
+#include "ImageEncoder.h"
+#include "Benchmark.h"
+#include "TileCache.h"
+#include "Checkpoint.h"
+#include "SharedFrameBuffer.h"
+
+// stl includes
+#include <thread>
+#include <deque>
+#include <cstdlib>
 
 namespace RecRays
 {
-	int Client::ParseArgs(int argc, char** argv, std::string& outParsedFilepath)
+	/**
+	 * \brief Parse a TCP port number
+	 * \return If text was a valid port
+	 */
+	static bool ParsePort(const std::string& text, uint16_t& outPort)
+	{
+		char* end = nullptr;
+		auto const value = std::strtoul(text.c_str(), &end, 10);
+		if (text.empty() || *end != '\0' || value == 0 || value > 65535)
+			return false;
+
+		outPort = static_cast<uint16_t>(value);
+		return true;
+	}
+
+	int Client::ParseArgs(int argc, char** argv, ClientOptions& outOptions)
 	{
-		if (argc < 2)
+		ClientOptions options;
+		std::string filepath;
+
+		for (int i = 1; i < argc; i++)
 		{
-			std::cerr << "Missing argument: file path to scene description" << std::endl;
+			std::string const arg(argv[i]);
+
+			if (arg == "--trace")
+			{
+				if (i + 1 >= argc)
+				{
+					std::cerr << "Missing argument: file path for --trace" << std::endl;
+					return FAIL;
+				}
+				options.traceFile = argv[++i];
+			}
+			else if (arg == "--coordinator")
+			{
+				if (i + 1 >= argc || !ParsePort(argv[i + 1], options.port))
+				{
+					std::cerr << "Missing or invalid argument: port for --coordinator" << std::endl;
+					return FAIL;
+				}
+				options.mode = RunMode::Coordinator;
+				i++;
+			}
+			else if (arg == "--worker")
+			{
+				// Coordinator address as host:port
+				std::string const address = i + 1 < argc ? argv[i + 1] : "";
+				auto const separator = address.rfind(':');
+				if (separator == std::string::npos || separator == 0 || !ParsePort(address.substr(separator + 1), options.port))
+				{
+					std::cerr << "Missing or invalid argument: coordinator address for --worker, expected host:port" << std::endl;
+					return FAIL;
+				}
+				options.mode = RunMode::Worker;
+				options.coordinatorHost = address.substr(0, separator);
+				i++;
+			}
+			else if (arg == "--coordinator-timeout")
+			{
+				std::string const seconds = i + 1 < argc ? argv[i + 1] : "";
+				char* end = nullptr;
+				auto const value = std::strtol(seconds.c_str(), &end, 10);
+				if (seconds.empty() || *end != '\0' || value < 0 || value > INT32_MAX)
+				{
+					std::cerr << "Missing or invalid argument: seconds for --coordinator-timeout, 0 to wait forever" << std::endl;
+					return FAIL;
+				}
+				options.coordinatorTimeoutSeconds = static_cast<int>(value);
+				i++;
+			}
+			else if (arg == "--preview")
+			{
+				std::string const scale = i + 1 < argc ? argv[i + 1] : "";
+				char* end = nullptr;
+				options.previewScale = std::strtoul(scale.c_str(), &end, 10);
+				if (scale.empty() || *end != '\0' || !IsValidPreviewScale(options.previewScale))
+				{
+					std::cerr << "Missing or invalid argument: resolution divisor for --preview, expected 2 or 4" << std::endl;
+					return FAIL;
+				}
+				i++;
+			}
+			else if (arg == "--incremental")
+			{
+				if (i + 1 >= argc)
+				{
+					std::cerr << "Missing argument: file path for --incremental" << std::endl;
+					return FAIL;
+				}
+				options.stateFile = argv[++i];
+			}
+			else if (arg == "--tile-cache")
+			{
+				if (i + 1 >= argc)
+				{
+					std::cerr << "Missing argument: directory for --tile-cache" << std::endl;
+					return FAIL;
+				}
+				options.tileCacheDirectory = argv[++i];
+			}
+			else if (arg == "--tile-cache-size")
+			{
+				std::string const size = i + 1 < argc ? argv[i + 1] : "";
+				char* end = nullptr;
+				options.tileCacheMegabytes = std::strtoull(size.c_str(), &end, 10);
+				if (size.empty() || *end != '\0' || options.tileCacheMegabytes == 0)
+				{
+					std::cerr << "Missing or invalid argument: size in megabytes for --tile-cache-size" << std::endl;
+					return FAIL;
+				}
+				i++;
+			}
+			else if (arg == "--checkpoint")
+			{
+				if (i + 1 >= argc)
+				{
+					std::cerr << "Missing argument: file path for --checkpoint" << std::endl;
+					return FAIL;
+				}
+				options.checkpointFile = argv[++i];
+			}
+			else if (arg == "--export-scene")
+			{
+				if (i + 1 >= argc)
+				{
+					std::cerr << "Missing argument: file path for --export-scene" << std::endl;
+					return FAIL;
+				}
+				options.exportSceneFile = argv[++i];
+			}
+			else if (arg == "--profile")
+			{
+				if (i + 1 >= argc)
+				{
+					std::cerr << "Missing argument: file path for --profile" << std::endl;
+					return FAIL;
+				}
+				options.profileFile = argv[++i];
+			}
+			else if (arg == "--shm")
+			{
+				if (i + 1 >= argc)
+				{
+					std::cerr << "Missing argument: shared memory name for --shm" << std::endl;
+					return FAIL;
+				}
+				options.sharedMemoryName = argv[++i];
+			}
+			else if (arg == "--resume")
+				options.resume = true;
+			else if (arg == "--autotune")
+				options.autotune = true;
+			else if (arg == "--benchmark-spheres")
+				options.benchmarkSpheres = true;
+			else if (arg == "--no-window")
+				options.previewWindow = false;
+			else if (arg.rfind("--", 0) == 0)
+			{
+				std::cerr << "Unrecognized option: " << arg << std::endl;
+				return FAIL;
+			}
+			else if (filepath.empty())
+				filepath = arg;
+			else
+			{
+				std::cerr << "Unexpected argument: " << arg << std::endl;
+				return FAIL;
+			}
+		}
+
+		if (options.coordinatorTimeoutSeconds >= 0 && options.mode != RunMode::Coordinator)
+		{
+			std::cerr << "--coordinator-timeout needs --coordinator" << std::endl;
+			return FAIL;
+		}
+
+		// Only local renders show the image while it's drawn, workers and coordinators often run on machines without a display
+		if (options.mode != RunMode::Local)
+			options.previewWindow = false;
+
+		// Workers get their scene from the coordinator
+		if (options.mode == RunMode::Worker)
+		{
+			if (!filepath.empty())
+				std::cerr << "Ignoring scene file in worker mode: " << filepath << std::endl;
+
+			outOptions = options;
+			return SUCCESS;
+		}
+
+		// Benchmarks generate their own scenes
+		if (options.benchmarkSpheres)
+		{
+			if (options.mode != RunMode::Local || !filepath.empty())
+			{
+				std::cerr << "--benchmark-spheres takes no scene file and can't be used with --coordinator" << std::endl;
+				return FAIL;
+			}
+
+			outOptions = options;
+			return SUCCESS;
+		}
+
+		if (options.mode == RunMode::Coordinator && options.previewScale > 1)
+		{
+			std::cerr << "--preview can't be used with --coordinator, previews are rendered locally" << std::endl;
+			return FAIL;
+		}
+
+		if (!options.stateFile.empty() && (options.mode == RunMode::Coordinator || options.previewScale > 1))
+		{
+			std::cerr << "--incremental can't be used with --coordinator or --preview" << std::endl;
+			return FAIL;
+		}
+
+		if (!options.tileCacheDirectory.empty() && (options.mode == RunMode::Coordinator || options.previewScale > 1 || !options.stateFile.empty()))
+		{
+			std::cerr << "--tile-cache can't be used with --coordinator, --preview or --incremental" << std::endl;
+			return FAIL;
+		}
+
+		if (!options.checkpointFile.empty() && (options.mode == RunMode::Coordinator || options.previewScale > 1 || !options.stateFile.empty()))
+		{
+			std::cerr << "--checkpoint can't be used with --coordinator, --preview or --incremental" << std::endl;
+			return FAIL;
+		}
+
+		if (!options.sharedMemoryName.empty() && (options.mode == RunMode::Coordinator || options.previewScale > 1))
+		{
+			std::cerr << "--shm can't be used with --coordinator or --preview" << std::endl;
 			return FAIL;
 		}
 
-		// parse filepath from arguments
-		std::string filepath(argv[1]);
+		// Images published in shared memory are shown by external viewers, renders doing so run headless
+		if (!options.sharedMemoryName.empty())
+			options.previewWindow = false;
+
+		if (options.autotune && (options.mode != RunMode::Local || !options.exportSceneFile.empty()))
+		{
+			std::cerr << "--autotune can't be used with --coordinator or --export-scene" << std::endl;
+			return FAIL;
+		}
+
+		if (!options.exportSceneFile.empty() && options.mode != RunMode::Local)
+		{
+			std::cerr << "--export-scene can't be used with --coordinator, exported scenes are not rendered" << std::endl;
+			return FAIL;
+		}
+
+		if (options.resume && options.checkpointFile.empty())
+		{
+			std::cerr << "--resume needs a file to resume from, given with --checkpoint" << std::endl;
+			return FAIL;
+		}
+
+		if (filepath.empty())
+		{
+			std::cerr << "Missing argument: file path to scene description" << std::endl;
+			std::cerr << "Usage: rec_rays <scene file> [--trace <output.json>] [--coordinator <port> [--coordinator-timeout <seconds>]]" << std::endl;
+			std::cerr << "                            [--preview <2|4>] [--incremental <state file>]" << std::endl;
+			std::cerr << "                            [--tile-cache <directory>] [--tile-cache-size <MB>] [--checkpoint <file> [--resume]]" << std::endl;
+			std::cerr << "                            [--shm <name>] [--no-window] [--profile <file>]" << std::endl;
+			std::cerr << "       rec_rays <scene file> --export-scene <output.rrscene>" << std::endl;
+			std::cerr << "       rec_rays <scene file> --autotune [--profile <file>]" << std::endl;
+			std::cerr << "       rec_rays --worker <host:port> [--trace <output.json>]" << std::endl;
+			std::cerr << "       rec_rays --benchmark-spheres" << std::endl;
+			return FAIL;
+		}
 
 		// Check filepath existence
 		std::filesystem::path path(filepath);
@@ -32,32 +305,201 @@ namespace RecRays
 			return FAIL;
 		}
 
-		outParsedFilepath = absolute(path).string();
+		options.sceneFile = absolute(path).string();
+		outOptions = options;
 		return SUCCESS;
 	}
 
 	int Client::Run()
 	{
 		std::cout << "Starting RecRays..." << std::endl;
+		if (!m_Options.traceFile.empty())
+		{
+			Tracer::Enable();
+			Tracer::SetThreadName("Main");
+		}
+
 		Init();
 
-		// Try to parse scene
-		std::cout << "Parsing scene from " << m_SceneFile << "..." << std::endl;
+		// Renders of this machine use its tuned settings, if it was tuned
+		RenderProfile profile;
+		bool const hasProfile = !m_Options.autotune && !m_Options.benchmarkSpheres && LoadProfile(profile);
 
+		if (m_Options.mode == RunMode::Worker)
+			return RunWorker(hasProfile ? profile.nThreads : std::thread::hardware_concurrency());
+
+		if (m_Options.benchmarkSpheres)
+			return RunBenchmark();
+
+		// Try to parse scene
 		SceneDescription scene;
-		auto status = SceneParser::Parse(m_SceneFile, scene);
+		int status = LoadScene(scene);
 		if (status != SUCCESS)
 		{
 			std::cerr << "[ERROR] Could not parse scene" << std::endl;
 			return FAIL;
 		}
 
+		// Text scenes are converted once, so generated scenes load fast from then on
+		if (!m_Options.exportSceneFile.empty())
+		{
+			status = BinaryScene::Save(scene, m_Options.exportSceneFile);
+			if (status == SUCCESS)
+				std::cout << "Scene exported to " << m_Options.exportSceneFile << std::endl;
+			else
+				std::cerr << "[ERROR] Could not export scene to " << m_Options.exportSceneFile << std::endl;
+
+			std::cout << "Shutting Down RecRays..." << std::endl;
+			Shutdown();
+
+			if (!m_Options.traceFile.empty() && Tracer::WriteToFile(m_Options.traceFile) != SUCCESS)
+				std::cerr << "ERROR: Could not write trace to " << m_Options.traceFile << std::endl;
+
+			return status;
+		}
+
+		if (m_Options.autotune)
+			return RunAutotune(scene);
+
 		// With a parsed scene, define the recursive ray tracer and generate image
 		RecursiveRayTracer rayTracer(scene);
+		rayTracer.SetProfile(profile);
+
+		// Scenes with several cameras render all of them at once
+		if (scene.GetNumViews() > 1)
+		{
+			if (m_Options.mode != RunMode::Local || m_Options.previewScale > 1 || !m_Options.stateFile.empty())
+			{
+				std::cerr << "[ERROR] Scenes with multiple cameras can't be rendered distributed, as previews or incrementally" << std::endl;
+				return FAIL;
+			}
+
+			// Cached tiles are keyed by tile index only, every view would take the tiles of the first one
+			if (!m_Options.tileCacheDirectory.empty())
+			{
+				std::cerr << "[ERROR] Scenes with multiple cameras can't be rendered with --tile-cache" << std::endl;
+				return FAIL;
+			}
+
+			// Checkpoints hold the tiles of a single image
+			if (!m_Options.checkpointFile.empty())
+			{
+				std::cerr << "[ERROR] Scenes with multiple cameras can't be rendered with --checkpoint" << std::endl;
+				return FAIL;
+			}
+
+			// Shared frame buffers publish a single image
+			if (!m_Options.sharedMemoryName.empty())
+			{
+				std::cerr << "[ERROR] Scenes with multiple cameras can't be rendered with --shm" << std::endl;
+				return FAIL;
+			}
+
+			status = DrawViews(rayTracer, profile.nThreads);
+
+			std::cout << "Shutting Down RecRays..." << std::endl;
+			Shutdown();
+
+			if (!m_Options.traceFile.empty() && Tracer::WriteToFile(m_Options.traceFile) != SUCCESS)
+				std::cerr << "ERROR: Could not write trace to " << m_Options.traceFile << std::endl;
+
+			return status;
+		}
+
+		rayTracer.SetPreviewWindow(m_Options.previewWindow);
 
+		// Image is compressed and written in the background, local renders start compressing rows as they finish
+		PngEncoder encoder;
+		TileCache tileCache(m_Options.tileCacheDirectory, m_Options.tileCacheMegabytes << 20);
+		std::unique_ptr<RenderCheckpoint> checkpoint;
+		SharedFrameBuffer sharedFrameBuffer;
 		FIBITMAP* image;
 		std::cout << "Drawing scene..." << std::endl;
-		status = rayTracer.Draw(image, 12);
+		if (m_Options.mode == RunMode::Coordinator)
+		{
+			// Tiles are rendered by worker processes instead
+			if (Socket::InitNetworking() != SUCCESS)
+			{
+				std::cerr << "[ERROR] Could not init networking" << std::endl;
+				return FAIL;
+			}
+
+			int const timeoutSeconds = m_Options.coordinatorTimeoutSeconds >= 0 ? m_Options.coordinatorTimeoutSeconds : DEFAULT_COORDINATOR_TIMEOUT_SECONDS;
+			RenderCoordinator coordinator(scene, m_Options.port, timeoutSeconds);
+			status = coordinator.Draw(image);
+			Socket::ShutdownNetworking();
+
+			if (status == SUCCESS)
+				encoder.Start(image);
+		}
+		else if (m_Options.previewScale > 1)
+		{
+			RRAYS_TRACE_SCOPE("RecursiveRayTracer::DrawPreview");
+			status = rayTracer.DrawPreview(image, m_Options.previewScale, profile.nThreads);
+
+			if (status == SUCCESS)
+				encoder.Start(image);
+		}
+		else
+		{
+			// Previous state is optional, the first render just draws everything
+			RenderState previousState;
+			if (!m_Options.stateFile.empty())
+			{
+				bool const hasPrevious = LoadRenderState(m_Options.stateFile, previousState) == SUCCESS;
+				if (hasPrevious)
+					std::cout << "Loaded previous render state from " << m_Options.stateFile << std::endl;
+				else
+					std::cout << "No previous render state in " << m_Options.stateFile << ", drawing every tile" << std::endl;
+
+				rayTracer.EnableIncrementalRendering(hasPrevious ? &previousState : nullptr);
+			}
+
+			// Same scene, meshes and settings as a cached render give the same tiles, whatever the output file is
+			if (!m_Options.tileCacheDirectory.empty())
+			{
+				if (tileCache.Open() == SUCCESS)
+					rayTracer.SetTileCache(&tileCache, TileCache::HashScene(scene, rayTracer.GetTileSize()));
+				else
+					std::cerr << "[WARNING] Tile cache disabled" << std::endl;
+			}
+
+			// Finished tiles are saved as they go, an interrupted render can be resumed from them
+			if (!m_Options.checkpointFile.empty())
+			{
+				checkpoint = std::make_unique<RenderCheckpoint>(m_Options.checkpointFile, TileCache::HashScene(scene, rayTracer.GetTileSize()), rayTracer.GetNumTiles());
+				if (m_Options.resume && checkpoint->Load() == SUCCESS)
+					std::cout << "Loaded checkpoint with " << checkpoint->GetNumFinishedTiles() << " finished tiles from " << m_Options.checkpointFile << std::endl;
+				else if (m_Options.resume)
+					std::cout << "No checkpoint of this scene in " << m_Options.checkpointFile << ", drawing every tile" << std::endl;
+
+				rayTracer.SetCheckpoint(checkpoint.get());
+			}
+
+			// Viewers on this machine can map the image while it's drawn
+			if (!m_Options.sharedMemoryName.empty())
+			{
+				if (sharedFrameBuffer.Create(m_Options.sharedMemoryName, scene.imgResX, scene.imgResY, rayTracer.GetTileSize()) == SUCCESS)
+				{
+					std::cout << "Publishing image in shared memory segment " << m_Options.sharedMemoryName << std::endl;
+					rayTracer.SetSharedFrameBuffer(&sharedFrameBuffer);
+				}
+				else
+					std::cerr << "[WARNING] Image won't be published in shared memory" << std::endl;
+			}
+
+			RRAYS_TRACE_SCOPE("RecursiveRayTracer::Draw");
+			rayTracer.SetImageEncoder(&encoder);
+			status = rayTracer.Draw(image, profile.nThreads);
+
+			if (status == SUCCESS && !m_Options.stateFile.empty())
+			{
+				if (SaveRenderState(m_Options.stateFile, rayTracer.GetRenderState()) == SUCCESS)
+					std::cout << "Saved render state to " << m_Options.stateFile << std::endl;
+				else
+					std::cerr << "[ERROR] Could not save render state to " << m_Options.stateFile << std::endl;
+			}
+		}
 
 		if (status != SUCCESS)
 		{
@@ -65,37 +507,232 @@ namespace RecRays
 			return FAIL;
 		}
 
-		// Save image to file
-		std::filesystem::path outputPath("output.png");
+		// Save image to file, while the rest of the output is produced
+		std::filesystem::path outputPath(scene.output.empty() ? "output.png" : scene.output);
 		std::cout << "Saving image to " << absolute(outputPath) << "..." << std::endl;
-		if (FreeImage_Save(FIF_PNG, image, outputPath.string().c_str()))
+		encoder.Finish(outputPath.string());
+
+		// Report where render time went. Workers keep their own statistics in distributed renders
+		if (m_Options.mode == RunMode::Local)
+		{
+			auto const& stats = rayTracer.GetStats();
+			stats.Print(std::cout);
+
+			std::filesystem::path heatmapPath = outputPath;
+			heatmapPath.replace_filename(outputPath.stem().string() + "_heatmap.png");
+			FIBITMAP* heatmap = stats.CreateHeatmap(scene.imgResX, scene.imgResY);
+			if (heatmap && FreeImage_Save(FIF_PNG, heatmap, heatmapPath.string().c_str()))
+				std::cout << "Tile cost heatmap saved to " << absolute(heatmapPath) << std::endl;
+			else
+				std::cerr << "ERROR: Could not save tile cost heatmap" << std::endl;
+
+			if (heatmap)
+				FreeImage_Unload(heatmap);
+		}
+
+		bool saved;
+		{
+			RRAYS_TRACE_SCOPE("PngEncoder::Wait");
+			saved = encoder.Wait() == SUCCESS;
+		}
+		if (saved)
 			std::cout << "Image successfully saved!" << std::endl;
 		else
 			std::cerr << "ERROR: Could not save image :(" << std::endl;
-		
+
+		// Nothing left to resume once the image is on disk
+		if (saved && checkpoint)
+			checkpoint->Remove();
+
+		FreeImage_Unload(image);
 		
 		std::cout << "Shutting Down RecRays..." << std::endl;
 		Shutdown();
+
+		if (!m_Options.traceFile.empty())
+		{
+			if (Tracer::WriteToFile(m_Options.traceFile) == SUCCESS)
+				std::cout << "Trace written to " << m_Options.traceFile << std::endl;
+			else
+				std::cerr << "ERROR: Could not write trace to " << m_Options.traceFile << std::endl;
+		}
+
 		return SUCCESS;
 	}
 
+	int Client::LoadScene(SceneDescription& outScene)
+	{
+		if (BinaryScene::IsBinarySceneFile(m_SceneFile))
+		{
+			std::cout << "Loading binary scene from " << m_SceneFile << "..." << std::endl;
+			RRAYS_TRACE_SCOPE("BinaryScene::Load");
+			return BinaryScene::Load(m_SceneFile, outScene);
+		}
+
+		std::cout << "Parsing scene from " << m_SceneFile << "..." << std::endl;
+		RRAYS_TRACE_SCOPE("SceneParser::Parse");
+		return SceneParser::Parse(m_SceneFile, outScene);
+	}
+
+	bool Client::LoadProfile(RenderProfile& outProfile)
+	{
+		// Machines that were never tuned just use defaults
+		auto const filepath = GetProfileFile();
+		std::error_code error;
+		if (!std::filesystem::exists(filepath, error))
+			return false;
+
+		if (LoadRenderProfile(filepath, outProfile) != SUCCESS)
+		{
+			std::cerr << "[WARNING] Ignoring render profile " << filepath << ", using defaults" << std::endl;
+			return false;
+		}
+
+		std::cout << "Using render profile " << filepath << ": " << outProfile.nThreads << " threads, " << outProfile.tileSize << " pixel tiles" << std::endl;
+		return true;
+	}
+
+	std::string Client::GetProfileFile() const
+	{
+		return m_Options.profileFile.empty() ? RENDER_PROFILE_FILE : m_Options.profileFile;
+	}
+
+	int Client::RunAutotune(const SceneDescription& scene)
+	{
+		RenderProfile profile;
+		int status = RecRays::RunAutotune(scene, profile, std::cout);
+		if (status == SUCCESS)
+		{
+			status = SaveRenderProfile(GetProfileFile(), profile);
+			if (status == SUCCESS)
+				std::cout << "Render profile saved to " << absolute(std::filesystem::path(GetProfileFile())) << std::endl;
+			else
+				std::cerr << "[ERROR] Could not save render profile to " << GetProfileFile() << std::endl;
+		}
+
+		std::cout << "Shutting Down RecRays..." << std::endl;
+		Shutdown();
+
+		if (!m_Options.traceFile.empty() && Tracer::WriteToFile(m_Options.traceFile) != SUCCESS)
+			std::cerr << "ERROR: Could not write trace to " << m_Options.traceFile << std::endl;
+
+		return status;
+	}
+
+	int Client::RunWorker(size_t nThreads)
+	{
+		if (Socket::InitNetworking() != SUCCESS)
+		{
+			std::cerr << "[ERROR] Could not init networking" << std::endl;
+			return FAIL;
+		}
+
+		RenderWorker worker(m_Options.coordinatorHost, m_Options.port, nThreads);
+		auto const status = worker.Run();
+		Socket::ShutdownNetworking();
+
+		std::cout << "Shutting Down RecRays..." << std::endl;
+		Shutdown();
+
+		if (!m_Options.traceFile.empty() && Tracer::WriteToFile(m_Options.traceFile) != SUCCESS)
+			std::cerr << "ERROR: Could not write trace to " << m_Options.traceFile << std::endl;
+
+		return status;
+	}
+
+	int Client::RunBenchmark()
+	{
+		auto const status = RunSphereBenchmark(std::cout);
+
+		std::cout << "Shutting Down RecRays..." << std::endl;
+		Shutdown();
+
+		if (!m_Options.traceFile.empty() && Tracer::WriteToFile(m_Options.traceFile) != SUCCESS)
+			std::cerr << "ERROR: Could not write trace to " << m_Options.traceFile << std::endl;
+
+		return status;
+	}
+
+	int Client::DrawViews(RecursiveRayTracer& rayTracer, size_t nThreads)
+	{
+		auto const& scene = rayTracer.GetSceneDescription();
+		size_t const nViews = scene.GetNumViews();
+
+		// Each view is compressed and written in the background as soon as it's done, while the next ones are traced.
+		// Encoders share the threads a single image would use
+		std::deque<PngEncoder> encoders;
+		for (size_t view = 0; view < nViews; view++)
+			encoders.emplace_back(std::max<size_t>(PNG_ENCODER_THREADS / nViews, 1));
+
+		// Views without an output file are numbered after the main one
+		std::vector<FIBITMAP*> images;
+		auto const saveView = [&scene, &images, &encoders](size_t view)
+		{
+			auto const& output = scene.GetView(view).output;
+			std::filesystem::path outputPath(!output.empty() ? output : view == 0 ? "output.png" : "output_" + std::to_string(view) + ".png");
+			std::cout << std::endl << "Saving image to " << absolute(outputPath) << "..." << std::endl;
+			encoders[view].Start(images[view]);
+			encoders[view].Finish(outputPath.string());
+		};
+
+		std::cout << "Drawing " << nViews << " views of scene..." << std::endl;
+		{
+			RRAYS_TRACE_SCOPE("RecursiveRayTracer::DrawViews");
+			if (rayTracer.DrawViews(images, nThreads, saveView) != SUCCESS)
+			{
+				std::cerr << "[ERROR] Could not draw image" << std::endl;
+				return FAIL;
+			}
+		}
+
+		// Tiles of different views overlap in the image, so there's no heatmap for them
+		rayTracer.GetStats().Print(std::cout);
+
+		int status = SUCCESS;
+		for (size_t view = 0; view < images.size(); view++)
+		{
+			RRAYS_TRACE_SCOPE("PngEncoder::Wait", "view", static_cast<int64_t>(view));
+			if (encoders[view].Wait() != SUCCESS)
+			{
+				std::cerr << "ERROR: Could not save image :(" << std::endl;
+				status = FAIL;
+			}
+
+			FreeImage_Unload(images[view]);
+		}
+
+		if (status == SUCCESS)
+			std::cout << "Images successfully saved!" << std::endl;
+
+		return status;
+	}
+
 	void Client::Init()
 	{
 		std::cout << "Starting FreeImage..." << std::endl;
-		FreeImage_Initialise();
-		std::cout << "Loading Geometry..." << std::endl;
+		{
+			RRAYS_TRACE_SCOPE("FreeImage_Initialise");
+			FreeImage_Initialise();
+		}
+		std::cout << "Starting geometry loader..." << std::endl;
 		GeometryLoader::Init();
-		std::cout << "Starting SDL..." << std::endl;
 
-		auto const error = SDL_Init(SDL_INIT_VIDEO);
+		// Headless renders never open a window, so they run on machines without a display
+		if (!m_Options.previewWindow)
+			return;
+
+		std::cout << "Starting SDL..." << std::endl;
+		int error;
+		{
+			RRAYS_TRACE_SCOPE("SDL_Init");
+			error = SDL_Init(SDL_INIT_VIDEO);
+		}
 		if (error)
 		{
 			const char* sdlError = SDL_GetError();
-			std::cerr << "Could not init SDL. Error: " << sdlError << std::endl;
-			exit(1);
+			std::cerr << "[WARNING] Could not init SDL, drawing without preview window. Error: " << sdlError << std::endl;
+			m_Options.previewWindow = false;
 		}
-
-
 	}
 
 	void Client::Shutdown()
@@ -104,8 +741,11 @@ namespace RecRays
 		FreeImage_DeInitialise();
 		std::cout << "Freeing geometry memory..." << std::endl;
 		GeometryLoader::Shutdown();
-		std::cout << "Shutting down SDL..." << std::endl;
-		SDL_Quit();
+		if (SDL_WasInit(SDL_INIT_VIDEO))
+		{
+			std::cout << "Shutting down SDL..." << std::endl;
+			SDL_Quit();
+		}
 	}
 
 
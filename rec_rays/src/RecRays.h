@@ -2,12 +2,87 @@
 #include <string>
 #include <iostream>
 #include <filesystem>
+#include <cstdint>
 
-#define SUCCESS 0
-#define FAIL 1
+// Local includes
+#include "Status.h"
 
 namespace RecRays
 {
+	class RecursiveRayTracer;
+	struct SceneDescription;
+	struct RenderProfile;
+
+	/**
+	 * \brief How this process takes part in rendering
+	 */
+	enum class RunMode
+	{
+		Local,			// Render everything in this process
+		Coordinator,	// Parse scene and hand out tiles to worker processes
+		Worker			// Render tiles for a coordinator
+	};
+
+	/**
+	 * \brief Options parsed from command line arguments
+	 */
+	struct ClientOptions
+	{
+		// Name of file to parse to generate scene, .rrscene files are loaded as binary scenes
+		std::string sceneFile;
+
+		// Where to write the scene as a binary scene file instead of rendering it. Empty to render
+		std::string exportSceneFile;
+
+		// Where to write a Chrome trace of the pipeline, empty when tracing is disabled
+		std::string traceFile;
+
+		RunMode mode = RunMode::Local;
+
+		// Port to listen to as coordinator, or to connect to as worker
+		uint16_t port = 0;
+
+		// Where to find the coordinator as worker
+		std::string coordinatorHost;
+
+		// How long a coordinator waits without a worker connecting or a tile arriving before failing, 0 to wait forever.
+		// Negative for DEFAULT_COORDINATOR_TIMEOUT_SECONDS
+		int coordinatorTimeoutSeconds = -1;
+
+		// Trace at 1 / previewScale of the resolution and upsample, 1 renders at full resolution
+		size_t previewScale = 1;
+
+		// Where to keep state of the last render, so the next one only draws tiles affected by scene edits. Empty to disable
+		std::string stateFile;
+
+		// Time sphere accelerators on generated scenes instead of rendering a scene file
+		bool benchmarkSpheres = false;
+
+		// Where to keep finished tiles so renders of the same scene are assembled from disk. Empty to disable
+		std::string tileCacheDirectory;
+
+		// Size limit of the tile cache, in megabytes
+		uint64_t tileCacheMegabytes = 256;
+
+		// Where to save finished tiles every now and then while drawing. Empty to disable
+		std::string checkpointFile;
+
+		// Start from the tiles of the checkpoint file instead of drawing everything
+		bool resume = false;
+
+		// Name of shared memory segment where to publish the image while it's drawn, for external viewers. Empty to disable
+		std::string sharedMemoryName;
+
+		// Time renders of the scene with different settings and save the fastest ones to the profile file, instead of rendering it
+		bool autotune = false;
+
+		// Render profile of this machine, loaded by renders and written by autotune. Empty for RENDER_PROFILE_FILE
+		std::string profileFile;
+
+		// Show the image in a window while it's drawn. Off for headless renders, which need no display
+		bool previewWindow = true;
+	};
+
 	/**
 	 * \brief Main interface for this application, use this class to run workflow
 	 */
@@ -16,10 +91,11 @@ namespace RecRays
 	public:
 		/**
 		 * \brief Create a new client object to run workflow
-		 * \param filepath Name of file to parse to generate scene
+		 * \param options Options for this run, like the scene file to parse
 		 */
-		Client(const std::string& filepath, size_t width = 512, size_t height = 512)
-			: m_SceneFile(filepath)
+		Client(const ClientOptions& options, size_t width = 512, size_t height = 512)
+			: m_SceneFile(options.sceneFile)
+			, m_Options(options)
 			, m_Width(width)
 			, m_Height(height)
 		{}
@@ -28,10 +104,10 @@ namespace RecRays
 		 * \brief Parse arguments from command line arguments
 		 * \param argc How many arguments, provided from main function 
 		 * \param argv Actual arguments, provided from main function
-		 * \param outParsedFilepath Parsed filepath from arguments
+		 * \param outOptions Parsed options from arguments
 		 * \return Success status: 0 for success, 1 for failure
 		 */
-		static int ParseArgs(int argc, char** argv, std::string& outParsedFilepath);
+		static int ParseArgs(int argc, char** argv, ClientOptions& outOptions);
 
 		/**
 		 * \brief Run application: Parse scene file and perform ray tracing algorithm
@@ -40,7 +116,45 @@ namespace RecRays
 
 	private:
 		/**
-		 * \brief Init subsystems, like freeimage
+		 * \brief Read scene file, parsing text or loading a binary scene depending on its extension
+		 */
+		int LoadScene(SceneDescription& outScene);
+
+		/**
+		 * \brief Load render profile of this machine if there's one
+		 * \param outProfile Loaded profile, left as is if there's none
+		 * \return If a profile was loaded
+		 */
+		bool LoadProfile(RenderProfile& outProfile);
+
+		/**
+		 * \brief Where the render profile of this machine is
+		 */
+		std::string GetProfileFile() const;
+
+		/**
+		 * \brief Find the fastest render profile for a scene and save it
+		 */
+		int RunAutotune(const SceneDescription& scene);
+
+		/**
+		 * \brief Serve tiles to a coordinator instead of rendering a scene file
+		 */
+		int RunWorker(size_t nThreads);
+
+		/**
+		 * \brief Time sphere accelerators on generated scenes and print results, instead of rendering a scene file
+		 */
+		int RunBenchmark();
+
+		/**
+		 * \brief Draw every camera of a scene with more than one and save their images
+		 */
+		int DrawViews(RecursiveRayTracer& rayTracer, size_t nThreads);
+
+		/**
+		 * \brief Init subsystems, like freeimage. SDL video is only started for the preview window, if it can't be
+		 * the window is disabled
 		 */
 		void Init();
 
@@ -55,6 +169,9 @@ namespace RecRays
 		 */
 		std::string m_SceneFile;
 
+		// Options this client was created with
+		ClientOptions m_Options;
+
 		// Dimensions of image to render
 		size_t m_Width, m_Height;
 
@@ -1,9 +1,15 @@
 // Local includes
 #include "RecursiveRayTracer.h"
-#include "RecRays.h"
+#include "Status.h"
+#include "Trace.h"
+#include "Memory.h"
+#include "SceneSerializer.h"
 
 // STL includes
 #include <assert.h>
+#include <algorithm>
+#include <iostream>
+#include <thread>
 
 // Vendor includes
 #include <glm/gtc/matrix_transform.hpp>
@@ -13,6 +19,9 @@
 
 namespace RecRays
 {
+	// How often renders without a preview window check for finished tiles
+	constexpr int HEADLESS_POLL_MILLISECONDS = 10;
+
 	// -- < Scene Description > -------------------------
 	int SceneDescription::AddLight(const Light& newLigth)
 	{
@@ -27,49 +36,64 @@ namespace RecRays
 
 	int SceneDescription::AddObject(const Object& newObject)
 	{
-		// Can't add light if already at max objects
-		if (objects.size() == MAX_OBJECTS)
+		// Can't add object if already at max objects, spheres have a bound of their own
+		bool const isSphere = newObject.shape == Shape::Sphere;
+		if (isSphere ? nSpheres == MAX_SPHERES : objects.size() - nSpheres == MAX_OBJECTS)
 			return FAIL;
 
 		objects.push_back(newObject);
+		nSpheres += isSphere ? 1 : 0;
 
 		return SUCCESS;
 	}
 
 	// -- < Object > ---------------------------------
-	void Object::SetGeometry()
+	Material Object::GetMaterial(bool enableLight) const
+	{
+		Material material;
+		material.ambient = ambient;
+		material.diffuse = diffuse;
+		material.specular = specular;
+		material.emission = emission;
+		material.mirror = mirror;
+		material.shininess = shininess;
+		material.Classify(enableLight);
+
+		return material;
+	}
+
+	Bounds Object::GetBounds() const
 	{
-		// Load proper geometry
+		Bounds bounds;
+		const Geometry* geometry = nullptr;
 		switch (shape)
 		{
+		case Shape::Sphere:
+		{
+			auto const center = glm::vec3(transform * glm::vec4(0, 0, 0, 1));
+			bounds.Extend(center - glm::vec3(size));
+			bounds.Extend(center + glm::vec3(size));
+			return bounds;
+		}
 		case Shape::Cube:
-			geometry = GeometryLoader::GetCubeGeometry();
+			geometry = &GeometryLoader::GetCubeGeometry();
 			break;
 		case Shape::Teapot:
-			geometry = GeometryLoader::GetTeapotGeometry();
+			geometry = &GeometryLoader::GetTeapotGeometry();
 			break;
-		case Shape::Sphere:
-			return;
 		default:
 			assert(false && "Invalid shape");
+			return bounds;
 		}
 
-		// Transform geometry:
-		for (auto& vertex : geometry.vertices)
-		{
-			// Scale object to right size
-			vertex = size * vertex;
+		for (auto const& vertex : geometry->vertices)
+			bounds.Extend(vertex);
 
-			// Set up vertices  transformation
-			vertex = glm::vec3(transform * glm::vec4(vertex, 1.0f));
-		}
+		// Geometry could not be loaded
+		if (bounds.IsEmpty())
+			return bounds;
 
-		// Set up normals
-		auto const inverseTransform = glm::transpose(glm::inverse(transform));
-		for (auto& normal : geometry.normals)
-		{
-			normal = glm::vec3(inverseTransform * glm::vec4(normal, 0.f));
-		}
+		return bounds.Transform(transform * glm::scale(glm::mat4(1), glm::vec3(size)));
 	}
 
 	// -- < Camera > -----------------------------------
@@ -174,7 +198,30 @@ namespace RecRays
 		pixelCoordinates += offsetInsidePixel;
 
 		// Generate ray 
-		return Ray{ m_Camera.GetPosition(), glm::normalize(pixelCoordinates - m_Camera.GetPosition()) };
+		auto const toPixel = pixelCoordinates - m_Camera.GetPosition();
+		auto const distanceToPixel = glm::length(toPixel);
+		auto const direction = toPixel / distanceToPixel;
+
+		// Rays spread over a pixel where they cross the view plane. Pixels are seen at an angle,
+		// so they cover less once projected perpendicular to the ray
+		float const cosAngle = std::abs(glm::dot(direction, m_Camera.GetV()));
+		float const spread = std::min(pixelWidth, pixelHeight) * cosAngle / distanceToPixel;
+
+		return Ray{ m_Camera.GetPosition(), direction, 0.f, spread };
+	}
+
+	ViewPlane RayGenerator::GetViewPlane() const
+	{
+		// Same grid GetRayThroughPixel walks
+		float const pixelWidth = (m_Right + m_Left) / static_cast<float>(m_PixelsX);
+		float const pixelHeight = (m_Top + m_Bottom) / static_cast<float>(m_PixelsY);
+
+		ViewPlane viewPlane;
+		viewPlane.eye = m_Camera.GetPosition();
+		viewPlane.topLeft = -m_Left * m_Camera.GetU() + m_Top * m_Camera.GetW() + m_DistanceToViewPlane * m_Camera.GetV();
+		viewPlane.right = m_Camera.GetU() * pixelWidth;
+		viewPlane.down = -m_Camera.GetW() * pixelHeight;
+		return viewPlane;
 	}
 
 	// -- < Recursive ray tracer > ----------------------------------------------
@@ -184,16 +231,7 @@ namespace RecRays
 		m_SceneDescription = description;
 
 		// Set up ray generator
-		auto const cam = Camera(description.camera.up, description.camera.position, description.camera.lookAt);
-		auto const height = HeightFromAspectRatio(description.imgWidth / description.imgHeight, description.imgWidth);
-		m_RayGenerator = RayGenerator{
-			cam,
-			description.imgWidth,
-			height, // ??
-			description.imgResX,
-			description.imgResY,
-			FocalLength(description.camera.fovy,height)
-		};
+		m_RayGenerator = CreateRayGenerator(description.camera);
 
 		// Set up random seed to be used in ray generation
 		srand(static_cast<unsigned>(time(nullptr)));
@@ -202,55 +240,216 @@ namespace RecRays
 
 	int RecursiveRayTracer::Draw(FIBITMAP*& outImage, size_t nThreads = 12)
 	{
-		// Allocate space for this image
-		auto Image = FreeImage_Allocate(
+		return DrawFrame(outImage, nThreads, [this](thread_pool& threads, TwoDimensionVector<glm::vec4>& colorBuffer, FIBITMAP* image)
+		{
+			DrawTiles(threads, colorBuffer, image);
+		});
+	}
+
+	int RecursiveRayTracer::DrawPreview(FIBITMAP*& outImage, size_t scale, size_t nThreads)
+	{
+		assert(IsValidPreviewScale(scale) && "Unsupported preview scale");
+		assert(GetTileSize() % scale == 0 && "Tiles should be a multiple of every preview scale");
+		static_assert(TILE_SIZE % 4 == 0, "Tiles should be a multiple of every preview scale");
+
+		return DrawFrame(outImage, nThreads, [this, scale](thread_pool& threads, TwoDimensionVector<glm::vec4>& colorBuffer, FIBITMAP* image)
+		{
+			DrawPreviewTiles(threads, colorBuffer, image, scale);
+		});
+	}
+
+	int RecursiveRayTracer::DrawFrame(FIBITMAP*& outImage, size_t nThreads, const std::function<void(thread_pool&, TwoDimensionVector<glm::vec4>&, FIBITMAP*)>& drawTiles)
+	{
+		auto image = AllocateImage();
+		if (!image)
+			return FAIL;
+
+		// Concurrency stuff: Render disjoint tiles of the screen in multiple threads
+		thread_pool threads(nThreads);
+		PrepareScene(&threads);
+
+		// Where the colors are actually drawn
+		TwoDimensionVector<glm::vec4> colorBuffer(m_SceneDescription.imgResX, m_SceneDescription.imgResY);
+		auto const frameStart = std::chrono::steady_clock::now();
+
+		drawTiles(threads, colorBuffer, image);
+
+		auto const frameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart);
+		m_Stats.Aggregate(frameTime.count());
+		std::cout << std::endl;
+
+		outImage = image;
+		return SUCCESS;
+	}
+
+	FIBITMAP* RecursiveRayTracer::AllocateImage() const
+	{
+		return FreeImage_Allocate(
 			m_SceneDescription.imgResX,
 			m_SceneDescription.imgResY,
 			static_cast<size_t>(8 * 3)); // 8 bit colors, 3 color components
+	}
 
-		if (!Image)
-			return FAIL;
+	void RecursiveRayTracer::WaitForTiles(std::vector<std::future<void>>& futures, ProgressBar& progressBar, const std::function<void(size_t)>& onTileDone)
+	{
+		for (size_t i = 0; i < futures.size(); i++)
+		{
+			futures[i].get();
+			progressBar.Step();
+			progressBar.Draw();
 
-		// Set up geometry for objects. I think this is unnecessary bc the ray casting should be
-		// enough to simulate camera positioning
-		SetUpGeometry();
+			if (onTileDone)
+				onTileDone(i);
+		}
+	}
 
-		// Concurrency stuff: Render disjoint segments of the screen in multiple threads
-		thread_pool threads(nThreads);
+	void RecursiveRayTracer::DrawTiles(thread_pool& threads, TwoDimensionVector<glm::vec4>& colorBuffer, FIBITMAP* image)
+	{
 		std::vector<std::future<void>> futures;
+		futures.reserve(GetNumTiles());
 
-		// Where the colors are actually drawn
-		TwoDimensionVector<glm::vec4> colorBuffer(m_SceneDescription.imgResX, m_SceneDescription.imgResY);
+		RasterizePrimaryVisibility(threads);
 
-		// Start parallel shading: Schedule regions for each thread
-		uint32_t const yIntervalSize = m_SceneDescription.imgResY / nThreads;
-		for (uint32_t i = 0; i < nThreads; i++)
+		// Tiles of the previous render not affected by scene edits are copied instead of drawn
+		std::vector<bool> dirtyTiles(GetNumTiles(), true);
+		if (m_PreviousFrame && FindDirtyTiles(*m_PreviousFrame, m_SceneDescription, GetTileSize(), dirtyTiles))
 		{
-			futures.push_back(threads.execute(&RecursiveRayTracer::DrawThread, this, std::ref(colorBuffer), 0, m_SceneDescription.imgResX, i * yIntervalSize, (i + 1) * yIntervalSize));
+			size_t reusedTiles = 0;
+			for (size_t tileIndex = 0; tileIndex < GetNumTiles(); tileIndex++)
+			{
+				if (dirtyTiles[tileIndex])
+					continue;
+
+				size_t startI, endI, startJ, endJ;
+				GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+				for (size_t i = startI; i < endI; i++)
+					for (size_t j = startJ; j < endJ; j++)
+						colorBuffer.Set(i, j, m_PreviousFrame->colors[i * m_SceneDescription.imgResY + j]);
+
+				m_TileDependencies[tileIndex] = m_PreviousFrame->tiles[tileIndex];
+				reusedTiles++;
+			}
+
+			std::cout << "Reusing " << reusedTiles << " of " << GetNumTiles() << " tiles from previous render" << std::endl;
+		}
+		else if (m_PreviousFrame)
+		{
+			std::cout << "Previous render can't be reused, drawing every tile" << std::endl;
 		}
 
+		// Tiles rendered before with the exact same scene are read back instead of drawn
+		bool const useTileCache = m_TileCache && !m_IncrementalRendering;
+		if (useTileCache)
+		{
+			RRAYS_TRACE_SCOPE("Load cached tiles");
+			size_t cachedTiles = 0;
+			std::vector<glm::vec4> colors;
+			for (size_t tileIndex = 0; tileIndex < GetNumTiles(); tileIndex++)
+			{
+				size_t startI, endI, startJ, endJ;
+				GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+				if (!m_TileCache->Load(m_TileCacheKey, tileIndex, (endI - startI) * (endJ - startJ), colors))
+					continue;
+
+				SetTileColors(colorBuffer, tileIndex, colors);
+				dirtyTiles[tileIndex] = false;
+				cachedTiles++;
+			}
+
+			std::cout << "Reusing " << cachedTiles << " of " << GetNumTiles() << " tiles from tile cache" << std::endl;
+		}
+
+		// Tiles finished before an interrupted render was stopped. Tiles reused from elsewhere go into the
+		// checkpoint too, so it has every finished tile
+		if (m_Checkpoint)
+		{
+			size_t resumedTiles = 0;
+			std::vector<glm::vec4> colors;
+			for (size_t tileIndex = 0; tileIndex < GetNumTiles(); tileIndex++)
+			{
+				size_t startI, endI, startJ, endJ;
+				GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+				colors.clear();
+				if (m_Checkpoint->HasTile(tileIndex))
+					m_Checkpoint->GetTile(tileIndex, colors);
+
+				bool const hasTile = colors.size() == (endI - startI) * (endJ - startJ);
+				if (!dirtyTiles[tileIndex] && !hasTile)
+					m_Checkpoint->AddTile(tileIndex, GetTileColors(colorBuffer, tileIndex));
+
+				if (!dirtyTiles[tileIndex] || !hasTile)
+					continue;
+
+				SetTileColors(colorBuffer, tileIndex, colors);
+				dirtyTiles[tileIndex] = false;
+				resumedTiles++;
+			}
+
+			if (resumedTiles > 0)
+				std::cout << "Resuming with " << resumedTiles << " of " << GetNumTiles() << " tiles from checkpoint" << std::endl;
+		}
+
+		// Viewers see reused tiles right away
+		for (size_t tileIndex = 0; m_SharedFrameBuffer && tileIndex < GetNumTiles(); tileIndex++)
+		{
+			if (dirtyTiles[tileIndex])
+				continue;
+
+			size_t startI, endI, startJ, endJ;
+			GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+			m_SharedFrameBuffer->PublishTile(tileIndex, startI, endI, startJ, endJ, GetTileColors(colorBuffer, tileIndex));
+		}
+
+		// Start parallel shading: Schedule tiles, row by row
+		std::vector<size_t> futureTiles;
+		for (size_t tileIndex = 0; tileIndex < GetNumTiles(); tileIndex++)
+		{
+			if (!dirtyTiles[tileIndex])
+				continue;
+
+			futures.push_back(threads.execute(&RecursiveRayTracer::DrawTile, this, std::ref(colorBuffer), tileIndex));
+			futureTiles.push_back(tileIndex);
+		}
+
+		// Rows of tiles are converted and handed to the encoder as soon as all their tiles are done
+		if (m_Encoder)
+			m_Encoder->Start(image);
+
+		size_t const tileSize = GetTileSize();
+		size_t const nTilesX = (m_SceneDescription.imgResX + tileSize - 1) / tileSize;
+		std::vector<bool> tileDone(GetNumTiles());
+		for (size_t tileIndex = 0; tileIndex < GetNumTiles(); tileIndex++)
+			tileDone[tileIndex] = !dirtyTiles[tileIndex];
+		std::vector<bool> tileRowConverted(GetNumTiles() / nTilesX, false);
 
-		// Now we can intersect things with rays
-		RGBQUAD color;
 		// Use this variables to print a progress bar
+		ProgressBar progressBar(futures.size());
+		size_t lastCompletedTiles = 0;
 
 		// Draw in SDL while futures are not yet done 
-		// Set up SDL window
+		// Set up SDL window, headless renders just wait for tiles
 		SDL_Renderer* renderer = nullptr;
 		SDL_Window* window = nullptr;
 		SDL_Event event;
-		SDL_CreateWindowAndRenderer(m_SceneDescription.imgResX, m_SceneDescription.imgResY, 0, &window, &renderer);
-		SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-		SDL_RenderClear(renderer);
-		SDL_SetWindowTitle(window, "Ray Tracer preview");
+		if (m_PreviewWindow)
+		{
+			if (SDL_CreateWindowAndRenderer(m_SceneDescription.imgResX, m_SceneDescription.imgResY, 0, &window, &renderer) == 0)
+			{
+				SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+				SDL_RenderClear(renderer);
+				SDL_SetWindowTitle(window, "Ray Tracer preview");
+			}
+			else
+				std::cerr << "[WARNING] Could not create preview window. Error: " << SDL_GetError() << std::endl;
+		}
 
 		bool ready = false;
 
 		while (!ready)
 		{
-			for (size_t i = 0; i < m_SceneDescription.imgResY; i++)
+			for (size_t i = 0; renderer && i < m_SceneDescription.imgResX; i++)
 			{
-				for (size_t j = 0; j < m_SceneDescription.imgResX; j++)
+				for (size_t j = 0; j < m_SceneDescription.imgResY; j++)
 				{
 					glm::vec4 shadeColor = 255.0f * colorBuffer.Get(i, j);
 					shadeColor.r = glm::clamp(shadeColor.r, 0.f, 255.f);
@@ -272,316 +471,728 @@ namespace RecRays
 				}
 			}
 
-			if (SDL_PollEvent(&event)); // do nothing with event
+			if (renderer)
+			{
+				if (SDL_PollEvent(&event)); // do nothing with event
 
-			// Display image
-			SDL_RenderPresent(renderer);
+				// Display image
+				SDL_RenderPresent(renderer);
+			}
+			else
+				std::this_thread::sleep_for(std::chrono::milliseconds(HEADLESS_POLL_MILLISECONDS));
+
+			// Only redraw progress when some tile finished, to avoid flooding the console
+			size_t const completedTiles = m_CompletedTiles;
+			if (completedTiles != lastCompletedTiles)
+			{
+				progressBar.SetSteps(completedTiles);
+				progressBar.Draw();
+				lastCompletedTiles = completedTiles;
+			}
 
 			// Update ready status
 			bool allEnded = true;
-			for (auto const& future : futures)
+			for (size_t i = 0; i < futures.size(); i++)
 			{
-				if (future.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+				if (tileDone[futureTiles[i]])
+					continue;
+
+				if (futures[i].wait_for(std::chrono::seconds(0)) == std::future_status::ready)
 				{
-					allEnded = false;
-					break;
+					tileDone[futureTiles[i]] = true;
+					PublishTile(colorBuffer, futureTiles[i]);
 				}
+				else
+					allEnded = false;
 			}
 			ready = allEnded;
-		}
 
-		// Draw final FreeImage output image
-		for (size_t i = 0; i < m_SceneDescription.imgResY; i++)
-		{
-			for (size_t j = 0; j < m_SceneDescription.imgResX; j++)
-			{
-				glm::vec4 shadeColor = 255.0f * colorBuffer.Get(i, j);
+			if (m_Checkpoint)
+				m_Checkpoint->Update();
 
-				shadeColor.r = glm::clamp(shadeColor.r, 0.f, 255.f);
-				shadeColor.g = glm::clamp(shadeColor.g, 0.f, 255.f);
-				shadeColor.b = glm::clamp(shadeColor.b, 0.f, 255.f);
+			for (size_t tileRow = 0; m_Encoder && tileRow < tileRowConverted.size(); tileRow++)
+			{
+				if (tileRowConverted[tileRow])
+					continue;
 
-				color.rgbRed = shadeColor.r;
-				color.rgbGreen = shadeColor.g;
-				color.rgbBlue = shadeColor.b;
+				auto const first = tileDone.begin() + tileRow * nTilesX;
+				if (!std::all_of(first, first + nTilesX, [](bool done) { return done; }))
+					continue;
 
-				FreeImage_SetPixelColor(Image, i, m_SceneDescription.imgResX - j, &color);
+				size_t firstScanLine, endScanLine;
+				ConvertToImage(colorBuffer, image, tileRow * tileSize, (tileRow + 1) * tileSize, firstScanLine, endScanLine);
+				m_Encoder->EncodeScanLines(firstScanLine, endScanLine);
+				tileRowConverted[tileRow] = true;
 			}
 		}
 
+		// Draw final FreeImage output image, streamed rows are already there
+		if (!m_Encoder)
+			ConvertToImage(colorBuffer, image);
+
 		for (auto& future : futures)
 			future.get(); // end all threads
 
-		SDL_DestroyRenderer(renderer);
-		SDL_DestroyWindow(window);
+		if (m_IncrementalRendering)
+			StoreRenderState(colorBuffer);
 
-		outImage = Image;
-		return SUCCESS;
+		if (useTileCache && !futureTiles.empty())
+			StoreCachedTiles(colorBuffer, futureTiles);
+
+		if (m_SharedFrameBuffer)
+			m_SharedFrameBuffer->Finish();
+
+		if (renderer)
+			SDL_DestroyRenderer(renderer);
+		if (window)
+			SDL_DestroyWindow(window);
 	}
 
-	void RecursiveRayTracer::DrawThread(TwoDimensionVector<glm::vec4>& outBuffer, size_t startI, size_t endI, size_t startJ, size_t endJ)
+	void RecursiveRayTracer::DrawPreviewTiles(thread_pool& threads, TwoDimensionVector<glm::vec4>& colorBuffer, FIBITMAP* image, size_t scale)
 	{
-		for (size_t i = startI; i < endI; i++)
+		// G-buffer at reduced resolution, the last row and column of samples might cover less pixels
+		size_t const sampleResX = (m_SceneDescription.imgResX + scale - 1) / scale;
+		size_t const sampleResY = (m_SceneDescription.imgResY + scale - 1) / scale;
+		std::vector<GBufferSample> gBuffer(sampleResX * sampleResY);
+		std::vector<TileStats> sampleStats(GetNumTiles());
+
+		std::vector<std::future<void>> futures;
+		futures.reserve(GetNumTiles());
+		ProgressBar progressBar(2 * GetNumTiles());
+
 		{
-			for (size_t j = startJ; j < endJ; j++)
+			RRAYS_TRACE_SCOPE("Preview samples");
+			for (size_t tileIndex = 0; tileIndex < GetNumTiles(); tileIndex++)
+				futures.push_back(threads.execute(&RecursiveRayTracer::TracePreviewSamples, this, std::ref(gBuffer), sampleResX, scale, tileIndex, std::ref(sampleStats[tileIndex])));
+			WaitForTiles(futures, progressBar);
+			futures.clear();
+		}
+
+		// Pixels near tile borders blend samples of neighbor tiles, so upsampling waits for every sample
+		{
+			RRAYS_TRACE_SCOPE("Preview upsampling");
+			PreviewUpsampler const upsampler(gBuffer.data(), sampleResX, sampleResY, scale);
+			for (size_t tileIndex = 0; tileIndex < GetNumTiles(); tileIndex++)
+				futures.push_back(threads.execute(&RecursiveRayTracer::UpsamplePreviewTile, this, std::ref(colorBuffer), std::cref(upsampler), std::cref(sampleStats[tileIndex]), tileIndex));
+			WaitForTiles(futures, progressBar);
+		}
+
+		ConvertToImage(colorBuffer, image);
+	}
+
+	int RecursiveRayTracer::DrawViews(std::vector<FIBITMAP*>& outImages, size_t nThreads, const std::function<void(size_t)>& onViewDone)
+	{
+		assert(!m_IncrementalRendering && "Incremental rendering only supports a single view");
+		size_t const nViews = m_SceneDescription.GetNumViews();
+		size_t const nTiles = GetNumTiles();
+
+		outImages.assign(nViews, nullptr);
+		for (auto& image : outImages)
+		{
+			image = AllocateImage();
+			if (!image)
 			{
+				for (auto* allocated : outImages)
+					if (allocated)
+						FreeImage_Unload(allocated);
+				outImages.clear();
+				return FAIL;
+			}
+		}
+
+		// Geometry and acceleration structures are shared by every view
+		thread_pool threads(nThreads);
+		PrepareScene(&threads);
 
-				auto const ray = m_RayGenerator.GetRayThroughPixel(i, j);
-				auto const result = IntersectRay(ray);
-				auto shadeColor = Shade(result);
+		// Every tile of every view gets its own slot, view after view
+		m_Stats.Reset(nViews * nTiles);
+
+		std::vector<RayGenerator> rayGenerators;
+		std::vector<VisibilityRasterizer> rasterizers(nViews);
+		std::vector<TwoDimensionVector<glm::vec4>> colorBuffers(nViews, TwoDimensionVector<glm::vec4>(m_SceneDescription.imgResX, m_SceneDescription.imgResY));
+		auto const frameStart = std::chrono::steady_clock::now();
+
+		for (size_t view = 0; view < nViews; view++)
+		{
+			rayGenerators.push_back(CreateRayGenerator(m_SceneDescription.GetView(view).camera));
+			if (m_SceneDescription.rasterPrimary)
+			{
+				rasterizers[view].Rasterize(
+					rayGenerators[view].GetViewPlane(),
+					m_SceneDescription.imgResX,
+					m_SceneDescription.imgResY,
+					std::get<SphereSet>(m_Primitives),
+					std::get<MeshSet>(m_Primitives),
+					threads);
+			}
+		}
 
-				outBuffer.Set(i, j, shadeColor);
+		// Tiles of every view go to the same queue, so threads never wait for a view to finish before the next one
+		std::vector<std::future<void>> futures;
+		futures.reserve(nViews * nTiles);
+		for (size_t view = 0; view < nViews; view++)
+		{
+			for (size_t tileIndex = 0; tileIndex < nTiles; tileIndex++)
+			{
+				size_t startI, endI, startJ, endJ;
+				GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+				futures.push_back(threads.execute(&RecursiveRayTracer::DrawThread, this, std::ref(colorBuffers[view]), view * nTiles + tileIndex,
+					startI, endI, startJ, endJ, std::cref(rayGenerators[view]), std::cref(rasterizers[view])));
 			}
 		}
+
+		// Views are queued in order, so each one is done once its last tile is, and can be handed over while the
+		// next ones are traced
+		ProgressBar progressBar(futures.size());
+		WaitForTiles(futures, progressBar, [&](size_t i)
+		{
+			if ((i + 1) % nTiles != 0)
+				return;
+
+			size_t const view = i / nTiles;
+			ConvertToImage(colorBuffers[view], outImages[view]);
+			if (onViewDone)
+				onViewDone(view);
+		});
+
+		auto const frameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart);
+		m_Stats.Aggregate(frameTime.count());
+		std::cout << std::endl;
+
+		return SUCCESS;
 	}
 
-	float RecursiveRayTracer::FocalLength(float fovy, float height)
+	void RecursiveRayTracer::PrepareScene(thread_pool* threads)
 	{
-		float const cos = glm::pow(glm::cos(fovy / 2.f), 2.f);
-		float result = cos * height * height;
-		result = result / (1 - cos);
-		result = glm::sqrt(result);
+		{
+			RRAYS_TRACE_SCOPE("SetUpGeometry");
+			SetUpGeometry(threads);
+		}
 
-		return result;
+		m_Stats.Reset(GetNumTiles());
+		m_Stats.SetGeometryBytes(std::get<MeshSet>(m_Primitives).GetMeshMemory());
+		m_CompletedTiles = 0;
+		m_Rasterizer.Clear();
+
+		if (m_IncrementalRendering)
+		{
+			m_TileDependencies.resize(GetNumTiles());
+			for (auto& dependencies : m_TileDependencies)
+				dependencies.Reset();
+		}
 	}
 
-	float RecursiveRayTracer::HeightFromAspectRatio(float aspectRatio, float width)
+	void RecursiveRayTracer::RasterizePrimaryVisibility(thread_pool& threads)
 	{
-		return width / aspectRatio;
+		// Hybrid rendering: find what primary rays hit by rasterizing, tiles only trace secondary rays
+		if (!m_SceneDescription.rasterPrimary)
+			return;
+
+		m_Rasterizer.Rasterize(
+			m_RayGenerator.GetViewPlane(),
+			m_SceneDescription.imgResX,
+			m_SceneDescription.imgResY,
+			std::get<SphereSet>(m_Primitives),
+			std::get<MeshSet>(m_Primitives),
+			threads);
 	}
 
-	void RecursiveRayTracer::SetUpGeometry()
+	void RecursiveRayTracer::EnableIncrementalRendering(const RenderState* previous)
 	{
-		for (auto& obj : m_SceneDescription.GetObjects())
+		m_IncrementalRendering = true;
+		m_PreviousFrame = previous;
+	}
+
+	void RecursiveRayTracer::StoreCachedTiles(const TwoDimensionVector<glm::vec4>& colorBuffer, const std::vector<size_t>& tiles)
+	{
+		RRAYS_TRACE_SCOPE("Store cached tiles");
+		size_t failedTiles = 0;
+		for (auto const tileIndex : tiles)
 		{
-			obj.SetGeometry();
+			if (m_TileCache->Store(m_TileCacheKey, tileIndex, GetTileColors(colorBuffer, tileIndex)) != SUCCESS)
+				failedTiles++;
 		}
+
+		if (failedTiles > 0)
+			std::cerr << "Could not store " << failedTiles << " tiles in tile cache" << std::endl;
+
+		m_TileCache->Trim();
 	}
 
-	RayIntersectionResult RecursiveRayTracer::IntersectRay(const Ray& ray, float minT, float maxT)
+	std::vector<glm::vec4> RecursiveRayTracer::GetTileColors(const TwoDimensionVector<glm::vec4>& colorBuffer, size_t tileIndex) const
 	{
-		// Find nearest object intersecting this ray
-		RayIntersectionResult finalResult;
-		float nearestT = maxT;
-		for (auto const& obj : m_SceneDescription.GetObjects())
-		{
-			auto const result = IntersectRayToObject(ray, obj, minT, nearestT);
-			if (result.WasIntersection() && result.t < nearestT && result.t > 0)
-			{
-				finalResult = result;
-				nearestT = result.t;
-			}
+		size_t startI, endI, startJ, endJ;
+		GetTileBounds(tileIndex, startI, endI, startJ, endJ);
 
-		}
+		std::vector<glm::vec4> colors;
+		colors.reserve((endI - startI) * (endJ - startJ));
+		for (size_t i = startI; i < endI; i++)
+			for (size_t j = startJ; j < endJ; j++)
+				colors.push_back(colorBuffer.Get(i, j));
 
-		return finalResult;
+		return colors;
+	}
+
+	void RecursiveRayTracer::SetTileColors(TwoDimensionVector<glm::vec4>& outColorBuffer, size_t tileIndex, const std::vector<glm::vec4>& colors) const
+	{
+		size_t startI, endI, startJ, endJ;
+		GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+		assert(colors.size() == (endI - startI) * (endJ - startJ) && "Colors don't match tile size");
+
+		auto color = colors.begin();
+		for (size_t i = startI; i < endI; i++)
+			for (size_t j = startJ; j < endJ; j++)
+				outColorBuffer.Set(i, j, *color++);
 	}
 
-	RayIntersectionResult RecursiveRayTracer::IntersectRayToObject(const Ray& ray, const Object& object, float minT, float maxT) const
+	void RecursiveRayTracer::PublishTile(const TwoDimensionVector<glm::vec4>& colorBuffer, size_t tileIndex)
 	{
-		switch (object.shape)
+		if (!m_Checkpoint && !m_SharedFrameBuffer)
+			return;
+
+		auto const colors = GetTileColors(colorBuffer, tileIndex);
+		if (m_SharedFrameBuffer)
 		{
-		case Shape::Sphere:
-			return IntersectRayToSphere(ray, object);
-		default:
-			return IntersectRayToTesselatedObject(ray, object, minT, maxT);
+			size_t startI, endI, startJ, endJ;
+			GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+			m_SharedFrameBuffer->PublishTile(tileIndex, startI, endI, startJ, endJ, colors);
 		}
+
+		if (m_Checkpoint)
+			m_Checkpoint->AddTile(tileIndex, colors);
+	}
+
+	void RecursiveRayTracer::StoreRenderState(const TwoDimensionVector<glm::vec4>& colorBuffer)
+	{
+		m_RenderState.scene.clear();
+		SceneSerializer::Serialize(m_SceneDescription, m_RenderState.scene);
+		m_RenderState.sceneBounds = m_SceneBounds;
+		m_RenderState.tileSize = GetTileSize();
+		m_RenderState.tiles = m_TileDependencies;
+
+		// Same layout as the color buffer
+		size_t const resX = colorBuffer.GetDim1Size();
+		size_t const resY = colorBuffer.GetDim2Size();
+		m_RenderState.colors.resize(resX * resY);
+		for (size_t i = 0; i < resX; i++)
+			for (size_t j = 0; j < resY; j++)
+				m_RenderState.colors[i * resY + j] = colorBuffer.Get(i, j);
 	}
 
-	RayIntersectionResult RecursiveRayTracer::IntersectRayToSphere(const Ray& ray, const Object& sphere, float minT, float maxT) const
+	size_t RecursiveRayTracer::GetNumTiles() const
 	{
-		// Sanity check 
-		assert(sphere.shape == Shape::Sphere);
+		// Split image in tiles, the last row and column of tiles might be smaller
+		size_t const tileSize = GetTileSize();
+		size_t const nTilesX = (m_SceneDescription.imgResX + tileSize - 1) / tileSize;
+		size_t const nTilesY = (m_SceneDescription.imgResY + tileSize - 1) / tileSize;
+		return nTilesX * nTilesY;
+	}
 
-		// We just have to compute intersection point solving for t in the
-		// equation of a sphere substituting by a point in the ray
+	void RecursiveRayTracer::GetTileBounds(size_t tileIndex, size_t& outStartI, size_t& outEndI, size_t& outStartJ, size_t& outEndJ) const
+	{
+		// Tiles are numbered row by row
+		size_t const tileSize = GetTileSize();
+		size_t const nTilesX = (m_SceneDescription.imgResX + tileSize - 1) / tileSize;
+		size_t const tileX = tileIndex % nTilesX;
+		size_t const tileY = tileIndex / nTilesX;
+
+		outStartI = tileX * tileSize;
+		outStartJ = tileY * tileSize;
+		outEndI = std::min(outStartI + tileSize, m_SceneDescription.imgResX);
+		outEndJ = std::min(outStartJ + tileSize, m_SceneDescription.imgResY);
+	}
 
-		// Compute discriminant to check what kind of intersection we have here
-		auto const d = ray.direction;
-		auto const e = ray.position;
-		auto const c = glm::vec3(sphere.transform * glm::vec4(0, 0, 0, 1)); // Extract sphere position from transform
-		auto const r = sphere.size; // Radius
+	void RecursiveRayTracer::DrawTile(TwoDimensionVector<glm::vec4>& outBuffer, size_t tileIndex)
+	{
+		size_t startI, endI, startJ, endJ;
+		GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+		DrawThread(outBuffer, tileIndex, startI, endI, startJ, endJ, m_RayGenerator, m_Rasterizer);
+	}
 
-		auto discriminant = glm::dot(d, e - c);
-		discriminant = discriminant * discriminant;
-		discriminant -= (dot(d, d) * dot(e - c, e - c) - r * r);
+	const glm::vec4* RecursiveRayTracer::DrawTileColors(size_t tileIndex)
+	{
+		size_t startI, endI, startJ, endJ;
+		GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+		return TraceTile(tileIndex, startI, endI, startJ, endJ, m_RayGenerator, m_Rasterizer);
+	}
 
-		float t = -dot(d, e - c);
-		std::vector<float> results;
-		auto emptyResult = RayIntersectionResult{ nullptr, glm::vec3(0), glm::vec3(0), 0 , ray };
-		if (discriminant < -0.0001)
-		{
-			// no intersection at all
-			return emptyResult;
-		}
+	void RecursiveRayTracer::ConvertToImage(const TwoDimensionVector<glm::vec4>& colorBuffer, FIBITMAP* image)
+	{
+		size_t firstScanLine, endScanLine;
+		ConvertToImage(colorBuffer, image, 0, colorBuffer.GetDim2Size(), firstScanLine, endScanLine);
+	}
 
-		if (abs(discriminant) > 0.0001) // near 0
+	void RecursiveRayTracer::ConvertToImage(const TwoDimensionVector<glm::vec4>& colorBuffer, FIBITMAP* image, size_t startJ, size_t endJ, size_t& outFirstScanLine, size_t& outEndScanLine)
+	{
+		RRAYS_TRACE_SCOPE("Convert to FreeImage");
+		size_t const resX = colorBuffer.GetDim1Size();
+		size_t const resY = colorBuffer.GetDim2Size();
+		endJ = std::min(endJ, resY);
+		if (startJ >= endJ)
 		{
-			results.emplace_back(t + glm::sqrt(discriminant));
-			results.emplace_back(t - glm::sqrt(discriminant));
+			outFirstScanLine = outEndScanLine = 0;
+			return;
 		}
-		else
+
+		// Rows [startJ, endJ) are scanlines [resY - endJ, resY - startJ)
+		outFirstScanLine = RowToScanLine(endJ - 1, resY);
+		outEndScanLine = RowToScanLine(startJ, resY) + 1;
+
+		RGBQUAD color;
+		for (size_t i = 0; i < resX; i++)
 		{
-			results.emplace_back(t);
+			for (size_t j = startJ; j < endJ; j++)
+			{
+				glm::vec4 shadeColor = 255.0f * colorBuffer.Get(i, j);
+
+				shadeColor.r = glm::clamp(shadeColor.r, 0.f, 255.f);
+				shadeColor.g = glm::clamp(shadeColor.g, 0.f, 255.f);
+				shadeColor.b = glm::clamp(shadeColor.b, 0.f, 255.f);
+
+				color.rgbRed = shadeColor.r;
+				color.rgbGreen = shadeColor.g;
+				color.rgbBlue = shadeColor.b;
+
+				FreeImage_SetPixelColor(image, i, RowToScanLine(j, resY), &color);
+			}
 		}
+	}
+
+	void RecursiveRayTracer::DrawThread(TwoDimensionVector<glm::vec4>& outBuffer, size_t tileIndex, size_t startI, size_t endI, size_t startJ, size_t endJ, const RayGenerator& rayGenerator, const VisibilityRasterizer& rasterizer)
+	{
+		auto const* const tileColors = TraceTile(tileIndex, startI, endI, startJ, endJ, rayGenerator, rasterizer);
+		size_t const tileHeight = endJ - startJ;
+
+		// Write the whole tile at once
+		for (size_t i = startI; i < endI; i++)
+			for (size_t j = startJ; j < endJ; j++)
+				outBuffer.Set(i, j, tileColors[(i - startI) * tileHeight + (j - startJ)]);
+	}
+
+	const glm::vec4* RecursiveRayTracer::TraceTile(size_t tileIndex, size_t startI, size_t endI, size_t startJ, size_t endJ, const RayGenerator& rayGenerator, const VisibilityRasterizer& rasterizer)
+	{
+		RRAYS_TRACE_SCOPE("Tile", "tile", static_cast<int64_t>(tileIndex));
+		auto& counters = RenderStats::Local();
+		counters.Reset();
+		auto const tileStart = std::chrono::steady_clock::now();
+
+		// Scratch memory for this tile comes from the thread's arena, released as a whole when the tile is done
+		auto& arena = ScratchArena::Local();
+		arena.Reset();
+		size_t const tileHeight = endJ - startJ;
+		auto* const tileColors = arena.Allocate<glm::vec4>((endI - startI) * tileHeight);
+
+		// Every ray traced from now on is a dependency of this tile
+		s_TileDependencies = m_IncrementalRendering ? &m_TileDependencies[tileIndex] : nullptr;
+		if (s_TileDependencies)
+			s_ObjectRecorder.Begin(m_SceneDescription.GetNumObjects());
 
-		float desiredResult = INFINITY;
-		for (auto const result : results)
 		{
-			if (result > 0 && result < desiredResult)
+			// Rendering pixels should never touch the heap
+			RRAYS_NO_ALLOCATION_SCOPE("Tile pixels");
+			bool const rasterized = !rasterizer.IsEmpty();
+			for (size_t i = startI; i < endI; i++)
 			{
-				desiredResult = result;
+				for (size_t j = startJ; j < endJ; j++)
+				{
+					auto const ray = rayGenerator.GetRayThroughPixel(i, j);
+					RayIntersectionResult result;
+					if (rasterized)
+					{
+						result = ResolveHit(ray, rasterizer.GetHit(i, j), INFINITY);
+					}
+					else
+					{
+						counters.primaryRays++;
+						result = IntersectRay(ray);
+					}
+					tileColors[(i - startI) * tileHeight + (j - startJ)] = Shade(result);
+				}
 			}
 		}
 
-		// Check if t out of ray range
-		if (desiredResult < minT && desiredResult > maxT)
-			return emptyResult;
+		if (s_TileDependencies)
+			s_ObjectRecorder.End(s_TileDependencies->objects);
+		s_TileDependencies = nullptr;
+
+		TileStats stats;
+		stats.startX = startI;
+		stats.endX = endI;
+		stats.startY = startJ;
+		stats.endY = endJ;
+		stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tileStart).count();
+		stats.counters = counters;
+		m_Stats.RecordTile(tileIndex, stats);
+
+		m_CompletedTiles++;
+		return tileColors;
+	}
 
-		// Compute intersection point and normal
-		glm::vec3 const intersectionPos = ray.position + desiredResult * ray.direction;
-		glm::vec3 const intersectionNormal = glm::normalize(glm::vec3(intersectionPos - c));
+	GBufferSample RecursiveRayTracer::TraceSample(size_t pixelX, size_t pixelY)
+	{
+		auto const ray = m_RayGenerator.GetRayThroughPixel(pixelX, pixelY);
+		RenderStats::Local().primaryRays++;
+		auto const result = IntersectRay(ray);
 
-		return RayIntersectionResult{
-				&sphere,
-				intersectionNormal,
-				intersectionPos, desiredResult, ray };
+		GBufferSample sample;
+		sample.color = Shade(result);
+		if (result.WasIntersection())
+		{
+			sample.normal = glm::normalize(result.normal);
+			sample.depth = result.t;
+			sample.objectId = result.materialId;
+		}
+
+		return sample;
 	}
 
-	bool RecursiveRayTracer::PointInsideTriangle(const glm::vec3& point, const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3)
+	void RecursiveRayTracer::TracePreviewSamples(std::vector<GBufferSample>& outSamples, size_t sampleResX, size_t scale, size_t tileIndex, TileStats& outStats)
 	{
-		auto const edge1 = v2 - v1;
-		auto const edge2 = v3 - v2;
-		auto const edge3 = v1 - v3;
+		RRAYS_TRACE_SCOPE("Preview tile samples", "tile", static_cast<int64_t>(tileIndex));
+		auto& counters = RenderStats::Local();
+		counters.Reset();
+		auto const tileStart = std::chrono::steady_clock::now();
 
-		auto const v12P = point - v1;
-		auto const v22P = point - v2;
-		auto const v32P = point - v3;
+		size_t startI, endI, startJ, endJ;
+		GetTileBounds(tileIndex, startI, endI, startJ, endJ);
 
-		auto const normal = glm::cross(v2 - v1, v3 - v1);
+		{
+			RRAYS_NO_ALLOCATION_SCOPE("Preview samples");
+			for (size_t x = startI / scale; x < (endI + scale - 1) / scale; x++)
+			{
+				for (size_t y = startJ / scale; y < (endJ + scale - 1) / scale; y++)
+				{
+					// Through the center of the block of pixels it stands for, or the last pixel for partial blocks
+					size_t const pixelX = std::min(x * scale + scale / 2, m_SceneDescription.imgResX - 1);
+					size_t const pixelY = std::min(y * scale + scale / 2, m_SceneDescription.imgResY - 1);
+					outSamples[y * sampleResX + x] = TraceSample(pixelX, pixelY);
+				}
+			}
+		}
 
-		return	glm::dot(normal, glm::cross(edge1, v12P)) > 0 &&
-				glm::dot(normal, glm::cross(edge2, v22P)) > 0 &&
-				glm::dot(normal, glm::cross(edge3, v32P)) > 0
-		;
+		outStats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tileStart).count();
+		outStats.counters = counters;
 	}
 
-	bool  RecursiveRayTracer::IntersectRayToTriangle(const Ray& ray, const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3, const glm::vec3& n1, const glm::vec3& n2, const glm::vec3& n3, glm::vec3& outIntersection, glm::vec3& outNormal, float& outT, float minT, float maxT)
+	void RecursiveRayTracer::UpsamplePreviewTile(TwoDimensionVector<glm::vec4>& outBuffer, const PreviewUpsampler& upsampler, const TileStats& sampleStats, size_t tileIndex)
 	{
-		// Before everything, perform backface culling. If direction and triangle normal
-		// have an angle > 90, then it can't intersect by any mean. Winding order is clock wise
-		auto const triangleNormal = glm::cross(v2 - v1, v3 - v1);
-		if (glm::dot(ray.direction, triangleNormal) >= 0)
-			return false;
+		RRAYS_TRACE_SCOPE("Preview tile upsampling", "tile", static_cast<int64_t>(tileIndex));
+		auto& counters = RenderStats::Local();
+		counters.Reset();
+		auto const tileStart = std::chrono::steady_clock::now();
 
-		constexpr float EPSILON = 0.0000001f;
+		size_t startI, endI, startJ, endJ;
+		GetTileBounds(tileIndex, startI, endI, startJ, endJ);
+		size_t const tileHeight = endJ - startJ;
 
-		auto const edge1 = v2 - v1;
-		auto const edge2 = v3 - v1;
-		auto const h = glm::cross(ray.direction, edge2);
-		auto const k = glm::dot(edge1, h);
+		// Allocated once per thread, before allocations are forbidden
+		auto& fallbackPixels = s_PreviewFallbackPixels;
+		fallbackPixels.clear();
+		fallbackPixels.reserve((endI - startI) * tileHeight);
 
-		// No intersection, ray is parallel to triangle
-		if (k > -EPSILON && k < EPSILON)
-			return false;
+		{
+			RRAYS_NO_ALLOCATION_SCOPE("Preview upsampling");
+			for (size_t i = startI; i < endI; i++)
+			{
+				for (size_t j = startJ; j < endJ; j++)
+				{
+					glm::vec4 color;
+					if (!upsampler.Reconstruct(i, j, color))
+						fallbackPixels.push_back(static_cast<uint32_t>((i - startI) * tileHeight + (j - startJ)));
+					outBuffer.Set(i, j, color);
+				}
+			}
 
-		auto const f = 1.f / k;
-		auto const s = ray.position - v1;
-		auto const u = f * glm::dot(s, h);
-		if (u < 0.0f || u > 1.0)
-			return false;
+			// Only discontinuities get rays of their own, spread evenly over the tile when there are more than the
+			// budget allows
+			size_t const nFallback = fallbackPixels.size();
+			size_t const budget = std::min(nFallback, static_cast<size_t>(PREVIEW_EXTRA_RAY_BUDGET * sampleStats.counters.primaryRays));
+			for (size_t k = 0; k < nFallback; k++)
+			{
+				if ((k + 1) * budget / nFallback == k * budget / nFallback)
+					continue;
 
-		auto const q = glm::cross(s, edge1);
-		auto const v = f * glm::dot(ray.direction, q);
-		if (v < 0.0 || u + v > 1.0)
-			return false;
+				size_t const i = startI + fallbackPixels[k] / tileHeight;
+				size_t const j = startJ + fallbackPixels[k] % tileHeight;
+				outBuffer.Set(i, j, TraceSample(i, j).color);
+			}
+		}
 
-		auto const t = f * glm::dot(edge2, q);
-		if (t <= EPSILON)
-			return false; // Line intersection, but not ray
+		TileStats stats;
+		stats.startX = startI;
+		stats.endX = endI;
+		stats.startY = startJ;
+		stats.endY = endJ;
+		stats.milliseconds = sampleStats.milliseconds + std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - tileStart).count();
+		stats.counters = counters;
+		stats.counters += sampleStats.counters;
+		m_Stats.RecordTile(tileIndex, stats);
+
+		m_CompletedTiles++;
+	}
 
-		auto const intersectionPoint = ray.position + ray.direction * t;
+	float RecursiveRayTracer::FocalLength(float fovy, float height)
+	{
+		float const cos = glm::pow(glm::cos(fovy / 2.f), 2.f);
+		float result = cos * height * height;
+		result = result / (1 - cos);
+		result = glm::sqrt(result);
 
-		// Compute normal based on intersection position
-		auto vecMatrix = glm::mat3(v1, v2, v3);
-		auto const vecMatrixDet = glm::determinant(vecMatrix);
+		return result;
+	}
 
-		// Compute a
-		vecMatrix[0] = intersectionPoint;
-		auto const a = glm::determinant(vecMatrix) / vecMatrixDet;
+	float RecursiveRayTracer::HeightFromAspectRatio(float aspectRatio, float width)
+	{
+		return width / aspectRatio;
+	}
 
-		// Compute b
-		vecMatrix[0] = v1;
-		vecMatrix[1] = intersectionPoint;
-		auto const b = glm::determinant(vecMatrix) / vecMatrixDet;
+	RayGenerator RecursiveRayTracer::CreateRayGenerator(const CameraDescription& camera) const
+	{
+		auto const& description = m_SceneDescription;
+		auto const cam = Camera(camera.up, camera.position, camera.lookAt);
+		auto const height = HeightFromAspectRatio(description.imgWidth / description.imgHeight, description.imgWidth);
+		return RayGenerator{
+			cam,
+			description.imgWidth,
+			height, // ??
+			description.imgResX,
+			description.imgResY,
+			FocalLength(camera.fovy,height)
+		};
+	}
 
-		// Compute c
-		vecMatrix[1] = v2;
-		vecMatrix[2] = intersectionPoint;
-		auto const c = glm::determinant(vecMatrix) / vecMatrixDet;
+	void RecursiveRayTracer::SetUpGeometry(thread_pool* threads)
+	{
+		auto& spheres = std::get<SphereSet>(m_Primitives);
+		auto& meshes = std::get<MeshSet>(m_Primitives);
+		spheres.Clear();
+		meshes.Clear();
+		m_Materials.clear();
+		m_SceneBounds = Bounds();
+
+		// Start loading every mesh the scene uses before waiting for any of them, parsing might have requested them already
+		for (auto const& obj : m_SceneDescription.GetObjectsConst())
+		{
+			if (obj.shape == Shape::Cube)
+				GeometryLoader::Request(MeshAsset::Cube);
+			else if (obj.shape == Shape::Teapot)
+				GeometryLoader::Request(MeshAsset::Teapot);
+		}
 
-		// compute normal
-		auto const newNormal = a * n1 + b * n2 + c * n3;
+		// Meshes are stored once no matter how many objects use them
+		uint32_t cubeMesh = UINT32_MAX, teapotMesh = UINT32_MAX;
+		auto const noLods = std::vector<GeometryLod>();
 
-		// Return results
-		outNormal = newNormal;
-		outIntersection = intersectionPoint;
-		outT = t;
+		for (auto const& obj : m_SceneDescription.GetObjectsConst())
+		{
+			// Every object gets its own material
+			auto const materialId = static_cast<uint32_t>(m_Materials.size());
+			m_Materials.push_back(obj.GetMaterial(m_SceneDescription.enableLight));
+			m_SceneBounds.Extend(obj.GetBounds());
+
+			// Skip meshes that could not be loaded, their loader already reported why
+			if ((obj.shape == Shape::Cube && GeometryLoader::HasFailed(MeshAsset::Cube)) ||
+				(obj.shape == Shape::Teapot && GeometryLoader::HasFailed(MeshAsset::Teapot)))
+				continue;
 
-		return true;
+			// Group objects by type of primitive
+			switch (obj.shape)
+			{
+			case Shape::Sphere:
+			{
+				auto const center = glm::vec3(obj.transform * glm::vec4(0, 0, 0, 1)); // Extract sphere position from transform
+				spheres.Add(center, obj.size, materialId);
+				break;
+			}
+			case Shape::Cube:
+				if (cubeMesh == UINT32_MAX)
+					cubeMesh = meshes.AddMeshWithLods(GeometryLoader::GetCubeGeometry(), m_SceneDescription.meshLods ? GeometryLoader::GetCubeLods() : noLods, m_SceneDescription.compactMeshes);
+				meshes.AddInstance(cubeMesh, obj.transform * glm::scale(glm::mat4(1), glm::vec3(obj.size)), materialId);
+				break;
+			case Shape::Teapot:
+				if (teapotMesh == UINT32_MAX)
+					teapotMesh = meshes.AddMeshWithLods(GeometryLoader::GetTeapotGeometry(), m_SceneDescription.meshLods ? GeometryLoader::GetTeapotLods() : noLods, m_SceneDescription.compactMeshes);
+				meshes.AddInstance(teapotMesh, obj.transform * glm::scale(glm::mat4(1), glm::vec3(obj.size)), materialId);
+				break;
+			default:
+				assert(false && "Invalid shape");
+			}
+		}
+
+		auto const buildStart = std::chrono::steady_clock::now();
+		{
+			RRAYS_TRACE_SCOPE("BuildAccelerationStructures");
+			meshes.BuildAccelerationStructures(threads, m_Profile.bvhMaxLeafTriangles);
+			spheres.BuildAccelerationStructures(m_SceneDescription.sphereAccelerator, meshes.Size(), m_Profile.sphereGridCellsPerSphere);
+		}
+		auto const buildTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - buildStart);
+
+		size_t bvhTriangles = 0;
+		for (uint32_t mesh = 0; mesh < meshes.GetNumMeshes(); mesh++)
+		{
+			if (meshes.meshBvhRoot[mesh] != MeshSet::NO_BVH)
+				bvhTriangles += meshes.meshTriangleCount[mesh];
+		}
+		m_Stats.SetBvhBuild(buildTime.count(), bvhTriangles);
 	}
 
-	RayIntersectionResult RecursiveRayTracer::IntersectRayToTesselatedObject(const Ray& ray, const Object& object, float minT, float maxT) const
+	RayIntersectionResult RecursiveRayTracer::IntersectRay(const Ray& ray, float minT, float maxT)
 	{
-		// sanity check
-		assert(object.shape != Shape::Sphere && "Sphere is parametric object");
+		// Find nearest primitive intersecting this ray, one set of primitives at a time
+		PrimitiveHit hit;
+		hit.t = maxT;
+		std::apply([&](auto const&... primitives)
+		{
+			(primitives.Intersect(ray, minT, hit), ...);
+		}, m_Primitives);
 
+		return ResolveHit(ray, hit, maxT);
+	}
 
-		glm::vec3 intersection, normal;
-		float t = maxT;
-		bool hitSome = false;
-		for (auto const& triIndices : object.geometry.indices)
+	RayIntersectionResult RecursiveRayTracer::ResolveHit(const Ray& ray, const PrimitiveHit& hit, float maxT)
+	{
+		if (!hit.WasHit())
 		{
-			glm::vec3 v1, v2, v3;
-			v1 = object.geometry.vertices[triIndices.x];
-			v2 = object.geometry.vertices[triIndices.y];
-			v3 = object.geometry.vertices[triIndices.z];
+			if (s_TileDependencies)
+				RecordRay(*s_TileDependencies, ray, maxT, NO_MATERIAL);
 
-			glm::vec3 n1, n2, n3;
-			n1 = object.geometry.normals[triIndices.x];
-			n2 = object.geometry.normals[triIndices.y];
-			n3 = object.geometry.normals[triIndices.z];
+			return RayIntersectionResult{ NO_MATERIAL, glm::vec3(0), glm::vec3(0), 0, &ray };
+		}
 
-			glm::vec3 nextIntersect, nextNormal;
-			float nextT;
-			bool wasIntersection = IntersectRayToTriangle(ray, v1, v2, v3, n1, n2, n3, nextIntersect, nextNormal, nextT, minT, t);
+		// Only the nearest hit needs its position, normal and material
+		RayIntersectionResult finalResult;
+		std::apply([&](auto const&... primitives)
+		{
+			((hit.kind == std::decay_t<decltype(primitives)>::KIND ? (void)(finalResult = primitives.GetIntersection(ray, hit)) : (void)0), ...);
+		}, m_Primitives);
 
-			// Continue if no intersection
-			if (!wasIntersection)
-				continue;
+		if (s_TileDependencies)
+			RecordRay(*s_TileDependencies, ray, hit.t, finalResult.materialId);
 
-			if (nextT >= minT && nextT < t)
-			{
-				hitSome = true;
-				t = nextT;
-				intersection = nextIntersect;
-				normal = nextNormal;
-			}
-		}
+		return finalResult;
+	}
 
-		// Check if there was a hit
-		if (hitSome)
+	void RecursiveRayTracer::RecordRay(TileDependencies& dependencies, const Ray& ray, float endT, uint32_t materialId) const
+	{
+		// Material ids are object indices
+		if (materialId != NO_MATERIAL)
+			s_ObjectRecorder.Record(materialId);
+
+		if (std::isinf(endT))
 		{
-			return RayIntersectionResult{
-			&object,
-				normal,
-				intersection,
-				t,
-				ray
-			};
+			// Anything the ray could hit later is either inside the scene bounds or outside of them, so it's
+			// enough to know where it leaves them and that it escaped
+			dependencies.raysEscape = true;
+			auto const inverseDirection = 1.f / ray.direction;
+			auto const t1 = (m_SceneBounds.min - ray.position) * inverseDirection;
+			auto const t2 = (m_SceneBounds.max - ray.position) * inverseDirection;
+			auto const tFar = glm::max(t1, t2);
+			float const exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+			endT = exit > 0.f ? exit : 0.f;
 		}
-	
-		return RayIntersectionResult{nullptr, glm::vec3(0), glm::vec3(0), 0 };
+
+		dependencies.rayBounds.Extend(ray.position);
+		dependencies.rayBounds.Extend(ray.position + endT * ray.direction);
 	}
 
 	glm::vec4 RecursiveRayTracer::Shade(const RayIntersectionResult& rayIntersection, uint32_t maxRecursionDepth)
@@ -590,87 +1201,139 @@ namespace RecRays
 		if (!rayIntersection.WasIntersection())
 			return glm::vec4(0);
 
+		RenderStats::Local().depthHistogram[std::min<size_t>(MAX_RECURSION_DEPTH - maxRecursionDepth, MAX_TRACKED_DEPTH - 1)]++;
+
+		// Use the shading kernel specialized for this kind of material
+		using ShadeKernel = glm::vec4 (RecursiveRayTracer::*)(const RayIntersectionResult&, uint32_t);
+		static constexpr ShadeKernel kernels[] = {
+			&RecursiveRayTracer::ShadeMaterial<false, false, false>,
+			&RecursiveRayTracer::ShadeMaterial<true, false, false>,
+			&RecursiveRayTracer::ShadeMaterial<false, true, false>,
+			&RecursiveRayTracer::ShadeMaterial<true, true, false>,
+			&RecursiveRayTracer::ShadeMaterial<false, false, true>,
+			&RecursiveRayTracer::ShadeMaterial<true, false, true>,
+			&RecursiveRayTracer::ShadeMaterial<false, true, true>,
+			&RecursiveRayTracer::ShadeMaterial<true, true, true>,
+		};
+		static_assert(std::size(kernels) == MATERIAL_CLASS_COUNT);
+
+		return (this->*kernels[m_Materials[rayIntersection.materialId].materialClass])(rayIntersection, maxRecursionDepth);
+	}
 
+	template<bool HasDiffuse, bool HasSpecular, bool IsReflective>
+	glm::vec4 RecursiveRayTracer::ShadeMaterial(const RayIntersectionResult& rayIntersection, uint32_t maxRecursionDepth)
+	{
+		auto& counters = RenderStats::Local();
 		auto normal = glm::normalize(rayIntersection.normal);
 		glm::vec4 lightColor(0);
-		auto const &object = *rayIntersection.object;
-		// Add ambient color
-		lightColor += object.ambient;
+		auto const &material = m_Materials[rayIntersection.materialId];
+		// Add ambient and emitted color
+		lightColor += material.ambient + material.emission;
+
+		// Footprint of the ray where it hit, secondary rays start that wide
+		float const footprint = rayIntersection.ray->GetFootprint(rayIntersection.t);
 
 		// Compute diffuse + specular for each light
-		glm::vec4 diffuse(0), specular(0);
-		for (auto const & light : m_SceneDescription.GetLights())
-		{
-			// Compute direction of light. If point light, then use relative position.
-			// If directional light, use straight up as direction.
-			glm::vec3 lightDirection(0);
-			float maxRayToLightLen;
-			if (light.position.w == 0.0)
-			{
-				lightDirection = glm::normalize(light.position);
-				maxRayToLightLen = INFINITY;
-			}
-			else
+		if constexpr (HasDiffuse || HasSpecular)
+		{
+			glm::vec4 diffuse(0), specular(0);
+			auto const& lights = m_SceneDescription.GetLights();
+			for (size_t lightIndex = 0; lightIndex < lights.size(); lightIndex++)
 			{
-				lightDirection = glm::vec3(light.position) - rayIntersection.position;
-				maxRayToLightLen = glm::length(lightDirection);
-				lightDirection = lightDirection / maxRayToLightLen;
+				auto const& light = lights[lightIndex];
+
+				// Compute direction of light. If point light, then use relative position.
+				// If directional light, use straight up as direction.
+				glm::vec3 lightDirection(0);
+				float maxRayToLightLen;
+				if (light.position.w == 0.0)
+				{
+					lightDirection = glm::normalize(light.position);
+					maxRayToLightLen = INFINITY;
+				}
+				else
+				{
+					lightDirection = glm::vec3(light.position) - rayIntersection.position;
+					maxRayToLightLen = glm::length(lightDirection);
+					lightDirection = lightDirection / maxRayToLightLen;
+				}
+
+				// Check if light can reach this point. Shadow rays narrow towards the light, keep them
+				// as wide as the shaded point so occluders are intersected at a similar level of detail
+				Ray ray{
+					rayIntersection.position + normal* 0.01f, lightDirection, footprint, 0.f
+				};
+
+				counters.shadowRays++;
+				auto const result = IntersectRay(ray, 0.f, maxRayToLightLen);
+				if (result.WasIntersection())
+				{
+					// Light is occluded, so nothing more to add. Its color doesn't matter here, only where it is
+					if (s_TileDependencies)
+						s_TileDependencies->RecordShadowedLight(lightIndex);
+					continue;
+				}
+
+				if (s_TileDependencies)
+					s_TileDependencies->RecordLight(lightIndex);
+
+				// Compute diffuse 
+				if constexpr (HasDiffuse)
+				{
+					diffuse +=
+						material.diffuse *
+						light.color *
+						glm::max(0.f, glm::dot(glm::vec3(normal), lightDirection));
+				}
+
+				// Compute specular
+				if constexpr (HasSpecular)
+				{
+					const glm::vec3 halfVec = glm::normalize(
+							lightDirection + 
+							(
+								-rayIntersection.ray->direction
+							)
+					);
+
+					specular += glm::pow(
+								glm::max(
+									0.f, 
+									glm::dot(glm::vec3(normal), halfVec)
+									), 
+								material.shininess
+								) * 
+								light.color * 
+								material.specular;
+				}
 			}
 
-			// Check if light can reach this point 
-			Ray ray{
-				rayIntersection.position + normal* 0.01f, lightDirection
-			};
-
-			auto const result = IntersectRay(ray, 0.f, maxRayToLightLen);
-			if (result.WasIntersection())
-				continue; // Light is occluded, so nothing more to add
-
-			// Compute diffuse 
-			diffuse +=
-				object.diffuse *
-				light.color *
-				glm::max(0.f, glm::dot(glm::vec3(normal), lightDirection));
-
-			// Compute specular
-			const glm::vec3 halfVec = glm::normalize(
-					lightDirection + 
-					(
-						-rayIntersection.ray.direction
-					)
-			);
-
-			specular += glm::pow(
-						glm::max(
-							0.f, 
-							glm::dot(glm::vec3(normal), halfVec)
-							), 
-						object.shininess
-						) * 
-						light.color * 
-						object.specular;
-
-		}
-
-		lightColor += diffuse + specular;
+			lightColor += diffuse + specular;
+		}
+
 		lightColor.a = 1;
 
+		if constexpr (!IsReflective)
+			return lightColor;
+
 		if (maxRecursionDepth == 0)
 			return lightColor;
 
 		// Now compute reflections.
 		// Generate reflection vector: r = d - 2(dot(d, normal)) * normal
 
-		auto const& d = rayIntersection.ray.direction;
+		auto const& d = rayIntersection.ray->direction;
 		const glm::vec3 reflectionDir = glm::normalize(d - 2.f * (glm::dot(d, normal)) * normal);
-		const Ray reflectionRay{ rayIntersection.position + normal * 0.00001f, reflectionDir };
+		// Treat the surface as flat, curved mirrors spread rays more, so this picks detailed levels to be safe
+		const Ray reflectionRay{ rayIntersection.position + normal * 0.00001f, reflectionDir, footprint, rayIntersection.ray->spread };
+		counters.reflectionRays++;
 		auto const reflecResult = IntersectRay(reflectionRay);
 
 		// If nothing to reflect, just return your own color
 		if (!reflecResult.WasIntersection())
 			return lightColor;
 
-		auto const reflecColor = object.mirror * Shade(reflecResult, maxRecursionDepth - 1);
+		auto const reflecColor = material.mirror * Shade(reflecResult, maxRecursionDepth - 1);
 		lightColor += reflecColor;
 		lightColor.a = 1;
 		return lightColor;
@@ -682,6 +1345,11 @@ namespace RecRays
 		m_CurrentSteps = std::min(m_CurrentSteps + 1, m_NSteps);
 	}
 
+	void ProgressBar::SetSteps(size_t steps)
+	{
+		m_CurrentSteps = std::min(steps, m_NSteps);
+	}
+
 	void ProgressBar::Draw() const
 	{
 		float const progress = static_cast<float>(m_CurrentSteps) / static_cast<float>(m_NSteps);
@@ -692,7 +1360,16 @@ namespace RecRays
 			else if (i == pos) std::cout << ">";
 			else std::cout << " ";
 		}
-		std::cout << "] " << static_cast<size_t>(progress * 100.0) <<  " %(" << m_CurrentSteps << " / " << m_NSteps << ")" "\r";
+		std::cout << "] " << static_cast<size_t>(progress * 100.0) <<  " %(" << m_CurrentSteps << " / " << m_NSteps << ")";
+
+		// Estimate remaining time assuming the remaining steps take as long as the previous ones
+		if (m_CurrentSteps > 0)
+		{
+			auto const elapsed = std::chrono::duration<float>(std::chrono::steady_clock::now() - m_StartTime).count();
+			auto const eta = elapsed / progress - elapsed;
+			std::cout << " ETA: " << static_cast<size_t>(eta) << "s   ";
+		}
+		std::cout << "\r";
 		std::cout.flush();
 	}
 }
\ No newline at end of file
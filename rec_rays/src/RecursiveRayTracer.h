@@ -1,7 +1,13 @@
 #pragma once
 // STL Includes
 #include <vector>
+#include <string>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <tuple>
+#include <functional>
+#include <future>
 
 // Third party includes
 #include <glm/glm.hpp>
@@ -10,11 +16,43 @@
 
 // Local includes
 #include "Geometry.h"
+#include "Primitives.h"
+#include "RenderStats.h"
+#include "Preview.h"
+#include "Incremental.h"
+#include "ImageEncoder.h"
+#include "Rasterizer.h"
+#include "TileCache.h"
+#include "Checkpoint.h"
+#include "SharedFrameBuffer.h"
 
 namespace RecRays
 {
 	constexpr int MAX_LIGHTS = 20;
 	constexpr int MAX_OBJECTS = 20;
+	// Spheres are counted apart from other objects, sphere scenes are only worth a grid with many of them
+	constexpr int MAX_SPHERES = 1 << 24;
+	constexpr uint32_t MAX_RECURSION_DEPTH = 10;
+	// Largest width and height in pixels of a rendered image
+	constexpr size_t MAX_IMAGE_RESOLUTION = 1 << 15;
+
+	// Width and height in pixels of each unit of work scheduled to render threads
+	constexpr size_t TILE_SIZE = 32;
+
+	// Threads drawing local renders when no render profile says otherwise
+	constexpr size_t DEFAULT_RENDER_THREADS = 12;
+
+	/**
+	 * \brief Settings that change how fast a machine renders, but not the image. Defaults work anywhere,
+	 * --autotune finds the fastest ones for each machine
+	 */
+	struct RenderProfile
+	{
+		size_t nThreads = DEFAULT_RENDER_THREADS;
+		size_t tileSize = TILE_SIZE; // Multiple of every preview scale
+		uint32_t bvhMaxLeafTriangles = BVH_MAX_LEAF_TRIANGLES;
+		float sphereGridCellsPerSphere = SPHERE_GRID_CELLS_PER_SPHERE;
+	};
 
 	/**
 	 * \brief Light properties
@@ -40,21 +78,36 @@ namespace RecRays
 	struct Object
 	{
 		// Coloring
-		glm::vec4 ambient, diffuse, specular, emission, mirror;
-		float shininess;
+		glm::vec4 ambient = glm::vec4(0), diffuse = glm::vec4(0), specular = glm::vec4(0), emission = glm::vec4(0), mirror = glm::vec4(0);
+		float shininess = 0;
 
 		// Geometry
-		Shape shape;
-		float size; // a scaling factor
-		glm::mat4 transform;
-		Geometry geometry; // empty geometry when it's sphere
+		Shape shape = Shape::Sphere;
+		float size = 1; // a scaling factor
+		glm::mat4 transform = glm::mat4(1);
+
+		/**
+		 * \brief Shading properties of this object, as stored in the material table
+		 * \param enableLight If lighting is enabled in the scene
+		 */
+		Material GetMaterial(bool enableLight) const;
 
 		/**
-		 * \brief Set up geometry ptr according to the shape
+		 * \brief World space box enclosing this object
 		 */
-		void SetGeometry();
+		Bounds GetBounds() const;
 	};
 
+	/**
+	 * \brief Scene primitives grouped by type. Intersection runs a loop specialized for each set instead of
+	 * switching on the shape of every object. To support a new kind of primitive, add a set for it here with
+	 * its own Intersect and GetIntersection functions and a unique KIND
+	 */
+	using PrimitiveLists = std::tuple<
+		SphereSet,
+		MeshSet
+	>;
+
 	/**
 	 * \brief Data required to define a camera
 	 */
@@ -68,6 +121,15 @@ namespace RecRays
 		float fovy;
 	};
 
+	/**
+	 * \brief A camera of the scene and where its image goes
+	 */
+	struct ViewDescription
+	{
+		CameraDescription camera;
+		std::string output; // Image file, empty for the default one
+	};
+
 	/**
 	 * \brief Data conforming a single scene
 	 */
@@ -84,18 +146,48 @@ namespace RecRays
 		 * \return Success status, might fail if already max lights
 		 */
 		int AddLight(const Light& newLigth);
+
+		/**
+		 * \brief Add a new object to object array
+		 * \return Success status, might fail if already max spheres, or max objects for other shapes
+		 */
 		int AddObject(const Object& newObject);
 
-		inline const std::vector<Light>& GetLights() { return lights; }
+		inline const std::vector<Light>& GetLights() const { return lights; }
 		inline std::vector<Object>& GetObjects() { return objects; }
-		inline const std::vector<Object>& GetObjectsConst() { return objects; }
+		inline const std::vector<Object>& GetObjectsConst() const { return objects; }
 
 		// If should use lighting
 		bool enableLight = true;
 
+		// If meshes should be stored in compact form, using less memory at some precision and speed cost
+		bool compactMeshes = false;
+
+		// If distant meshes should be intersected with simplified versions of them
+		bool meshLods = true;
+
+		// If primary visibility should be rasterized instead of traced, in local renders
+		bool rasterPrimary = false;
+
+		// How rays find the spheres they hit
+		SphereAccelerator sphereAccelerator = SphereAccelerator::Auto;
+
 		// Camera specification
 		CameraDescription camera;
 
+		// Where to write the image of the camera above, empty for the default file
+		std::string output;
+
+		// Cameras after the first one, rendered along with it sharing the same scene setup
+		std::vector<ViewDescription> extraViews;
+
+		inline size_t GetNumViews() const { return 1 + extraViews.size(); }
+
+		/**
+		 * \brief Get a view of the scene, the first one is the main camera
+		 */
+		inline ViewDescription GetView(size_t view) const { return view == 0 ? ViewDescription{ camera, output } : extraViews[view - 1]; }
+
 		// Output image specification
 		float imgHeight, imgWidth; // Height Possibly unused
 		size_t imgResX, imgResY;
@@ -104,6 +196,7 @@ namespace RecRays
 	private:
 		std::vector<Light> lights;
 		std::vector<Object> objects;
+		size_t nSpheres = 0;
 	};
 
 	/**
@@ -147,12 +240,6 @@ namespace RecRays
 		glm::vec3 m_U, m_V, m_W; 
 	};
 
-	struct Ray
-	{
-		glm::vec3 position;
-		glm::vec3 direction;
-	};
-
 	class RayGenerator
 	{
 	public:
@@ -203,6 +290,11 @@ namespace RecRays
 
 		const Camera& GetCamera() const { return m_Camera; }
 
+		/**
+		 * \brief Pixel grid rays go through, rays of MID type go through the center of each pixel
+		 */
+		ViewPlane GetViewPlane() const;
+
 	private:
 		Camera m_Camera;
 		// amount of pixels in each axis
@@ -215,26 +307,6 @@ namespace RecRays
 		float m_DistanceToViewPlane;
 	};
 
-	struct RayIntersectionResult
-	{
-		RayIntersectionResult(const Object* _object = nullptr, glm::vec3 _normal = glm::vec3(0), glm::vec3 _position = glm::vec3(0), float _t = 0, Ray _ray = Ray())
-			: object(_object)
-			, normal(_normal)
-			, position(_position)
-			, t(_t)
-			, ray(_ray)
-		{
-
-		}
-		const Object* object;
-		glm::vec3 normal;
-		glm::vec3 position; // world coordinates
-		float t; // Intersection point in ray. How far from origin 
-		Ray ray; // Ray casted
-
-		bool WasIntersection() const { return object != nullptr; }
-	};
-
 	template<typename T>
 	class TwoDimensionVector
 	{
@@ -268,6 +340,8 @@ namespace RecRays
 		std::vector<T> m_Data;
 	};
 
+	class ProgressBar;
+
 	class RecursiveRayTracer
 	{
 	public:
@@ -275,14 +349,274 @@ namespace RecRays
 
 		int Draw(FIBITMAP*& outImage, size_t nThreads);
 
+		/**
+		 * \brief Draw a quick preview: trace a G-buffer with color, depth, normal and object id at a fraction of the
+		 * resolution, then upsample it to full resolution. Pixels across discontinuities are traced at full resolution,
+		 * as many as PREVIEW_EXTRA_RAY_BUDGET allows
+		 * \param outImage Full resolution image
+		 * \param scale Resolution divisor, one of PREVIEW_SCALES
+		 * \param nThreads How many threads to render with
+		 * \return Success status
+		 */
+		int DrawPreview(FIBITMAP*& outImage, size_t scale, size_t nThreads);
+
+		/**
+		 * \brief Draw the image of every camera of the scene. Scene is set up once for all of them, and tiles of every
+		 * view are scheduled together on the same threads
+		 * \param outImages One image per view, in the order of SceneDescription::GetView
+		 * \param nThreads How many threads to render with
+		 * \param onViewDone Called from the calling thread with the index of each view as soon as its image is final,
+		 * while later views are still being traced. Might be empty
+		 * \return Success status
+		 */
+		int DrawViews(std::vector<FIBITMAP*>& outImages, size_t nThreads, const std::function<void(size_t)>& onViewDone = nullptr);
+
+		/**
+		 * \brief Set up scene geometry and per frame state. Call it once before drawing tiles by hand
+		 * \param threads Render threads, used to build acceleration structures in parallel. Might be nullptr
+		 */
+		void PrepareScene(thread_pool* threads = nullptr);
+
+		/**
+		 * \brief Rasterize what primary rays hit if the scene asks for hybrid rendering, so tiles only trace
+		 * secondary rays. Call it after PrepareScene, before drawing tiles
+		 * \param threads Where to run rasterization jobs. Waits for them before returning
+		 */
+		void RasterizePrimaryVisibility(thread_pool& threads);
+
+		/**
+		 * \brief How many tiles the image is split into
+		 */
+		size_t GetNumTiles() const;
+
+		/**
+		 * \brief Get pixel range covered by a tile, as [startI, endI) x [startJ, endJ)
+		 * \param tileIndex Index of tile, tiles are numbered row by row
+		 */
+		void GetTileBounds(size_t tileIndex, size_t& outStartI, size_t& outEndI, size_t& outStartJ, size_t& outEndJ) const;
+
+		/**
+		 * \brief Render a single tile. Scene should be prepared with PrepareScene first. Safe to call concurrently
+		 * for different tiles
+		 * \param outBuffer Full size buffer where to write colors of the tile
+		 * \param tileIndex Index of tile to render
+		 */
+		void DrawTile(TwoDimensionVector<glm::vec4>& outBuffer, size_t tileIndex);
+
+		/**
+		 * \brief Render a single tile without a full size color buffer, like DrawTile
+		 * \return Colors of the tile column by column: pixel (i, j) of the tile is at i * tile height + j. They live in
+		 * scratch memory of the calling thread, valid until it draws its next tile
+		 */
+		const glm::vec4* DrawTileColors(size_t tileIndex);
+
+		/**
+		 * \brief Copy colors from a color buffer into an image of the same size
+		 * \param colorBuffer Rendered colors
+		 * \param image Image where to write colors, should be already allocated
+		 */
+		static void ConvertToImage(const TwoDimensionVector<glm::vec4>& colorBuffer, FIBITMAP* image);
+
+		/**
+		 * \brief Copy colors of a row of tiles from a color buffer into an image of the same size
+		 * \param startJ First row of pixels of the tiles
+		 * \param endJ One past last row of pixels of the tiles
+		 * \param outFirstScanLine First scanline of the image written
+		 * \param outEndScanLine One past last scanline of the image written, equal to first if nothing was written
+		 */
+		static void ConvertToImage(const TwoDimensionVector<glm::vec4>& colorBuffer, FIBITMAP* image, size_t startJ, size_t endJ, size_t& outFirstScanLine, size_t& outEndScanLine);
+
+		const SceneDescription& GetSceneDescription() const { return m_SceneDescription; }
+
+		/**
+		 * \brief Statistics collected during the last call to Draw
+		 */
+		const RenderStats& GetStats() const { return m_Stats; }
+
+		/**
+		 * \brief Add up statistics of tiles drawn by hand once every one of them is done
+		 * \param totalMilliseconds Wall time spent rendering the whole frame
+		 */
+		void AggregateStats(double totalMilliseconds) { m_Stats.Aggregate(totalMilliseconds); }
+
+		/**
+		 * \brief Record what each tile depends on during Draw, and reuse tiles of a previous render that are not
+		 * affected by changes to the scene since then
+		 * \param previous State of previous render, nullptr to render everything. Should outlive next call to Draw
+		 */
+		void EnableIncrementalRendering(const RenderState* previous);
+
+		/**
+		 * \brief State of the last call to Draw, to be passed to a later render of an edited scene. Only filled when
+		 * incremental rendering is enabled
+		 */
+		const RenderState& GetRenderState() const { return m_RenderState; }
+
+		/**
+		 * \brief Stream rows of the image to an encoder as soon as they are done, so they're compressed while the
+		 * rest is being traced. Draw starts the encoder on the image it allocates, the caller finishes it
+		 * \param encoder Encoder to use, nullptr to stop streaming. Should outlive next call to Draw
+		 */
+		void SetImageEncoder(PngEncoder* encoder) { m_Encoder = encoder; }
+
+		/**
+		 * \brief Take tiles from a cache instead of drawing them when they are there, and store tiles Draw does
+		 * draw. Ignored by incremental renders, cached tiles don't know what they depend on
+		 * \param cache Cache to use, nullptr to draw every tile. Should outlive next call to Draw
+		 * \param sceneKey Key of this scene, from TileCache::HashScene
+		 */
+		void SetTileCache(const TileCache* cache, uint64_t sceneKey)
+		{
+			m_TileCache = cache;
+			m_TileCacheKey = sceneKey;
+		}
+
+		/**
+		 * \brief Record tiles in a checkpoint as Draw finishes them, and skip tiles the checkpoint already has.
+		 * Not meant for incremental renders, tiles taken from checkpoints don't know what they depend on
+		 * \param checkpoint Checkpoint of this render, possibly loaded from an interrupted one. nullptr to disable.
+		 * Should outlive next call to Draw
+		 */
+		void SetCheckpoint(RenderCheckpoint* checkpoint) { m_Checkpoint = checkpoint; }
+
+		/**
+		 * \brief Publish tiles to a shared frame buffer as Draw finishes them, for viewers in other processes.
+		 * Tiles are copied from the main thread, render threads never touch it
+		 * \param frameBuffer Frame buffer created with the resolution of the scene, nullptr to disable. Should outlive next call to Draw
+		 */
+		void SetSharedFrameBuffer(SharedFrameBuffer* frameBuffer) { m_SharedFrameBuffer = frameBuffer; }
+
+		/**
+		 * \brief Show the image in an SDL window while Draw traces it. Needs SDL video to be initialized, renders
+		 * on machines without a display should disable it
+		 */
+		void SetPreviewWindow(bool enabled) { m_PreviewWindow = enabled; }
+
+		/**
+		 * \brief Use tile size and acceleration structure settings of a profile. Call it before drawing, thread count
+		 * is still the one given to each draw call
+		 */
+		void SetProfile(const RenderProfile& profile) { m_Profile = profile; }
+
+		size_t GetTileSize() const { return m_Profile.tileSize; }
+
 	private:
 		// Scene to render 
 		SceneDescription m_SceneDescription;
 		// Object to generate rays from scene description
 		RayGenerator m_RayGenerator;
+		// Scene objects ready for intersection, grouped by type
+		PrimitiveLists m_Primitives;
+		// Shading properties of scene objects, indexed by material id. Only read for the nearest hit
+		std::vector<Material> m_Materials;
+		// Work counters and timings for the last frame
+		RenderStats m_Stats;
+		// How many tiles are already done in the current frame
+		std::atomic<size_t> m_CompletedTiles = 0;
+		// Bounds of every object in the scene, rays leaving the scene are recorded up to them
+		Bounds m_SceneBounds;
+		// Tile size and acceleration structure settings
+		RenderProfile m_Profile;
+
+		// Incremental rendering
+		bool m_IncrementalRendering = false;
+		const RenderState* m_PreviousFrame = nullptr;
+		std::vector<TileDependencies> m_TileDependencies;
+		RenderState m_RenderState;
+
+		// Where to stream finished rows of the image, if any
+		PngEncoder* m_Encoder = nullptr;
+
+		// Where to look for finished tiles before drawing them, if anywhere
+		const TileCache* m_TileCache = nullptr;
+		uint64_t m_TileCacheKey = 0;
+
+		// Where to save finished tiles while drawing, if anywhere
+		RenderCheckpoint* m_Checkpoint = nullptr;
+
+		// Where to publish finished tiles for other processes, if anywhere
+		SharedFrameBuffer* m_SharedFrameBuffer = nullptr;
+
+		// If Draw shows the image in a window while tracing it
+		bool m_PreviewWindow = true;
+
+		// Nearest hits of primary rays for the current frame, empty when primary rays are traced
+		VisibilityRasterizer m_Rasterizer;
+
+		// Dependencies of the tile being rendered by this thread, nullptr if not recording
+		inline static thread_local TileDependencies* s_TileDependencies = nullptr;
+		// Objects hit by the tile being rendered by this thread, only used while recording
+		inline static thread_local TileObjectRecorder s_ObjectRecorder;
+		// Pixels of the tile being upsampled by this thread that couldn't be reconstructed, as offsets in the tile
+		inline static thread_local std::vector<uint32_t> s_PreviewFallbackPixels;
 
 	private:
-		void DrawThread(TwoDimensionVector<glm::vec4>& outBuffer, size_t startI, size_t endI, size_t startJ, size_t endJ);
+		/**
+		 * \brief Render a single tile of the image, covering pixels in [startI, endI) x [startJ, endJ)
+		 * \param outBuffer Buffer where to write resulting colors
+		 * \param tileIndex Index of this tile, used to store its statistics
+		 */
+		void DrawThread(TwoDimensionVector<glm::vec4>& outBuffer, size_t tileIndex, size_t startI, size_t endI, size_t startJ, size_t endJ, const RayGenerator& rayGenerator, const VisibilityRasterizer& rasterizer);
+
+		/**
+		 * \brief Trace and shade every pixel of a tile, recording its statistics and dependencies
+		 * \return Colors of the tile column by column, in scratch memory of the calling thread
+		 */
+		const glm::vec4* TraceTile(size_t tileIndex, size_t startI, size_t endI, size_t startJ, size_t endJ, const RayGenerator& rayGenerator, const VisibilityRasterizer& rasterizer);
+
+		/**
+		 * \brief Steps shared by every way of drawing a single image: allocate it, set up threads and scene, then time
+		 * the frame and add up its statistics around the actual drawing
+		 * \param outImage Drawn image, left as is on failure
+		 * \param drawTiles Fills the color buffer running tiles on the threads, and writes it to the image
+		 * \return Success status
+		 */
+		int DrawFrame(FIBITMAP*& outImage, size_t nThreads, const std::function<void(thread_pool&, TwoDimensionVector<glm::vec4>&, FIBITMAP*)>& drawTiles);
+
+		/**
+		 * \brief Draw every tile of the image, reusing the ones incremental rendering, the tile cache or the
+		 * checkpoint already have. Body of Draw
+		 */
+		void DrawTiles(thread_pool& threads, TwoDimensionVector<glm::vec4>& colorBuffer, FIBITMAP* image);
+
+		/**
+		 * \brief Trace preview samples of every tile and upsample them. Body of DrawPreview
+		 */
+		void DrawPreviewTiles(thread_pool& threads, TwoDimensionVector<glm::vec4>& colorBuffer, FIBITMAP* image, size_t scale);
+
+		/**
+		 * \brief Allocate an image as large as the scene's, 8 bit RGB
+		 * \return nullptr if there's not enough memory
+		 */
+		FIBITMAP* AllocateImage() const;
+
+		/**
+		 * \brief Wait for tiles in the order they were scheduled, stepping a progress bar as each one is done
+		 * \param onTileDone Called with the position of each tile in futures once it's done. Might be empty
+		 */
+		static void WaitForTiles(std::vector<std::future<void>>& futures, ProgressBar& progressBar, const std::function<void(size_t)>& onTileDone = nullptr);
+
+		/**
+		 * \brief Trace and shade a primary ray through the center of a pixel, keeping what it hit
+		 */
+		GBufferSample TraceSample(size_t pixelX, size_t pixelY);
+
+		/**
+		 * \brief Trace preview samples falling inside a tile. Tile size is a multiple of every preview scale,
+		 * so every sample belongs to exactly one tile
+		 * \param outSamples Low resolution G-buffer where to write samples, row by row
+		 * \param sampleResX Width of G-buffer
+		 * \param scale Resolution divisor of G-buffer
+		 * \param outStats Where to write time and counters spent on this tile
+		 */
+		void TracePreviewSamples(std::vector<GBufferSample>& outSamples, size_t sampleResX, size_t scale, size_t tileIndex, TileStats& outStats);
+
+		/**
+		 * \brief Reconstruct pixels of a tile from preview samples, tracing the ones that can't be reconstructed as
+		 * long as the tile has budget left for them, see PREVIEW_EXTRA_RAY_BUDGET
+		 * \param sampleStats Stats of tracing samples of this tile, added to the ones of upsampling it
+		 */
+		void UpsamplePreviewTile(TwoDimensionVector<glm::vec4>& outBuffer, const PreviewUpsampler& upsampler, const TileStats& sampleStats, size_t tileIndex);
 
 		/**
 		 * \brief Utility function to compute focal length from camera configuration
@@ -300,10 +634,15 @@ namespace RecRays
 		 */
 		static float HeightFromAspectRatio(float aspectRatio, float width);
 
+		/**
+		 * \brief Ray generator for a camera looking at this scene, with the image settings of the scene
+		 */
+		RayGenerator CreateRayGenerator(const CameraDescription& camera) const;
+
 		/**
 		 * \brief Set up geometry of objects in scene description so it matches with the camera
 		 */
-		void SetUpGeometry();
+		void SetUpGeometry(thread_pool* threads);
 
 		/**
 		 * \brief Intersect a ray and return a description of the intersection point, if any.
@@ -316,68 +655,44 @@ namespace RecRays
 		RayIntersectionResult IntersectRay(const Ray& ray, float minT = 0, float maxT = INFINITY);
 
 		/**
-		 * \brief Perform ray intersection between the provided ray and object
-		 * \param ray Ray to intersect
-		 * \param object Object to check for intersection, with vertices in world coordinates
-		 * \param minT = Minimum T value for ray
-		 * \param maxT = Maximum T value for ray. You can replace this if you already found an object and you're
-		 * not interested in any object further away
-		 * \return Ray intersection description if any
+		 * \brief Describe the intersection point of a ray from the nearest hit found for it
+		 * \param hit Nearest hit, might be no hit at all
+		 * \param maxT Max value of T that was considered
+		 */
+		RayIntersectionResult ResolveHit(const Ray& ray, const PrimitiveHit& hit, float maxT);
+
+		/**
+		 * \brief Add a traced ray to dependencies of current tile
+		 * \param endT Where the ray stopped, INFINITY if it left the scene
+		 * \param materialId Material id of object hit, NO_MATERIAL if none
 		 */
-		RayIntersectionResult IntersectRayToObject(const Ray& ray, const Object& object, float minT = 0, float maxT = INFINITY) const;
+		void RecordRay(TileDependencies& dependencies, const Ray& ray, float endT, uint32_t materialId) const;
 
 		/**
-		 * \brief Check for intersection between the provided ray and sphere. Will crash if
-		 * object is not of type sphere
-		 * \param ray Ray to intersect
-		 * \param sphere Object of type sphere to check for intersection
-		 * \return Intersection description
+		 * \brief Keep colors and dependencies of the last render in m_RenderState
 		 */
-		RayIntersectionResult IntersectRayToSphere(const Ray& ray, const Object& sphere, float minT = 0, float maxT = INFINITY) const;
+		void StoreRenderState(const TwoDimensionVector<glm::vec4>& colorBuffer);
 
 		/**
-		 * \brief Check if the specified point is inside a triangle specified by its vertices
-		 * \param point Point to check if inside
-		 * \param v1 first vertice
-		 * \param v2 second vertice
-		 * \param v3 third vertice
-		 * \return if point is inside triangle
+		 * \brief Store drawn tiles in the tile cache and trim it
+		 * \param tiles Indices of tiles to store
 		 */
-		static bool PointInsideTriangle(const glm::vec3& point, const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3);
+		void StoreCachedTiles(const TwoDimensionVector<glm::vec4>& colorBuffer, const std::vector<size_t>& tiles);
 
 		/**
-		 * \brief Intersect a ray to the triangle specified by the given vertices. Winding order does not
-		 * matter.
-		 * \param ray Ray to intersect
-		 * \param v1 First vertex of triangle 
-		 * \param v2 Second vertex of triangle 
-		 * \param v3 Third vertex of triangle
-		 * \param n1 normal fist vertex of triangle 
-		 * \param n2 normal second vertex of triangle 
-		 * \param n3 normal third vertex of triangle
-		 * \param outIntersection position of intersection with given triangle
-		 * \param outNormal interpolated normal at intersection
-		 * \param outT where in the ray the intersection happened 
-		 * \param minT minimum acceptable T (point from eye position)
-		 * \param maxT max acceptable T (point from eye position)
-		 * \return If there was an intersection
+		 * \brief Colors of a tile, column by column
 		 */
-		static bool IntersectRayToTriangle(
-			const Ray& ray, 
-			const glm::vec3& v1, const glm::vec3& v2, const glm::vec3& v3, 
-			const glm::vec3& n1, const glm::vec3& n2, const glm::vec3& n3, 
-			glm::vec3& outIntersection, glm::vec3& outNormal, float& outT,
-			float minT, float maxT);
+		std::vector<glm::vec4> GetTileColors(const TwoDimensionVector<glm::vec4>& colorBuffer, size_t tileIndex) const;
 
 		/**
-		 * \brief Intersect a given ray with a tesselated object (an object made of triangles)
-		 * \param ray  Ray to intersect
-		 * \param object Object to intersect with
-		 * \param minT minimum acceptable T (point from eye position)
-		 * \param maxT max acceptable T (point from eye position)
-		 * \return Result of ray intersection with this object
+		 * \brief Write colors of a tile, in the order GetTileColors returns them
 		 */
-		RayIntersectionResult IntersectRayToTesselatedObject(const Ray& ray, const Object& object, float minT = 0, float maxT = INFINITY) const;
+		void SetTileColors(TwoDimensionVector<glm::vec4>& outColorBuffer, size_t tileIndex, const std::vector<glm::vec4>& colors) const;
+
+		/**
+		 * \brief Hand a finished tile to the checkpoint and shared frame buffer, the ones in use
+		 */
+		void PublishTile(const TwoDimensionVector<glm::vec4>& colorBuffer, size_t tileIndex);
 
 		/**
 		 * \brief select color using global information and ray intersection information
@@ -386,7 +701,18 @@ namespace RecRays
 		 * \param maxRecursionDepth How many recursive steps to perform for reflections
 		 * \return color corresponding to this pixel
 		 */
-		glm::vec4 Shade(const RayIntersectionResult& rayIntersection, uint32_t maxRecursionDepth = 10);
+		glm::vec4 Shade(const RayIntersectionResult& rayIntersection, uint32_t maxRecursionDepth = MAX_RECURSION_DEPTH);
+
+		/**
+		 * \brief Shading kernel for a single material class. Terms the material doesn't use are removed at
+		 * compile time, so no shadow rays are traced for materials not affected by lights and no reflection rays
+		 * for materials that don't reflect
+		 * \param rayIntersection Valid intersection to shade
+		 * \param maxRecursionDepth How many recursive steps to perform for reflections
+		 * \return color corresponding to this pixel
+		 */
+		template<bool HasDiffuse, bool HasSpecular, bool IsReflective>
+		glm::vec4 ShadeMaterial(const RayIntersectionResult& rayIntersection, uint32_t maxRecursionDepth);
 
 		
 	};
@@ -401,16 +727,26 @@ namespace RecRays
 			: m_BarSize(barSize)
 			, m_NSteps(nSteps)
 			, m_CurrentSteps(0)
+			, m_StartTime(std::chrono::steady_clock::now())
 		{ }
 
 		void Step();
 
+		/**
+		 * \brief Set how many steps are done so far, useful when progress is tracked somewhere else
+		 */
+		void SetSteps(size_t steps);
+
+		/**
+		 * \brief Draw bar, percentage and estimated time to finish
+		 */
 		void Draw() const;
 
 	private:
 		size_t m_BarSize;
 		size_t m_NSteps;
 		size_t m_CurrentSteps;
+		std::chrono::steady_clock::time_point m_StartTime;
 
 	};
 }
@@ -0,0 +1,124 @@
+// Local includes
+#include "RenderStats.h"
+#include "ImageEncoder.h"
+
+// STL includes
+#include <algorithm>
+#include <iomanip>
+
+// Vendor includes
+#include <glm/glm.hpp>
+
+namespace RecRays
+{
+	// -- < Render Counters > ---------------------------------------------------
+	RenderCounters& RenderCounters::operator+=(const RenderCounters& other)
+	{
+		primaryRays += other.primaryRays;
+		shadowRays += other.shadowRays;
+		reflectionRays += other.reflectionRays;
+		triangleTests += other.triangleTests;
+		sphereTests += other.sphereTests;
+		traversalSteps += other.traversalSteps;
+
+		for (size_t i = 0; i < MAX_TRACKED_DEPTH; i++)
+			depthHistogram[i] += other.depthHistogram[i];
+
+		return *this;
+	}
+
+	// -- < Render Stats > ------------------------------------------------------
+	void RenderStats::Reset(size_t nTiles)
+	{
+		m_Tiles.assign(nTiles, TileStats());
+		m_Totals.Reset();
+		m_TotalMilliseconds = 0;
+	}
+
+	void RenderStats::Aggregate(double totalMilliseconds)
+	{
+		m_Totals.Reset();
+		for (auto const& tile : m_Tiles)
+			m_Totals += tile.counters;
+
+		m_TotalMilliseconds = totalMilliseconds;
+	}
+
+	void RenderStats::Print(std::ostream& os) const
+	{
+		auto const totalRays = m_Totals.primaryRays + m_Totals.shadowRays + m_Totals.reflectionRays;
+		auto const seconds = m_TotalMilliseconds / 1000.0;
+
+		os << "-- Render statistics ---------------------------" << std::endl;
+		os << "Total time:       " << std::fixed << std::setprecision(3) << seconds << " s" << std::endl;
+		os << "Primary rays:     " << m_Totals.primaryRays << std::endl;
+		os << "Shadow rays:      " << m_Totals.shadowRays << std::endl;
+		os << "Reflection rays:  " << m_Totals.reflectionRays << std::endl;
+		if (seconds > 0)
+			os << "Rays per second:  " << std::setprecision(0) << static_cast<double>(totalRays) / seconds << std::endl;
+		os << "Triangle tests:   " << m_Totals.triangleTests << std::endl;
+		os << "Sphere tests:     " << m_Totals.sphereTests << std::endl;
+		os << "Traversal steps:  " << m_Totals.traversalSteps << std::endl;
+		os << "Mesh memory:      " << std::setprecision(1) << static_cast<double>(m_GeometryBytes) / 1024.0 << " KB" << std::endl;
+		os << "BVH build:        " << std::setprecision(3) << m_BvhBuildMilliseconds << " ms (" << m_BvhTriangles << " triangles)" << std::endl;
+
+		// Recursion depth histogram, skipping depths nothing reached
+		os << "Recursion depth histogram:" << std::endl;
+		for (size_t i = 0; i < MAX_TRACKED_DEPTH; i++)
+		{
+			if (m_Totals.depthHistogram[i] == 0)
+				continue;
+			os << "  " << std::setw(2) << i << (i == MAX_TRACKED_DEPTH - 1 ? "+" : " ") << ": " << m_Totals.depthHistogram[i] << std::endl;
+		}
+
+		// Tile times
+		if (!m_Tiles.empty())
+		{
+			auto const [minTile, maxTile] = std::minmax_element(m_Tiles.begin(), m_Tiles.end(),
+				[](const TileStats& a, const TileStats& b) { return a.milliseconds < b.milliseconds; });
+
+			double sum = 0;
+			for (auto const& tile : m_Tiles)
+				sum += tile.milliseconds;
+
+			os << std::setprecision(3);
+			os << "Tiles:            " << m_Tiles.size() << std::endl;
+			os << "Tile time (ms):   min " << minTile->milliseconds
+				<< ", avg " << sum / static_cast<double>(m_Tiles.size())
+				<< ", max " << maxTile->milliseconds
+				<< " (tile at " << maxTile->startX << ", " << maxTile->startY << ")" << std::endl;
+		}
+
+		os << "------------------------------------------------" << std::endl;
+		os << std::defaultfloat;
+	}
+
+	FIBITMAP* RenderStats::CreateHeatmap(size_t resX, size_t resY) const
+	{
+		auto heatmap = FreeImage_Allocate(resX, resY, 8 * 3);
+		if (!heatmap)
+			return nullptr;
+
+		double maxTime = 0;
+		for (auto const& tile : m_Tiles)
+			maxTime = std::max(maxTime, tile.milliseconds);
+
+		for (auto const& tile : m_Tiles)
+		{
+			// Black -> red -> yellow -> white as the tile gets more expensive
+			float const cost = maxTime > 0 ? static_cast<float>(tile.milliseconds / maxTime) : 0.f;
+			glm::vec3 const heat = glm::clamp(glm::vec3(3.f * cost, 3.f * cost - 1.f, 3.f * cost - 2.f), 0.f, 1.f);
+
+			RGBQUAD color;
+			color.rgbRed = static_cast<BYTE>(255.f * heat.r);
+			color.rgbGreen = static_cast<BYTE>(255.f * heat.g);
+			color.rgbBlue = static_cast<BYTE>(255.f * heat.b);
+
+			for (size_t i = tile.startX; i < tile.endX; i++)
+				for (size_t j = tile.startY; j < tile.endY; j++)
+					FreeImage_SetPixelColor(heatmap, i, RowToScanLine(j, resY), &color);
+		}
+
+		return heatmap;
+	}
+}
@@ -0,0 +1,121 @@
+// Cheap counters to find out where render time goes
+#pragma once
+
+// STL includes
+#include <array>
+#include <vector>
+#include <ostream>
+#include <cstdint>
+
+// Third party includes
+#include <FreeImage.h>
+
+namespace RecRays
+{
+	// Deeper recursion levels are accumulated in the last histogram bucket
+	constexpr size_t MAX_TRACKED_DEPTH = 16;
+
+	/**
+	 * \brief Work counters for a single thread. Plain integers: every thread owns its own copy, so
+	 * no synchronization is required while rendering
+	 */
+	struct RenderCounters
+	{
+		uint64_t primaryRays = 0;
+		uint64_t shadowRays = 0;
+		uint64_t reflectionRays = 0;
+
+		uint64_t triangleTests = 0;
+		uint64_t sphereTests = 0;
+		uint64_t traversalSteps = 0;
+
+		// How many shading calls happened at each recursion depth
+		std::array<uint64_t, MAX_TRACKED_DEPTH> depthHistogram = {};
+
+		void Reset() { *this = RenderCounters(); }
+
+		RenderCounters& operator+=(const RenderCounters& other);
+	};
+
+	/**
+	 * \brief Statistics collected for a single rendered tile
+	 */
+	struct TileStats
+	{
+		size_t startX = 0, endX = 0, startY = 0, endY = 0;
+		double milliseconds = 0;
+		RenderCounters counters;
+	};
+
+	/**
+	 * \brief Statistics for a whole frame. Each tile writes to its own slot, so render threads never contend,
+	 * and results are aggregated once the frame is done
+	 */
+	class RenderStats
+	{
+	public:
+		/**
+		 * \brief Counters for the calling thread
+		 */
+		static RenderCounters& Local() { return s_LocalCounters; }
+
+		/**
+		 * \brief Clear previous results and allocate a slot per tile
+		 * \param nTiles How many tiles the next frame will be split into
+		 */
+		void Reset(size_t nTiles);
+
+		/**
+		 * \brief Store the stats of a finished tile. Safe to call concurrently for different tiles
+		 */
+		void RecordTile(size_t tileIndex, const TileStats& stats) { m_Tiles[tileIndex] = stats; }
+
+		/**
+		 * \brief Add up per tile counters into frame totals. Call once every tile is recorded
+		 * \param totalMilliseconds Wall time spent rendering the whole frame
+		 */
+		void Aggregate(double totalMilliseconds);
+
+		/**
+		 * \brief Store how much memory scene geometry and acceleration structures take, to be printed with the rest
+		 */
+		void SetGeometryBytes(size_t bytes) { m_GeometryBytes = bytes; }
+
+		/**
+		 * \brief Store how long building mesh BVHs took, to be printed with the rest
+		 * \param triangles Triangles of every mesh a BVH was built for
+		 */
+		void SetBvhBuild(double milliseconds, size_t triangles)
+		{
+			m_BvhBuildMilliseconds = milliseconds;
+			m_BvhTriangles = triangles;
+		}
+
+		/**
+		 * \brief Print a human readable summary of the last frame
+		 */
+		void Print(std::ostream& os) const;
+
+		/**
+		 * \brief Create an image where each tile is colored by the time it took to render,
+		 * from black (cheapest) to white (most expensive)
+		 * \param resX Width in pixels of the rendered image
+		 * \param resY Height in pixels of the rendered image
+		 * \return A new image owned by the caller, or nullptr if allocation failed
+		 */
+		FIBITMAP* CreateHeatmap(size_t resX, size_t resY) const;
+
+		const RenderCounters& GetTotals() const { return m_Totals; }
+		const std::vector<TileStats>& GetTiles() const { return m_Tiles; }
+
+	private:
+		std::vector<TileStats> m_Tiles;
+		RenderCounters m_Totals;
+		double m_TotalMilliseconds = 0;
+		size_t m_GeometryBytes = 0;
+		double m_BvhBuildMilliseconds = 0;
+		size_t m_BvhTriangles = 0;
+
+		inline static thread_local RenderCounters s_LocalCounters;
+	};
+}
@@ -0,0 +1,113 @@
+// Local includes
+#include "Renderer.h"
+#include "Status.h"
+#include "Trace.h"
+
+// STL includes
+#include <chrono>
+#include <cstring>
+#include <iostream>
+
+namespace RecRays
+{
+	Renderer::Renderer(size_t nThreads)
+		: m_Threads(nThreads > 0 ? nThreads : 1)
+	{ }
+
+	int Renderer::Render(const SceneDescription& scene, const FrameBuffer& target, const TileCallback& onTile)
+	{
+		RRAYS_TRACE_SCOPE("Renderer::Render");
+		if (!target.pixels || target.width != scene.imgResX || target.height != scene.imgResY ||
+			target.GetRowStride() < target.width * target.GetBytesPerPixel())
+		{
+			std::cerr << "[ERROR] Frame buffer doesn't match scene resolution " << scene.imgResX << "x" << scene.imgResY << std::endl;
+			return EndRender(FAIL);
+		}
+
+		m_RayTracer = std::make_unique<RecursiveRayTracer>(scene);
+		auto& rayTracer = *m_RayTracer;
+		rayTracer.SetProfile(m_Profile);
+		rayTracer.PrepareScene(&m_Threads);
+		if (m_Cancelled)
+			return EndRender(FAIL);
+
+		auto const frameStart = std::chrono::steady_clock::now();
+		rayTracer.RasterizePrimaryVisibility(m_Threads);
+
+		size_t const nTiles = rayTracer.GetNumTiles();
+		std::atomic<size_t> completedTiles = 0;
+		auto const drawTile = [&](size_t tileIndex)
+		{
+			if (m_Cancelled)
+				return;
+
+			// Tiles go straight from the thread's scratch memory to the frame buffer
+			auto const* const colors = rayTracer.DrawTileColors(tileIndex);
+
+			TileUpdate update;
+			rayTracer.GetTileBounds(tileIndex, update.startX, update.endX, update.startY, update.endY);
+			WriteTile(colors, target, update.startX, update.endX, update.startY, update.endY);
+
+			update.completedTiles = ++completedTiles;
+			update.totalTiles = nTiles;
+			if (onTile)
+				onTile(update);
+		};
+
+		std::vector<std::future<void>> futures;
+		futures.reserve(nTiles);
+		for (size_t tileIndex = 0; tileIndex < nTiles; tileIndex++)
+			futures.push_back(m_Threads.execute(drawTile, tileIndex));
+
+		for (auto& future : futures)
+			future.get();
+
+		auto const frameTime = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - frameStart);
+		rayTracer.AggregateStats(frameTime.count());
+
+		return EndRender(SUCCESS);
+	}
+
+	int Renderer::EndRender(int status)
+	{
+		// Requests live until a render ends, so cancelling right before Render is called is not lost
+		m_WasCancelled = m_Cancelled.exchange(false);
+		return m_WasCancelled ? FAIL : status;
+	}
+
+	const RenderStats& Renderer::GetStats() const
+	{
+		return m_RayTracer ? m_RayTracer->GetStats() : m_EmptyStats;
+	}
+
+	void Renderer::WriteTile(const glm::vec4* colors, const FrameBuffer& target, size_t startX, size_t endX, size_t startY, size_t endY)
+	{
+		auto* const pixels = static_cast<uint8_t*>(target.pixels);
+		size_t const rowStride = target.GetRowStride();
+		size_t const bytesPerPixel = target.GetBytesPerPixel();
+		size_t const tileHeight = endY - startY;
+
+		// Tile colors are indexed by column first
+		for (size_t y = startY; y < endY; y++)
+		{
+			uint8_t* const row = pixels + y * rowStride;
+			for (size_t x = startX; x < endX; x++)
+			{
+				auto const& color = colors[(x - startX) * tileHeight + (y - startY)];
+				uint8_t* const pixel = row + x * bytesPerPixel;
+				if (target.format == PixelFormat::RGB8)
+				{
+					glm::vec3 const shadeColor = glm::clamp(255.0f * glm::vec3(color), 0.f, 255.f);
+					pixel[0] = static_cast<uint8_t>(shadeColor.r);
+					pixel[1] = static_cast<uint8_t>(shadeColor.g);
+					pixel[2] = static_cast<uint8_t>(shadeColor.b);
+				}
+				else
+				{
+					float const rgba[4] = { color.r, color.g, color.b, 1.f };
+					std::memcpy(pixel, rgba, sizeof(rgba));
+				}
+			}
+		}
+	}
+}
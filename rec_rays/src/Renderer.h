@@ -0,0 +1,128 @@
+// Library entry point: render scenes built in memory into buffers owned by the caller
+#pragma once
+
+// STL includes
+#include <memory>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <cstdint>
+
+// Third party includes
+#include <threadpool.h>
+
+// Local includes
+#include "RecursiveRayTracer.h"
+#include "RenderStats.h"
+
+namespace RecRays
+{
+	/**
+	 * \brief Layout of pixels in a frame buffer
+	 */
+	enum class PixelFormat
+	{
+		RGB8,		// 3 bytes per pixel, colors clamped to [0, 255]
+		RGBA32F		// 4 floats per pixel, colors as traced and alpha set to 1
+	};
+
+	/**
+	 * \brief Pixels owned by the caller. Rows go from the top of the image down, pixels from left to right
+	 */
+	struct FrameBuffer
+	{
+		void* pixels = nullptr;
+		size_t width = 0, height = 0;
+		size_t rowStride = 0;	// Bytes from a row to the next one, 0 for tightly packed rows
+		PixelFormat format = PixelFormat::RGB8;
+
+		size_t GetBytesPerPixel() const { return format == PixelFormat::RGB8 ? 3 : 4 * sizeof(float); }
+		size_t GetRowStride() const { return rowStride > 0 ? rowStride : width * GetBytesPerPixel(); }
+	};
+
+	/**
+	 * \brief Tile just written to the frame buffer
+	 */
+	struct TileUpdate
+	{
+		size_t startX, endX, startY, endY;	// Pixels covered, as [startX, endX) x [startY, endY)
+		size_t completedTiles;				// Tiles done so far, this one included
+		size_t totalTiles;
+	};
+
+	/**
+	 * \brief Called from render threads, possibly concurrently, as soon as the pixels of a tile are written
+	 */
+	using TileCallback = std::function<void(const TileUpdate& tile)>;
+
+	/**
+	 * \brief Renders scenes without touching files: scene comes from a SceneDescription and pixels go to a buffer
+	 * of the caller. Keeps its render threads alive between renders, so a renderer can be reused for many frames.
+	 * Mesh assets are loaded on first use; call GeometryLoader::Init once to load them in the background instead
+	 */
+	class Renderer
+	{
+	public:
+		/**
+		 * \param nThreads How many threads to render with
+		 */
+		Renderer(size_t nThreads = std::thread::hardware_concurrency());
+
+		/**
+		 * \brief Render a scene, blocking until every tile is done or the render is cancelled
+		 * \param scene Scene to render
+		 * \param target Where to write pixels, should have the resolution of the scene
+		 * \param onTile Called as tiles are done, might be empty
+		 * \return Success status. Fails if target doesn't match the scene or the render was cancelled,
+		 * in which case tiles not done yet are left untouched
+		 */
+		int Render(const SceneDescription& scene, const FrameBuffer& target, const TileCallback& onTile = TileCallback());
+
+		/**
+		 * \brief Stop the current render as soon as possible: tiles already started are finished, the rest skipped.
+		 * If no render is running, the next one stops before tracing anything. Safe to call from any thread, tile
+		 * callbacks included
+		 */
+		void Cancel() { m_Cancelled = true; }
+
+		/**
+		 * \brief If the last render was stopped by Cancel
+		 */
+		bool WasCancelled() const { return m_WasCancelled; }
+
+		/**
+		 * \brief Statistics of the last render
+		 */
+		const RenderStats& GetStats() const;
+
+		/**
+		 * \brief Render next scenes with tile size and acceleration structure settings of a profile. Thread count
+		 * is the one given on construction
+		 */
+		void SetProfile(const RenderProfile& profile) { m_Profile = profile; }
+
+	private:
+		/**
+		 * \brief Consume the pending cancel request, once a render is over
+		 * \param status Status of the render if it was not cancelled
+		 * \return Final status of the render
+		 */
+		int EndRender(int status);
+
+		/**
+		 * \brief Copy the pixels of a tile to the frame buffer
+		 * \param colors Colors of the tile column by column, from RecursiveRayTracer::DrawTileColors
+		 */
+		static void WriteTile(const glm::vec4* colors, const FrameBuffer& target, size_t startX, size_t endX, size_t startY, size_t endY);
+
+	private:
+		thread_pool m_Threads;
+		// Cancel requested and not consumed by a render yet
+		std::atomic<bool> m_Cancelled = false;
+		bool m_WasCancelled = false;
+		RenderProfile m_Profile;
+		// Ray tracer of the last render, kept around for its statistics
+		std::unique_ptr<RecursiveRayTracer> m_RayTracer;
+		RenderStats m_EmptyStats;
+	};
+}
@@ -1,10 +1,11 @@
 // Local includes
-#include "RecRays.h"
+#include "Status.h"
 #include "SceneParser.h"
 
 // C++ includes
 #include <sstream>
 #include <fstream>
+#include <iostream>
 #include <stack>
 #include <assert.h>
 
@@ -26,6 +27,9 @@ namespace RecRays
 		// Next object to add
 		Object nextObject;
 
+		// If the main camera was set already
+		bool hasCamera = false;
+
 		// Open and read file line by line
 		std::ifstream infile(filepath);
 		std::string line;
@@ -46,7 +50,7 @@ namespace RecRays
 			// Parse according to the command
 			if (command == "light")
 			{
-				auto const nums = ParseNNumbers(ss, 8);
+				auto const nums = ParseNNumbers<8>(ss);
 
 				Light newLight{
 					glm::vec4(nums[0], nums[1], nums[2], nums[3]),
@@ -58,50 +62,76 @@ namespace RecRays
 			}
 			else if (command == "ambient")
 			{
-				auto const nums = ParseNNumbers(ss, 4);
+				auto const nums = ParseNNumbers<4>(ss);
 				nextObject.ambient = glm::vec4(nums[0], nums[1], nums[2], nums[3]);
 			}
 			else if (command == "diffuse")
 			{
-				auto const nums = ParseNNumbers(ss, 4);
+				auto const nums = ParseNNumbers<4>(ss);
 				nextObject.diffuse = glm::vec4(nums[0], nums[1], nums[2], nums[3]);
 			}
 			else if (command == "specular")
 			{
-				auto const nums = ParseNNumbers(ss, 4);
+				auto const nums = ParseNNumbers<4>(ss);
 				nextObject.specular = glm::vec4(nums[0], nums[1], nums[2], nums[3]);
 			}
+			else if (command == "emission")
+			{
+				auto const nums = ParseNNumbers<4>(ss);
+				nextObject.emission = glm::vec4(nums[0], nums[1], nums[2], nums[3]);
+			}
 			else if (command == "shininess")
 			{
-				auto const nums = ParseNNumbers(ss, 1);
+				auto const nums = ParseNNumbers<1>(ss);
 				nextObject.shininess = nums[0];
 			}
 			else if (command == "mirror")
 			{
-				auto const nums = ParseNNumbers(ss, 4);
+				auto const nums = ParseNNumbers<4>(ss);
 				nextObject.mirror = glm::vec4(nums[0], nums[1], nums[2], nums[3]);
 			}
 			else if (command == "size")
 			{
-				auto const nums = ParseNNumbers(ss, 1);
+				auto const nums = ParseNNumbers<1>(ss);
 				nextObject.size = nums[0];
 			}
 			else if (command == "camera")
 			{
-				auto const nums = ParseNNumbers(ss, 10);
+				auto const nums = ParseNNumbers<10>(ss);
 				CameraDescription camera{
 					glm::vec3(nums[0], nums[1], nums[2]),
 					glm::vec3(nums[3], nums[4], nums[5]),
 					glm::vec3(nums[6], nums[7], nums[8]),
 					nums[9]
 				};
-				description.camera = camera;
+
+				// Every camera after the first one adds another view of the scene
+				if (!hasCamera)
+					description.camera = camera;
+				else
+					description.extraViews.push_back(ViewDescription{ camera, "" });
+				hasCamera = true;
+			}
+			else if (command == "output")
+			{
+				// output filename: image file of the last camera
+				std::string filename;
+				if (!(ss >> filename))
+				{
+					std::cerr << "Missing file name in output command" << std::endl;
+					return FAIL;
+				}
+
+				if (description.extraViews.empty())
+					description.output = filename;
+				else
+					description.extraViews.back().output = filename;
 			}
 			else if (command == "sphere" || command == "cube" || command == "teapot")
 			{
 				// Object pushing: Push current object into scene
 				nextObject.transform = transformStack.top();
-				auto const nums = ParseNNumbers(ss, 1);
+				auto const nums = ParseNNumbers<1>(ss);
 
 				// Set up object type
 				if (command == "sphere")
@@ -111,13 +141,19 @@ namespace RecRays
 				else if (command == "teapot")
 					nextObject.shape = Shape::Teapot;
 
+				// Meshes load in the background while the rest of the scene is parsed
+				if (nextObject.shape == Shape::Cube)
+					GeometryLoader::Request(MeshAsset::Cube);
+				else if (nextObject.shape == Shape::Teapot)
+					GeometryLoader::Request(MeshAsset::Teapot);
+
 				nextObject.size = nums[0];
 				description.AddObject(nextObject);
 				//nextObject = Object();
 			}
 			else if (command == "translate")
 			{
-				auto const nums = ParseNNumbers(ss, 3);
+				auto const nums = ParseNNumbers<3>(ss);
 				glm::vec3 newTranslate(nums[0], nums[1], nums[2]);
 
 				// Alter top transform
@@ -126,7 +162,7 @@ namespace RecRays
 			}
 			else if (command == "scale")
 			{
-				auto const nums = ParseNNumbers(ss, 3);
+				auto const nums = ParseNNumbers<3>(ss);
 				glm::vec3 newScale(nums[0], nums[1], nums[2]);
 
 				// Alter top transform
@@ -135,7 +171,7 @@ namespace RecRays
 			}
 			else if (command == "rotate")
 			{
-				auto const nums = ParseNNumbers(ss, 4);
+				auto const nums = ParseNNumbers<4>(ss);
 				glm::vec3 rotationAxis(nums[0], nums[1], nums[2]);
 				float rotationDegrees = nums[3];
 
@@ -149,10 +185,47 @@ namespace RecRays
 					std::cerr << "No transform in stack, can't pop transform" << std::endl;
 				else
 					transformStack.pop();
+			else if (command == "compactMeshes")
+			{
+				// compactMeshes 0|1
+				auto const nums = ParseNNumbers<1>(ss);
+				description.compactMeshes = nums[0] != 0;
+			}
+			else if (command == "meshLods")
+			{
+				// meshLods 0|1
+				auto const nums = ParseNNumbers<1>(ss);
+				description.meshLods = nums[0] != 0;
+			}
+			else if (command == "rasterPrimary")
+			{
+				// rasterPrimary 0|1
+				auto const nums = ParseNNumbers<1>(ss);
+				description.rasterPrimary = nums[0] != 0;
+			}
+			else if (command == "sphereGrid")
+			{
+				// sphereGrid auto|on|off
+				std::string mode;
+				ss >> mode;
+				if (mode == "auto")
+					description.sphereAccelerator = SphereAccelerator::Auto;
+				else if (mode == "on")
+					description.sphereAccelerator = SphereAccelerator::Grid;
+				else if (mode == "off")
+					description.sphereAccelerator = SphereAccelerator::None;
+				else
+					std::cerr << "Unknown sphereGrid mode '" << mode << "', expected auto, on or off" << std::endl;
+			}
 			else if (command == "image")
 			{
 				// image width height resX resY
-				auto const nums = ParseNNumbers(ss, 5);
+				auto const nums = ParseNNumbers<5>(ss);
+				if (!(nums[2] >= 1 && nums[2] <= MAX_IMAGE_RESOLUTION && nums[3] >= 1 && nums[3] <= MAX_IMAGE_RESOLUTION))
+				{
+					std::cerr << "Invalid image resolution " << nums[2] << "x" << nums[3] << ", expected 1 to " << MAX_IMAGE_RESOLUTION << " pixels per side" << std::endl;
+					return FAIL;
+				}
 
 				description.imgWidth = nums[0];
 				description.imgHeight = nums[1];
@@ -171,16 +244,16 @@ namespace RecRays
 		return SUCCESS;
 	}
 
-	std::vector<float> SceneParser::ParseNNumbers(std::stringstream& ss, int numArgs)
+	template<size_t N>
+	std::array<float, N> SceneParser::ParseNNumbers(std::stringstream& ss)
 	{
-		std::vector<float> result(numArgs);
+		std::array<float, N> result = {};
 
-		for (int i = 0; i < numArgs; i++)
+		for (size_t i = 0; i < N; i++)
 		{
-			float value;
-			assert(ss >> value && "Could no read float value");
-
-			result[i] = value;
+			// Read outside of assert, so numbers are still read when asserts are disabled
+			bool const couldRead = static_cast<bool>(ss >> result[i]);
+			assert(couldRead && "Could no read float value");
 		}
 
 		return result;
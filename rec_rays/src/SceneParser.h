@@ -1,6 +1,8 @@
 #pragma once
 #include "RecursiveRayTracer.h"
 #include <string>
+#include <array>
+#include <sstream>
 
 
 namespace RecRays
@@ -20,6 +22,12 @@ namespace RecRays
 		static int Parse(const std::string& filepath, SceneDescription& outDescription);
 
 	private:
-		static std::vector<float> ParseNNumbers(std::stringstream& ss, int numArgs);
+		/**
+		 * \brief Read a fixed amount of numbers from a command's arguments
+		 * \param ss Stream positioned after the command name
+		 * \return Numbers read, missing numbers are 0
+		 */
+		template<size_t N>
+		static std::array<float, N> ParseNNumbers(std::stringstream& ss);
 	};
 }
@@ -0,0 +1,130 @@
+// Local includes
+#include "SceneSerializer.h"
+#include "Status.h"
+
+namespace RecRays
+{
+	void SceneSerializer::Serialize(const SceneDescription& description, std::vector<uint8_t>& outData)
+	{
+		BinaryWriter writer(outData);
+		writer.Write(s_Magic);
+		writer.Write(s_Version);
+
+		// Global settings
+		writer.Write(static_cast<uint8_t>(description.enableLight));
+		writer.Write(static_cast<uint8_t>(description.compactMeshes));
+		writer.Write(static_cast<uint8_t>(description.meshLods));
+		writer.Write(static_cast<uint8_t>(description.rasterPrimary));
+		writer.Write(static_cast<uint8_t>(description.sphereAccelerator));
+		writer.Write(description.camera);
+		writer.Write(description.imgHeight);
+		writer.Write(description.imgWidth);
+		writer.Write(static_cast<uint64_t>(description.imgResX));
+		writer.Write(static_cast<uint64_t>(description.imgResY));
+		writer.Write(description.imgDistanceToViewplane);
+
+		// Lights
+		auto const& lights = description.GetLights();
+		writer.Write(static_cast<uint32_t>(lights.size()));
+		for (auto const& light : lights)
+			writer.Write(light);
+
+		// Objects, without geometry
+		auto const& objects = description.GetObjectsConst();
+		writer.Write(static_cast<uint32_t>(objects.size()));
+		for (auto const& object : objects)
+		{
+			writer.Write(object.ambient);
+			writer.Write(object.diffuse);
+			writer.Write(object.specular);
+			writer.Write(object.emission);
+			writer.Write(object.mirror);
+			writer.Write(object.shininess);
+			writer.Write(static_cast<uint32_t>(object.shape));
+			writer.Write(object.size);
+			writer.Write(object.transform);
+		}
+	}
+
+	int SceneSerializer::Deserialize(const uint8_t* data, size_t size, SceneDescription& outDescription)
+	{
+		BinaryReader reader(data, size);
+		SceneDescription description;
+
+		uint32_t magic, version;
+		if (!reader.Read(magic) || magic != s_Magic || !reader.Read(version) || version != s_Version)
+			return FAIL;
+
+		// Global settings
+		uint8_t enableLight, compactMeshes, meshLods, rasterPrimary, sphereAccelerator;
+		uint64_t resX, resY;
+		bool ok = reader.Read(enableLight) &&
+			reader.Read(compactMeshes) &&
+			reader.Read(meshLods) &&
+			reader.Read(rasterPrimary) &&
+			reader.Read(sphereAccelerator) &&
+			reader.Read(description.camera) &&
+			reader.Read(description.imgHeight) &&
+			reader.Read(description.imgWidth) &&
+			reader.Read(resX) &&
+			reader.Read(resY) &&
+			reader.Read(description.imgDistanceToViewplane);
+
+		if (!ok || sphereAccelerator > static_cast<uint8_t>(SphereAccelerator::Grid))
+			return FAIL;
+
+		// Scenes might come from the network, never size buffers after a resolution that wasn't validated
+		if (resX < 1 || resX > MAX_IMAGE_RESOLUTION || resY < 1 || resY > MAX_IMAGE_RESOLUTION)
+			return FAIL;
+
+		description.enableLight = enableLight != 0;
+		description.compactMeshes = compactMeshes != 0;
+		description.meshLods = meshLods != 0;
+		description.rasterPrimary = rasterPrimary != 0;
+		description.sphereAccelerator = static_cast<SphereAccelerator>(sphereAccelerator);
+		description.imgResX = static_cast<size_t>(resX);
+		description.imgResY = static_cast<size_t>(resY);
+
+		// Lights
+		uint32_t nLights;
+		if (!reader.Read(nLights))
+			return FAIL;
+
+		for (uint32_t i = 0; i < nLights; i++)
+		{
+			Light light;
+			if (!reader.Read(light) || description.AddLight(light) != SUCCESS)
+				return FAIL;
+		}
+
+		// Objects
+		uint32_t nObjects;
+		if (!reader.Read(nObjects))
+			return FAIL;
+
+		for (uint32_t i = 0; i < nObjects; i++)
+		{
+			Object object;
+			uint32_t shape;
+			ok = reader.Read(object.ambient) &&
+				reader.Read(object.diffuse) &&
+				reader.Read(object.specular) &&
+				reader.Read(object.emission) &&
+				reader.Read(object.mirror) &&
+				reader.Read(object.shininess) &&
+				reader.Read(shape) &&
+				reader.Read(object.size) &&
+				reader.Read(object.transform);
+
+			if (!ok || shape > static_cast<uint32_t>(Shape::Teapot))
+				return FAIL;
+
+			object.shape = static_cast<Shape>(shape);
+			if (description.AddObject(object) != SUCCESS)
+				return FAIL;
+		}
+
+		outDescription = description;
+		return SUCCESS;
+	}
+}
@@ -0,0 +1,110 @@
+// Binary encoding of parsed scenes, so they can be shipped around without parsing text again
+#pragma once
+
+// STL includes
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Local includes
+#include "RecursiveRayTracer.h"
+
+namespace RecRays
+{
+	/**
+	 * \brief Append plain values to a byte buffer
+	 */
+	class BinaryWriter
+	{
+	public:
+		BinaryWriter(std::vector<uint8_t>& buffer)
+			: m_Buffer(buffer)
+		{ }
+
+		template<typename T>
+		void Write(const T& value)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be written");
+			WriteBytes(&value, sizeof(T));
+		}
+
+		void WriteBytes(const void* data, size_t size)
+		{
+			auto const bytes = static_cast<const uint8_t*>(data);
+			m_Buffer.insert(m_Buffer.end(), bytes, bytes + size);
+		}
+
+	private:
+		std::vector<uint8_t>& m_Buffer;
+	};
+
+	/**
+	 * \brief Read plain values from a byte buffer. Reads past the end fail instead of crashing
+	 */
+	class BinaryReader
+	{
+	public:
+		BinaryReader(const uint8_t* data, size_t size)
+			: m_Data(data)
+			, m_Size(size)
+			, m_Position(0)
+		{ }
+
+		template<typename T>
+		bool Read(T& outValue)
+		{
+			static_assert(std::is_trivially_copyable_v<T>, "Only plain values can be read");
+			return ReadBytes(&outValue, sizeof(T));
+		}
+
+		bool ReadBytes(void* outData, size_t size)
+		{
+			if (size > m_Size - m_Position)
+				return false;
+
+			std::memcpy(outData, m_Data + m_Position, size);
+			m_Position += size;
+			return true;
+		}
+
+		size_t GetPosition() const { return m_Position; }
+		size_t GetSize() const { return m_Size; }
+
+	private:
+		const uint8_t* m_Data;
+		size_t m_Size;
+		size_t m_Position;
+	};
+
+	/**
+	 * \brief Convert scene descriptions to and from a compact binary form. Object geometry is not stored,
+	 * it's set up again from the object's shape. Values are stored with the native byte order.
+	 */
+	class SceneSerializer
+	{
+		// Default constructor private, use static members only
+		SceneSerializer();
+
+	public:
+		/**
+		 * \brief Encode a scene
+		 * \param description Scene to encode
+		 * \param outData Buffer where encoded scene will be appended
+		 */
+		static void Serialize(const SceneDescription& description, std::vector<uint8_t>& outData);
+
+		/**
+		 * \brief Decode a scene encoded with Serialize
+		 * \param data Encoded scene
+		 * \param size Size in bytes of encoded scene
+		 * \param outDescription decoded scene if everything went ok
+		 * \return Success status, 0 for success, 1 for failure
+		 */
+		static int Deserialize(const uint8_t* data, size_t size, SceneDescription& outDescription);
+
+	private:
+		static constexpr uint32_t s_Magic = 0x53435252; // "RRCS"
+		static constexpr uint32_t s_Version = 5;
+	};
+}
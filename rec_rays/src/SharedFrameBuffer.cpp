@@ -0,0 +1,162 @@
+// Local includes
+#include "SharedFrameBuffer.h"
+#include "Status.h"
+
+// STL includes
+#include <new>
+#include <cstring>
+#include <iostream>
+#include <assert.h>
+
+#ifdef RRAYS_PLATFORM_WINDOWS
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <fcntl.h>
+	#include <unistd.h>
+#endif
+
+namespace RecRays
+{
+	SharedFrameBuffer::~SharedFrameBuffer()
+	{
+		Close();
+	}
+
+	int SharedFrameBuffer::Create(const std::string& name, size_t width, size_t height, size_t tileSize)
+	{
+		Close();
+		m_Name = name.empty() || name[0] != '/' ? "/" + name : name;
+
+		size_t const tilesX = (width + tileSize - 1) / tileSize;
+		size_t const tilesY = (height + tileSize - 1) / tileSize;
+		size_t const pixelsOffset = (sizeof(SharedFrameHeader) + 63) / 64 * 64;
+		size_t const tileMapOffset = pixelsOffset + width * height * 4;
+		m_Size = tileMapOffset + (tilesX * tilesY + 7) / 8;
+
+		void* memory = nullptr;
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		// Names starting with a slash are not valid object names
+		std::string const objectName = "Local\\" + m_Name.substr(1);
+		m_Mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE,
+			static_cast<DWORD>(static_cast<uint64_t>(m_Size) >> 32), static_cast<DWORD>(m_Size), objectName.c_str());
+		if (m_Mapping != nullptr)
+			memory = MapViewOfFile(m_Mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_Size);
+	#else
+		// A segment left behind by a render that crashed is replaced
+		shm_unlink(m_Name.c_str());
+		int const descriptor = shm_open(m_Name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+		if (descriptor >= 0)
+		{
+			if (ftruncate(descriptor, static_cast<off_t>(m_Size)) == 0)
+			{
+				memory = mmap(nullptr, m_Size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+				if (memory == MAP_FAILED)
+					memory = nullptr;
+			}
+			close(descriptor);
+		}
+	#endif
+
+		if (memory == nullptr)
+		{
+			std::cerr << "Could not create shared memory segment " << m_Name << std::endl;
+			Close();
+			return FAIL;
+		}
+
+		// New segments are zeroed, so the image starts black with no tile done
+		m_Header = new (memory) SharedFrameHeader();
+		m_Header->magic = SharedFrameHeader::MAGIC;
+		m_Header->version = SharedFrameHeader::VERSION;
+		m_Header->width = static_cast<uint32_t>(width);
+		m_Header->height = static_cast<uint32_t>(height);
+		m_Header->tileSize = static_cast<uint32_t>(tileSize);
+		m_Header->tilesX = static_cast<uint32_t>(tilesX);
+		m_Header->tilesY = static_cast<uint32_t>(tilesY);
+		m_Header->pixelsOffset = pixelsOffset;
+		m_Header->tileMapOffset = tileMapOffset;
+		m_Header->sequence.store(0, std::memory_order_release);
+		return SUCCESS;
+	}
+
+	void SharedFrameBuffer::PublishTile(size_t tile, size_t startX, size_t endX, size_t startY, size_t endY, const std::vector<glm::vec4>& colors)
+	{
+		if (!IsOpen())
+			return;
+
+		assert(colors.size() == (endX - startX) * (endY - startY) && "Colors don't match tile size");
+		auto const base = reinterpret_cast<uint8_t*>(m_Header);
+		uint8_t* const pixels = base + m_Header->pixelsOffset;
+		uint8_t* const tileMap = base + m_Header->tileMapOffset;
+
+		BeginWrite();
+		auto color = colors.begin();
+		for (size_t x = startX; x < endX; x++)
+		{
+			for (size_t y = startY; y < endY; y++, color++)
+			{
+				auto const rgb = glm::clamp(255.f * glm::vec3(*color), 0.f, 255.f);
+				uint8_t* const pixel = pixels + (y * m_Header->width + x) * 4;
+				pixel[0] = static_cast<uint8_t>(rgb.r);
+				pixel[1] = static_cast<uint8_t>(rgb.g);
+				pixel[2] = static_cast<uint8_t>(rgb.b);
+				pixel[3] = 255;
+			}
+		}
+
+		uint8_t const bit = static_cast<uint8_t>(1u << (tile % 8));
+		if (!(tileMap[tile / 8] & bit))
+		{
+			tileMap[tile / 8] |= bit;
+			m_Header->completedTiles++;
+		}
+		EndWrite();
+	}
+
+	void SharedFrameBuffer::Finish()
+	{
+		if (!IsOpen())
+			return;
+
+		BeginWrite();
+		m_Header->finished = 1;
+		EndWrite();
+	}
+
+	void SharedFrameBuffer::BeginWrite()
+	{
+		// Odd sequence tells readers a write is in progress. The fence keeps the data writes after it
+		auto const sequence = m_Header->sequence.load(std::memory_order_relaxed);
+		m_Header->sequence.store(sequence + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+	}
+
+	void SharedFrameBuffer::EndWrite()
+	{
+		auto const sequence = m_Header->sequence.load(std::memory_order_relaxed);
+		m_Header->sequence.store(sequence + 1, std::memory_order_release);
+	}
+
+	void SharedFrameBuffer::Close()
+	{
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		if (m_Header)
+			UnmapViewOfFile(m_Header);
+		if (m_Mapping)
+			CloseHandle(m_Mapping);
+		m_Mapping = nullptr;
+	#else
+		if (m_Header)
+			munmap(m_Header, m_Size);
+		if (!m_Name.empty())
+			shm_unlink(m_Name.c_str());
+	#endif
+		m_Header = nullptr;
+		m_Name.clear();
+	}
+}
@@ -0,0 +1,94 @@
+// Image being rendered published in shared memory, so viewer processes on the same machine can watch it progress
+#pragma once
+
+// STL includes
+#include <vector>
+#include <string>
+#include <atomic>
+#include <cstdint>
+
+// Third party includes
+#include <glm/glm.hpp>
+
+namespace RecRays
+{
+	/**
+	 * \brief Layout of the start of a shared frame buffer. Pixels follow at pixelsOffset as 8 bit RGBA, rows from
+	 * the top of the image down, then a bit per tile at tileMapOffset, set once the tile is final. Tiles are numbered
+	 * row by row.
+	 *
+	 * Writes are guarded by a sequence lock: sequence is odd while the renderer is writing. Viewers read sequence,
+	 * copy what they need, and keep the copy only if sequence was even and didn't change meanwhile. Viewers never
+	 * write, so they can't stall the renderer
+	 */
+	struct SharedFrameHeader
+	{
+		static constexpr uint32_t MAGIC = 0x42465252; // "RRFB"
+		static constexpr uint32_t VERSION = 1;
+
+		uint32_t magic;
+		uint32_t version;
+		std::atomic<uint64_t> sequence;
+		uint32_t width, height;
+		uint32_t tileSize, tilesX, tilesY;
+		uint32_t completedTiles;
+		uint32_t finished;			// 1 once every tile is final
+		uint32_t padding;
+		uint64_t pixelsOffset;		// Bytes from the start of the segment
+		uint64_t tileMapOffset;		// Bytes from the start of the segment
+	};
+
+	static_assert(std::atomic<uint64_t>::is_always_lock_free, "Sequence is shared between processes, it can't use a lock");
+
+	/**
+	 * \brief Owns a named shared memory segment holding a SharedFrameHeader, the pixels of the image and the tile
+	 * bitmap. The segment goes away when this is destroyed, viewers that mapped it keep their mapping
+	 */
+	class SharedFrameBuffer
+	{
+	public:
+		SharedFrameBuffer() = default;
+		~SharedFrameBuffer();
+
+		SharedFrameBuffer(const SharedFrameBuffer&) = delete;
+		SharedFrameBuffer& operator=(const SharedFrameBuffer&) = delete;
+
+		/**
+		 * \brief Create the segment, with a black image and no tile done
+		 * \param name Name of segment, viewers open it with the same name. A leading slash is added if missing
+		 * \param tileSize Width and height in pixels of tiles
+		 * \return Success status
+		 */
+		int Create(const std::string& name, size_t width, size_t height, size_t tileSize);
+
+		bool IsOpen() const { return m_Header != nullptr; }
+
+		/**
+		 * \brief Copy the final colors of a tile and mark it as done
+		 * \param colors Colors of pixels in [startX, endX) x [startY, endY), column by column
+		 */
+		void PublishTile(size_t tile, size_t startX, size_t endX, size_t startY, size_t endY, const std::vector<glm::vec4>& colors);
+
+		/**
+		 * \brief Mark image as finished
+		 */
+		void Finish();
+
+	private:
+		void BeginWrite();
+		void EndWrite();
+
+		/**
+		 * \brief Unmap and delete segment
+		 */
+		void Close();
+
+	private:
+		std::string m_Name;
+		SharedFrameHeader* m_Header = nullptr;
+		size_t m_Size = 0;
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		void* m_Mapping = nullptr;
+	#endif
+	};
+}
@@ -0,0 +1,5 @@
+// Status codes returned by functions of the render library and the client
+#pragma once
+
+#define SUCCESS 0
+#define FAIL 1
@@ -0,0 +1,241 @@
+// Local includes
+#include "TileCache.h"
+#include "RecursiveRayTracer.h"
+#include "SceneSerializer.h"
+#include "Geometry.h"
+#include "Status.h"
+
+// STL includes
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+#include <cstdio>
+#include <atomic>
+#include <chrono>
+
+#ifdef RRAYS_PLATFORM_WINDOWS
+	#include <process.h>
+#else
+	#include <unistd.h>
+#endif
+
+namespace RecRays
+{
+	constexpr uint32_t TILE_CACHE_MAGIC = 0x43545252; // "RRTC"
+	constexpr uint32_t TILE_CACHE_VERSION = 1;
+	constexpr const char* TILE_CACHE_EXTENSION = ".tile";
+	constexpr const char* TILE_CACHE_TEMPORARY_EXTENSION = ".tmp";
+	// Temporary files older than this were left behind by writers that died before renaming them
+	constexpr auto TILE_CACHE_TEMPORARY_MAX_AGE = std::chrono::hours(1);
+
+	/**
+	 * \brief Temporary path to write a tile to before renaming it, unique to this writer: the process id tells
+	 * processes apart and a counter tells apart threads of a process storing the same tile
+	 */
+	static std::filesystem::path GetTemporaryPath(const std::filesystem::path& path)
+	{
+		static std::atomic<uint64_t> s_NextTemporary = 0;
+	#ifdef RRAYS_PLATFORM_WINDOWS
+		auto const processId = static_cast<unsigned long long>(_getpid());
+	#else
+		auto const processId = static_cast<unsigned long long>(getpid());
+	#endif
+
+		char suffix[64];
+		std::snprintf(suffix, sizeof(suffix), ".%llu.%llu%s", processId, static_cast<unsigned long long>(s_NextTemporary++), TILE_CACHE_TEMPORARY_EXTENSION);
+		auto temporaryPath = path;
+		temporaryPath += suffix;
+		return temporaryPath;
+	}
+
+	uint64_t HashBytes(const void* data, size_t size, uint64_t hash)
+	{
+		auto const bytes = static_cast<const uint8_t*>(data);
+		for (size_t i = 0; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 0x100000001b3ull;
+		}
+
+		return hash;
+	}
+
+	TileCache::TileCache(const std::string& directory, uint64_t maxBytes)
+		: m_Directory(directory)
+		, m_MaxBytes(maxBytes)
+	{ }
+
+	int TileCache::Open()
+	{
+		std::error_code error;
+		std::filesystem::create_directories(m_Directory, error);
+		if (error || !std::filesystem::is_directory(m_Directory, error))
+		{
+			std::cerr << "Could not create tile cache directory " << m_Directory << std::endl;
+			return FAIL;
+		}
+
+		return SUCCESS;
+	}
+
+	uint64_t TileCache::HashScene(const SceneDescription& scene, size_t tileSize)
+	{
+		// Serialized scenes hold every setting that changes pixels, but not output files
+		std::vector<uint8_t> data;
+		BinaryWriter writer(data);
+		writer.Write(TILE_CACHE_VERSION);
+		writer.Write(static_cast<uint64_t>(tileSize));
+		SceneSerializer::Serialize(scene, data);
+		uint64_t hash = HashBytes(data.data(), data.size());
+
+		// Objects only name their meshes, so an edited mesh file has to change the key too
+		bool usesAsset[static_cast<size_t>(MeshAsset::Count)] = {};
+		for (auto const& object : scene.GetObjectsConst())
+		{
+			if (object.shape == Shape::Cube)
+				usesAsset[static_cast<size_t>(MeshAsset::Cube)] = true;
+			else if (object.shape == Shape::Teapot)
+				usesAsset[static_cast<size_t>(MeshAsset::Teapot)] = true;
+		}
+
+		for (size_t asset = 0; asset < static_cast<size_t>(MeshAsset::Count); asset++)
+		{
+			if (!usesAsset[asset])
+				continue;
+
+			auto const& geometry = GeometryLoader::GetGeometry(static_cast<MeshAsset>(asset));
+			hash = HashBytes(&asset, sizeof(asset), hash);
+			hash = HashBytes(geometry.vertices.data(), geometry.vertices.size() * sizeof(glm::vec3), hash);
+			hash = HashBytes(geometry.normals.data(), geometry.normals.size() * sizeof(glm::vec3), hash);
+			hash = HashBytes(geometry.indices.data(), geometry.indices.size() * sizeof(glm::uvec3), hash);
+		}
+
+		return hash;
+	}
+
+	bool TileCache::Load(uint64_t sceneKey, size_t tile, size_t nColors, std::vector<glm::vec4>& outColors) const
+	{
+		auto const path = GetTilePath(sceneKey, tile);
+		std::ifstream file(path, std::ios::binary);
+		if (!file)
+			return false;
+
+		std::vector<uint8_t> const data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		file.close();
+		BinaryReader reader(data.data(), data.size());
+
+		// Files could be truncated or written by another version, only take exact matches
+		uint32_t magic, version;
+		uint64_t key, index, size;
+		bool const ok = reader.Read(magic) && magic == TILE_CACHE_MAGIC &&
+			reader.Read(version) && version == TILE_CACHE_VERSION &&
+			reader.Read(key) && key == sceneKey &&
+			reader.Read(index) && index == tile &&
+			reader.Read(size) && size == nColors &&
+			reader.GetSize() - reader.GetPosition() == nColors * sizeof(glm::vec4);
+
+		if (!ok)
+			return false;
+
+		outColors.resize(nColors);
+		reader.ReadBytes(outColors.data(), nColors * sizeof(glm::vec4));
+
+		// Mark as recently used
+		std::error_code error;
+		std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), error);
+		return true;
+	}
+
+	int TileCache::Store(uint64_t sceneKey, size_t tile, const std::vector<glm::vec4>& colors) const
+	{
+		std::vector<uint8_t> data;
+		BinaryWriter writer(data);
+		writer.Write(TILE_CACHE_MAGIC);
+		writer.Write(TILE_CACHE_VERSION);
+		writer.Write(sceneKey);
+		writer.Write(static_cast<uint64_t>(tile));
+		writer.Write(static_cast<uint64_t>(colors.size()));
+		writer.WriteBytes(colors.data(), colors.size() * sizeof(glm::vec4));
+
+		// Written under a temporary name and renamed, so other processes never read half a tile
+		auto const path = GetTilePath(sceneKey, tile);
+		auto const temporaryPath = GetTemporaryPath(path);
+		{
+			std::ofstream file(temporaryPath, std::ios::binary);
+			if (!file)
+				return FAIL;
+
+			file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+			if (!file)
+				return FAIL;
+		}
+
+		std::error_code error;
+		std::filesystem::rename(temporaryPath, path, error);
+		if (error)
+		{
+			std::filesystem::remove(temporaryPath, error);
+			return FAIL;
+		}
+
+		return SUCCESS;
+	}
+
+	void TileCache::Trim() const
+	{
+		struct Entry
+		{
+			std::filesystem::path path;
+			std::filesystem::file_time_type lastUse;
+			uint64_t size;
+		};
+
+		std::vector<Entry> entries;
+		uint64_t totalSize = 0;
+		std::error_code error;
+		auto const now = std::filesystem::file_time_type::clock::now();
+		for (auto const& file : std::filesystem::directory_iterator(m_Directory, error))
+		{
+			auto const extension = file.path().extension();
+			if (extension != TILE_CACHE_EXTENSION && extension != TILE_CACHE_TEMPORARY_EXTENSION)
+				continue;
+
+			std::error_code fileError;
+			Entry entry{ file.path(), file.last_write_time(fileError), file.file_size(fileError) };
+			if (fileError)
+				continue;
+
+			// Temporary files are still being written unless they are old, then nobody will rename them anymore
+			if (extension == TILE_CACHE_TEMPORARY_EXTENSION)
+			{
+				if (now - entry.lastUse > TILE_CACHE_TEMPORARY_MAX_AGE)
+					std::filesystem::remove(entry.path, fileError);
+				continue;
+			}
+
+			totalSize += entry.size;
+			entries.push_back(std::move(entry));
+		}
+
+		if (totalSize <= m_MaxBytes)
+			return;
+
+		std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return a.lastUse < b.lastUse; });
+		for (auto const& entry : entries)
+		{
+			if (totalSize <= m_MaxBytes)
+				break;
+
+			if (std::filesystem::remove(entry.path, error))
+				totalSize -= entry.size;
+		}
+	}
+
+	std::filesystem::path TileCache::GetTilePath(uint64_t sceneKey, size_t tile) const
+	{
+		char name[64];
+		std::snprintf(name, sizeof(name), "%016llx_%zu%s", static_cast<unsigned long long>(sceneKey), tile, TILE_CACHE_EXTENSION);
+		return m_Directory / name;
+	}
+}
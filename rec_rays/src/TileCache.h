@@ -0,0 +1,83 @@
+// Finished tiles kept on disk, so renders of a scene seen before are assembled without tracing again
+#pragma once
+
+// STL includes
+#include <vector>
+#include <string>
+#include <filesystem>
+#include <cstdint>
+
+// Third party includes
+#include <glm/glm.hpp>
+
+namespace RecRays
+{
+	struct SceneDescription;
+
+	// Default size limit of a tile cache directory
+	constexpr uint64_t TILE_CACHE_DEFAULT_MAX_BYTES = uint64_t(256) << 20;
+
+	/**
+	 * \brief 64 bit FNV-1a hash of some bytes
+	 * \param hash Hash of previous bytes, to hash several buffers as if they were a single one
+	 */
+	uint64_t HashBytes(const void* data, size_t size, uint64_t hash = 0xcbf29ce484222325ull);
+
+	/**
+	 * \brief Colors of finished tiles stored in a directory, one file per tile, keyed by a hash of everything that
+	 * affects the pixels of a render. Tiles are read back when the same scene is rendered again, whatever it's saved as.
+	 * The directory is kept under a size limit by deleting the least recently used tiles first: reading a tile
+	 * refreshes its modification time, so several processes can share a cache without extra bookkeeping
+	 */
+	class TileCache
+	{
+	public:
+		/**
+		 * \param directory Where to keep tiles, created if missing
+		 * \param maxBytes Size limit of tiles in directory
+		 */
+		TileCache(const std::string& directory, uint64_t maxBytes = TILE_CACHE_DEFAULT_MAX_BYTES);
+
+		/**
+		 * \brief Create cache directory if necessary
+		 * \return Success status
+		 */
+		int Open();
+
+		/**
+		 * \brief Key of a render: scene settings, camera, lights and objects, the contents of every mesh it uses and
+		 * how the image is split into tiles. Output file names are left out. Waits for meshes to load
+		 * \param tileSize Width and height of tiles the image is drawn in, from RecursiveRayTracer::GetTileSize
+		 */
+		static uint64_t HashScene(const SceneDescription& scene, size_t tileSize);
+
+		/**
+		 * \brief Read a tile of a render
+		 * \param sceneKey Key of render, from HashScene
+		 * \param tile Index of tile
+		 * \param nColors Pixels in tile
+		 * \param outColors Colors of tile, in the order they were stored
+		 * \return If tile was in cache
+		 */
+		bool Load(uint64_t sceneKey, size_t tile, size_t nColors, std::vector<glm::vec4>& outColors) const;
+
+		/**
+		 * \brief Store a tile of a render, replacing the previous version if any
+		 * \return Success status
+		 */
+		int Store(uint64_t sceneKey, size_t tile, const std::vector<glm::vec4>& colors) const;
+
+		/**
+		 * \brief Delete least recently used tiles until cache fits in its size limit, and temporary files left
+		 * behind by writers that died mid write
+		 */
+		void Trim() const;
+
+	private:
+		std::filesystem::path GetTilePath(uint64_t sceneKey, size_t tile) const;
+
+	private:
+		std::filesystem::path m_Directory;
+		uint64_t m_MaxBytes;
+	};
+}
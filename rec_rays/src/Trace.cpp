@@ -0,0 +1,90 @@
+// Local includes
+#include "Trace.h"
+#include "Status.h"
+
+// STL includes
+#include <fstream>
+
+namespace RecRays
+{
+	// Reserve events in big chunks so recording almost never reallocates
+	constexpr size_t TRACE_EVENTS_CHUNK = 4096;
+
+	void Tracer::Enable()
+	{
+		s_StartTime = std::chrono::steady_clock::now();
+		s_Enabled = true;
+	}
+
+	void Tracer::SetThreadName(const std::string& name)
+	{
+		GetThreadBuffer().threadName = name;
+	}
+
+	void Tracer::Record(const TraceEvent& event)
+	{
+		auto& buffer = GetThreadBuffer();
+		if (buffer.events.size() == buffer.events.capacity())
+			buffer.events.reserve(buffer.events.size() + TRACE_EVENTS_CHUNK);
+
+		buffer.events.push_back(event);
+	}
+
+	int64_t Tracer::Now()
+	{
+		return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - s_StartTime).count();
+	}
+
+	Tracer::ThreadBuffer& Tracer::GetThreadBuffer()
+	{
+		if (s_ThreadBuffer)
+			return *s_ThreadBuffer;
+
+		// First event in this thread, register a new buffer
+		std::lock_guard<std::mutex> lock(s_BuffersMutex);
+		auto buffer = std::make_unique<ThreadBuffer>();
+		buffer->threadId = static_cast<uint32_t>(s_Buffers.size());
+		buffer->threadName = buffer->threadId == 0 ? "Main" : "Worker " + std::to_string(buffer->threadId);
+		buffer->events.reserve(TRACE_EVENTS_CHUNK);
+
+		s_ThreadBuffer = buffer.get();
+		s_Buffers.push_back(std::move(buffer));
+
+		return *s_ThreadBuffer;
+	}
+
+	int Tracer::WriteToFile(const std::string& filepath)
+	{
+		std::ofstream file(filepath);
+		if (!file)
+			return FAIL;
+
+		std::lock_guard<std::mutex> lock(s_BuffersMutex);
+		file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+
+		bool first = true;
+		for (auto const& buffer : s_Buffers)
+		{
+			// Thread name metadata, so workers are easy to tell apart
+			if (!first)
+				file << ",\n";
+			first = false;
+			file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << buffer->threadId
+				<< ",\"args\":{\"name\":\"" << buffer->threadName << "\"}}";
+
+			for (auto const& event : buffer->events)
+			{
+				file << ",\n{\"name\":\"" << event.name << "\",\"ph\":\"X\",\"pid\":0,\"tid\":" << buffer->threadId
+					<< ",\"ts\":" << event.startMicroseconds << ",\"dur\":" << event.durationMicroseconds;
+
+				if (event.argName)
+					file << ",\"args\":{\"" << event.argName << "\":" << event.argValue << "}";
+
+				file << "}";
+			}
+		}
+
+		file << "\n]}\n";
+		return file ? SUCCESS : FAIL;
+	}
+}
@@ -0,0 +1,117 @@
+// Timeline of the render pipeline, written as Chrome trace events (chrome://tracing, ui.perfetto.dev)
+#pragma once
+
+// STL includes
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+
+#define RRAYS_TRACE_CONCAT_IMPL(a, b) a##b
+#define RRAYS_TRACE_CONCAT(a, b) RRAYS_TRACE_CONCAT_IMPL(a, b)
+
+// Time the enclosing scope: RRAYS_TRACE_SCOPE(name [, argName, argValue]).
+// Names should be string literals, they're stored by pointer
+#define RRAYS_TRACE_SCOPE(...) ::RecRays::TraceScope RRAYS_TRACE_CONCAT(_traceScope, __LINE__)(__VA_ARGS__)
+
+namespace RecRays
+{
+	/**
+	 * \brief A single complete event: something with a name that started at some point and took some time
+	 */
+	struct TraceEvent
+	{
+		const char* name;
+		int64_t startMicroseconds;
+		int64_t durationMicroseconds;
+		const char* argName; // optional integer argument, nullptr if unused
+		int64_t argValue;
+	};
+
+	/**
+	 * \brief Collects trace events from every thread. Each thread appends to its own buffer, so
+	 * recording an event never takes a lock. Does nothing unless enabled.
+	 */
+	class Tracer
+	{
+	public:
+		/**
+		 * \brief Start recording events from now on
+		 */
+		static void Enable();
+
+		static bool IsEnabled() { return s_Enabled; }
+
+		/**
+		 * \brief Name shown in the timeline for the calling thread
+		 */
+		static void SetThreadName(const std::string& name);
+
+		/**
+		 * \brief Store an event for the calling thread
+		 */
+		static void Record(const TraceEvent& event);
+
+		/**
+		 * \brief Microseconds since tracing was enabled
+		 */
+		static int64_t Now();
+
+		/**
+		 * \brief Write every recorded event to a json file. Call it when no other thread is recording
+		 * \param filepath Where to write the file
+		 * \return Success status, 0 for success, 1 for failure
+		 */
+		static int WriteToFile(const std::string& filepath);
+
+	private:
+		struct ThreadBuffer
+		{
+			uint32_t threadId;
+			std::string threadName;
+			std::vector<TraceEvent> events;
+		};
+
+		static ThreadBuffer& GetThreadBuffer();
+
+	private:
+		inline static bool s_Enabled = false;
+		inline static std::chrono::steady_clock::time_point s_StartTime;
+
+		// Buffers are owned here so they outlive the threads that filled them
+		inline static std::mutex s_BuffersMutex;
+		inline static std::vector<std::unique_ptr<ThreadBuffer>> s_Buffers;
+		inline static thread_local ThreadBuffer* s_ThreadBuffer = nullptr;
+	};
+
+	/**
+	 * \brief Record an event spanning the lifetime of this object
+	 */
+	class TraceScope
+	{
+	public:
+		TraceScope(const char* name, const char* argName = nullptr, int64_t argValue = 0)
+			: m_Name(name)
+			, m_ArgName(argName)
+			, m_ArgValue(argValue)
+			, m_Start(Tracer::IsEnabled() ? Tracer::Now() : 0)
+		{ }
+
+		~TraceScope()
+		{
+			if (Tracer::IsEnabled())
+				Tracer::Record({ m_Name, m_Start, Tracer::Now() - m_Start, m_ArgName, m_ArgValue });
+		}
+
+		TraceScope(const TraceScope&) = delete;
+		TraceScope& operator=(const TraceScope&) = delete;
+
+	private:
+		const char* m_Name;
+		const char* m_ArgName;
+		int64_t m_ArgValue;
+		int64_t m_Start;
+	};
+}
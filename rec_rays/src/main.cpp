@@ -9,8 +9,8 @@ int main(int argc, char ** argv)
 
     
     // Parse arguments for client object
-    std::string sceneFile;
-	int status = RecRays::Client::ParseArgs(argc, argv, sceneFile);
+    RecRays::ClientOptions options;
+	int status = RecRays::Client::ParseArgs(argc, argv, options);
 
     // Finish if could not parse arguments
     if (status == FAIL)
@@ -20,7 +20,7 @@ int main(int argc, char ** argv)
     }
 
     // Create client with valid arguments otherwise
-    RecRays::Client client(sceneFile);
+    RecRays::Client client(options);
 
     status = client.Run();
 
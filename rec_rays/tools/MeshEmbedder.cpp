@@ -0,0 +1,175 @@
+// Build step converting the meshes GeometryLoader knows about into C++ arrays, so the renderer starts with them
+// and their levels of detail already in memory. Usage: mesh_embedder <output header>
+//
+// Meshes are embedded as Geometry: vertices, normals and indices. The packed triangles and BVHs the renderer
+// intersects are still built when a scene is set up, because their layout depends on the scene's compactMeshes
+// setting and the leaf size of the render profile. Every asset file must be present, relative to the working
+// directory, or the build fails
+
+// Local includes
+#include "Geometry.h"
+#include "Status.h"
+
+// STL includes
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iterator>
+#include <cstdio>
+
+namespace RecRays
+{
+	// Names used in generated identifiers, indexed by MeshAsset
+	constexpr const char* ASSET_NAMES[] = { "Cube", "Teapot" };
+	static_assert(sizeof(ASSET_NAMES) / sizeof(ASSET_NAMES[0]) == static_cast<size_t>(MeshAsset::Count), "Every asset needs a name");
+
+	/**
+	 * \brief Write floats as hexadecimal literals, so they read back bit for bit
+	 */
+	static void WriteFloats(std::ostream& out, const float* values, size_t count)
+	{
+		char literal[32];
+		for (size_t i = 0; i < count; i++)
+		{
+			std::snprintf(literal, sizeof(literal), "%af,", static_cast<double>(values[i]));
+			out << (i % 6 == 0 ? "\n\t\t" : " ") << literal;
+		}
+	}
+
+	static void WriteIndices(std::ostream& out, const uint32_t* values, size_t count)
+	{
+		for (size_t i = 0; i < count; i++)
+			out << (i % 12 == 0 ? "\n\t\t" : " ") << values[i] << "u,";
+	}
+
+	/**
+	 * \brief Write arrays of a level of an asset
+	 * \return Initializer of its EmbeddedGeometry
+	 */
+	static std::string WriteGeometry(std::ostream& out, const std::string& name, const Geometry& geometry, float error)
+	{
+		auto const vertices = reinterpret_cast<const float*>(geometry.vertices.data());
+		auto const normals = reinterpret_cast<const float*>(geometry.normals.data());
+		auto const indices = reinterpret_cast<const uint32_t*>(geometry.indices.data());
+
+		// Zero sized arrays are not allowed, empty buffers become null pointers
+		if (!geometry.vertices.empty())
+		{
+			out << "\tstatic const float s_" << name << "Vertices[] = {";
+			WriteFloats(out, vertices, geometry.vertices.size() * 3);
+			out << "\n\t};\n\n";
+		}
+
+		if (!geometry.normals.empty())
+		{
+			out << "\tstatic const float s_" << name << "Normals[] = {";
+			WriteFloats(out, normals, geometry.normals.size() * 3);
+			out << "\n\t};\n\n";
+		}
+
+		if (!geometry.indices.empty())
+		{
+			out << "\tstatic const uint32_t s_" << name << "Indices[] = {";
+			WriteIndices(out, indices, geometry.indices.size() * 3);
+			out << "\n\t};\n\n";
+		}
+
+		char errorLiteral[32];
+		std::snprintf(errorLiteral, sizeof(errorLiteral), "%af", static_cast<double>(error));
+
+		std::stringstream initializer;
+		initializer << "{ "
+			<< (geometry.vertices.empty() ? "nullptr" : "s_" + name + "Vertices") << ", " << geometry.vertices.size() << ", "
+			<< (geometry.normals.empty() ? "nullptr" : "s_" + name + "Normals") << ", " << geometry.normals.size() << ", "
+			<< (geometry.indices.empty() ? "nullptr" : "s_" + name + "Indices") << ", " << geometry.indices.size() << ", "
+			<< errorLiteral << " }";
+		return initializer.str();
+	}
+
+	/**
+	 * \brief Load every asset from its file and write the header
+	 * \param outHeader Contents of header
+	 * \return Success status, fails if some asset couldn't be loaded
+	 */
+	static int GenerateHeader(std::string& outHeader)
+	{
+		std::stringstream out;
+		out << "// Generated by mesh_embedder from the mesh assets, do not edit\n";
+		out << "#pragma once\n\n";
+		out << "// Local includes\n";
+		out << "#include \"Geometry.h\"\n\n";
+		out << "// STL includes\n";
+		out << "#include <cstdint>\n\n";
+		out << "namespace RecRays::EmbeddedMeshes\n{\n";
+
+		std::string meshes;
+		for (size_t asset = 0; asset < static_cast<size_t>(MeshAsset::Count); asset++)
+		{
+			std::string const name = ASSET_NAMES[asset];
+			// A renderer silently built without its meshes would only fail once a scene uses them
+			if (GeometryLoader::HasFailed(static_cast<MeshAsset>(asset)))
+			{
+				std::cerr << "Could not load asset " << name << ", mesh files should be in the models directory of rec_rays" << std::endl;
+				return FAIL;
+			}
+
+			auto const& geometry = GeometryLoader::GetGeometry(static_cast<MeshAsset>(asset));
+			auto const& lods = GeometryLoader::GetLods(static_cast<MeshAsset>(asset));
+
+			std::vector<std::string> levels;
+			levels.push_back(WriteGeometry(out, name, geometry, 0));
+			for (size_t level = 0; level < lods.size(); level++)
+				levels.push_back(WriteGeometry(out, name + "Lod" + std::to_string(level + 1), lods[level].geometry, lods[level].error));
+
+			out << "\tstatic const EmbeddedGeometry s_" << name << "Levels[] = {\n";
+			for (auto const& level : levels)
+				out << "\t\t" << level << ",\n";
+			out << "\t};\n\n";
+
+			meshes += "\t\t{ s_" + name + "Levels, " + std::to_string(levels.size()) + " }, // " + name + "\n";
+		}
+
+		out << "\t// Indexed by MeshAsset\n";
+		out << "\tstatic const EmbeddedMesh s_Meshes[" << static_cast<size_t>(MeshAsset::Count) << "] = {\n";
+		out << meshes;
+		out << "\t};\n}\n";
+		outHeader = out.str();
+		return SUCCESS;
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	using namespace RecRays;
+	if (argc != 2)
+	{
+		std::cerr << "Usage: mesh_embedder <output header>" << std::endl;
+		return 1;
+	}
+
+	GeometryLoader::Init();
+	std::string header;
+	int const status = GenerateHeader(header);
+	GeometryLoader::Shutdown();
+	if (status != SUCCESS)
+		return 1;
+
+	// Rewriting an unchanged header would rebuild everything including it
+	std::string const outputPath = argv[1];
+	{
+		std::ifstream previous(outputPath, std::ios::binary);
+		std::string const contents((std::istreambuf_iterator<char>(previous)), std::istreambuf_iterator<char>());
+		if (previous && contents == header)
+			return 0;
+	}
+
+	std::ofstream file(outputPath, std::ios::binary);
+	file << header;
+	if (!file)
+	{
+		std::cerr << "Could not write " << outputPath << std::endl;
+		return 1;
+	}
+
+	return 0;
+}